@@ -0,0 +1,241 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// bench_decompress.cpp - 小块解压的性能测试
+//
+// 对比每个块重新初始化解压器（旧实现）与复用解压上下文、直接解压到输出末尾
+// 的吞吐量，并给出XlogDecoder解码整个文件（含分帧）的结果
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "file_utils.h"
+#include "output_sink.h"
+#include "xlog_constants.h"
+#include "xlog_decoder.h"
+
+using namespace xlog_decode;
+
+namespace {
+
+constexpr size_t kBlockCount = 20000;
+constexpr int kLinesPerBlock = 8;
+constexpr size_t kChunkSize = 1024;
+
+// 生成一个块的日志文本，与异步模式下的小块相近
+std::string MakeLogText(size_t block_index) {
+  std::string text;
+  for (int line = 0; line < kLinesPerBlock; ++line) {
+    text += "[I][2024-03-01 +8.0 10:11:12.345][1234, 5678*][net][conn.cc, "
+            "OnRecv, " +
+            std::to_string(line) + "][block " + std::to_string(block_index) +
+            " recv 512 bytes from 10.0.0." + std::to_string(line) + "\n";
+  }
+  return text;
+}
+
+// 以原始deflate格式压缩
+std::vector<uint8_t> CompressZlib(const std::string& text) {
+  z_stream strm;
+  std::memset(&strm, 0, sizeof(strm));
+  deflateInit2(&strm, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  std::vector<uint8_t> out(deflateBound(&strm, text.size()));
+  strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(text.data()));
+  strm.avail_in = static_cast<uInt>(text.size());
+  strm.next_out = out.data();
+  strm.avail_out = static_cast<uInt>(out.size());
+  deflate(&strm, Z_FINISH);
+  out.resize(out.size() - strm.avail_out);
+  deflateEnd(&strm);
+  return out;
+}
+
+// 以流式刷新压缩，帧中不记录内容大小，与Mars异步模式一致
+std::vector<uint8_t> CompressZstd(const std::string& text) {
+  ZSTD_CCtx* cctx = ZSTD_createCCtx();
+  std::vector<uint8_t> out(ZSTD_compressBound(text.size()) + 64);
+  ZSTD_inBuffer input = {text.data(), text.size(), 0};
+  ZSTD_outBuffer output = {out.data(), out.size(), 0};
+  ZSTD_compressStream2(cctx, &output, &input, ZSTD_e_flush);
+  out.resize(output.pos);
+  ZSTD_freeCCtx(cctx);
+  return out;
+}
+
+// 旧实现：每个块重新初始化z_stream，经1KB栈缓冲逐段追加
+bool OneShotZlib(const std::vector<uint8_t>& body, std::vector<uint8_t>& out) {
+  z_stream strm;
+  unsigned char chunk[kChunkSize];
+  std::memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+    return false;
+  }
+  strm.avail_in = static_cast<uInt>(body.size());
+  strm.next_in = const_cast<Bytef*>(body.data());
+  int ret = Z_OK;
+  do {
+    strm.avail_out = kChunkSize;
+    strm.next_out = chunk;
+    ret = inflate(&strm, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+      break;
+    }
+    out.insert(out.end(), chunk, chunk + (kChunkSize - strm.avail_out));
+  } while (strm.avail_out == 0);
+  inflateEnd(&strm);
+  return ret == Z_STREAM_END || ret == Z_OK;
+}
+
+// 旧实现：每个块创建和释放ZSTD_DStream
+bool OneShotZstd(const std::vector<uint8_t>& body, std::vector<uint8_t>& out) {
+  std::vector<char> buffer(ZSTD_DStreamOutSize());
+  ZSTD_DStream* dstream = ZSTD_createDStream();
+  ZSTD_initDStream(dstream);
+  ZSTD_inBuffer input = {body.data(), body.size(), 0};
+  while (input.pos < input.size) {
+    ZSTD_outBuffer output = {buffer.data(), buffer.size(), 0};
+    size_t ret = ZSTD_decompressStream(dstream, &output, &input);
+    if (ZSTD_isError(ret)) {
+      ZSTD_freeDStream(dstream);
+      return false;
+    }
+    out.insert(out.end(), buffer.begin(), buffer.begin() + output.pos);
+  }
+  ZSTD_freeDStream(dstream);
+  return true;
+}
+
+// 新实现：复用z_stream，直接解压到输出末尾
+bool ReusedZlib(const std::vector<uint8_t>& body, std::vector<uint8_t>& out) {
+  static z_stream strm;
+  static bool ready = false;
+  if (!ready) {
+    inflateInit2(&strm, -MAX_WBITS);
+    ready = true;
+  } else {
+    inflateReset(&strm);
+  }
+  size_t base = out.size();
+  size_t capacity = std::max<size_t>(body.size() * 4, 4096);
+  out.resize(base + capacity);
+  strm.avail_in = static_cast<uInt>(body.size());
+  strm.next_in = const_cast<Bytef*>(body.data());
+  strm.avail_out = static_cast<uInt>(capacity);
+  strm.next_out = out.data() + base;
+  int ret = inflate(&strm, Z_NO_FLUSH);
+  out.resize(base + capacity - strm.avail_out);
+  return ret == Z_STREAM_END || ret == Z_OK;
+}
+
+// 新实现：复用ZSTD_DCtx，直接解压到输出末尾
+bool ReusedZstd(const std::vector<uint8_t>& body, std::vector<uint8_t>& out) {
+  static ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+  size_t base = out.size();
+  size_t capacity = std::max<size_t>(body.size() * 4, 4096);
+  out.resize(base + capacity);
+  ZSTD_inBuffer input = {body.data(), body.size(), 0};
+  ZSTD_outBuffer output = {out.data() + base, capacity, 0};
+  size_t ret = ZSTD_decompressStream(dctx, &output, &input);
+  out.resize(base + output.pos);
+  return !ZSTD_isError(ret);
+}
+
+// 拼接成XLOG文件
+std::vector<uint8_t> MakeXlog(const std::vector<std::vector<uint8_t>>& bodies,
+                              uint8_t magic) {
+  std::vector<uint8_t> data;
+  uint32_t header_len = GetHeaderLen(magic);
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    size_t offset = data.size();
+    data.resize(offset + header_len, 0);
+    data[offset] = magic;
+    uint16_t seq = static_cast<uint16_t>(i % 65535 + 1);
+    uint32_t length = static_cast<uint32_t>(bodies[i].size());
+    std::memcpy(&data[offset + 1], &seq, sizeof(seq));
+    std::memcpy(&data[offset + 5], &length, sizeof(length));
+    data.insert(data.end(), bodies[i].begin(), bodies[i].end());
+    data.push_back(MAGIC_END);
+  }
+  return data;
+}
+
+void PrintResult(const std::string& codec,
+                 const std::string& method,
+                 double seconds,
+                 size_t output_size) {
+  std::cout << std::left << std::setw(7) << codec << std::setw(16) << method
+            << std::right << std::fixed << std::setprecision(1)
+            << std::setw(10) << seconds * 1000 << std::setw(14)
+            << kBlockCount / seconds << std::setw(12)
+            << output_size / (1024.0 * 1024.0) / seconds << std::endl;
+}
+
+// 依次解压所有块并计时
+void TimeDecompress(const std::string& codec,
+                    const std::string& method,
+                    const std::vector<std::vector<uint8_t>>& bodies,
+                    bool (*decompress)(const std::vector<uint8_t>&,
+                                       std::vector<uint8_t>&)) {
+  std::vector<uint8_t> output;
+  auto start_time = std::chrono::steady_clock::now();
+  for (const auto& body : bodies) {
+    decompress(body, output);
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start_time)
+                       .count();
+  PrintResult(codec, method, seconds, output.size());
+}
+
+void RunCodec(const std::string& codec,
+              uint8_t magic,
+              std::vector<uint8_t> (*compress)(const std::string&),
+              bool (*one_shot)(const std::vector<uint8_t>&,
+                               std::vector<uint8_t>&),
+              bool (*reused)(const std::vector<uint8_t>&,
+                             std::vector<uint8_t>&)) {
+  std::vector<std::vector<uint8_t>> bodies;
+  bodies.reserve(kBlockCount);
+  for (size_t i = 0; i < kBlockCount; ++i) {
+    bodies.push_back(compress(MakeLogText(i)));
+  }
+
+  TimeDecompress(codec, "per-block init", bodies, one_shot);
+  TimeDecompress(codec, "reused context", bodies, reused);
+
+  // 解码器解码整个文件，包含分帧和序列号检查
+  const std::string bench_file = "bench_decompress.xlog";
+  FileUtils::WriteFile(bench_file, MakeXlog(bodies, magic));
+  std::vector<uint8_t> decoded;
+  BufferOutputSink sink(decoded);
+  XlogDecoder decoder;
+  auto start_time = std::chrono::steady_clock::now();
+  decoder.DecodeFileStreaming(bench_file, sink);
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start_time)
+                       .count();
+  PrintResult(codec, "XlogDecoder", seconds, decoded.size());
+  FileUtils::DeleteFile(bench_file);
+}
+
+}  // namespace
+
+int main() {
+  std::cout << "codec  method                  ms      blocks/s  out MB/s"
+            << std::endl;
+  RunCodec("zlib", MAGIC_COMPRESS_NO_CRYPT_START, CompressZlib, OneShotZlib,
+           ReusedZlib);
+  RunCodec("zstd", MAGIC_ASYNC_NO_CRYPT_ZSTD_START, CompressZstd, OneShotZstd,
+           ReusedZstd);
+  return 0;
+}
@@ -0,0 +1,201 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// bench_decrypt.cpp - 加密块解密的性能测试
+//
+// 对比各TEA实现的解密吞吐量，并给出XlogDecoder解码同一份日志的未加密版本
+// 与加密版本的耗时，衡量解密带来的额外开销
+
+#include <zstd.h>
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "file_utils.h"
+#include "magic_scanner.h"
+#include "output_sink.h"
+#include "xlog_constants.h"
+#include "xlog_crypt.h"
+#include "xlog_decoder.h"
+
+using namespace xlog_decode;
+
+namespace {
+
+constexpr size_t kBlockCount = 4000;
+constexpr int kLinesPerBlock = 200;
+constexpr int kRepeat = 5;
+
+// Mars解码脚本附带的示例私钥，以及用另一个私钥生成的客户端公钥
+const char* kServerPrivateKey =
+    "145aa7717bf9745b91e9569b80bbf1eedaa6cc6cd0e26317d810e35710f44cf8";
+const char* kClientPublicKey =
+    "bf3bb76511949219861f1fb3661d362587cf082395a984a8f441450e433bba8b"
+    "30effd3c9d084b9faa035c19a1fb5a03f801b1335cfb922be99c6cbbc06df9b0";
+
+std::vector<uint8_t> HexBytes(const std::string& hex) {
+  std::vector<uint8_t> bytes;
+  for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+    bytes.push_back(
+        static_cast<uint8_t>(std::stoul(hex.substr(i, 2), nullptr, 16)));
+  }
+  return bytes;
+}
+
+// 与Mars客户端相同的TEA加密
+void TeaEncrypt(const TeaKey& key, std::vector<uint8_t>& data) {
+  for (size_t pos = 0; pos + 8 <= data.size(); pos += 8) {
+    uint32_t v0 = 0;
+    uint32_t v1 = 0;
+    std::memcpy(&v0, &data[pos], 4);
+    std::memcpy(&v1, &data[pos + 4], 4);
+    uint32_t sum = 0;
+    for (int round = 0; round < 16; ++round) {
+      sum += 0x9E3779B9;
+      v0 += ((v1 << 4) + key[0]) ^ (v1 + sum) ^ ((v1 >> 5) + key[1]);
+      v1 += ((v0 << 4) + key[2]) ^ (v0 + sum) ^ ((v0 >> 5) + key[3]);
+    }
+    std::memcpy(&data[pos], &v0, 4);
+    std::memcpy(&data[pos + 4], &v1, 4);
+  }
+}
+
+// 生成一个块的日志文本
+std::string MakeLogText(size_t block_index) {
+  std::string text;
+  for (int line = 0; line < kLinesPerBlock; ++line) {
+    text += "[I][2024-03-01 +8.0 10:11:12.345][1234, 5678*][net][conn.cc, "
+            "OnRecv, " +
+            std::to_string(line) + "][block " + std::to_string(block_index) +
+            " recv " + std::to_string(block_index * 7 + line) +
+            " bytes from 10.0.0." + std::to_string(line) + "\n";
+  }
+  return text;
+}
+
+// 拼接成XLOG文件，key不为空时加密主体并在头部写入公钥
+std::vector<uint8_t> MakeXlog(const std::vector<std::vector<uint8_t>>& bodies,
+                              const TeaKey* key) {
+  std::vector<uint8_t> public_key = HexBytes(kClientPublicKey);
+  uint8_t magic = key != nullptr ? MAGIC_ASYNC_ZSTD_START
+                                 : MAGIC_ASYNC_NO_CRYPT_ZSTD_START;
+  uint32_t header_len = GetHeaderLen(magic);
+  std::vector<uint8_t> data;
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    std::vector<uint8_t> body = bodies[i];
+    if (key != nullptr) {
+      TeaEncrypt(*key, body);
+    }
+    size_t offset = data.size();
+    data.resize(offset + header_len, 0);
+    data[offset] = magic;
+    uint16_t seq = static_cast<uint16_t>(i % 65535 + 1);
+    uint32_t length = static_cast<uint32_t>(body.size());
+    std::memcpy(&data[offset + 1], &seq, sizeof(seq));
+    std::memcpy(&data[offset + 5], &length, sizeof(length));
+    std::memcpy(&data[offset + header_len - kXlogPublicKeySize],
+                public_key.data(), public_key.size());
+    data.insert(data.end(), body.begin(), body.end());
+    data.push_back(MAGIC_END);
+  }
+  return data;
+}
+
+// 解码kRepeat次取最短时间
+double TimeDecode(const std::string& file,
+                  std::shared_ptr<XlogKeyRing> key_ring,
+                  size_t* output_size) {
+  double best = 0;
+  for (int i = 0; i < kRepeat; ++i) {
+    std::vector<uint8_t> decoded;
+    BufferOutputSink sink(decoded);
+    XlogDecoder decoder;
+    decoder.set_key_ring(key_ring);
+    auto start_time = std::chrono::steady_clock::now();
+    decoder.DecodeFile(file, sink);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start_time)
+                         .count();
+    if (i == 0 || seconds < best) {
+      best = seconds;
+    }
+    *output_size = decoded.size();
+  }
+  return best;
+}
+
+}  // namespace
+
+int main() {
+  std::vector<std::vector<uint8_t>> bodies;
+  size_t body_bytes = 0;
+  for (size_t i = 0; i < kBlockCount; ++i) {
+    std::string text = MakeLogText(i);
+    std::vector<uint8_t> body(ZSTD_compressBound(text.size()));
+    body.resize(ZSTD_compress(body.data(), body.size(), text.data(),
+                              text.size(), 3));
+    body_bytes += body.size();
+    bodies.push_back(body);
+  }
+
+  auto key_ring = std::make_shared<XlogKeyRing>();
+  key_ring->SetPrivateKeyHex(kServerPrivateKey);
+  const TeaKey* key = key_ring->GetTeaKey(HexBytes(kClientPublicKey).data());
+  if (key == nullptr) {
+    std::cerr << "Key derivation failed" << std::endl;
+    return 1;
+  }
+
+  // 各实现的TEA解密吞吐量
+  std::vector<uint8_t> buffer(64 * 1024 * 1024, 0x5A);
+  std::cout << "tea impl      MB/s" << std::endl;
+  MagicScanner::Implementation original = MagicScanner::ActiveImplementation();
+  for (auto implementation : {MagicScanner::Implementation::kScalar,
+                              MagicScanner::Implementation::kSse2,
+                              MagicScanner::Implementation::kAvx2}) {
+    if (!MagicScanner::ForceImplementation(implementation)) {
+      continue;
+    }
+    auto start_time = std::chrono::steady_clock::now();
+    TeaDecrypt(*key, buffer.data(), buffer.size());
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start_time)
+                         .count();
+    std::cout << std::left << std::setw(10)
+              << MagicScanner::ImplementationName(implementation) << std::right
+              << std::fixed << std::setprecision(1) << std::setw(8)
+              << buffer.size() / (1024.0 * 1024.0) / seconds << std::endl;
+  }
+  MagicScanner::ForceImplementation(original);
+
+  // 同一份日志不加密与加密时的解码耗时
+  const std::string plain_file = "bench_decrypt_plain.xlog";
+  const std::string crypt_file = "bench_decrypt_crypt.xlog";
+  FileUtils::WriteFile(plain_file, MakeXlog(bodies, nullptr));
+  FileUtils::WriteFile(crypt_file, MakeXlog(bodies, key));
+  size_t plain_output = 0;
+  size_t crypt_output = 0;
+  double plain_seconds = TimeDecode(plain_file, nullptr, &plain_output);
+  double crypt_seconds = TimeDecode(crypt_file, key_ring, &crypt_output);
+  FileUtils::DeleteFile(plain_file);
+  FileUtils::DeleteFile(crypt_file);
+
+  std::cout << "\nbody " << std::fixed << std::setprecision(1)
+            << body_bytes / (1024.0 * 1024.0) << " MB, output "
+            << plain_output / (1024.0 * 1024.0) << " MB" << std::endl;
+  std::cout << "plain decode  " << std::setprecision(1)
+            << plain_seconds * 1000 << " ms" << std::endl;
+  std::cout << "crypt decode  " << crypt_seconds * 1000 << " ms ("
+            << std::showpos << (crypt_seconds / plain_seconds - 1) * 100
+            << std::noshowpos << "%)" << std::endl;
+  if (crypt_output != plain_output) {
+    std::cerr << "Decrypted output differs from the plain decode" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,504 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// bench_fleet.cpp - 整个目录批量解码的端到端性能测试
+//
+// 按固定种子生成一棵与设备日志上传目录形状相近的目录树（设备/日期/分片），
+// 其中.xlog大小按对数正态分布，.mmap3为固定大小且尾部补零的缓存文件，
+// 一部分文件被截断或写入垃圾数据；然后按decode和clean命令的流程完整地
+// 跑一遍，分别统计扫描、读取、解码、写出和删除的耗时以及files/s和MB/s
+//
+// 用法：bench_fleet [--root DIR] [--files N] [--depth N] [--corrupt-rate R]
+//                   [--mmap3-rate R] [--jobs N] [--seed N] [--keep]
+//   --root          目录树位置，默认bench_fleet；已存在时直接使用其中的
+//                   文件，不重新生成，结束后也不删除
+//   --files         生成的文件数，默认2000，例如--files 100000
+//   --depth         目录层数，默认3，0表示全部放在根目录下
+//   --corrupt-rate  损坏文件的比例，默认0.02
+//   --mmap3-rate    .mmap3文件的比例，默认0.3
+//   --jobs          并行解码的文件数，与decode --jobs相同，默认1
+//   --seed          随机种子，默认1
+//   --keep          保留生成的目录树（解码输出仍会被clean删除）
+//
+// 读取阶段在解码每个文件之前把整个文件读入内存一次，用于单独给出I/O耗时，
+// 随后的解码从页缓存映射同一文件；刚生成的目录树都在页缓存中，测量冷缓存
+// 时先用--keep保留目录树，清空页缓存后再用同一--root运行
+// 并行解码时各阶段耗时为所有线程的累计时间，total为实际经过的时间
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "file_utils.h"
+#include "output_sink.h"
+#include "thread_pool.h"
+#include "xlog_constants.h"
+#include "xlog_decoder.h"
+
+using namespace xlog_decode;
+
+namespace {
+
+constexpr size_t kBodyPoolSize = 64;
+constexpr size_t kFilesPerLeaf = 32;
+constexpr size_t kMmap3Size = 150 * 1024;  // Mars默认的mmap缓存大小
+constexpr double kMedianXlogSize = 64 * 1024;
+constexpr double kXlogSizeSigma = 1.2;
+constexpr size_t kMinXlogSize = 4 * 1024;
+constexpr size_t kMaxXlogSize = 32 * 1024 * 1024;
+
+struct BenchOptions {
+  std::string root = "bench_fleet";
+  size_t file_count = 2000;
+  size_t depth = 3;
+  double corrupt_rate = 0.02;
+  double mmap3_rate = 0.3;
+  size_t job_count = 1;
+  uint32_t seed = 1;
+  bool keep = false;
+};
+
+// 一个已压缩的块主体
+struct Body {
+  uint8_t magic;
+  std::vector<uint8_t> data;
+};
+
+struct FleetStats {
+  size_t xlog_count = 0;
+  size_t mmap3_count = 0;
+  size_t corrupt_count = 0;
+  uint64_t bytes = 0;
+};
+
+// 各阶段累计耗时（纳秒），多个线程同时累加
+struct PhaseTimes {
+  std::atomic<int64_t> read{0};
+  std::atomic<int64_t> decode{0};
+  std::atomic<int64_t> write{0};
+  std::atomic<uint64_t> input_bytes{0};
+  std::atomic<uint64_t> output_bytes{0};
+  std::atomic<size_t> failed{0};
+};
+
+int64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// 写出耗时计入write_ns，包括第一次写出时创建文件和关闭文件
+class TimedFileOutputSink : public FileOutputSink {
+ public:
+  TimedFileOutputSink(const std::string& file_path, int64_t* write_ns)
+      : FileOutputSink(file_path), write_ns_(write_ns) {}
+
+  bool Close() override {
+    int64_t start = NowNs();
+    int64_t before = *write_ns_;
+    bool result = FileOutputSink::Close();
+    // Close中刷新缓冲时WriteOut已累加过一次，这里改为整个Close的耗时
+    *write_ns_ = before + (NowNs() - start);
+    return result;
+  }
+
+ protected:
+  bool WriteOut(const uint8_t* first,
+                size_t first_size,
+                const uint8_t* second,
+                size_t second_size) override {
+    int64_t start = NowNs();
+    bool result =
+        FileOutputSink::WriteOut(first, first_size, second, second_size);
+    *write_ns_ += NowNs() - start;
+    return result;
+  }
+
+ private:
+  int64_t* write_ns_;
+};
+
+// 生成line_count行日志文本，内容随块编号变化，压缩率与真实日志相近
+std::string MakeLogText(std::mt19937& rng, size_t line_count) {
+  static const char* kTags[] = {"net", "ui", "db", "push", "video"};
+  static const char* kLevels[] = {"D", "I", "I", "I", "W", "E"};
+  std::string text;
+  for (size_t line = 0; line < line_count; ++line) {
+    uint32_t value = rng();
+    char prefix[96];
+    std::snprintf(prefix, sizeof(prefix),
+                  "[%s][2024-03-01 +8.0 10:%02u:%02u.%03u][%u, %u*][%s]",
+                  kLevels[value % 6], value % 60, (value >> 6) % 60,
+                  (value >> 12) % 1000, 1000 + value % 7, 2000 + value % 13,
+                  kTags[(value >> 3) % 5]);
+    text += prefix;
+    text += "[conn.cc, OnRecv, " + std::to_string(value % 900) + "][recv " +
+            std::to_string(value % 65536) + " bytes from 10.0." +
+            std::to_string((value >> 8) % 256) + "." +
+            std::to_string(value % 256) + "\n";
+  }
+  return text;
+}
+
+// 与Mars异步模式相同，以Z_SYNC_FLUSH结束的原始deflate流
+std::vector<uint8_t> CompressZlib(const std::string& text) {
+  z_stream strm;
+  std::memset(&strm, 0, sizeof(strm));
+  deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  std::vector<uint8_t> out(deflateBound(&strm, text.size()) + 64);
+  strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(text.data()));
+  strm.avail_in = static_cast<uInt>(text.size());
+  strm.next_out = out.data();
+  strm.avail_out = static_cast<uInt>(out.size());
+  deflate(&strm, Z_SYNC_FLUSH);
+  out.resize(strm.total_out);
+  deflateEnd(&strm);
+  return out;
+}
+
+std::vector<uint8_t> CompressZstd(const std::string& text) {
+  std::vector<uint8_t> out(ZSTD_compressBound(text.size()));
+  out.resize(ZSTD_compress(out.data(), out.size(), text.data(), text.size(),
+                           3));
+  return out;
+}
+
+// 预先压缩一批块主体，生成文件时只做拼接，十万个文件也能很快生成
+std::vector<Body> MakeBodyPool(std::mt19937& rng) {
+  std::uniform_int_distribution<size_t> line_dist(100, 600);
+  std::vector<Body> pool;
+  for (size_t i = 0; i < kBodyPoolSize; ++i) {
+    std::string text = MakeLogText(rng, line_dist(rng));
+    if (i % 2 == 0) {
+      pool.push_back({MAGIC_COMPRESS_NO_CRYPT_START, CompressZlib(text)});
+    } else {
+      pool.push_back({MAGIC_ASYNC_NO_CRYPT_ZSTD_START, CompressZstd(text)});
+    }
+  }
+  return pool;
+}
+
+void AppendBlock(const Body& body, uint16_t seq, std::vector<uint8_t>* data) {
+  uint32_t header_len = GetHeaderLen(body.magic);
+  size_t offset = data->size();
+  data->resize(offset + header_len, 0);
+  uint8_t* header = &(*data)[offset];
+  header[0] = body.magic;
+  std::memcpy(header + 1, &seq, sizeof(seq));
+  header[3] = 10;  // 开始和结束小时
+  header[4] = 11;
+  uint32_t length = static_cast<uint32_t>(body.data.size());
+  std::memcpy(header + 5, &length, sizeof(length));
+  data->insert(data->end(), body.data.begin(), body.data.end());
+  data->push_back(MAGIC_END);
+}
+
+// 拼接块直到达到目标大小；mmap3只写入缓存的一部分，其余补零
+std::vector<uint8_t> MakeFile(const std::vector<Body>& pool,
+                              bool mmap3,
+                              std::mt19937& rng) {
+  size_t target = 0;
+  if (mmap3) {
+    std::uniform_real_distribution<double> fill_dist(0.1, 0.9);
+    target = static_cast<size_t>(kMmap3Size * fill_dist(rng));
+  } else {
+    std::lognormal_distribution<double> size_dist(std::log(kMedianXlogSize),
+                                                  kXlogSizeSigma);
+    target = static_cast<size_t>(size_dist(rng));
+    target = std::min(std::max(target, kMinXlogSize), kMaxXlogSize);
+  }
+
+  std::vector<uint8_t> data;
+  for (size_t i = 0; data.size() < target; ++i) {
+    const Body& body = pool[rng() % pool.size()];
+    size_t block_size = GetHeaderLen(body.magic) + body.data.size() + 1;
+    if (mmap3 && data.size() + block_size > target) {
+      break;
+    }
+    AppendBlock(body, static_cast<uint16_t>(i % 65535 + 1), &data);
+  }
+  if (mmap3) {
+    data.resize(kMmap3Size, 0);
+  }
+  return data;
+}
+
+// 截断、覆盖中间一段或在开头插入垃圾数据
+void CorruptFile(std::vector<uint8_t>* data, std::mt19937& rng) {
+  std::uniform_int_distribution<size_t> garbage_dist(256, 8 * 1024);
+  std::vector<uint8_t> garbage(garbage_dist(rng));
+  for (auto& byte : garbage) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  switch (rng() % 3) {
+    case 0:
+      data->resize(rng() % (data->size() + 1));
+      break;
+    case 1: {
+      size_t offset = rng() % (data->size() + 1);
+      size_t size = std::min(garbage.size(), data->size() - offset);
+      std::memcpy(data->data() + offset, garbage.data(), size);
+      break;
+    }
+    default:
+      data->insert(data->begin(), garbage.begin(), garbage.end());
+      break;
+  }
+}
+
+// 第leaf个叶子目录的路径，各层分别为设备、日期和分片
+std::string LeafDirectory(const std::string& root,
+                          size_t leaf,
+                          size_t depth,
+                          size_t fanout) {
+  static const char* kLevelNames[] = {"device", "day", "part"};
+  std::vector<size_t> digits(depth);
+  for (size_t level = depth; level > 0; --level) {
+    digits[level - 1] = leaf % fanout;
+    leaf /= fanout;
+  }
+  std::string path = root;
+  for (size_t level = 0; level < depth; ++level) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%s_%04zu",
+                  kLevelNames[std::min<size_t>(level, 2)], digits[level]);
+    path = FileUtils::JoinPath(path, name);
+  }
+  return path;
+}
+
+bool GenerateFleet(const BenchOptions& options, FleetStats* stats) {
+  std::mt19937 rng(options.seed);
+  std::vector<Body> pool = MakeBodyPool(rng);
+  std::uniform_real_distribution<double> rate_dist(0.0, 1.0);
+
+  size_t leaf_count = (options.file_count + kFilesPerLeaf - 1) / kFilesPerLeaf;
+  size_t fanout = 1;
+  if (options.depth > 0) {
+    fanout = static_cast<size_t>(std::ceil(
+        std::pow(static_cast<double>(std::max<size_t>(leaf_count, 1)),
+                 1.0 / static_cast<double>(options.depth))));
+    fanout = std::max<size_t>(fanout, 1);
+  }
+
+  std::string directory;
+  for (size_t i = 0; i < options.file_count; ++i) {
+    if (i % kFilesPerLeaf == 0) {
+      directory = LeafDirectory(options.root, i / kFilesPerLeaf,
+                                options.depth, fanout);
+      if (!FileUtils::CreateDirectory(directory)) {
+        std::cerr << "Failed to create directory: " << directory << std::endl;
+        return false;
+      }
+    }
+    bool mmap3 = rate_dist(rng) < options.mmap3_rate;
+    std::vector<uint8_t> data = MakeFile(pool, mmap3, rng);
+    if (rate_dist(rng) < options.corrupt_rate) {
+      CorruptFile(&data, rng);
+      stats->corrupt_count++;
+    }
+    std::string name = "app_" + std::to_string(i) +
+                       (mmap3 ? kMmapFileExt : kXlogFileExt);
+    if (!FileUtils::WriteFile(FileUtils::JoinPath(directory, name), data)) {
+      std::cerr << "Failed to write file: " << name << std::endl;
+      return false;
+    }
+    (mmap3 ? stats->mmap3_count : stats->xlog_count)++;
+    stats->bytes += data.size();
+  }
+  return true;
+}
+
+// 与decode命令相同：解码到<输入>_.log，没有输出时写一个空文件
+void DecodeOne(const std::string& file, PhaseTimes* times) {
+  int64_t start = NowNs();
+  std::vector<uint8_t> input;
+  FileUtils::ReadFile(file, input);
+  int64_t read_end = NowNs();
+  times->read += read_end - start;
+  times->input_bytes += input.size();
+  input = std::vector<uint8_t>();
+
+  int64_t write_ns = 0;
+  std::string output_file = XlogDecoder::GenerateOutputFilename(file);
+  TimedFileOutputSink sink(output_file, &write_ns);
+  XlogDecoder decoder;
+  bool result = decoder.DecodeFile(file, sink);
+  if (result && sink.bytes_written() == 0) {
+    int64_t empty_start = NowNs();
+    result = FileUtils::WriteFile(output_file, {});
+    write_ns += NowNs() - empty_start;
+  }
+  int64_t decode_end = NowNs();
+  times->decode += decode_end - read_end - write_ns;
+  times->write += write_ns;
+  times->output_bytes += sink.bytes_written();
+  if (!result) {
+    times->failed++;
+  }
+}
+
+void DecodeAll(const std::vector<std::string>& files,
+               size_t job_count,
+               PhaseTimes* times) {
+  if (job_count <= 1) {
+    for (const auto& file : files) {
+      DecodeOne(file, times);
+    }
+    return;
+  }
+
+  // 与decode --jobs相同，大文件先开始
+  std::vector<std::pair<uint64_t, const std::string*>> sized_files;
+  for (const auto& file : files) {
+    sized_files.emplace_back(FileUtils::GetFileSize(file), &file);
+  }
+  std::stable_sort(
+      sized_files.begin(), sized_files.end(),
+      [](const auto& a, const auto& b) { return a.first > b.first; });
+  ThreadPool pool(std::min(job_count, files.size()));
+  for (const auto& sized_file : sized_files) {
+    const std::string* file = sized_file.second;
+    pool.Submit([file, times] { DecodeOne(*file, times); });
+  }
+  pool.Wait();
+}
+
+void PrintPhase(const char* name, int64_t ns, size_t files, uint64_t bytes) {
+  double seconds = static_cast<double>(ns) / 1e9;
+  std::cout << "  " << std::left << std::setw(8) << name << std::right
+            << std::fixed << std::setprecision(1) << std::setw(11)
+            << seconds * 1000 << std::setw(12)
+            << (seconds > 0 ? files / seconds : 0.0);
+  if (bytes > 0) {
+    std::cout << std::setw(10) << (seconds > 0 ? bytes / 1048576.0 / seconds
+                                               : 0.0);
+  }
+  std::cout << std::endl;
+}
+
+bool ParseOptions(int argc, char* argv[], BenchOptions* options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--root" && has_value) {
+      options->root = argv[++i];
+    } else if (arg == "--files" && has_value) {
+      options->file_count = std::stoul(argv[++i]);
+    } else if (arg == "--depth" && has_value) {
+      options->depth = std::stoul(argv[++i]);
+    } else if (arg == "--corrupt-rate" && has_value) {
+      options->corrupt_rate = std::stod(argv[++i]);
+    } else if (arg == "--mmap3-rate" && has_value) {
+      options->mmap3_rate = std::stod(argv[++i]);
+    } else if (arg == "--jobs" && has_value) {
+      options->job_count =
+          ThreadPool::ResolveThreadCount(std::stoul(argv[++i]));
+    } else if (arg == "--seed" && has_value) {
+      options->seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (arg == "--keep") {
+      options->keep = true;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  BenchOptions options;
+  bool parsed = false;
+  try {
+    parsed = ParseOptions(argc, argv, &options);
+  } catch (const std::exception&) {
+    parsed = false;
+  }
+  if (!parsed) {
+    std::cerr << "Usage: bench_fleet [--root DIR] [--files N] [--depth N] "
+                 "[--corrupt-rate R] [--mmap3-rate R] [--jobs N] [--seed N] "
+                 "[--keep]"
+              << std::endl;
+    return 1;
+  }
+
+  // 已存在的目录树直接使用，不覆盖也不删除
+  bool generated = !FileUtils::PathExists(options.root);
+  if (generated) {
+    FleetStats stats;
+    int64_t start = NowNs();
+    if (!GenerateFleet(options, &stats)) {
+      return 1;
+    }
+    std::cout << "fleet: " << options.file_count << " files ("
+              << stats.xlog_count << " .xlog, " << stats.mmap3_count
+              << " .mmap3, " << stats.corrupt_count << " corrupt), depth "
+              << options.depth << ", " << std::fixed << std::setprecision(1)
+              << stats.bytes / 1048576.0 << " MB, generated in "
+              << (NowNs() - start) / 1000000 << " ms" << std::endl;
+  } else {
+    std::cout << "fleet: using existing tree " << options.root << std::endl;
+  }
+
+  // decode：扫描目录后逐个文件读取、解码、写出
+  int64_t decode_start = NowNs();
+  std::vector<std::string> files = FileUtils::ScanDirectory(
+      options.root, {kXlogFileExt, kMmapFileExt}, true);
+  int64_t scan_ns = NowNs() - decode_start;
+  PhaseTimes times;
+  DecodeAll(files, options.job_count, &times);
+  int64_t decode_total_ns = NowNs() - decode_start;
+
+  std::cout << "\ndecode (jobs " << options.job_count << ")         ms"
+            << "     files/s      MB/s" << std::endl;
+  uint64_t input_bytes = times.input_bytes;
+  uint64_t output_bytes = times.output_bytes;
+  PrintPhase("scan", scan_ns, files.size(), 0);
+  PrintPhase("read", times.read, files.size(), input_bytes);
+  PrintPhase("decode", times.decode, files.size(), input_bytes);
+  PrintPhase("write", times.write, files.size(), output_bytes);
+  PrintPhase("total", decode_total_ns, files.size(), input_bytes);
+  std::cout << "  " << std::setprecision(1) << input_bytes / 1048576.0
+            << " MB -> " << output_bytes / 1048576.0 << " MB, "
+            << times.failed << " files failed" << std::endl;
+
+  // clean：查找并删除全部解码输出
+  int64_t clean_start = NowNs();
+  std::vector<std::string> decoded = FileUtils::FindDecodedFiles(options.root,
+                                                                 true);
+  int64_t find_ns = NowNs() - clean_start;
+  size_t deleted = 0;
+  for (const auto& file : decoded) {
+    if (FileUtils::DeleteFile(file)) {
+      deleted++;
+    }
+  }
+  int64_t clean_total_ns = NowNs() - clean_start;
+
+  std::cout << "\nclean                   ms     files/s" << std::endl;
+  PrintPhase("scan", find_ns, decoded.size(), 0);
+  PrintPhase("delete", clean_total_ns - find_ns, decoded.size(), 0);
+  PrintPhase("total", clean_total_ns, decoded.size(), 0);
+
+  if (generated && !options.keep) {
+    std::error_code error;
+    std::filesystem::remove_all(options.root, error);
+  }
+  return deleted == decoded.size() ? 0 : 1;
+}
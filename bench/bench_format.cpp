@@ -0,0 +1,123 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// bench_format.cpp - 日志行解析与结构化输出的性能测试
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "mars_log_line.h"
+#include "output_sink.h"
+#include "structured_output_sink.h"
+
+using namespace xlog_decode;
+
+namespace {
+
+// 生成与真实解码结果相近的日志文本：消息长度不一，部分消息含有逗号、引号
+std::string MakeDecodedText(size_t target_size, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> length_dist(20, 300);
+  const char* levels[] = {"D", "I", "I", "I", "W", "E"};
+  const char* tags[] = {"network", "ui", "storage", "tag"};
+
+  std::string text;
+  text.reserve(target_size + 1024);
+  for (uint64_t i = 0; text.size() < target_size; ++i) {
+    text += "[";
+    text += levels[i % 6];
+    text += "][2024-03-01 +8.0 10:11:";
+    text += std::to_string(10 + i % 50);
+    text += ".";
+    text += std::to_string(100 + i % 900);
+    text += "][1234, ";
+    text += std::to_string(5678 + i % 7);
+    text += i % 7 == 0 ? "*][" : "][";
+    text += tags[i % 4];
+    text += "][client.cc:";
+    text += std::to_string(i % 2000);
+    text += ", SendRequest][";
+    int length = length_dist(rng);
+    for (int j = 0; j < length; ++j) {
+      text += static_cast<char>('a' + (i + j) % 26);
+    }
+    if (i % 5 == 0) {
+      text += ", retry=\"3\"";
+    }
+    text += "\n";
+  }
+  return text;
+}
+
+// 按块大小分批写入，与解码器逐块输出一致
+double RunSink(const std::string& text, OutputFormat format, size_t* records) {
+  NullOutputSink null_sink;
+  StructuredOutputSink sink(null_sink, format);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+  const size_t kBlockSize = 128 * 1024;
+
+  auto start_time = std::chrono::steady_clock::now();
+  for (size_t offset = 0; offset < text.size(); offset += kBlockSize) {
+    sink.Write(data + offset, std::min(kBlockSize, text.size() - offset));
+  }
+  sink.Close();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start_time)
+                       .count();
+  *records = sink.record_count();
+  return seconds;
+}
+
+}  // namespace
+
+int main() {
+  const std::string text = MakeDecodedText(256 * 1024 * 1024, 42);
+  double mb = static_cast<double>(text.size()) / (1024 * 1024);
+
+  std::cout << "mode        MB        ms      MB/s   records" << std::endl;
+  auto print = [mb](const char* mode, double seconds, size_t records) {
+    std::cout << std::left << std::setw(8) << mode << std::right << std::fixed
+              << std::setprecision(1) << std::setw(8) << mb << std::setw(10)
+              << seconds * 1000 << std::setw(10) << mb / seconds
+              << std::setw(10) << records << std::endl;
+  };
+
+  // 只解析不输出，衡量解析本身的开销
+  auto start_time = std::chrono::steady_clock::now();
+  size_t parsed = 0;
+  const char* line = text.data();
+  const char* end = text.data() + text.size();
+  while (line < end) {
+    const char* line_end =
+        static_cast<const char*>(std::memchr(line, '\n', end - line)) + 1;
+    MarsLogRecord record;
+    if (ParseMarsLogLine(std::string_view(line, line_end - line), &record)) {
+      parsed++;
+    }
+    line = line_end;
+  }
+  print("parse",
+        std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                      start_time)
+            .count(),
+        parsed);
+
+  // MB/s按输入的解码文本计算，单线程
+  const std::pair<const char*, OutputFormat> formats[] = {
+      {"json", OutputFormat::kJson},
+      {"csv", OutputFormat::kCsv},
+      {"tsv", OutputFormat::kTsv}};
+  for (const auto& format : formats) {
+    size_t records = 0;
+    double seconds = RunSink(text, format.second, &records);
+    print(format.first, seconds, records);
+  }
+  return 0;
+}
@@ -0,0 +1,185 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// bench_resync.cpp - 损坏数据块重新同步的性能测试
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "file_utils.h"
+#include "magic_scanner.h"
+#include "xlog_block_reader.h"
+#include "xlog_constants.h"
+
+using namespace xlog_decode;
+
+namespace {
+
+// 生成指定数量的块，主体为随机字节（与压缩数据的魔数密度相近）
+// corrupt_rate比例的块会被写入越界的长度字段或错误的尾部，迫使读取器重新同步
+std::vector<uint8_t> MakeCorruptedXlog(size_t block_count,
+                                       double corrupt_rate,
+                                       uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> byte_dist(0, 255);
+  std::uniform_int_distribution<uint32_t> size_dist(2 * 1024, 16 * 1024);
+  std::uniform_real_distribution<double> rate_dist(0.0, 1.0);
+
+  std::vector<uint8_t> data;
+  for (size_t i = 0; i < block_count; ++i) {
+    uint32_t length = size_dist(rng);
+    uint32_t header_len = GetHeaderLen(MAGIC_ASYNC_NO_CRYPT_ZSTD_START);
+    size_t offset = data.size();
+    data.resize(offset + header_len + length + 1, 0);
+
+    uint8_t* block = &data[offset];
+    block[0] = MAGIC_ASYNC_NO_CRYPT_ZSTD_START;
+    uint16_t seq = static_cast<uint16_t>(i + 1);
+    std::memcpy(block + 1, &seq, sizeof(seq));
+    std::memcpy(block + 5, &length, sizeof(length));
+    for (uint32_t j = 0; j < length; ++j) {
+      block[header_len + j] = static_cast<uint8_t>(byte_dist(rng));
+    }
+    block[header_len + length] = MAGIC_END;
+
+    if (rate_dist(rng) < corrupt_rate) {
+      if (rng() % 2 == 0) {
+        uint32_t bad_length = 0xF0000000u | rng();
+        std::memcpy(block + 5, &bad_length, sizeof(bad_length));
+      } else {
+        block[header_len + length] = static_cast<uint8_t>(1 + rng() % 255);
+      }
+    }
+  }
+  return data;
+}
+
+struct ResyncResult {
+  uint64_t blocks = 0;
+  uint64_t resyncs = 0;
+  uint64_t skipped = 0;
+  double seconds = 0;
+};
+
+ResyncResult ReadAllBlocks(XlogBlockReader& reader) {
+  ResyncResult result;
+  XlogBlock block;
+  auto start_time = std::chrono::steady_clock::now();
+  while (true) {
+    BlockReadStatus status = reader.Next(&block, true);
+    if (block.resynced) {
+      result.resyncs++;
+      result.skipped += block.skipped;
+    }
+    if (status != BlockReadStatus::kBlock) {
+      break;
+    }
+    result.blocks++;
+  }
+  auto end_time = std::chrono::steady_clock::now();
+  result.seconds =
+      std::chrono::duration<double>(end_time - start_time).count();
+  return result;
+}
+
+void PrintResult(const std::string& mode,
+                 int32_t chain_length,
+                 size_t block_count,
+                 double corrupt_rate,
+                 size_t size,
+                 const ResyncResult& result) {
+  double mb = static_cast<double>(size) / (1024 * 1024);
+  std::cout << std::left << std::setw(8) << mode << std::right
+            << std::setw(6) << chain_length << std::setw(8) << block_count << std::setw(6)
+            << static_cast<int>(corrupt_rate * 100) << "%" << std::fixed
+            << std::setprecision(1) << std::setw(10) << mb << std::setw(10)
+            << result.seconds * 1000 << std::setw(10) << mb / result.seconds
+            << std::setw(10)
+            << result.seconds * 1e9 / static_cast<double>(size)
+            << std::setw(9) << result.blocks << std::setw(9)
+            << result.resyncs << std::endl;
+}
+
+}  // namespace
+
+int main() {
+  const std::string bench_file = "bench_resync.xlog";
+  const double corrupt_rates[] = {0.01, 0.10, 0.50};
+  const size_t block_counts[] = {2000, 8000, 32000};
+  const int32_t chain_lengths[] = {1, 3};
+
+  std::cout << "mode     chain  blocks  rate      MB        ms      MB/s"
+               "   ns/byte   blocks  resyncs"
+            << std::endl;
+
+  // ns/byte在不同文件大小下应保持不变，说明重新同步是线性时间
+  // chain为1时随机数据中的伪块头可能导致跳过大段有效数据
+  for (double corrupt_rate : corrupt_rates) {
+    for (size_t block_count : block_counts) {
+      std::vector<uint8_t> data =
+          MakeCorruptedXlog(block_count, corrupt_rate, 42);
+      FileUtils::WriteFile(bench_file, data);
+
+      for (int32_t chain_length : chain_lengths) {
+        XlogBlockReader memory_reader;
+        memory_reader.Attach(data.data(), data.size());
+        memory_reader.set_resync_chain_length(chain_length);
+        PrintResult("memory", chain_length, block_count, corrupt_rate,
+                    data.size(), ReadAllBlocks(memory_reader));
+
+        XlogBlockReader file_reader;
+        if (file_reader.Open(bench_file)) {
+          file_reader.set_resync_chain_length(chain_length);
+          PrintResult("stream", chain_length, block_count, corrupt_rate,
+                      data.size(), ReadAllBlocks(file_reader));
+        }
+      }
+    }
+  }
+
+  FileUtils::DeleteFile(bench_file);
+
+  // 比较各魔数扫描实现：纯扫描吞吐量与高损坏率下的重新同步耗时
+  std::cout << std::endl
+            << "scanner   scan MB/s   resync ms   blocks  resyncs" << std::endl;
+  std::vector<uint8_t> data = MakeCorruptedXlog(32000, 0.50, 42);
+  const MagicScanner::Implementation implementations[] = {
+      MagicScanner::Implementation::kScalar,
+      MagicScanner::Implementation::kSse2,
+      MagicScanner::Implementation::kAvx2};
+  for (auto implementation : implementations) {
+    if (!MagicScanner::ForceImplementation(implementation)) {
+      continue;
+    }
+
+    auto scan_begin = std::chrono::steady_clock::now();
+    size_t offset = 0;
+    size_t positions[256];
+    while (offset < data.size()) {
+      size_t scanned = 0;
+      MagicScanner::Collect(data.data() + offset, data.size() - offset,
+                            positions, 256, &scanned);
+      offset += scanned;
+    }
+    double scan_ms = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - scan_begin)
+                         .count();
+
+    XlogBlockReader reader;
+    reader.Attach(data.data(), data.size());
+    ResyncResult result = ReadAllBlocks(reader);
+
+    std::cout << std::left << std::setw(8)
+              << MagicScanner::ImplementationName(implementation) << std::right
+              << std::fixed << std::setprecision(1) << std::setw(12)
+              << data.size() / 1048576.0 / (scan_ms / 1000.0) << std::setw(12)
+              << result.seconds * 1000 << std::setw(9) << result.blocks
+              << std::setw(9) << result.resyncs << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,420 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// bench_xlog_decoder.cpp - 解码内核的性能测试套件
+//
+// 为每种魔数生成合成的XLOG数据（不同块大小、不同损坏比例），分别测量
+// 块校验、重新同步扫描、分帧加解码以及ZLIB/ZSTD解压的吞吐量，结果写入
+// JSON文件，便于比较不同提交之间的性能变化
+//
+// 用法：bench_xlog_decoder [--quick] [--label TEXT] [--json FILE]
+//   --quick  每组数据量减为1/8，用于快速检查
+//   --label  写入JSON的标签，例如提交号
+//   --json   JSON输出路径，默认bench_xlog_decoder.json
+//
+// 每条结果中bytes的含义：IsValidLogBuffer为被校验的块覆盖的输入字节数
+// （只读取头部和尾部），FindLogStartPosition为扫描的输入字节数，
+// DecodeBlock、DecompressZlib和DecompressZstd为解码输出的字节数
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "magic_scanner.h"
+#include "xlog_block_reader.h"
+#include "xlog_constants.h"
+#include "xlog_decoder.h"
+
+using namespace xlog_decode;
+
+namespace {
+
+// 每组数据的日志文本总量
+constexpr size_t kCaseBytes = 8 * 1024 * 1024;
+
+// 每项测量重复的次数，取最短时间
+constexpr int kRepeat = 3;
+
+// 块主体的编码方式
+enum class Encoding {
+  kRaw,           // 不压缩
+  kZlib,          // 原始deflate流
+  kZlibSegments,  // 按2字节长度前缀分段的deflate流（MAGIC_COMPRESS_START1）
+  kZstdFrame,     // 每块一个完整的zstd帧（同步模式）
+  kZstdStream     // 流式刷新的zstd数据，帧中不记录内容大小（异步模式）
+};
+
+struct Variant {
+  const char* name;
+  uint8_t magic;
+  Encoding encoding;
+};
+
+// MagicNumbers中的全部魔数；加密魔数不带密钥解码，与命令行不加
+// --private-key时相同，解密的开销见bench_decrypt
+const Variant kVariants[] = {
+    {"raw_v2", MAGIC_NO_COMPRESS_START, Encoding::kRaw},
+    {"zlib_v2", MAGIC_COMPRESS_START, Encoding::kZlib},
+    {"zlib_segments", MAGIC_COMPRESS_START1, Encoding::kZlibSegments},
+    {"raw_async", MAGIC_NO_COMPRESS_START1, Encoding::kRaw},
+    {"zlib_async_crypt", MAGIC_COMPRESS_START2, Encoding::kZlib},
+    {"raw_no_crypt", MAGIC_NO_COMPRESS_NO_CRYPT_START, Encoding::kRaw},
+    {"zlib_no_crypt", MAGIC_COMPRESS_NO_CRYPT_START, Encoding::kZlib},
+    {"zstd_sync", MAGIC_SYNC_ZSTD_START, Encoding::kZstdFrame},
+    {"zstd_sync_no_crypt", MAGIC_SYNC_NO_CRYPT_ZSTD_START,
+     Encoding::kZstdFrame},
+    {"zstd_async", MAGIC_ASYNC_ZSTD_START, Encoding::kZstdStream},
+    {"zstd_async_no_crypt", MAGIC_ASYNC_NO_CRYPT_ZSTD_START,
+     Encoding::kZstdStream},
+};
+
+const size_t kBlockSizes[] = {1024, 16 * 1024, 128 * 1024};
+const double kCorruptRates[] = {0.0, 0.01, 0.10};
+
+// 生成约size字节的日志文本
+std::string MakeLogText(size_t block_index, size_t size) {
+  std::string text;
+  for (size_t line = 0; text.size() < size; ++line) {
+    text += "[I][2024-03-01 +8.0 10:11:12.345][1234, 5678*][net][conn.cc, "
+            "OnRecv, " +
+            std::to_string(line) + "][block " + std::to_string(block_index) +
+            " recv " + std::to_string(block_index * 7 + line) +
+            " bytes from 10.0.0." + std::to_string(line % 256) + "\n";
+  }
+  return text;
+}
+
+// 以原始deflate格式压缩，flush为Z_SYNC_FLUSH时与Mars异步模式一致
+std::vector<uint8_t> CompressZlib(const std::string& text, int flush) {
+  z_stream strm;
+  std::memset(&strm, 0, sizeof(strm));
+  deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  std::vector<uint8_t> out(deflateBound(&strm, text.size()) + 64);
+  strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(text.data()));
+  strm.avail_in = static_cast<uInt>(text.size());
+  strm.next_out = out.data();
+  strm.avail_out = static_cast<uInt>(out.size());
+  deflate(&strm, flush);
+  out.resize(out.size() - strm.avail_out);
+  deflateEnd(&strm);
+  return out;
+}
+
+std::vector<uint8_t> Encode(const std::string& text, Encoding encoding) {
+  switch (encoding) {
+    case Encoding::kRaw:
+      return std::vector<uint8_t>(text.begin(), text.end());
+    case Encoding::kZlib:
+      return CompressZlib(text, Z_SYNC_FLUSH);
+    case Encoding::kZlibSegments: {
+      // 每段最长4KB，各段拼接后是一个完整的压缩流
+      std::vector<uint8_t> stream = CompressZlib(text, Z_FINISH);
+      std::vector<uint8_t> body;
+      for (size_t pos = 0; pos < stream.size(); pos += 4096) {
+        uint16_t len =
+            static_cast<uint16_t>(std::min<size_t>(4096, stream.size() - pos));
+        body.push_back(static_cast<uint8_t>(len & 0xFF));
+        body.push_back(static_cast<uint8_t>(len >> 8));
+        body.insert(body.end(), stream.begin() + pos,
+                    stream.begin() + pos + len);
+      }
+      return body;
+    }
+    case Encoding::kZstdFrame: {
+      std::vector<uint8_t> body(ZSTD_compressBound(text.size()));
+      body.resize(ZSTD_compress(body.data(), body.size(), text.data(),
+                                text.size(), 3));
+      return body;
+    }
+    case Encoding::kZstdStream: {
+      ZSTD_CCtx* cctx = ZSTD_createCCtx();
+      std::vector<uint8_t> body(ZSTD_compressBound(text.size()) + 64);
+      ZSTD_inBuffer input = {text.data(), text.size(), 0};
+      ZSTD_outBuffer output = {body.data(), body.size(), 0};
+      ZSTD_compressStream2(cctx, &output, &input, ZSTD_e_flush);
+      body.resize(output.pos);
+      ZSTD_freeCCtx(cctx);
+      return body;
+    }
+  }
+  return {};
+}
+
+// 一组合成数据：拼接好的XLOG数据，以及各块的偏移和主体
+struct Case {
+  std::vector<uint8_t> data;
+  std::vector<uint64_t> offsets;
+  std::vector<std::vector<uint8_t>> bodies;
+  size_t text_bytes = 0;
+};
+
+Case MakeCase(const Variant& variant, size_t block_size, size_t case_bytes) {
+  Case result;
+  uint32_t header_len = GetHeaderLen(variant.magic);
+  size_t block_count = std::max<size_t>(16, case_bytes / block_size);
+  for (size_t i = 0; i < block_count; ++i) {
+    std::string text = MakeLogText(i, block_size);
+    result.text_bytes += text.size();
+    std::vector<uint8_t> body = Encode(text, variant.encoding);
+
+    size_t offset = result.data.size();
+    result.offsets.push_back(offset);
+    result.data.resize(offset + header_len, 0);
+    result.data[offset] = variant.magic;
+    uint16_t seq = static_cast<uint16_t>(i % 65535 + 1);
+    uint32_t length = static_cast<uint32_t>(body.size());
+    std::memcpy(&result.data[offset + 1], &seq, sizeof(seq));
+    result.data[offset + 3] = 10;
+    result.data[offset + 4] = 11;
+    std::memcpy(&result.data[offset + 5], &length, sizeof(length));
+    result.data.insert(result.data.end(), body.begin(), body.end());
+    result.data.push_back(MAGIC_END);
+    result.bodies.push_back(std::move(body));
+  }
+  return result;
+}
+
+// 按比例损坏块：写入越界的长度字段或错误的尾部，迫使读取器重新同步
+std::vector<uint8_t> Corrupt(const Case& input,
+                             const Variant& variant,
+                             double rate) {
+  std::vector<uint8_t> data = input.data;
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> rate_dist(0.0, 1.0);
+  uint32_t header_len = GetHeaderLen(variant.magic);
+  for (size_t i = 0; i < input.offsets.size(); ++i) {
+    if (rate_dist(rng) >= rate) {
+      continue;
+    }
+    uint8_t* block = &data[input.offsets[i]];
+    if (rng() % 2 == 0) {
+      uint32_t bad_length = 0xF0000000u | rng();
+      std::memcpy(block + 5, &bad_length, sizeof(bad_length));
+    } else {
+      block[header_len + input.bodies[i].size()] =
+          static_cast<uint8_t>(1 + rng() % 255);
+    }
+  }
+  return data;
+}
+
+struct Result {
+  std::string kernel;
+  const Variant* variant;
+  size_t block_size;
+  double corrupt_rate;
+  uint64_t blocks = 0;
+  uint64_t bytes = 0;
+  double seconds = 0;
+};
+
+// 运行kRepeat次取最短时间；run返回本次处理的块数和字节数
+template <typename Run>
+Result Measure(const std::string& kernel,
+               const Variant& variant,
+               size_t block_size,
+               double corrupt_rate,
+               Run run) {
+  Result result{kernel, &variant, block_size, corrupt_rate};
+  for (int i = 0; i < kRepeat; ++i) {
+    uint64_t blocks = 0;
+    uint64_t bytes = 0;
+    auto start_time = std::chrono::steady_clock::now();
+    run(&blocks, &bytes);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start_time)
+                         .count();
+    if (i == 0 || seconds < result.seconds) {
+      result.seconds = seconds;
+    }
+    result.blocks = blocks;
+    result.bytes = bytes;
+  }
+  return result;
+}
+
+void PrintResult(const Result& result) {
+  double seconds = result.seconds > 0 ? result.seconds : 1e-9;
+  std::cout << std::left << std::setw(22) << result.kernel << std::setw(21)
+            << result.variant->name << std::right << std::setw(8)
+            << result.block_size << std::setw(6) << std::fixed
+            << std::setprecision(0) << result.corrupt_rate * 100 << "%"
+            << std::setprecision(1) << std::setw(11)
+            << result.bytes / (1024.0 * 1024.0) / seconds << std::setw(13)
+            << result.blocks / seconds << std::endl;
+}
+
+// 按固定小数位数格式化，JSON中不出现科学计数法
+std::string FormatNumber(double value, int digits) {
+  char buffer[64];
+  std::snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+  return buffer;
+}
+
+// 写出JSON结果，标签中的引号和反斜杠需要转义
+bool WriteJson(const std::string& path,
+               const std::string& label,
+               const std::vector<Result>& results) {
+  std::ostringstream json;
+  json << "{\n  \"benchmark\": \"bench_xlog_decoder\",\n";
+  json << "  \"label\": \"";
+  for (char c : label) {
+    if (c == '"' || c == '\\') {
+      json << '\\';
+    }
+    json << c;
+  }
+  json << "\",\n  \"simd\": \""
+       << MagicScanner::ImplementationName(MagicScanner::ActiveImplementation())
+       << "\",\n  \"repeat\": " << kRepeat << ",\n  \"results\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    double seconds = r.seconds > 0 ? r.seconds : 1e-9;
+    json << (i == 0 ? "\n" : ",\n") << "    {\"kernel\": \"" << r.kernel
+         << "\", \"variant\": \"" << r.variant->name
+         << "\", \"magic\": " << static_cast<int>(r.variant->magic)
+         << ", \"block_size\": " << r.block_size
+         << ", \"corrupt_rate\": " << FormatNumber(r.corrupt_rate, 2)
+         << ", \"blocks\": " << r.blocks << ", \"bytes\": " << r.bytes
+         << ", \"seconds\": " << FormatNumber(r.seconds, 9)
+         << ", \"mb_per_s\": "
+         << FormatNumber(r.bytes / (1024.0 * 1024.0) / seconds, 3)
+         << ", \"blocks_per_s\": " << FormatNumber(r.blocks / seconds, 1)
+         << "}";
+  }
+  json << "\n  ]\n}\n";
+
+  std::ofstream file(path, std::ios::binary);
+  file << json.str();
+  return static_cast<bool>(file);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string json_path = "bench_xlog_decoder.json";
+  std::string label;
+  size_t case_bytes = kCaseBytes;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--quick") {
+      case_bytes = kCaseBytes / 8;
+    } else if (arg == "--label" && i + 1 < argc) {
+      label = argv[++i];
+    } else if (arg == "--json" && i + 1 < argc) {
+      json_path = argv[++i];
+    } else {
+      std::cerr << "Usage: bench_xlog_decoder [--quick] [--label TEXT] "
+                   "[--json FILE]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "kernel                variant               block  rate"
+               "       MB/s     blocks/s"
+            << std::endl;
+  std::vector<Result> results;
+  auto record = [&results](const Result& result) {
+    PrintResult(result);
+    results.push_back(result);
+  };
+
+  XlogDecoder decoder;
+  std::vector<uint8_t> output;
+  for (const Variant& variant : kVariants) {
+    for (size_t block_size : kBlockSizes) {
+      Case input = MakeCase(variant, block_size, case_bytes);
+
+      for (double rate : kCorruptRates) {
+        std::vector<uint8_t> data = Corrupt(input, variant, rate);
+
+        // 逐个校验原始块的起始位置（链长度1，与默认的--resync-chain相同）
+        record(Measure("IsValidLogBuffer", variant, block_size, rate,
+                       [&](uint64_t* blocks, uint64_t* bytes) {
+                         XlogBlockReader reader;
+                         reader.Attach(data.data(), data.size());
+                         for (uint64_t offset : input.offsets) {
+                           *blocks += reader.IsValidLogBuffer(offset, 1,
+                                                              nullptr);
+                         }
+                         *bytes = data.size();
+                       }));
+
+        // 从头到尾找出所有可信的块起点，每个字节只扫描一次
+        record(Measure("FindLogStartPosition", variant, block_size, rate,
+                       [&](uint64_t* blocks, uint64_t* bytes) {
+                         XlogBlockReader reader;
+                         reader.Attach(data.data(), data.size());
+                         uint64_t position = 0;
+                         uint64_t start = 0;
+                         while (reader.FindLogStartPosition(start, 1,
+                                                            &position)) {
+                           (*blocks)++;
+                           start = position + 1;
+                         }
+                         *bytes = data.size();
+                       }));
+
+        // 分帧（含损坏数据的重新同步）并解码每个块
+        record(Measure("DecodeBlock", variant, block_size, rate,
+                       [&](uint64_t* blocks, uint64_t* bytes) {
+                         XlogBlockReader reader;
+                         reader.Attach(data.data(), data.size());
+                         XlogBlock block;
+                         while (reader.Next(&block, true) ==
+                                BlockReadStatus::kBlock) {
+                           output.clear();
+                           decoder.DecodeBlockBody(block.magic, block.body,
+                                                   block.length, output);
+                           (*blocks)++;
+                           *bytes += output.size();
+                         }
+                       }));
+      }
+
+      // 只解压已分帧的主体，不含校验和分帧
+      const char* kernel = nullptr;
+      if (variant.encoding == Encoding::kZlib ||
+          variant.encoding == Encoding::kZlibSegments) {
+        kernel = "DecompressZlib";
+      } else if (variant.encoding == Encoding::kZstdFrame ||
+                 variant.encoding == Encoding::kZstdStream) {
+        kernel = "DecompressZstd";
+      }
+      // 没有密钥时MAGIC_COMPRESS_START2的主体原样输出，不经过解压
+      if (kernel != nullptr && variant.magic != MAGIC_COMPRESS_START2) {
+        record(Measure(kernel, variant, block_size, 0.0,
+                       [&](uint64_t* blocks, uint64_t* bytes) {
+                         for (const auto& body : input.bodies) {
+                           output.clear();
+                           decoder.DecodeBlockBody(variant.magic, body.data(),
+                                                   body.size(), output);
+                           (*blocks)++;
+                           *bytes += output.size();
+                         }
+                       }));
+      }
+    }
+  }
+
+  if (!WriteJson(json_path, label, results)) {
+    std::cerr << "Failed to write " << json_path << std::endl;
+    return 1;
+  }
+  std::cout << "\n" << results.size() << " results written to " << json_path
+            << std::endl;
+  return 0;
+}
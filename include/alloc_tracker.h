@@ -0,0 +1,107 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// alloc_tracker.h - 按解码阶段统计内存分配
+//
+// 编译时定义XLOG_DECODE_ALLOC_TRACKING（xmake f --alloc-tracking=y）时替换
+// 全局operator new/delete，每次分配前加一个记录大小、所属账户和阶段的头部；
+// 运行时只有设置了账户的线程上的分配才计数。未定义时AllocScope只设置线程
+// 局部变量，不影响分配
+
+#ifndef XLOG_DECODE_ALLOC_TRACKER_H_
+#define XLOG_DECODE_ALLOC_TRACKER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace xlog_decode {
+
+// 分配所属的解码阶段，与DecodeStats的耗时阶段对应
+enum class AllocStage : uint8_t {
+  kOther = 0,   // 不属于以下阶段，如序列号缺失提示和结果行
+  kOpen,        // 打开、映射输入或解压ZIP条目
+  kFrame,       // 分帧和重新同步，包括流式读取时主体的副本
+  kDecompress,  // 解密和解压
+  kWrite,       // 写入输出，包括过滤和格式转换
+};
+
+constexpr int kAllocStageCount = 5;
+
+// 编译时是否开启了分配统计
+bool AllocTrackingCompiled();
+
+// 一次解码的分配计数，可以在任意线程上更新
+// 释放按分配时的账户和阶段扣减，因此跨线程释放也能得到正确的存活字节数
+// 账户按引用计数释放：创建者持有一个引用，每个计入账户且尚未释放的分配
+// 也持有一个引用，因此比解码器存活更久的分配（如线程局部的解压缓冲）释放时
+// 账户仍然有效
+class AllocAccount {
+ public:
+  // 创建一个新账户，调用方持有一个引用，用完后调用Release
+  static AllocAccount* Create();
+
+  // 增加和释放一个引用，最后一个引用释放时删除账户
+  void Acquire();
+  void Release();
+
+  // 清零分配次数和字节数，峰值从当前的存活字节数重新开始
+  void Reset();
+
+  void OnAllocate(AllocStage stage, size_t size);
+  void OnFree(AllocStage stage, size_t size);
+
+  uint64_t count(AllocStage stage) const;
+  uint64_t bytes(AllocStage stage) const;
+
+  // 该阶段分配且尚未释放的字节数的峰值
+  int64_t peak(AllocStage stage) const;
+
+  // 所有阶段存活字节数之和的峰值
+  int64_t peak() const { return peak_.load(std::memory_order_relaxed); }
+
+ private:
+  AllocAccount() = default;
+
+  struct Stage {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<int64_t> live{0};
+    std::atomic<int64_t> peak{0};
+  };
+
+  Stage stages_[kAllocStageCount];
+  std::atomic<int64_t> refs_{1};
+  std::atomic<int64_t> live_{0};
+  std::atomic<int64_t> peak_{0};
+};
+
+// 调用线程当前的账户，没有时为nullptr
+AllocAccount* CurrentAllocAccount();
+
+// 作用域内调用线程的分配计入指定的账户和阶段，结束时恢复之前的设置
+class AllocScope {
+ public:
+  // 只切换阶段，账户不变
+  explicit AllocScope(AllocStage stage);
+
+  // 切换账户和阶段；account为nullptr时作用域内的分配不计数
+  AllocScope(AllocAccount* account, AllocStage stage);
+
+  ~AllocScope() { Leave(); }
+
+  AllocScope(const AllocScope&) = delete;
+  AllocScope& operator=(const AllocScope&) = delete;
+
+  // 提前恢复之前的设置
+  void Leave();
+
+ private:
+  bool active_ = true;
+  AllocAccount* saved_account_;
+  AllocStage saved_stage_;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_ALLOC_TRACKER_H_
@@ -0,0 +1,242 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// columnar_log.h - 解码日志的列式存储（.xcol）读写
+
+#ifndef XLOG_DECODE_COLUMNAR_LOG_H_
+#define XLOG_DECODE_COLUMNAR_LOG_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "file_utils.h"
+#include "output_sink.h"
+
+namespace xlog_decode {
+
+// 列式文件中的列，行组内各列的数据按此顺序依次存放
+enum ColumnarColumn : uint32_t {
+  kColumnTime = 0,  // UTC毫秒时间戳，与上一行的差值以zigzag变长整数存储
+  kColumnLevel,     // 级别字符，每行1字节
+  kColumnFlags,     // 每行1字节，见kColumnarFlagParsed等
+  kColumnPid,       // 变长整数
+  kColumnTid,       // 变长整数
+  kColumnTag,       // 行组内字典编码
+  kColumnFile,      // 行组内字典编码
+  kColumnFunction,  // 行组内字典编码
+  kColumnLine,      // 变长整数
+  kColumnMessage,   // 每行的结束偏移（不压缩）+ zstd压缩的消息数据
+  kColumnCount
+};
+
+// 按位组合的列集合，用于只读取部分列
+constexpr uint32_t ColumnBit(ColumnarColumn column) {
+  return 1u << column;
+}
+constexpr uint32_t kAllColumns = (1u << kColumnCount) - 1;
+
+// 标志列中的位
+constexpr uint8_t kColumnarFlagParsed = 0x01;      // 是否为完整的Mars日志行
+constexpr uint8_t kColumnarFlagMainThread = 0x02;  // 是否为主线程
+
+// 行组的元数据，定长存储在文件末尾，扫描时不读取行组本身即可按时间跳过
+#pragma pack(push, 1)
+struct ColumnarRowGroupInfo {
+  uint64_t offset;                      // 行组在文件中的偏移
+  uint32_t row_count;                   // 行数
+  int64_t min_time;                     // 行组内最早的时间（UTC毫秒）
+  int64_t max_time;                     // 行组内最晚的时间（UTC毫秒）
+  uint32_t column_sizes[kColumnCount];  // 各列数据的字节数
+};
+#pragma pack(pop)
+
+// 读取出的一行，字符串指向ColumnarRowGroup内的数据
+struct ColumnarRecord {
+  int64_t time = 0;  // 无法解析时间的行（如多行消息的后续行）沿用上一行的时间
+  char level = 0;    // 无法解析的行为0
+  bool parsed = false;
+  bool main_thread = false;
+  uint64_t pid = 0;
+  uint64_t tid = 0;
+  std::string_view tag;
+  std::string_view file;
+  std::string_view function;
+  uint64_t line = 0;
+  std::string_view message;  // 无法解析的行为整行内容
+};
+
+// ColumnarOutputSink把解码输出逐行解析后按列写入下游
+// 每row_group_rows行组成一个行组，行组写出后只保留元数据，文件尾部
+// 在Close时写出；下游只需要顺序写入
+class ColumnarOutputSink : public OutputSink {
+ public:
+  // 默认行组行数，兼顾按时间跳过的粒度和消息的压缩率
+  static constexpr size_t kDefaultRowGroupRows = 16384;
+
+  explicit ColumnarOutputSink(OutputSink& downstream,
+                              size_t row_group_rows = kDefaultRowGroupRows);
+
+  bool Write(const uint8_t* data, size_t size) override;
+
+  // 只刷新下游，未满的行组保留到写满或Close
+  bool Flush() override;
+
+  // 写出最后一个行组和文件尾部，并关闭下游
+  bool Close() override;
+
+  bool WantsMore() const override { return downstream_.WantsMore(); }
+
+  uint64_t record_count() const { return record_count_; }
+  size_t row_group_count() const { return row_groups_.size(); }
+
+ private:
+  // 行组内的字典编码列
+  struct Dictionary {
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<const std::string*> values;  // 按编号排列，指向ids中的键
+    std::vector<uint32_t> rows;              // 每行的编号
+    uint32_t last_id = 0;                    // 上一行的编号，相同时免去查找
+
+    void Add(std::string_view value);
+    void Clear();
+  };
+
+  // 解析一行并追加到当前行组
+  void AddLine(std::string_view line);
+
+  // 编码并写出当前行组
+  bool WriteRowGroup();
+
+  // 第一次写出前在encoded_中加上文件头
+  void AppendFileHeader();
+
+  bool WriteOut(const std::vector<uint8_t>& data);
+
+  OutputSink& downstream_;
+  size_t row_group_rows_;
+  bool header_written_ = false;
+  uint64_t bytes_written_ = 0;
+  uint64_t record_count_ = 0;
+
+  // 上一次写入末尾未结束的行
+  std::string partial_;
+
+  // 上一行的时间，无法解析时间的行沿用
+  int64_t last_time_ = 0;
+
+  // 当前行组各列的数据
+  std::vector<int64_t> times_;
+  std::vector<uint8_t> levels_;
+  std::vector<uint8_t> flags_;
+  std::vector<uint64_t> pids_;
+  std::vector<uint64_t> tids_;
+  Dictionary tags_;
+  Dictionary files_;
+  Dictionary functions_;
+  std::vector<uint64_t> lines_;
+  std::vector<uint32_t> message_ends_;
+  std::string messages_;
+
+  std::vector<ColumnarRowGroupInfo> row_groups_;
+  std::vector<uint8_t> encoded_;
+};
+
+// ColumnarRowGroup保存从文件中读出的一个行组的部分或全部列
+class ColumnarRowGroup {
+ public:
+  size_t row_count() const { return row_count_; }
+
+  // 已读取的列（按位组合）
+  uint32_t columns() const { return columns_; }
+
+  // 第row行，未读取的列为默认值
+  ColumnarRecord Record(size_t row) const;
+
+  int64_t time(size_t row) const { return times_[row]; }
+
+  // 标签字典中value的编号，不存在时返回false（需要已读取标签列）
+  bool FindTag(std::string_view value, uint32_t* id) const;
+
+  // 第row行的标签编号（需要已读取标签列）
+  uint32_t tag_id(size_t row) const { return dictionaries_[0].rows[row]; }
+
+ private:
+  friend class ColumnarReader;
+
+  struct Dictionary {
+    std::vector<std::string> values;
+    std::vector<uint32_t> rows;
+  };
+
+  // 清空已读取的列，准备读取另一个行组
+  void Reset(size_t index, size_t row_count);
+
+  size_t index_ = std::numeric_limits<size_t>::max();
+  size_t row_count_ = 0;
+  uint32_t columns_ = 0;
+
+  std::vector<int64_t> times_;
+  std::vector<uint8_t> levels_;
+  std::vector<uint8_t> flags_;
+  std::vector<uint64_t> pids_;
+  std::vector<uint64_t> tids_;
+  Dictionary dictionaries_[3];  // 标签、文件、函数
+  std::vector<uint64_t> lines_;
+  std::vector<uint32_t> message_ends_;
+  std::vector<char> messages_;
+};
+
+// 扫描条件，时间为UTC毫秒，包含两端
+struct ColumnarScanFilter {
+  int64_t min_time = std::numeric_limits<int64_t>::min();
+  int64_t max_time = std::numeric_limits<int64_t>::max();
+  std::string tag;  // 为空时不按标签过滤
+};
+
+// ColumnarReader按行组随机读取.xcol文件
+class ColumnarReader {
+ public:
+  // 打开文件并读取尾部的行组元数据，格式错误时返回false
+  bool Open(const std::string& file_path);
+
+  const std::vector<ColumnarRowGroupInfo>& row_groups() const {
+    return row_groups_;
+  }
+
+  uint64_t row_count() const { return row_count_; }
+
+  // 读取第index个行组中columns指定的列；group中已有同一行组的列时
+  // 只读取缺少的列，可以先读取少量列判断，再补读其余列
+  bool ReadRowGroup(size_t index, uint32_t columns, ColumnarRowGroup* group);
+
+  // 依次访问满足条件的行，visit返回false时停止
+  // 时间范围与元数据不相交、或标签字典中没有filter.tag的行组整体跳过，
+  // 只读取时间和标签列就能确定没有匹配行的行组也不会读取和解压消息
+  bool Scan(const ColumnarScanFilter& filter,
+            const std::function<bool(const ColumnarRecord&)>& visit);
+
+  // 最近一次Scan中没有读取消息列的行组数
+  size_t groups_skipped() const { return groups_skipped_; }
+
+ private:
+  // 读取并解码一列
+  bool ReadColumn(const ColumnarRowGroupInfo& info,
+                  ColumnarColumn column,
+                  ColumnarRowGroup* group);
+
+  RandomAccessFile file_;
+  std::vector<ColumnarRowGroupInfo> row_groups_;
+  uint64_t row_count_ = 0;
+  size_t groups_skipped_ = 0;
+  std::vector<uint8_t> buffer_;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_COLUMNAR_LOG_H_
@@ -0,0 +1,21 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// console_output.h - 多线程共用的标准输出和标准错误
+
+#ifndef XLOG_DECODE_CONSOLE_OUTPUT_H_
+#define XLOG_DECODE_CONSOLE_OUTPUT_H_
+
+#include <ostream>
+#include <string>
+
+namespace xlog_decode {
+
+// 将一行完整信息写入输出流
+// 批量解码时多个线程同时报告结果和错误，所有写出共用一把锁，每行整体写出，
+// 行与行之间不会交错。库中的诊断信息和命令行的结果行都应通过这里写出
+void PrintLine(std::ostream& stream, const std::string& line);
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_CONSOLE_OUTPUT_H_
@@ -0,0 +1,80 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// decode_manifest.h - 目录增量解码的清单
+
+#ifndef XLOG_DECODE_DECODE_MANIFEST_H_
+#define XLOG_DECODE_DECODE_MANIFEST_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "xlog_decoder.h"
+
+namespace xlog_decode {
+
+// 清单中一个输入文件的记录
+struct DecodeManifestEntry {
+  uint64_t size = 0;           // 输入文件大小
+  int64_t modified_time = 0;   // 输入文件修改时间（纳秒）
+  uint32_t content_crc = 0;    // 输入文件全部内容的CRC32
+  uint64_t output_size = 0;    // 解码输出文件的大小
+  XlogResumePoint resume;      // 最后一个完整块之后的解码进度
+};
+
+// 输入文件相对上次解码的变化
+enum class ManifestChange {
+  kUnchanged,  // 内容没有变化
+  kAppended,   // 只在末尾追加了数据，可以从上次的进度继续解码
+  kChanged,    // 新文件或内容被改写，需要完整解码
+};
+
+// DecodeManifest记录目录中每个输入文件上次解码时的状态，重复解码同一目录时
+// 跳过没有变化的文件，追加了数据的文件只解码新增的块
+// 清单为文本文件，每行一个文件，路径相对于解码的根目录；解码选项不同时
+// 整个清单作废
+class DecodeManifest {
+ public:
+  // options描述影响解码输出的选项，选项不同的清单不能互相使用
+  explicit DecodeManifest(const std::string& options) : options_(options) {}
+
+  // 根目录对应的清单文件路径
+  static std::string ManifestPathFor(const std::string& root_dir);
+
+  // 只根据文件大小和修改时间判断记录是否仍然有效，不读取文件内容
+  // 输出文件被删除或改动过时同样视为失效
+  static bool IsUpToDate(const std::string& input_file,
+                         const std::string& output_file,
+                         const DecodeManifestEntry& entry);
+
+  // 读取输入文件内容，与上次的记录比较（previous为nullptr表示没有记录），
+  // 并把当前的大小、修改时间和CRC32写入current
+  static ManifestChange Compare(const std::string& input_file,
+                                const DecodeManifestEntry* previous,
+                                DecodeManifestEntry* current);
+
+  // 读取清单；文件不存在、格式错误或记录时的选项不同时返回false，
+  // 此时清单为空
+  bool Load(const std::string& manifest_file);
+
+  // 写出清单（先写临时文件再改名，中断时不会留下损坏的清单）
+  bool Save(const std::string& manifest_file) const;
+
+  // 查找相对路径对应的记录，不存在时返回nullptr
+  const DecodeManifestEntry* Find(const std::string& relative_path) const;
+
+  // 设置或删除相对路径对应的记录
+  void Set(const std::string& relative_path, const DecodeManifestEntry& entry);
+  void Remove(const std::string& relative_path);
+
+  size_t size() const { return entries_.size(); }
+
+ private:
+  std::string options_;
+  std::unordered_map<std::string, DecodeManifestEntry> entries_;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_DECODE_MANIFEST_H_
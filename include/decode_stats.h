@@ -0,0 +1,89 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// decode_stats.h - 解码各阶段的耗时和计数
+
+#ifndef XLOG_DECODE_DECODE_STATS_H_
+#define XLOG_DECODE_DECODE_STATS_H_
+
+#include <cstdint>
+#include <string>
+
+#include "alloc_tracker.h"
+#include "xlog_constants.h"
+
+namespace xlog_decode {
+
+// 单调时钟的当前时间（纳秒），只用于计算耗时
+int64_t MonotonicNanos();
+
+// 加上引号并转义引号、反斜杠和控制字符的JSON字符串
+std::string JsonQuote(const std::string& text);
+
+// 一次解码各阶段的耗时（纳秒）和计数，批量解码时用Add累加
+// 各阶段互不重叠：open为打开、映射或解压（ZIP条目）输入；frame为分帧和块
+// 校验，映射的页面在这里第一次被访问，读盘的耗时主要计入这里；resync为
+// 损坏数据之后的重新同步扫描；zlib、zstd和decrypt为各自的解压和解密；
+// write为写入输出，包括过滤和格式转换。total与各阶段之和的差为其余开销；
+// 并行解压时zlib、zstd和decrypt为各线程耗时之和，ZIP条目并行解码时
+// 各阶段都是各线程耗时之和
+struct DecodeStats {
+  // 按魔数计数的块，下标为魔数减去MAGIC_NO_COMPRESS_START
+  static constexpr int kMagicCount =
+      MAGIC_ASYNC_NO_CRYPT_ZSTD_START - MAGIC_NO_COMPRESS_START + 1;
+
+  uint64_t files = 0;                // 统计的文件数
+  uint64_t bytes_read = 0;           // 输入字节数
+  uint64_t bytes_written = 0;        // 写入输出的字节数（过滤和转换之前）
+  uint64_t blocks[kMagicCount] = {};
+  uint64_t hour_skipped_blocks = 0;  // 因小时过滤跳过的块
+  uint64_t resync_count = 0;         // 重新同步的次数
+  uint64_t resync_bytes = 0;         // 重新同步跳过的字节数，含开头的垃圾数据
+  uint64_t seq_gaps = 0;             // 序列号不连续的次数
+  uint64_t seq_missing = 0;          // 缺失的序列号个数
+  uint64_t decompress_errors = 0;    // 解压失败的块
+
+  int64_t total_ns = 0;
+  int64_t open_ns = 0;
+  int64_t frame_ns = 0;
+  int64_t resync_ns = 0;
+  int64_t zlib_ns = 0;
+  int64_t zstd_ns = 0;
+  int64_t decrypt_ns = 0;
+  int64_t write_ns = 0;
+
+  // 编译时开启分配统计时各阶段的分配次数、字节数和存活字节数的峰值，
+  // 下标为AllocStage；alloc_peak为各阶段存活字节数之和的峰值，包括解码器
+  // 从上次解码保留下来的缓冲。Add累加次数和字节数，峰值取最大值，合计中
+  // 即为单个文件的最大峰值
+  uint64_t alloc_count[kAllocStageCount] = {};
+  uint64_t alloc_bytes[kAllocStageCount] = {};
+  int64_t alloc_stage_peak[kAllocStageCount] = {};
+  int64_t alloc_peak = 0;
+
+  // 记录一个魔数为magic的块，魔数无效时忽略
+  void CountBlock(uint8_t magic);
+
+  // 全部魔数的块数之和
+  uint64_t block_count() const;
+
+  // 记录account中的分配计数，覆盖之前的分配统计
+  void SetAllocations(const AllocAccount& account);
+
+  // 是否有分配统计；未开启分配统计的编译中总是false
+  bool has_allocations() const;
+
+  // 累加另一次解码的统计
+  void Add(const DecodeStats& other);
+
+  // 单行文本摘要，耗时以毫秒为单位
+  std::string ToText() const;
+
+  // 单行JSON对象，file不为空时作为"file"字段写在最前面；耗时字段以_ms
+  // 结尾，blocks只列出出现过的魔数，有分配统计时才有allocations字段
+  std::string ToJson(const std::string& file = std::string()) const;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_DECODE_STATS_H_
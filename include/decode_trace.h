@@ -0,0 +1,110 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// decode_trace.h - 记录解码各阶段的时间区间，导出为Chrome trace-event格式
+
+#ifndef XLOG_DECODE_DECODE_TRACE_H_
+#define XLOG_DECODE_DECODE_TRACE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xlog_decode {
+
+// 一个已结束的时间区间
+struct TraceEvent {
+  const char* name = nullptr;  // 区间名称，必须是静态字符串
+  int64_t start_ns = 0;
+  int64_t duration_ns = 0;
+  std::string file;   // 文件或ZIP条目，为空时不输出
+  int magic = -1;     // 块的魔数，小于0时不输出
+  int64_t size = -1;  // 块主体或写入的字节数，小于0时不输出
+};
+
+// 进程内唯一的区间记录器
+// 每个线程第一次记录时登记一个只由自己追加的缓冲，之后的记录不加锁，
+// 工作线程之间互不等待。Start和WriteJson不能与记录并发：Start在解码开始前
+// 调用，WriteJson在所有线程的解码都结束（线程池Wait返回）之后调用
+class TraceRecorder {
+ public:
+  static TraceRecorder& Instance();
+
+  // 丢弃之前记录的区间并开始记录，调用线程在输出中名为main
+  void Start();
+
+  // 停止记录，已记录的区间保留到下次Start
+  void Stop();
+
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  // 把区间追加到调用线程的缓冲
+  void Record(TraceEvent&& event);
+
+  // 已记录的区间数
+  size_t event_count() const;
+
+  // 写出Chrome trace-event格式的JSON，可直接在Perfetto或chrome://tracing
+  // 中打开；每个记录过的线程一条时间线
+  bool WriteJson(const std::string& file_path) const;
+
+ private:
+  TraceRecorder() = default;
+
+  // 一个线程的区间缓冲，tid从1开始按登记顺序分配
+  struct ThreadBuffer {
+    int tid = 0;
+    std::string name;
+    std::vector<TraceEvent> events;
+  };
+
+  // 调用线程的缓冲，本轮记录中第一次调用时登记
+  ThreadBuffer* LocalBuffer();
+
+  std::atomic<bool> enabled_{false};
+  std::atomic<uint64_t> generation_{0};  // 每次Start加一，使旧的缓冲失效
+  int64_t origin_ns_ = 0;                // Start的时间，输出的时间戳以此为零点
+  std::thread::id main_thread_;
+
+  // 以下成员由mutex_保护
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+};
+
+// 作用域内的一个区间，析构时记录；未开启记录时不读取时钟
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name);
+  TraceSpan(const char* name, const std::string& file);
+  ~TraceSpan();
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  // 结束前修改名称，如分帧中遇到损坏改为resync
+  void set_name(const char* name) { event_.name = name; }
+
+  // 记录块的魔数和主体大小
+  void set_block(uint8_t magic, size_t size) {
+    event_.magic = magic;
+    event_.size = static_cast<int64_t>(size);
+  }
+
+  void set_size(size_t size) { event_.size = static_cast<int64_t>(size); }
+
+  // 提前结束并记录区间，析构时不再记录
+  void End();
+
+ private:
+  bool active_;
+  TraceEvent event_;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_DECODE_TRACE_H_
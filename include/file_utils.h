@@ -6,7 +6,9 @@
 #ifndef XLOG_DECODE_FILE_UTILS_H_
 #define XLOG_DECODE_FILE_UTILS_H_
 
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <string>
 #include <vector>
 
@@ -21,6 +23,9 @@ class FileUtils {
   // 检查路径是否为目录
   static bool IsDirectory(const std::string& path);
 
+  // 检查路径是否为普通文件，管道、FIFO和字符设备等返回false
+  static bool IsRegularFile(const std::string& path);
+
   // 检查文件是否有特定扩展名
   static bool HasExtension(const std::string& file_path,
                            const std::string& extension);
@@ -37,7 +42,7 @@ class FileUtils {
   // 连接路径组件
   static std::string JoinPath(const std::string& dir, const std::string& file);
 
-  // 将文件读入字节向量
+  // 将文件读入字节向量；管道等无法预先获取大小的输入顺序读取到EOF
   static bool ReadFile(const std::string& file_path,
                        std::vector<uint8_t>& buffer);
 
@@ -48,16 +53,43 @@ class FileUtils {
   // 获取文件大小（字节）
   static uint64_t GetFileSize(const std::string& file_path);
 
+  // 获取文件的修改时间（自1970年起的纳秒数，平台不支持时精确到秒），失败返回0
+  static int64_t GetModifiedTime(const std::string& file_path);
+
+  // 获取文件标识（POSIX平台为设备号和inode号的组合），用于判断路径是否
+  // 已指向另一个文件；失败或平台不支持时返回0
+  static uint64_t GetFileId(const std::string& file_path);
+
+  // 一次stat同时获取文件大小和修改时间（纳秒），文件不存在或不是普通文件时
+  // 返回false
+  static bool GetFileStatus(const std::string& file_path,
+                            uint64_t* size,
+                            int64_t* modified_time);
+
+  // 把文件截断到size字节
+  static bool TruncateFile(const std::string& file_path, uint64_t size);
+
   // 扫描目录中具有特定扩展名的文件（可递归）
   static std::vector<std::string> ScanDirectory(
       const std::string& dir_path,
       const std::vector<std::string>& extensions,
       bool recurse = false);
 
-  // 在目录中查找所有已解码文件（带_.log扩展名）
+  // 在目录中查找所有已解码文件（以_.log或列式存储的_.xcol结尾）
+  // ZIP逐条目解码的输出目录（<file>.zip_）属于目录中的ZIP文件，不递归时
+  // 也会进入查找
   static std::vector<std::string> FindDecodedFiles(const std::string& dir_path,
                                                    bool recurse = false);
 
+  // 在目录中查找ZIP逐条目解码的输出目录（以.zip_结尾）
+  static std::vector<std::string> FindZipOutputDirectories(
+      const std::string& dir_path,
+      bool recurse = false);
+
+  // 自底向上删除目录树中的空目录，还有文件的目录保留；返回dir_path本身
+  // 是否已被删除
+  static bool RemoveEmptyDirectories(const std::string& dir_path);
+
   // 删除文件
   static bool DeleteFile(const std::string& file_path);
 
@@ -71,6 +103,70 @@ class FileUtils {
       const std::string& directory_path);
 };
 
+// MappedFile以只读方式将整个文件映射到内存，避免ReadFile的整文件拷贝
+// 对空文件、超过kMaxMappedSize的文件或不支持mmap的文件系统，Open返回false，
+// 调用方应回退到RandomAccessFile按窗口读取；管道等非普通文件两者都不支持，
+// 只能用FileUtils::ReadFile顺序读取
+class MappedFile {
+ public:
+  // 可映射的最大文件大小；32位平台地址空间有限，大文件改为窗口读取
+  static constexpr uint64_t kMaxMappedSize =
+      sizeof(void*) >= 8 ? UINT64_MAX : (uint64_t{1} << 30);
+
+  MappedFile() = default;
+  ~MappedFile();
+
+  // 禁用拷贝和赋值
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // 映射文件并设置顺序访问提示
+  bool Open(const std::string& file_path);
+
+  // 解除映射
+  void Close();
+
+  bool IsOpen() const { return data_ != nullptr; }
+  const uint8_t* Data() const { return data_; }
+  size_t Size() const { return size_; }
+
+ private:
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// RandomAccessFile按64位偏移随机读取文件，不改变共享的文件位置
+// POSIX平台使用pread，其他平台使用64位定位后读取
+class RandomAccessFile {
+ public:
+  RandomAccessFile() = default;
+  ~RandomAccessFile();
+
+  // 禁用拷贝和赋值
+  RandomAccessFile(const RandomAccessFile&) = delete;
+  RandomAccessFile& operator=(const RandomAccessFile&) = delete;
+
+  // 以只读方式打开文件并获取文件大小，不是普通文件时返回false
+  bool Open(const std::string& file_path);
+
+  // 关闭文件
+  void Close();
+
+  bool IsOpen() const;
+  uint64_t Size() const { return size_; }
+
+  // 从offset开始读取最多len字节，返回实际读取的字节数（文件末尾或出错时较少）
+  size_t ReadAt(uint64_t offset, void* dest, size_t len);
+
+ private:
+#if defined(_WIN32)
+  std::FILE* file_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+  uint64_t size_ = 0;
+};
+
 }  // namespace xlog_decode
 
 #endif  // XLOG_DECODE_FILE_UTILS_H_
\ No newline at end of file
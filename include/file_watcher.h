@@ -0,0 +1,42 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// file_watcher.h - 等待文件内容变化
+
+#ifndef XLOG_DECODE_FILE_WATCHER_H_
+#define XLOG_DECODE_FILE_WATCHER_H_
+
+#include <string>
+
+namespace xlog_decode {
+
+// FileWatcher等待文件被追加、改写、删除或替换
+// Linux平台通过inotify监视文件所在目录，文件被替换（轮转）后仍能收到事件；
+// 其他平台或inotify不可用时退化为定时轮询
+// 通过mmap写入的修改不产生inotify事件，调用方应在超时后自行检查文件
+class FileWatcher {
+ public:
+  // 轮询间隔，也是调用方在没有事件时检查文件的间隔
+  static constexpr int kPollIntervalMs = 50;
+
+  explicit FileWatcher(const std::string& file_path);
+  ~FileWatcher();
+
+  // 禁用拷贝和赋值
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  // 等待文件变化，最多timeout_ms毫秒；收到该文件的事件时返回true
+  bool Wait(int timeout_ms);
+
+  // 是否使用inotify
+  bool UsesInotify() const { return inotify_fd_ >= 0; }
+
+ private:
+  std::string file_name_;
+  int inotify_fd_ = -1;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_FILE_WATCHER_H_
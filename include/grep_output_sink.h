@@ -0,0 +1,98 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// grep_output_sink.h - 解码时按行过滤输出
+
+#ifndef XLOG_DECODE_GREP_OUTPUT_SINK_H_
+#define XLOG_DECODE_GREP_OUTPUT_SINK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <regex>
+#include <string>
+
+#include "literal_search.h"
+#include "output_sink.h"
+
+namespace xlog_decode {
+
+// 按行过滤的选项
+struct GrepOptions {
+  std::string pattern;
+  bool regex = false;             // pattern为ECMAScript正则表达式
+  size_t context_lines = 0;       // 每个匹配行前后输出的上下文行数
+  uint64_t max_count = 0;         // 匹配行数达到后停止，0表示不限
+  bool keep_diagnostics = false;  // 输出全部[F]xlog_decode诊断行
+};
+
+// GrepOutputSink在每个块解码后的内存数据上逐行匹配，只把匹配行（及其
+// 上下文）写入下游，跨块的行会先拼接完整再匹配
+// 先用LiteralSearcher跳到可能匹配的位置，只对所在行做完整匹配；正则表达式
+// 从中提取必须出现的字面子串作为预过滤，提取不到时逐行匹配
+// 诊断行默认不输出，keep_diagnostics时全部输出且不计入匹配数
+class GrepOutputSink : public OutputSink {
+ public:
+  GrepOutputSink(OutputSink& downstream, const GrepOptions& options);
+
+  // 检查选项是否有效（正则表达式能否编译），无效时写入原因
+  static bool Validate(const GrepOptions& options, std::string* error);
+
+  bool Write(const uint8_t* data, size_t size) override;
+
+  // 把已输出的行交给下游；未结束的行保留到下一次写入
+  bool Flush() override;
+
+  // 处理最后一行（没有换行符时同样匹配）并关闭下游
+  bool Close() override;
+
+  // 达到max_count且后续上下文已输出后返回false，解码器可以提前结束
+  bool WantsMore() const override { return !finished_; }
+
+  // 已输出的匹配行数
+  uint64_t match_count() const { return match_count_; }
+
+ private:
+  // 处理[begin, end)中的完整行，最后一行可以没有换行符
+  bool ProcessLines(const uint8_t* begin, const uint8_t* end);
+
+  // 行（不含换行符）是否匹配
+  bool IsMatch(const uint8_t* line, const uint8_t* line_end) const;
+
+  // 行是否为解码器输出的诊断信息
+  static bool IsDiagnostic(const uint8_t* line, const uint8_t* line_end);
+
+  // 输出匹配行及其前面的上下文
+  bool EmitMatch(const uint8_t* line, const uint8_t* line_end);
+
+  // 把跳过的[begin, end)中最后几行记为之后匹配行的上文
+  void RememberSkipped(const uint8_t* begin, const uint8_t* end);
+
+  bool EmitLine(const uint8_t* line, const uint8_t* line_end);
+
+  OutputSink& downstream_;
+  GrepOptions options_;
+
+  // 字面模式下为pattern本身，正则模式下为提取出的必需子串（可以为空）
+  LiteralSearcher prefilter_;
+  LiteralSearcher diagnostic_searcher_;
+  std::unique_ptr<std::regex> regex_;
+
+  // 上一次写入末尾未结束的行
+  std::string partial_;
+
+  // 尚未输出的最近几行及上一次输出之后跳过的行数（超过上下文行数后不再计数）
+  std::deque<std::string> before_lines_;
+  size_t skipped_since_output_ = 0;
+  bool has_output_ = false;
+
+  // 还需要输出的下文行数
+  size_t after_left_ = 0;
+  uint64_t match_count_ = 0;
+  bool finished_ = false;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_GREP_OUTPUT_SINK_H_
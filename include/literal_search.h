@@ -0,0 +1,34 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// literal_search.h - 向量化的子串查找
+
+#ifndef XLOG_DECODE_LITERAL_SEARCH_H_
+#define XLOG_DECODE_LITERAL_SEARCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace xlog_decode {
+
+// LiteralSearcher在解码后的文本中查找固定子串
+// 先用向量比较同时筛选首尾两个字节都相同的位置，再逐个比较中间部分；
+// 与MagicScanner使用相同的实现（AVX2、SSE2或标量），ForceImplementation同样生效
+class LiteralSearcher {
+ public:
+  explicit LiteralSearcher(const std::string& needle);
+
+  // 返回needle在[data, data + size)中第一次出现的位置，没有找到时返回size
+  // needle为空时返回0
+  size_t Find(const uint8_t* data, size_t size) const;
+
+  const std::string& needle() const { return needle_; }
+
+ private:
+  std::string needle_;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_LITERAL_SEARCH_H_
@@ -0,0 +1,53 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// magic_scanner.h - 向量化的块起始魔数扫描
+
+#ifndef XLOG_DECODE_MAGIC_SCANNER_H_
+#define XLOG_DECODE_MAGIC_SCANNER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace xlog_decode {
+
+// MagicScanner批量查找值在魔数集合{0x03..0x0D}中的字节
+// 运行时根据CPU选择AVX2、SSE2或标量实现
+class MagicScanner {
+ public:
+  // 扫描实现类型
+  enum class Implementation { kScalar, kSse2, kAvx2 };
+
+  // 返回第一个魔数字节的位置，没有找到时返回size
+  static size_t FindFirst(const uint8_t* data, size_t size);
+
+  // 从data开始收集最多max_positions个魔数字节的位置（相对data）
+  // scanned返回已扫描的字节数，下次从data + scanned继续
+  static size_t Collect(const uint8_t* data,
+                        size_t size,
+                        size_t* positions,
+                        size_t max_positions,
+                        size_t* scanned);
+
+  // 预检查候选块的尾部：头部长度字段和尾部位置都在[data, data + size)内时，
+  // 丢弃尾部不是MAGIC_END的候选；无法在范围内判断的候选保留给调用方校验
+  // positions原地压缩，返回保留的数量
+  static size_t FilterByTrailer(const uint8_t* data,
+                                size_t size,
+                                size_t* positions,
+                                size_t count);
+
+  // 当前使用的实现
+  static Implementation ActiveImplementation();
+
+  // 强制使用指定实现（用于测试和性能对比），CPU不支持时返回false
+  // 应在开始解码前调用
+  static bool ForceImplementation(Implementation implementation);
+
+  // 实现名称，用于性能测试输出
+  static const char* ImplementationName(Implementation implementation);
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_MAGIC_SCANNER_H_
@@ -0,0 +1,40 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// mars_log_line.h - 解析Mars日志行
+
+#ifndef XLOG_DECODE_MARS_LOG_LINE_H_
+#define XLOG_DECODE_MARS_LOG_LINE_H_
+
+#include <cstdint>
+#include <string_view>
+
+namespace xlog_decode {
+
+// 一行Mars日志的各个字段，均指向原始行内，不复制数据
+// 例如 [I][2024-03-01 +8.0 10:11:12.345][1234, 5678*][tag][file, func, 12][msg
+struct MarsLogRecord {
+  std::string_view level;      // 日志级别，如I、W、E
+  std::string_view timestamp;  // 日期、时区和时间，原样保留
+  std::string_view pid;
+  std::string_view tid;
+  bool main_thread = false;  // tid后带*表示主线程
+  std::string_view tag;
+  std::string_view file;
+  std::string_view function;
+  std::string_view line;     // 源码行号，没有时为空
+  std::string_view message;  // 最后一个[之后到行尾，不含换行符
+};
+
+// 解析一行日志（可以带行尾的\n或\r\n）
+// 源码位置同时支持"file, func, line"和Mars默认的"file:line, func"两种写法
+// 不符合格式时返回false，此时只有message有效，为去掉换行符后的整行
+bool ParseMarsLogLine(std::string_view line, MarsLogRecord* record);
+
+// 把"2024-03-01 +8.0 10:11:12.345"形式的时间转换为UTC毫秒时间戳
+// 时区为相对UTC的小时数，可以带一位小数；毫秒部分可以省略
+bool ParseMarsTimestamp(std::string_view timestamp, int64_t* epoch_ms);
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_MARS_LOG_LINE_H_
@@ -0,0 +1,128 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// output_sink.h - 解码输出的写入目标
+
+#ifndef XLOG_DECODE_OUTPUT_SINK_H_
+#define XLOG_DECODE_OUTPUT_SINK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace xlog_decode {
+
+// OutputSink接收解码器逐块产生的输出数据
+class OutputSink {
+ public:
+  virtual ~OutputSink() = default;
+
+  // 写入一段解码后的数据
+  virtual bool Write(const uint8_t* data, size_t size) = 0;
+
+  // 把已缓冲的数据交给下游
+  virtual bool Flush() { return true; }
+
+  // 结束输出并刷新缓冲
+  virtual bool Close() { return Flush(); }
+
+  // 返回false表示不再需要后续数据（如过滤已达到行数上限），解码器可以
+  // 提前结束
+  virtual bool WantsMore() const { return true; }
+};
+
+// BufferedOutputSink把小块输出累积在缓冲区中，累积量达到刷新阈值时
+// 与本次数据一起写出；大块数据不经过缓冲区
+class BufferedOutputSink : public OutputSink {
+ public:
+  // 默认刷新阈值，兼顾系统调用次数与下游看到输出的延迟
+  static constexpr size_t kDefaultFlushThreshold = 64 * 1024;
+
+  explicit BufferedOutputSink(size_t flush_threshold);
+
+  bool Write(const uint8_t* data, size_t size) override;
+  bool Flush() override;
+
+  // 设置刷新阈值，0表示每次写入都直接写出
+  void set_flush_threshold(size_t flush_threshold) {
+    flush_threshold_ = flush_threshold;
+  }
+
+  // 已接收的字节数（含尚未写出的缓冲）
+  uint64_t bytes_written() const { return bytes_written_; }
+
+ protected:
+  // 依次写出两段数据，second可以为空
+  virtual bool WriteOut(const uint8_t* first,
+                        size_t first_size,
+                        const uint8_t* second,
+                        size_t second_size) = 0;
+
+ private:
+  std::vector<uint8_t> buffer_;
+  size_t flush_threshold_;
+  uint64_t bytes_written_ = 0;
+};
+
+// FileOutputSink将输出写入文件，第一次写出时才创建文件
+// POSIX平台上缓冲数据与新数据合并为一次writev
+class FileOutputSink : public BufferedOutputSink {
+ public:
+  explicit FileOutputSink(const std::string& file_path,
+                          size_t flush_threshold = kDefaultFlushThreshold);
+  ~FileOutputSink() override;
+
+  bool Close() override;
+
+  // 追加到已有文件末尾，而不是重新创建文件
+  void set_append(bool append) { append_ = append; }
+
+ protected:
+  // 写入已打开且不归本对象所有的流
+  FileOutputSink(std::FILE* stream,
+                 const std::string& name,
+                 size_t flush_threshold);
+
+  bool WriteOut(const uint8_t* first,
+                size_t first_size,
+                const uint8_t* second,
+                size_t second_size) override;
+
+ private:
+  std::string file_path_;
+  std::FILE* file_ = nullptr;
+  bool owns_file_ = true;
+  bool append_ = false;
+};
+
+// StdoutOutputSink将输出写入标准输出
+class StdoutOutputSink : public FileOutputSink {
+ public:
+  explicit StdoutOutputSink(size_t flush_threshold = kDefaultFlushThreshold);
+  ~StdoutOutputSink() override;
+};
+
+// BufferOutputSink将输出追加到调用方提供的内存缓冲区
+class BufferOutputSink : public OutputSink {
+ public:
+  explicit BufferOutputSink(std::vector<uint8_t>& buffer) : buffer_(buffer) {}
+
+  bool Write(const uint8_t* data, size_t size) override;
+
+ private:
+  std::vector<uint8_t>& buffer_;
+};
+
+// NullOutputSink丢弃所有输出，用于只需要解码副产物（如块索引）的场合
+class NullOutputSink : public OutputSink {
+ public:
+  bool Write(const uint8_t* /*data*/, size_t /*size*/) override {
+    return true;
+  }
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_OUTPUT_SINK_H_
@@ -0,0 +1,78 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// structured_output_sink.h - 把解码后的日志行转换为结构化格式
+
+#ifndef XLOG_DECODE_STRUCTURED_OUTPUT_SINK_H_
+#define XLOG_DECODE_STRUCTURED_OUTPUT_SINK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mars_log_line.h"
+#include "output_sink.h"
+
+namespace xlog_decode {
+
+// 解码输出的格式
+enum class OutputFormat {
+  kText,      // 原始日志文本
+  kJson,      // 每行一个JSON对象（JSON Lines）
+  kCsv,       // RFC 4180 CSV，第一行为列名
+  kTsv,       // 制表符分隔，\t、\n、\r和\\转义，第一行为列名
+  kColumnar,  // 二进制列式存储，见columnar_log.h
+};
+
+// 解析--format的取值（text、json、csv、tsv、columnar）
+bool ParseOutputFormat(const std::string& name, OutputFormat* format);
+
+// StructuredOutputSink把每行日志拆分为字段后按指定格式写入下游
+// 块内完整的行直接在解码缓冲上解析，只有跨块的行需要先拼接；
+// 每次写入的所有记录格式化到同一个缓冲区后一次写出
+// 无法解析的行（多行消息的后续行、诊断信息等）整行作为message，其他字段为空
+class StructuredOutputSink : public OutputSink {
+ public:
+  StructuredOutputSink(OutputSink& downstream, OutputFormat format);
+
+  bool Write(const uint8_t* data, size_t size) override;
+
+  // 把已转换的记录交给下游；未结束的行保留到下一次写入
+  bool Flush() override;
+
+  // 转换最后一行（没有换行符时同样输出）并关闭下游
+  bool Close() override;
+
+  bool WantsMore() const override { return downstream_.WantsMore(); }
+
+  // 已输出的记录数，不含列名行
+  uint64_t record_count() const { return record_count_; }
+
+ private:
+  // 转换[begin, end)中的完整行，最后一行可以没有换行符
+  void ConvertLines(const char* begin, const char* end);
+
+  // 保证output_在已用部分之后至少还有size字节
+  void Reserve(size_t size);
+
+  // 把已转换的记录写入下游
+  bool WriteOutput();
+
+  OutputSink& downstream_;
+  OutputFormat format_;
+  bool header_written_ = false;
+
+  // 上一次写入末尾未结束的行
+  std::string partial_;
+
+  // 转换结果，output_的大小只增不减，已用部分为前output_size_字节
+  std::vector<char> output_;
+  size_t output_size_ = 0;
+  uint64_t record_count_ = 0;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_STRUCTURED_OUTPUT_SINK_H_
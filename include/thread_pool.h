@@ -0,0 +1,81 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// thread_pool.h - 支持任务窃取的固定大小工作线程池
+
+#ifndef XLOG_DECODE_THREAD_POOL_H_
+#define XLOG_DECODE_THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace xlog_decode {
+
+// ThreadPool在固定数量的线程上执行提交的任务
+// 每个线程有自己的任务队列，提交时轮流分配；自己的队列为空时从其他线程的
+// 队列中窃取任务。出队和窃取都从队头开始，因此按优先级顺序提交的任务
+// （例如按文件大小降序）整体上仍按该顺序开始执行
+// 有任务可做时只使用原子计数和各队列自己的锁；只有线程空闲等待时才经过
+// 全局的mutex_
+// 任务不应抛出异常
+class ThreadPool {
+ public:
+  // thread_count为0时使用硬件线程数
+  explicit ThreadPool(size_t thread_count);
+  ~ThreadPool();
+
+  // 禁用拷贝和赋值
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // 提交一个任务
+  void Submit(std::function<void()> task);
+
+  // 等待所有已提交的任务执行完毕
+  void Wait();
+
+  // 工作线程数量
+  size_t thread_count() const { return workers_.size(); }
+
+  // 解析线程数参数：0表示硬件线程数，结果至少为1
+  static size_t ResolveThreadCount(size_t thread_count);
+
+ private:
+  // 单个工作线程的任务队列
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  // 工作线程主循环
+  void WorkerLoop(size_t worker_index);
+
+  // 先从自己的队列取任务，为空时依次窃取其他队列的任务
+  bool TakeTask(size_t worker_index, std::function<void()>* task);
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
+  std::vector<std::thread> workers_;
+
+  // 提交和认领任务只修改以下计数，不获取mutex_
+  std::atomic<size_t> queued_{0};      // 已计入但尚未被取走的任务数
+  std::atomic<size_t> pending_{0};     // 尚未执行完的任务数
+  std::atomic<size_t> next_queue_{0};  // 下一个任务分配到的队列
+  std::atomic<size_t> idle_{0};        // 正在等待任务的线程数
+
+  // 以下成员只在线程空闲等待、全部完成和停止时使用，由mutex_保护
+  std::mutex mutex_;
+  std::condition_variable task_available_;
+  std::condition_variable all_done_;
+  bool stopping_ = false;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_THREAD_POOL_H_
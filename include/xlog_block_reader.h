@@ -0,0 +1,164 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// xlog_block_reader.h - 按块读取XLOG数据的读取器
+
+#ifndef XLOG_DECODE_XLOG_BLOCK_READER_H_
+#define XLOG_DECODE_XLOG_BLOCK_READER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "file_utils.h"
+#include "xlog_constants.h"
+#include "xlog_index.h"
+
+namespace xlog_decode {
+
+// 一个已通过校验的XLOG数据块，body指向读取器内部窗口，
+// 在下一次调用Next/Seek之前有效
+struct XlogBlock {
+  uint64_t offset = 0;      // 块在文件中的偏移
+  uint8_t magic = 0;        // 块魔数
+  uint16_t seq = 0;         // 序列号
+  uint8_t begin_hour = 0;   // 开始小时
+  uint8_t end_hour = 0;     // 结束小时
+  uint32_t header_len = 0;  // 头部长度
+  uint32_t length = 0;      // 主体长度
+  const uint8_t* body = nullptr;
+
+  // 若读取此块前跳过了损坏数据，记录跳过的字节数和校验失败原因
+  bool resynced = false;
+  uint64_t skipped = 0;
+  std::string error;
+};
+
+// Next的返回状态
+enum class BlockReadStatus {
+  kBlock,  // 读到一个有效块
+  kEnd,    // 到达数据末尾（可能先跳过了无法恢复的尾部数据）
+  kError   // 数据无效且不允许跳过错误块
+};
+
+// XlogBlockReader从内存或文件中逐块拉取XLOG数据块
+// 文件模式通过pread只保留一个固定大小的滑动窗口，偏移全部为64位，
+// 内存占用与输入大小无关，可以解码任意大小的文件
+class XlogBlockReader {
+ public:
+  // 默认窗口大小
+  static constexpr size_t kDefaultWindowSize = 4 * 1024 * 1024;
+
+  XlogBlockReader();
+  ~XlogBlockReader();
+
+  // 禁用拷贝和赋值
+  XlogBlockReader(const XlogBlockReader&) = delete;
+  XlogBlockReader& operator=(const XlogBlockReader&) = delete;
+
+  // 直接读取调用方持有的内存数据（映射文件或已读入的缓冲区）
+  void Attach(const uint8_t* data, size_t size);
+
+  // 以固定大小窗口流式读取文件
+  bool Open(const std::string& file_path,
+            size_t window_size = kDefaultWindowSize);
+
+  // 数据总长度
+  uint64_t Size() const { return size_; }
+
+  // 是否直接读取调用方持有的内存，此时块主体指针在整个解码期间有效
+  bool IsMemoryBacked() const { return data_ != nullptr; }
+
+  // 当前读取位置
+  uint64_t Tell() const { return cursor_; }
+
+  // 设置读取位置
+  void Seek(uint64_t offset);
+
+  // 读取下一个数据块；skip_error_blocks为true时跳过损坏数据
+  BlockReadStatus Next(XlogBlock* block, bool skip_error_blocks);
+
+  // 按索引记录读取块：Next不再校验和扫描，直接返回记录中的块，记录之间的
+  // 空隙按跳过的损坏数据报告；最后一个块之后再报告tail_skipped字节的尾部
+  // entries由调用方持有，在读取期间必须有效
+  void UseIndex(const XlogIndexEntry* entries,
+                size_t count,
+                uint64_t tail_skipped);
+
+  // 是否按索引读取
+  bool IsIndexed() const { return index_entries_ != nullptr; }
+
+  // 索引中第一个块的偏移，索引为空时返回false
+  bool FirstIndexedOffset(uint64_t* offset) const;
+
+  // 读取少量字节而不移动窗口，用于校验远处的头部和尾部
+  bool ReadAt(uint64_t offset, void* dest, size_t len);
+
+  // offset处是否是尚未写完的数据：魔数有效但块还没有写完整，或者是全零的
+  // 预留空间（mmap3文件）；用于跟踪正在增长的文件时等待后续写入
+  bool IsPendingTail(uint64_t offset);
+
+  // 跳过[skipped_start, offset)后在offset处重新同步的结果，在文件末尾追加
+  // 数据后是否保持不变：被跳过的位置中没有主体超出数据末尾、之后可能变为
+  // 有效的块，且offset处的块链在数据末尾之前已满足重新同步的链长度
+  bool IsResyncFinal(uint64_t skipped_start, uint64_t offset);
+
+  // 检查offset处是否有count个首尾相接的有效块
+  // 链在数据末尾或全零的尾部填充处结束也视为有效；error非空时写入失败原因
+  bool IsValidLogBuffer(uint64_t offset, int32_t count, std::string* error);
+
+  // 从offset开始查找满足IsValidLogBuffer(count)的块起始位置，找不到返回false
+  // 每个字节只被扫描一次，每个候选位置只读取O(count)个头部
+  bool FindLogStartPosition(uint64_t offset,
+                            int32_t count,
+                            uint64_t* position);
+
+  // 重新同步时要求的连续有效块数量
+  void set_resync_chain_length(int32_t count) {
+    resync_chain_length_ = count < 1 ? 1 : count;
+  }
+
+ private:
+  // 确保[offset, offset + len)位于窗口内并返回其指针，超出数据末尾返回nullptr
+  const uint8_t* Fetch(uint64_t offset, size_t len);
+
+  // 返回offset处窗口内连续可用的数据，必要时从offset开始重新装载窗口
+  const uint8_t* FetchAvailable(uint64_t offset, size_t* available);
+
+  // 检查offset处候选块的长度字段是否在合理范围内
+  bool HasPlausibleLength(uint64_t offset);
+
+  // 检查从offset到数据末尾是否全为零
+  bool IsZeroTail(uint64_t offset);
+
+  // 将窗口移动到从start开始并至少包含min_len字节
+  bool FillWindow(uint64_t start, size_t min_len);
+
+  // 索引模式下的Next
+  BlockReadStatus NextIndexed(XlogBlock* block, bool skip_error_blocks);
+
+  // 内存模式数据
+  const uint8_t* data_ = nullptr;
+
+  // 文件模式数据
+  RandomAccessFile file_;
+  std::vector<uint8_t> window_;
+  uint64_t window_start_ = 0;
+  size_t window_len_ = 0;
+  size_t window_size_ = kDefaultWindowSize;
+
+  uint64_t size_ = 0;
+  uint64_t cursor_ = 0;
+  int32_t resync_chain_length_ = 1;
+
+  // 索引模式数据
+  const XlogIndexEntry* index_entries_ = nullptr;
+  size_t index_count_ = 0;
+  size_t next_entry_ = 0;
+  uint64_t index_tail_skipped_ = 0;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_XLOG_BLOCK_READER_H_
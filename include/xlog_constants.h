@@ -38,6 +38,13 @@ struct XlogHeader {
 };
 #pragma pack(pop)
 
+// 判断字节是否为XLOG块起始魔数
+// 魔数恰好覆盖连续区间[0x03, 0x0D]，用一次范围比较代替逐个比较
+inline bool IsMagicStart(uint8_t value) {
+  return value >= MAGIC_NO_COMPRESS_START &&
+         value <= MAGIC_ASYNC_NO_CRYPT_ZSTD_START;
+}
+
 // 根据魔数计算头部长度
 inline uint32_t GetHeaderLen(uint8_t magic) {
   if (magic == MAGIC_NO_COMPRESS_START || magic == MAGIC_COMPRESS_START ||
@@ -57,6 +64,15 @@ inline uint32_t GetTrailerLen() {
 inline const char* kXlogFileExt = ".xlog";
 inline const char* kMmapFileExt = ".mmap3";
 
+// 设备上传的日志压缩包，其中的XLOG条目直接在内存中解码
+inline const char* kZipFileExt = ".zip";
+
+// 块索引文件的扩展名，追加在输入文件名之后
+inline const char* kIndexFileExt = ".xidx";
+
+// 增量解码清单的文件名，位于解码的根目录下
+inline const char* kManifestFileName = ".xlog_decode_manifest";
+
 }  // namespace xlog_decode
 
 #endif  // XLOG_DECODE_XLOG_CONSTANTS_H_
\ No newline at end of file
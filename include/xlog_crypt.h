@@ -0,0 +1,75 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// xlog_crypt.h - 加密日志块的解密（secp256k1 ECDH + TEA）
+
+#ifndef XLOG_DECODE_XLOG_CRYPT_H_
+#define XLOG_DECODE_XLOG_CRYPT_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace xlog_decode {
+
+// 私钥长度（大端整数）
+constexpr size_t kXlogPrivateKeySize = 32;
+
+// 块头部crypt字段中客户端公钥的长度：未压缩点的x、y坐标，各32字节大端
+constexpr size_t kXlogPublicKeySize = 64;
+
+// TEA密钥：ECDH共享点x坐标（大端）的前16字节，按小端读为4个32位整数
+using TeaKey = std::array<uint32_t, 4>;
+
+// 魔数表示的块是否经过TEA加密（Mars异步模式的MAGIC_COMPRESS_START2和
+// MAGIC_ASYNC_ZSTD_START）；同步模式和旧格式的块不加密
+bool IsEncryptedMagic(uint8_t magic);
+
+// 计算secp256k1上的ECDH共享点，输出x坐标（32字节大端）
+// 私钥为0或不小于曲线阶、公钥不在曲线上时返回false
+bool EcdhSharedSecret(const uint8_t* private_key,
+                      const uint8_t* public_key,
+                      uint8_t* shared_x);
+
+// 原地解密size字节，16轮TEA，各8字节分组独立（ECB）
+// 末尾不足8字节的部分Mars加密时保持明文，这里同样不处理
+// 运行时根据CPU每次并行处理8个（AVX2）或4个（SSE2）分组
+void TeaDecrypt(const TeaKey& key, uint8_t* data, size_t size);
+
+// XlogKeyRing持有解密用的私钥，按客户端公钥缓存派生的TEA密钥
+// 同一进程写出的块使用相同的公钥，点乘只在第一次遇到某个公钥时计算
+// 线程安全，多个解码器和解压线程可以共用一个实例
+class XlogKeyRing {
+ public:
+  // 解析十六进制私钥（64个十六进制字符，忽略空白），格式错误时返回false
+  bool SetPrivateKeyHex(const std::string& hex);
+
+  // 从文件读取十六进制私钥，即Mars生成密钥时输出的私钥
+  bool LoadPrivateKeyFile(const std::string& file_path);
+
+  // 取得公钥（kXlogPublicKeySize字节）对应的TEA密钥，无法派生时返回nullptr
+  // 返回的指针在XlogKeyRing销毁或重新设置私钥前一直有效
+  const TeaKey* GetTeaKey(const uint8_t* public_key);
+
+  // 已执行的ECDH次数，等于遇到的不同公钥数
+  size_t derivation_count() const;
+
+ private:
+  struct CacheEntry {
+    bool valid = false;
+    TeaKey key = {};
+  };
+
+  uint8_t private_key_[kXlogPrivateKeySize] = {};
+  bool has_private_key_ = false;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, CacheEntry> cache_;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_XLOG_CRYPT_H_
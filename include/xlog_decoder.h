@@ -6,15 +6,38 @@
 #ifndef XLOG_DECODE_XLOG_DECODER_H_
 #define XLOG_DECODE_XLOG_DECODER_H_
 
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "decode_stats.h"
 #include "xlog_constants.h"
+#include "xlog_crypt.h"
 
 namespace xlog_decode {
 
+class MappedFile;
+class OutputSink;
+class ThreadPool;
+struct DecompressContext;
+class XlogBlockReader;
+struct XlogBlock;
+class XlogIndex;
+struct FollowState;
+class ZipArchive;
+struct ZipEntry;
+
+// 最后一个完整块之后的解码进度，文件追加数据后可从这里继续解码
+struct XlogResumePoint {
+  uint64_t input_offset = 0;   // 下一个块在输入中的偏移，0表示没有完整的块
+  uint64_t output_offset = 0;  // 到这个块为止的输出长度
+  uint16_t last_seq = 0;       // 到这个块为止的序列号
+};
+
 // XlogDecoder类处理XLOG格式文件的解码
 class XlogDecoder {
  public:
@@ -37,52 +60,333 @@ class XlogDecoder {
   // 检查文件是否为标准ZIP文件
   static bool IsZipFile(const std::string& file_path);
 
-  // 解码单个XLOG文件
+  // 解码单个XLOG文件，输出逐块写入output_file
   bool DecodeFile(const std::string& input_file,
                   const std::string& output_file,
                   bool skip_error_blocks = true);
 
+  // 解码单个XLOG文件，输出逐块写入sink；成功时关闭sink
+  bool DecodeFile(const std::string& input_file,
+                  OutputSink& sink,
+                  bool skip_error_blocks = true);
+
+  // 流式解码：以固定大小窗口逐块读取输入，每个块解码后直接写入sink
+  // 输出与DecodeFile逐字节一致，峰值内存与输入大小无关
+  bool DecodeFileStreaming(const std::string& input_file,
+                           OutputSink& sink,
+                           bool skip_error_blocks = true);
+
+  // 跟踪正在增长的文件：先解码已有内容，之后等待追加，只解码新写完的块，
+  // 直到should_stop返回true；mmap3中原地增长的块只输出新增的解码内容
+  // 文件被截断、改写或替换（轮转）时从头重新解码
+  bool Follow(const std::string& input_file,
+              OutputSink& sink,
+              const std::function<bool()>& should_stop);
+
+  // 从上次解码的进度继续，只解码from之后追加的块；from必须来自同一文件
+  // 此前一次解码的resume_point()，输出与完整解码中对应的部分一致
+  bool DecodeFrom(const std::string& input_file,
+                  OutputSink& sink,
+                  const XlogResumePoint& from,
+                  bool skip_error_blocks = true);
+
+  // 最近一次解码到最后一个完整块为止的进度
+  const XlogResumePoint& resume_point() const { return resume_point_; }
+
+  // 设置流式解码的读取窗口大小
+  void set_stream_window_size(size_t window_size) {
+    stream_window_size_ = window_size;
+  }
+
+  // 设置DecodeFile写输出文件时的刷新阈值，0表示每个块解码后立即写出
+  void set_flush_threshold(size_t flush_threshold) {
+    flush_threshold_ = flush_threshold;
+  }
+
+  // 设置跳过损坏数据后，新的起始位置需要连续通过校验的块数量
+  void set_resync_chain_length(int32_t count) { resync_chain_length_ = count; }
+
+  // 设置单个文件内并行解压数据块的线程数，1为串行解码，0为硬件线程数
+  // ZIP文件按同样的线程数并行解码各个条目，每个条目内串行解码
+  void set_thread_count(size_t thread_count);
+
+  // 只解码头部小时与[from_hour, to_hour]（0~23，包含两端）有交集的块，
+  // 其余块不解压也不输出；from_hour大于to_hour时窗口跨越午夜
+  void set_hour_range(int from_hour, int to_hour);
+
+  // 取消小时过滤
+  void clear_hour_range() { hour_mask_ = kAllHours; }
+
+  // 最近一次解码因小时过滤而跳过的块数
+  uint64_t hour_skipped_blocks() const { return hour_skipped_blocks_; }
+
+  // 最近一次解码在第一个有效块之前跳过的字节数
+  uint64_t leading_bytes_skipped() const { return leading_skipped_; }
+
+  // 设置是否加载输入文件旁的.xidx索引；索引有效时跳过分帧和重新同步
+  void set_use_index(bool use_index) { use_index_ = use_index; }
+
+  // 设置解码完成后是否写出.xidx索引（仅在跳过错误块且未使用索引时写出）
+  void set_write_index(bool write_index) { write_index_ = write_index; }
+
+  // 设置解密用的密钥环；设置后MAGIC_COMPRESS_START2和MAGIC_ASYNC_ZSTD_START
+  // 的块先按头部公钥解密再解压，多个解码器可以共用同一个密钥环
+  void set_key_ring(std::shared_ptr<XlogKeyRing> key_ring) {
+    key_ring_ = std::move(key_ring);
+  }
+
+  // 设置是否统计各阶段的耗时和计数，默认关闭；关闭时解码路径上不读取时钟。
+  // 编译时开启了分配统计（XLOG_DECODE_ALLOC_TRACKING）时同时统计各阶段的
+  // 内存分配
+  void set_collect_stats(bool collect) { collect_stats_ = collect; }
+
+  // 最近一次解码的统计，未开启统计时全部为0；跟踪模式不重置统计
+  const DecodeStats& stats() const { return stats_; }
+
+  // 最近一次解码是否使用了已有的索引
+  bool used_index() const { return used_index_; }
+
+  // 最近一次解码加载或建立的索引，没有时返回nullptr
+  const XlogIndex* index() const { return index_.get(); }
+
+  // 完整解码一遍输入文件（不输出），写出其.xidx索引
+  bool BuildIndex(const std::string& input_file);
+
+  // 按索引只解码第first_block个块开始的block_count个块
+  // 没有有效的索引时先建立索引（不写出），输出与完整解码中这些块的内容一致
+  // 索引描述跳过错误块时的解码结果，因此总是跳过错误块；设置了小时范围时
+  // 只输出其中属于该范围的块
+  bool DecodeBlocks(const std::string& input_file,
+                    OutputSink& sink,
+                    size_t first_block,
+                    size_t block_count);
+
+  // 为ZIP中的XLOG条目创建输出，返回nullptr时该条目记为失败
+  // 并行解码时在工作线程中调用，需要线程安全
+  using ZipSinkFactory =
+      std::function<std::unique_ptr<OutputSink>(const std::string& entry)>;
+
+  // 把ZIP中的每个XLOG条目分别解码到open_sink创建的输出中（成功时关闭）
+  // 条目解压到内存，不写磁盘；有条目失败时返回false，其余条目照常解码
+  bool DecodeZipEntries(const std::string& input_file,
+                        const ZipSinkFactory& open_sink,
+                        bool skip_error_blocks = true);
+
+  // 按魔数解码单个块的主体（不解密），结果追加到output；解压失败时追加与
+  // 解码文件时相同的错误行。供性能测试等直接驱动解压内核的场合使用
+  void DecodeBlockBody(uint8_t magic,
+                       const uint8_t* body,
+                       size_t body_size,
+                       std::vector<uint8_t>& output);
+
   // 根据输入文件名生成输出文件名
   static std::string GenerateOutputFilename(const std::string& input_file);
 
  private:
   // 解析Mars XLOG格式文件
   bool ParseMarsXlogFile(const std::string& input_file,
-                         const std::string& output_file,
+                         OutputSink& sink,
                          bool skip_error_blocks);
 
-  // 解码ZIP格式文件
+  // 解码管道、FIFO等只能顺序读取一遍的输入：读到EOF后在内存中解码
+  bool ParseSequentialInput(const std::string& input_file,
+                            OutputSink& sink,
+                            bool skip_error_blocks);
+
+  // 解码ZIP格式文件：各XLOG条目按中央目录中的顺序写入sink，每个条目
+  // 之前有一行提示；同一批条目并行解码到内存，再依次写出
   bool DecodeZipFile(const std::string& input_file,
-                     const std::string& output_file);
-
-  // 解码单个XLOG数据块
-  int32_t DecodeBlock(const std::vector<uint8_t>& buffer,
-                      int32_t offset,
-                      std::vector<uint8_t>& output_buffer,
-                      bool skip_error_blocks);
-
-  // 检查缓冲区是否包含有效的XLOG数据
-  std::pair<bool, std::string> IsValidLogBuffer(
-      const std::vector<uint8_t>& buffer,
-      int32_t offset,
-      int32_t count);
-
-  // 查找有效XLOG块的起始位置
-  int32_t FindLogStartPosition(const std::vector<uint8_t>& buffer,
-                               int32_t count);
-
-  // 解压ZLIB压缩数据
-  bool DecompressZlib(const uint8_t* input_data,
+                     OutputSink& sink,
+                     bool skip_error_blocks);
+
+  // 打开ZIP文件并列出其中的XLOG条目，失败时输出错误信息
+  static bool OpenZip(const std::string& input_file,
+                      ZipArchive* archive,
+                      std::vector<const ZipEntry*>* entries);
+
+  // 用与本解码器相同的设置解码ZIP中的一个条目，可在多个线程中并发调用
+  // hour_skipped返回该条目因小时过滤而跳过的块数，stats不为空时累加该条目
+  // 读取和解码的统计
+  bool DecodeZipEntry(ZipArchive& archive,
+                      const ZipEntry& entry,
+                      const std::string& label,
+                      OutputSink& sink,
+                      bool skip_error_blocks,
+                      uint64_t* hour_skipped,
+                      DecodeStats* stats) const;
+
+  // 按条目数并发执行decode(i)，线程数大于1时使用线程池
+  void RunZipTasks(size_t count, const std::function<void(size_t)>& decode);
+
+  // 优先映射输入文件，无法映射时以固定大小窗口读取
+  bool OpenReader(const std::string& input_file,
+                  MappedFile& mapped_file,
+                  XlogBlockReader& reader);
+
+  // 加载与输入文件和当前配置匹配的索引
+  bool LoadIndex(const std::string& input_file, XlogIndex* index) const;
+
+  // 完整解码一遍输入文件（不输出），在index_中建立索引，失败时输出错误信息
+  bool CollectIndex(const std::string& input_file);
+
+  // 解码reader中的全部数据并关闭sink，失败时输出错误信息
+  bool DecodeToSink(XlogBlockReader& reader,
+                    OutputSink& sink,
+                    bool skip_error_blocks,
+                    const std::string& input_file);
+
+  // 分帧后从第一个有效块开始解码并写入sink，写入失败时返回false
+  // has_output表示是否产生了任何输出
+  bool DecodeStream(XlogBlockReader& reader,
+                    OutputSink& sink,
+                    bool skip_error_blocks,
+                    bool* has_output);
+
+  // 定位第一个可信的块链起点，整个文件中没有有效块时返回false
+  bool FrameStart(XlogBlockReader& reader, uint64_t* start_pos);
+
+  // 跟踪模式下解码一轮新写入的数据，progressed表示是否有新的输出
+  bool FollowRound(const std::string& input_file,
+                   OutputSink& sink,
+                   FollowState* state,
+                   bool* progressed);
+
+  // 按线程数选择串行或并行解码，从reader当前位置解码到结束
+  bool DecodeRemaining(XlogBlockReader& reader,
+                       OutputSink& sink,
+                       bool skip_error_blocks,
+                       bool* has_output);
+
+  // 从reader当前位置开始逐块解码，直到数据结束或遇到无法恢复的错误
+  bool DecodePass(XlogBlockReader& reader,
+                  OutputSink& sink,
+                  bool skip_error_blocks,
+                  bool* has_output);
+
+  // 两阶段并行解码：每批先顺序分帧并检查序列号，再由线程池并发解压，
+  // 最后按块顺序写入sink，输出与DecodePass逐字节一致
+  bool DecodePassParallel(XlogBlockReader& reader,
+                          OutputSink& sink,
+                          bool skip_error_blocks,
+                          bool* has_output);
+
+  // 块头部的小时范围是否与小时过滤窗口有交集
+  bool IsBlockSelected(const XlogBlock& block) const;
+
+  // 跳过未选中的块：丢弃其提示信息，只更新序列号
+  void SkipBlock(const XlogBlock& block, std::vector<uint8_t>& prefix);
+
+  // 块是重新同步后得到的且结果可能随追加的数据改变时，停止推进续解进度
+  void CheckResyncFinal(XlogBlockReader& reader, const XlogBlock& block);
+
+  // 建立索引时记录一个块，output_offset为块解码内容在输出中的偏移
+  void RecordBlock(const XlogBlock& block,
+                   uint64_t output_offset,
+                   size_t decoded_length);
+
+  // 开启统计时记录一次分帧：耗时计入frame或resync，并按魔数计数
+  void RecordFrame(const XlogBlock& block, bool is_block, int64_t start_ns);
+
+  // 开启统计时返回统计对象，否则返回nullptr
+  DecodeStats* active_stats() { return collect_stats_ ? &stats_ : nullptr; }
+
+  // 开启统计且编译时开启了分配统计时返回本解码器的分配账户，否则返回nullptr
+  AllocAccount* alloc_account();
+
+  // 检查序列号连续性，有缺失时追加警告并更新last_seq_
+  void CheckSequence(uint16_t seq, std::vector<uint8_t>& output_buffer);
+
+  // 块的TEA密钥：未设置密钥环、块未加密或公钥无法派生密钥时返回nullptr
+  // 需要在分帧阶段调用，此时块头部仍在body之前
+  const TeaKey* BlockKey(const XlogBlock& block) const;
+
+  // 按魔数解压块主体，tea_key不为空时先解密，不访问可变成员；
+  // 每个线程使用各自的context和stats时可在多个线程中并发调用
+  // stats不为空时累加解密、解压耗时和解压失败的块数
+  void DecodeBody(uint8_t magic_start,
+                  const uint8_t* body,
+                  size_t body_size,
+                  const TeaKey* tea_key,
+                  DecompressContext& context,
+                  std::vector<uint8_t>& output_buffer,
+                  DecodeStats* stats) const;
+
+  // 解压ZLIB压缩数据，直接追加到输出缓冲末尾
+  bool DecompressZlib(DecompressContext& context,
+                      const uint8_t* input_data,
                       size_t input_size,
-                      std::vector<uint8_t>& output_buffer);
+                      std::vector<uint8_t>& output_buffer) const;
+
+  // 解压由长度前缀分段的ZLIB数据（MAGIC_COMPRESS_START1），各段依次送入
+  // 同一个压缩流，不拼接
+  bool DecompressZlibSegments(DecompressContext& context,
+                              const uint8_t* body,
+                              size_t body_size,
+                              std::vector<uint8_t>& output_buffer) const;
 
-  // 解压ZSTD压缩数据
-  bool DecompressZstd(const uint8_t* input_data,
+  // 解压ZSTD压缩数据（可包含多个帧），直接追加到输出缓冲末尾
+  bool DecompressZstd(DecompressContext& context,
+                      const uint8_t* input_data,
                       size_t input_size,
-                      std::vector<uint8_t>& output_buffer);
+                      std::vector<uint8_t>& output_buffer) const;
+
+  // 表示全部24个小时的掩码
+  static constexpr uint32_t kAllHours = (1u << 24) - 1;
 
   // 用于日志连续性检查的全局序列号
   uint16_t last_seq_ = 0;
+
+  // 流式解码的读取窗口大小
+  size_t stream_window_size_;
+
+  // 输出文件的刷新阈值
+  size_t flush_threshold_;
+
+  // 重新同步时要求的连续有效块数量
+  int32_t resync_chain_length_;
+
+  // 第一个有效块之前跳过的字节数及开头的校验失败原因
+  uint64_t leading_skipped_;
+  std::string leading_error_;
+
+  // 单个块的解码输出，跨块复用
+  std::vector<uint8_t> block_buffer_;
+
+  // 串行解码复用的解压上下文，并行解码时每个线程使用线程局部的上下文
+  std::unique_ptr<DecompressContext> decompress_context_;
+
+  // 文件内并行解压的线程数及按需创建的线程池
+  size_t thread_count_;
+  std::unique_ptr<ThreadPool> thread_pool_;
+
+  // 块索引的读写设置，以及最近一次加载或建立的索引
+  bool use_index_;
+  bool write_index_;
+  bool collect_index_;
+  bool used_index_;
+  std::unique_ptr<XlogIndex> index_;
+
+  // 解密用的密钥环，不解密时为空
+  std::shared_ptr<XlogKeyRing> key_ring_;
+
+  // 小时过滤窗口，第h位表示选中h点，全部选中时不过滤
+  uint32_t hour_mask_;
+  uint64_t hour_skipped_blocks_;
+
+  // 正在建立的索引（不建立时为nullptr）及本次解码已输出的字节数
+  XlogIndex* index_builder_;
+  uint64_t output_bytes_;
+
+  // 最后一个完整块之后的解码进度；之后的分帧可能随追加数据改变时不再前进
+  XlogResumePoint resume_point_;
+  bool resume_frozen_ = false;
+
+  // 各阶段的统计；stats_scope_active_表示正处于最外层的公开解码调用中，
+  // 内部嵌套的解码（如建立索引）不重置统计
+  bool collect_stats_ = false;
+  bool stats_scope_active_ = false;
+  DecodeStats stats_;
+  AllocAccount* alloc_account_ = nullptr;  // 第一次需要时创建，析构时释放
 };
 
 }  // namespace xlog_decode
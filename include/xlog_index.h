@@ -0,0 +1,95 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// xlog_index.h - XLOG块索引（.xidx旁路文件）的读写
+
+#ifndef XLOG_DECODE_XLOG_INDEX_H_
+#define XLOG_DECODE_XLOG_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace xlog_decode {
+
+// 索引中的一个块记录，定长存储，第i个块的记录位于文件头之后
+// i * sizeof(XlogIndexEntry)处，可以直接跳到任意块
+#pragma pack(push, 1)
+struct XlogIndexEntry {
+  uint64_t offset;          // 块在输入文件中的偏移
+  uint64_t output_offset;   // 块解码内容在输出中的偏移（位于提示信息之后）
+  uint64_t decoded_length;  // 块解码内容的长度
+  uint32_t length;          // 块主体（压缩后）的长度
+  uint16_t seq;             // 序列号
+  uint8_t magic;            // 块魔数
+  uint8_t begin_hour;       // 开始小时
+  uint8_t end_hour;         // 结束小时
+};
+#pragma pack(pop)
+
+// 输入文件的校验戳，任一字段与当前文件不符都说明索引已过期
+struct XlogIndexStamp {
+  uint64_t file_size = 0;
+  int64_t modified_time = 0;  // 修改时间（纳秒）
+  uint32_t head_crc = 0;      // 文件开头一段数据的CRC32
+  uint32_t tail_crc = 0;      // 文件末尾一段数据的CRC32
+
+  bool operator==(const XlogIndexStamp& other) const {
+    return file_size == other.file_size &&
+           modified_time == other.modified_time &&
+           head_crc == other.head_crc && tail_crc == other.tail_crc;
+  }
+  bool operator!=(const XlogIndexStamp& other) const {
+    return !(*this == other);
+  }
+};
+
+// XlogIndex记录一次完整解码中每个块的位置和解码结果
+// 解码器加载有效的索引后不再分帧和重新同步，直接按记录的偏移读取块
+class XlogIndex {
+ public:
+  // 输入文件对应的索引文件路径：原文件名.xidx
+  static std::string IndexPathFor(const std::string& input_file);
+
+  // 计算输入文件当前的校验戳
+  static bool ComputeStamp(const std::string& input_file,
+                           XlogIndexStamp* stamp);
+
+  // 读取索引文件；格式错误或校验戳与input_file当前状态不符时返回false
+  bool Load(const std::string& index_file, const std::string& input_file);
+
+  // 写出索引文件
+  bool Save(const std::string& index_file) const;
+
+  // 追加一个块记录
+  void Add(const XlogIndexEntry& entry) { entries_.push_back(entry); }
+
+  const std::vector<XlogIndexEntry>& entries() const { return entries_; }
+
+  const XlogIndexStamp& stamp() const { return stamp_; }
+  void set_stamp(const XlogIndexStamp& stamp) { stamp_ = stamp; }
+
+  // 建立索引时使用的重新同步链长度，不同的链长度可能得到不同的分帧结果
+  int32_t resync_chain_length() const { return resync_chain_length_; }
+  void set_resync_chain_length(int32_t count) { resync_chain_length_ = count; }
+
+  // 最后一个块之后被跳过的尾部数据长度
+  uint64_t tail_skipped() const { return tail_skipped_; }
+  void set_tail_skipped(uint64_t tail_skipped) { tail_skipped_ = tail_skipped; }
+
+  // 完整解码输出的总长度
+  uint64_t decoded_size() const { return decoded_size_; }
+  void set_decoded_size(uint64_t decoded_size) { decoded_size_ = decoded_size; }
+
+ private:
+  std::vector<XlogIndexEntry> entries_;
+  XlogIndexStamp stamp_;
+  int32_t resync_chain_length_ = 1;
+  uint64_t tail_skipped_ = 0;
+  uint64_t decoded_size_ = 0;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_XLOG_INDEX_H_
@@ -0,0 +1,82 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// zip_archive.h - 读取ZIP压缩包（中央目录、存储和deflate条目）
+
+#ifndef XLOG_DECODE_ZIP_ARCHIVE_H_
+#define XLOG_DECODE_ZIP_ARCHIVE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "file_utils.h"
+
+namespace xlog_decode {
+
+// 中央目录中的一个条目
+struct ZipEntry {
+  std::string name;                // 压缩包内的路径，以'/'分隔
+  uint16_t flags = 0;              // 通用标志位，第0位表示加密
+  uint16_t method = 0;             // 0为存储，8为deflate
+  uint32_t crc32 = 0;              // 解压后数据的CRC32
+  uint64_t compressed_size = 0;    // 压缩后的大小
+  uint64_t uncompressed_size = 0;  // 解压后的大小
+  uint64_t local_header_offset = 0;
+
+  // 以'/'结尾的目录条目
+  bool IsDirectory() const;
+
+  // 是否为.xlog或.mmap3文件
+  bool IsXlog() const;
+};
+
+// ZipArchive通过中央目录定位条目，逐个解压到内存，不写磁盘
+// 支持ZIP64，不支持分卷和加密条目；ReadEntry可在多个线程中并发调用
+class ZipArchive {
+ public:
+  // 单个条目解压后的最大大小，与可映射的文件大小上限相同
+  static constexpr uint64_t kMaxEntrySize = MappedFile::kMaxMappedSize;
+
+  // 打开文件并读取中央目录，格式错误时返回false并写入error
+  bool Open(const std::string& file_path, std::string* error);
+
+  const std::vector<ZipEntry>& entries() const { return entries_; }
+
+  // 解压条目到data并校验大小和CRC32，失败时返回false并写入error
+  bool ReadEntry(const ZipEntry& entry,
+                 std::vector<uint8_t>* data,
+                 std::string* error);
+
+  // 条目路径能否安全地用于生成输出文件名：非空，不是绝对路径，
+  // 不含".."路径段和反斜杠
+  static bool IsSafeEntryName(const std::string& name);
+
+ private:
+  // 找到中央目录结束记录（及ZIP64记录），得到中央目录的位置和条目数
+  bool FindCentralDirectory(uint64_t* offset,
+                            uint64_t* size,
+                            uint64_t* count,
+                            std::string* error);
+
+  // 解析中央目录中的全部条目
+  bool ParseCentralDirectory(const std::vector<uint8_t>& directory,
+                             uint64_t count,
+                             std::string* error);
+
+  // 条目数据在文件中的偏移（跳过本地文件头）
+  bool DataOffset(const ZipEntry& entry, uint64_t* offset);
+
+  // 加锁读取，RandomAccessFile在部分平台上会移动共享的文件位置
+  bool ReadAt(uint64_t offset, void* dest, size_t len);
+
+  RandomAccessFile file_;
+  std::mutex mutex_;
+  std::vector<ZipEntry> entries_;
+};
+
+}  // namespace xlog_decode
+
+#endif  // XLOG_DECODE_ZIP_ARCHIVE_H_
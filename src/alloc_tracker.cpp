@@ -0,0 +1,225 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// alloc_tracker.cpp - 分配统计和可选的全局operator new/delete替换
+
+#include "alloc_tracker.h"
+
+#if defined(XLOG_DECODE_ALLOC_TRACKING)
+#include <cstdlib>
+#include <new>
+#endif
+
+namespace xlog_decode {
+
+namespace {
+
+// 调用线程的分配计入的账户和阶段；都是平凡类型，operator new中可以直接访问
+thread_local AllocAccount* t_account = nullptr;
+thread_local AllocStage t_stage = AllocStage::kOther;
+
+// 把peak提高到value，已经更高时不变
+void RaisePeak(std::atomic<int64_t>& peak, int64_t value) {
+  int64_t current = peak.load(std::memory_order_relaxed);
+  while (value > current &&
+         !peak.compare_exchange_weak(current, value,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+}  // namespace
+
+bool AllocTrackingCompiled() {
+#if defined(XLOG_DECODE_ALLOC_TRACKING)
+  return true;
+#else
+  return false;
+#endif
+}
+
+AllocAccount* AllocAccount::Create() {
+  // 账户本身不计入调用线程当前的账户
+  AllocScope scope(nullptr, AllocStage::kOther);
+  return new AllocAccount();
+}
+
+void AllocAccount::Acquire() {
+  refs_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AllocAccount::Release() {
+  if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete this;
+  }
+}
+
+void AllocAccount::Reset() {
+  for (Stage& stage : stages_) {
+    stage.count.store(0, std::memory_order_relaxed);
+    stage.bytes.store(0, std::memory_order_relaxed);
+    stage.peak.store(stage.live.load(std::memory_order_relaxed),
+                     std::memory_order_relaxed);
+  }
+  peak_.store(live_.load(std::memory_order_relaxed),
+              std::memory_order_relaxed);
+}
+
+void AllocAccount::OnAllocate(AllocStage stage, size_t size) {
+  Stage& counters = stages_[static_cast<int>(stage)];
+  int64_t delta = static_cast<int64_t>(size);
+  counters.count.fetch_add(1, std::memory_order_relaxed);
+  counters.bytes.fetch_add(size, std::memory_order_relaxed);
+  RaisePeak(counters.peak,
+            counters.live.fetch_add(delta, std::memory_order_relaxed) + delta);
+  RaisePeak(peak_, live_.fetch_add(delta, std::memory_order_relaxed) + delta);
+}
+
+void AllocAccount::OnFree(AllocStage stage, size_t size) {
+  int64_t delta = static_cast<int64_t>(size);
+  stages_[static_cast<int>(stage)].live.fetch_sub(delta,
+                                                  std::memory_order_relaxed);
+  live_.fetch_sub(delta, std::memory_order_relaxed);
+}
+
+uint64_t AllocAccount::count(AllocStage stage) const {
+  return stages_[static_cast<int>(stage)].count.load(
+      std::memory_order_relaxed);
+}
+
+uint64_t AllocAccount::bytes(AllocStage stage) const {
+  return stages_[static_cast<int>(stage)].bytes.load(
+      std::memory_order_relaxed);
+}
+
+int64_t AllocAccount::peak(AllocStage stage) const {
+  return stages_[static_cast<int>(stage)].peak.load(
+      std::memory_order_relaxed);
+}
+
+AllocAccount* CurrentAllocAccount() {
+  return t_account;
+}
+
+AllocScope::AllocScope(AllocStage stage)
+    : saved_account_(t_account), saved_stage_(t_stage) {
+  t_stage = stage;
+}
+
+AllocScope::AllocScope(AllocAccount* account, AllocStage stage)
+    : saved_account_(t_account), saved_stage_(t_stage) {
+  t_account = account;
+  t_stage = stage;
+}
+
+void AllocScope::Leave() {
+  if (active_) {
+    active_ = false;
+    t_account = saved_account_;
+    t_stage = saved_stage_;
+  }
+}
+
+#if defined(XLOG_DECODE_ALLOC_TRACKING)
+
+namespace {
+
+// 每次分配前的头部，记录释放时扣减所需的信息，并保持返回地址的对齐
+struct alignas(alignof(std::max_align_t)) AllocHeader {
+  size_t size;
+  AllocAccount* account;
+  AllocStage stage;
+};
+
+void* TrackedAllocate(size_t size) noexcept {
+  void* raw = std::malloc(sizeof(AllocHeader) + size);
+  if (raw == nullptr) {
+    return nullptr;
+  }
+  AllocHeader* header = static_cast<AllocHeader*>(raw);
+  header->size = size;
+  header->account = t_account;
+  header->stage = t_stage;
+  if (t_account != nullptr) {
+    t_account->Acquire();
+    t_account->OnAllocate(t_stage, size);
+  }
+  return header + 1;
+}
+
+void TrackedFree(void* ptr) noexcept {
+  if (ptr == nullptr) {
+    return;
+  }
+  AllocHeader* header = static_cast<AllocHeader*>(ptr) - 1;
+  if (header->account != nullptr) {
+    header->account->OnFree(header->stage, header->size);
+    header->account->Release();
+  }
+  std::free(header);
+}
+
+}  // namespace
+
+#endif  // XLOG_DECODE_ALLOC_TRACKING
+
+}  // namespace xlog_decode
+
+#if defined(XLOG_DECODE_ALLOC_TRACKING)
+
+// 替换全局的分配函数；按对齐分配的版本不经过这里，仍由标准库实现并不计数
+void* operator new(std::size_t size) {
+  // 与标准实现一样，失败时调用new_handler后重试
+  while (true) {
+    void* ptr = xlog_decode::TrackedAllocate(size);
+    if (ptr != nullptr) {
+      return ptr;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void* operator new[](std::size_t size) {
+  return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return ::operator new(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return ::operator new(size, std::nothrow);
+}
+
+void operator delete(void* ptr) noexcept {
+  xlog_decode::TrackedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  xlog_decode::TrackedFree(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  xlog_decode::TrackedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+  xlog_decode::TrackedFree(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  xlog_decode::TrackedFree(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  xlog_decode::TrackedFree(ptr);
+}
+
+#endif  // XLOG_DECODE_ALLOC_TRACKING
@@ -0,0 +1,658 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// columnar_log.cpp - 列式存储读写的实现
+//
+// 文件格式（小端）：
+//   "XCOL" 版本(4字节)
+//   行组...（各列数据依次存放，长度记录在元数据中）
+//   行组数(4字节) ColumnarRowGroupInfo...
+//   元数据偏移(8字节) "XCOL"
+
+#include "columnar_log.h"
+
+#include <zstd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "mars_log_line.h"
+
+namespace xlog_decode {
+
+namespace {
+// 文件格式版本，列或编码变化时递增
+constexpr uint32_t kColumnarVersion = 1;
+
+constexpr char kColumnarMagic[4] = {'X', 'C', 'O', 'L'};
+constexpr size_t kFileHeaderSize = sizeof(kColumnarMagic) + sizeof(uint32_t);
+constexpr size_t kTrailerSize = sizeof(uint64_t) + sizeof(kColumnarMagic);
+
+// 消息数据的存储方式
+constexpr uint8_t kCodecRaw = 0;
+constexpr uint8_t kCodecZstd = 1;
+
+// 消息压缩级别，解码时写出，优先速度
+constexpr int kZstdLevel = 1;
+
+// 行组消息数据的上限，超长的行较多时提前结束行组，限制内存占用，
+// 同时保证消息偏移不超过32位
+constexpr size_t kMaxRowGroupMessageBytes = 64 * 1024 * 1024;
+
+// 字典列在ColumnarRowGroup::dictionaries_中的位置
+size_t DictionarySlot(ColumnarColumn column) {
+  return column - kColumnTag;
+}
+
+template <typename T>
+void AppendRaw(const T& value, std::vector<uint8_t>* output) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  output->insert(output->end(), bytes, bytes + sizeof(value));
+}
+
+void AppendVarint(uint64_t value, std::vector<uint8_t>* output) {
+  while (value >= 0x80) {
+    output->push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  output->push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+int64_t UnZigZag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// 顺序读取一列数据，越界时ok()变为false并不再前进
+class ColumnDecoder {
+ public:
+  ColumnDecoder(const uint8_t* data, size_t size)
+      : data_(data), end_(data + size) {}
+
+  uint64_t Varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64 && data_ < end_; shift += 7) {
+      uint8_t byte = *data_++;
+      value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+    ok_ = false;
+    return 0;
+  }
+
+  const uint8_t* Bytes(size_t size) {
+    if (!ok_ || static_cast<size_t>(end_ - data_) < size) {
+      ok_ = false;
+      return nullptr;
+    }
+    const uint8_t* bytes = data_;
+    data_ += size;
+    return bytes;
+  }
+
+  size_t remaining() const { return end_ - data_; }
+  bool ok() const { return ok_; }
+
+ private:
+  const uint8_t* data_;
+  const uint8_t* end_;
+  bool ok_ = true;
+};
+
+uint64_t ParseUnsigned(std::string_view text) {
+  uint64_t value = 0;
+  for (char c : text) {
+    if (c < '0' || c > '9') {
+      return 0;
+    }
+    value = value * 10 + static_cast<uint64_t>(c - '0');
+  }
+  return value;
+}
+}  // namespace
+
+void ColumnarOutputSink::Dictionary::Add(std::string_view value) {
+  if (!rows.empty() && *values[last_id] == value) {
+    rows.push_back(last_id);
+    return;
+  }
+  auto result = ids.emplace(std::string(value),
+                            static_cast<uint32_t>(values.size()));
+  if (result.second) {
+    values.push_back(&result.first->first);
+  }
+  last_id = result.first->second;
+  rows.push_back(last_id);
+}
+
+void ColumnarOutputSink::Dictionary::Clear() {
+  ids.clear();
+  values.clear();
+  rows.clear();
+  last_id = 0;
+}
+
+ColumnarOutputSink::ColumnarOutputSink(OutputSink& downstream,
+                                       size_t row_group_rows)
+    : downstream_(downstream),
+      row_group_rows_(std::max<size_t>(row_group_rows, 1)) {}
+
+bool ColumnarOutputSink::Write(const uint8_t* data, size_t size) {
+  const char* begin = reinterpret_cast<const char*>(data);
+  const char* end = begin + size;
+
+  while (begin < end) {
+    const void* newline = std::memchr(begin, '\n', end - begin);
+    if (newline == nullptr) {
+      // 未结束的行保留到下一次写入
+      partial_.append(begin, end - begin);
+      break;
+    }
+    const char* line_end = static_cast<const char*>(newline) + 1;
+    if (partial_.empty()) {
+      AddLine(std::string_view(begin, line_end - begin));
+    } else {
+      partial_.append(begin, line_end - begin);
+      AddLine(partial_);
+      partial_.clear();
+    }
+    begin = line_end;
+
+    if ((times_.size() >= row_group_rows_ ||
+         messages_.size() >= kMaxRowGroupMessageBytes) &&
+        !WriteRowGroup()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ColumnarOutputSink::Flush() {
+  return downstream_.Flush();
+}
+
+bool ColumnarOutputSink::Close() {
+  if (!partial_.empty()) {
+    AddLine(partial_);
+    partial_.clear();
+  }
+  if (!times_.empty() && !WriteRowGroup()) {
+    return false;
+  }
+
+  // 文件尾部：行组元数据、元数据偏移和魔数
+  encoded_.clear();
+  AppendFileHeader();
+  uint64_t footer_offset = bytes_written_ + encoded_.size();
+  AppendRaw(static_cast<uint32_t>(row_groups_.size()), &encoded_);
+  for (const ColumnarRowGroupInfo& info : row_groups_) {
+    AppendRaw(info, &encoded_);
+  }
+  AppendRaw(footer_offset, &encoded_);
+  encoded_.insert(encoded_.end(), kColumnarMagic,
+                  kColumnarMagic + sizeof(kColumnarMagic));
+  return WriteOut(encoded_) && downstream_.Close();
+}
+
+void ColumnarOutputSink::AddLine(std::string_view line) {
+  MarsLogRecord record;
+  bool parsed = ParseMarsLogLine(line, &record);
+  // 空行没有任何内容，不产生记录
+  if (!parsed && record.message.empty()) {
+    return;
+  }
+
+  int64_t time = last_time_;
+  if (parsed && ParseMarsTimestamp(record.timestamp, &time)) {
+    last_time_ = time;
+  }
+  times_.push_back(time);
+  levels_.push_back(parsed && !record.level.empty()
+                        ? static_cast<uint8_t>(record.level[0])
+                        : 0);
+  uint8_t flags = 0;
+  if (parsed) {
+    flags |= kColumnarFlagParsed;
+  }
+  if (record.main_thread) {
+    flags |= kColumnarFlagMainThread;
+  }
+  flags_.push_back(flags);
+  pids_.push_back(ParseUnsigned(record.pid));
+  tids_.push_back(ParseUnsigned(record.tid));
+  tags_.Add(record.tag);
+  files_.Add(record.file);
+  functions_.Add(record.function);
+  lines_.push_back(ParseUnsigned(record.line));
+  messages_.append(record.message.data(), record.message.size());
+  message_ends_.push_back(static_cast<uint32_t>(messages_.size()));
+  record_count_++;
+}
+
+bool ColumnarOutputSink::WriteRowGroup() {
+  encoded_.clear();
+  AppendFileHeader();
+
+  ColumnarRowGroupInfo info = {};
+  info.offset = bytes_written_ + encoded_.size();
+  info.row_count = static_cast<uint32_t>(times_.size());
+  info.min_time = *std::min_element(times_.begin(), times_.end());
+  info.max_time = *std::max_element(times_.begin(), times_.end());
+
+  // 逐列编码，记录每列的长度
+  size_t column_start = encoded_.size();
+  auto end_column = [this, &info, &column_start](ColumnarColumn column) {
+    info.column_sizes[column] =
+        static_cast<uint32_t>(encoded_.size() - column_start);
+    column_start = encoded_.size();
+  };
+
+  int64_t previous = 0;
+  for (int64_t time : times_) {
+    AppendVarint(ZigZag(time - previous), &encoded_);
+    previous = time;
+  }
+  end_column(kColumnTime);
+  encoded_.insert(encoded_.end(), levels_.begin(), levels_.end());
+  end_column(kColumnLevel);
+  encoded_.insert(encoded_.end(), flags_.begin(), flags_.end());
+  end_column(kColumnFlags);
+  for (uint64_t pid : pids_) {
+    AppendVarint(pid, &encoded_);
+  }
+  end_column(kColumnPid);
+  for (uint64_t tid : tids_) {
+    AppendVarint(tid, &encoded_);
+  }
+  end_column(kColumnTid);
+
+  const std::pair<ColumnarColumn, Dictionary*> dictionaries[] = {
+      {kColumnTag, &tags_}, {kColumnFile, &files_},
+      {kColumnFunction, &functions_}};
+  for (const auto& dictionary : dictionaries) {
+    AppendVarint(dictionary.second->values.size(), &encoded_);
+    for (const std::string* value : dictionary.second->values) {
+      AppendVarint(value->size(), &encoded_);
+      encoded_.insert(encoded_.end(), value->begin(), value->end());
+    }
+    for (uint32_t id : dictionary.second->rows) {
+      AppendVarint(id, &encoded_);
+    }
+    end_column(dictionary.first);
+  }
+
+  for (uint64_t line : lines_) {
+    AppendVarint(line, &encoded_);
+  }
+  end_column(kColumnLine);
+
+  // 消息列：结束偏移不压缩，读取长度时不需要解压；数据压缩后存放
+  for (uint32_t message_end : message_ends_) {
+    AppendRaw(message_end, &encoded_);
+  }
+  size_t codec_pos = encoded_.size();
+  encoded_.push_back(kCodecZstd);
+  size_t bound = ZSTD_compressBound(messages_.size());
+  size_t data_pos = encoded_.size();
+  encoded_.resize(data_pos + bound);
+  size_t compressed =
+      ZSTD_compress(encoded_.data() + data_pos, bound, messages_.data(),
+                    messages_.size(), kZstdLevel);
+  if (ZSTD_isError(compressed) || compressed >= messages_.size()) {
+    // 压缩无效时直接存放原始数据
+    encoded_[codec_pos] = kCodecRaw;
+    encoded_.resize(data_pos);
+    encoded_.insert(encoded_.end(), messages_.begin(), messages_.end());
+  } else {
+    encoded_.resize(data_pos + compressed);
+  }
+  end_column(kColumnMessage);
+
+  row_groups_.push_back(info);
+  times_.clear();
+  levels_.clear();
+  flags_.clear();
+  pids_.clear();
+  tids_.clear();
+  tags_.Clear();
+  files_.Clear();
+  functions_.Clear();
+  lines_.clear();
+  message_ends_.clear();
+  messages_.clear();
+  return WriteOut(encoded_);
+}
+
+void ColumnarOutputSink::AppendFileHeader() {
+  if (!header_written_) {
+    encoded_.insert(encoded_.end(), kColumnarMagic,
+                    kColumnarMagic + sizeof(kColumnarMagic));
+    AppendRaw(kColumnarVersion, &encoded_);
+    header_written_ = true;
+  }
+}
+
+bool ColumnarOutputSink::WriteOut(const std::vector<uint8_t>& data) {
+  bytes_written_ += data.size();
+  return downstream_.Write(data.data(), data.size());
+}
+
+ColumnarRecord ColumnarRowGroup::Record(size_t row) const {
+  ColumnarRecord record;
+  if (columns_ & ColumnBit(kColumnTime)) {
+    record.time = times_[row];
+  }
+  if (columns_ & ColumnBit(kColumnLevel)) {
+    record.level = static_cast<char>(levels_[row]);
+  }
+  if (columns_ & ColumnBit(kColumnFlags)) {
+    record.parsed = (flags_[row] & kColumnarFlagParsed) != 0;
+    record.main_thread = (flags_[row] & kColumnarFlagMainThread) != 0;
+  }
+  if (columns_ & ColumnBit(kColumnPid)) {
+    record.pid = pids_[row];
+  }
+  if (columns_ & ColumnBit(kColumnTid)) {
+    record.tid = tids_[row];
+  }
+  std::string_view* strings[] = {&record.tag, &record.file, &record.function};
+  for (ColumnarColumn column : {kColumnTag, kColumnFile, kColumnFunction}) {
+    if (columns_ & ColumnBit(column)) {
+      const Dictionary& dictionary = dictionaries_[DictionarySlot(column)];
+      *strings[DictionarySlot(column)] =
+          dictionary.values[dictionary.rows[row]];
+    }
+  }
+  if (columns_ & ColumnBit(kColumnLine)) {
+    record.line = lines_[row];
+  }
+  if (columns_ & ColumnBit(kColumnMessage)) {
+    uint32_t begin = row == 0 ? 0 : message_ends_[row - 1];
+    record.message = std::string_view(messages_.data() + begin,
+                                      message_ends_[row] - begin);
+  }
+  return record;
+}
+
+bool ColumnarRowGroup::FindTag(std::string_view value, uint32_t* id) const {
+  const std::vector<std::string>& values = dictionaries_[0].values;
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (values[i] == value) {
+      *id = static_cast<uint32_t>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void ColumnarRowGroup::Reset(size_t index, size_t row_count) {
+  index_ = index;
+  row_count_ = row_count;
+  columns_ = 0;
+}
+
+bool ColumnarReader::Open(const std::string& file_path) {
+  row_groups_.clear();
+  row_count_ = 0;
+  file_.Close();
+  if (!file_.Open(file_path) ||
+      file_.Size() < kFileHeaderSize + sizeof(uint32_t) + kTrailerSize) {
+    return false;
+  }
+
+  uint8_t header[kFileHeaderSize];
+  uint8_t trailer[kTrailerSize];
+  uint32_t version = 0;
+  uint64_t footer_offset = 0;
+  if (file_.ReadAt(0, header, sizeof(header)) != sizeof(header) ||
+      file_.ReadAt(file_.Size() - kTrailerSize, trailer, sizeof(trailer)) !=
+          sizeof(trailer) ||
+      std::memcmp(header, kColumnarMagic, sizeof(kColumnarMagic)) != 0 ||
+      std::memcmp(trailer + sizeof(uint64_t), kColumnarMagic,
+                  sizeof(kColumnarMagic)) != 0) {
+    return false;
+  }
+  std::memcpy(&version, header + sizeof(kColumnarMagic), sizeof(version));
+  std::memcpy(&footer_offset, trailer, sizeof(footer_offset));
+  uint64_t footer_end = file_.Size() - kTrailerSize;
+  if (version != kColumnarVersion || footer_offset < kFileHeaderSize ||
+      footer_offset + sizeof(uint32_t) > footer_end) {
+    return false;
+  }
+
+  uint32_t group_count = 0;
+  file_.ReadAt(footer_offset, &group_count, sizeof(group_count));
+  if (group_count != (footer_end - footer_offset - sizeof(uint32_t)) /
+                         sizeof(ColumnarRowGroupInfo) ||
+      footer_offset + sizeof(uint32_t) +
+              group_count * sizeof(ColumnarRowGroupInfo) !=
+          footer_end) {
+    return false;
+  }
+  row_groups_.resize(group_count);
+  if (group_count > 0 &&
+      file_.ReadAt(footer_offset + sizeof(uint32_t), row_groups_.data(),
+                   group_count * sizeof(ColumnarRowGroupInfo)) !=
+          group_count * sizeof(ColumnarRowGroupInfo)) {
+    row_groups_.clear();
+    return false;
+  }
+
+  // 行组必须完整位于元数据之前
+  for (const ColumnarRowGroupInfo& info : row_groups_) {
+    uint64_t size = 0;
+    for (uint32_t column_size : info.column_sizes) {
+      size += column_size;
+    }
+    if (info.offset < kFileHeaderSize || info.offset + size > footer_offset) {
+      row_groups_.clear();
+      return false;
+    }
+    row_count_ += info.row_count;
+  }
+  return true;
+}
+
+bool ColumnarReader::ReadRowGroup(size_t index,
+                                  uint32_t columns,
+                                  ColumnarRowGroup* group) {
+  if (index >= row_groups_.size()) {
+    return false;
+  }
+  const ColumnarRowGroupInfo& info = row_groups_[index];
+  if (group->index_ != index) {
+    group->Reset(index, info.row_count);
+  }
+  for (uint32_t column = 0; column < kColumnCount; ++column) {
+    uint32_t bit = 1u << column;
+    if ((columns & bit) == 0 || (group->columns_ & bit) != 0) {
+      continue;
+    }
+    if (!ReadColumn(info, static_cast<ColumnarColumn>(column), group)) {
+      group->Reset(std::numeric_limits<size_t>::max(), 0);
+      return false;
+    }
+    group->columns_ |= bit;
+  }
+  return true;
+}
+
+bool ColumnarReader::ReadColumn(const ColumnarRowGroupInfo& info,
+                                ColumnarColumn column,
+                                ColumnarRowGroup* group) {
+  uint64_t offset = info.offset;
+  for (uint32_t i = 0; i < column; ++i) {
+    offset += info.column_sizes[i];
+  }
+  size_t size = info.column_sizes[column];
+  buffer_.resize(size);
+  if (file_.ReadAt(offset, buffer_.data(), size) != size) {
+    return false;
+  }
+
+  size_t rows = info.row_count;
+  ColumnDecoder decoder(buffer_.data(), size);
+  switch (column) {
+    case kColumnTime: {
+      group->times_.resize(rows);
+      int64_t previous = 0;
+      for (int64_t& time : group->times_) {
+        time = previous + UnZigZag(decoder.Varint());
+        previous = time;
+      }
+      break;
+    }
+    case kColumnLevel:
+    case kColumnFlags: {
+      std::vector<uint8_t>& values =
+          column == kColumnLevel ? group->levels_ : group->flags_;
+      const uint8_t* bytes = decoder.Bytes(rows);
+      if (bytes == nullptr) {
+        return false;
+      }
+      values.assign(bytes, bytes + rows);
+      break;
+    }
+    case kColumnPid:
+    case kColumnTid:
+    case kColumnLine: {
+      std::vector<uint64_t>& values = column == kColumnPid   ? group->pids_
+                                      : column == kColumnTid ? group->tids_
+                                                             : group->lines_;
+      values.resize(rows);
+      for (uint64_t& value : values) {
+        value = decoder.Varint();
+      }
+      break;
+    }
+    case kColumnTag:
+    case kColumnFile:
+    case kColumnFunction: {
+      ColumnarRowGroup::Dictionary& dictionary =
+          group->dictionaries_[DictionarySlot(column)];
+      uint64_t count = decoder.Varint();
+      if (count > decoder.remaining()) {
+        return false;
+      }
+      dictionary.values.resize(static_cast<size_t>(count));
+      for (std::string& value : dictionary.values) {
+        uint64_t length = decoder.Varint();
+        const uint8_t* bytes = decoder.Bytes(static_cast<size_t>(length));
+        if (bytes == nullptr) {
+          return false;
+        }
+        value.assign(reinterpret_cast<const char*>(bytes),
+                     static_cast<size_t>(length));
+      }
+      dictionary.rows.resize(rows);
+      for (uint32_t& id : dictionary.rows) {
+        uint64_t value = decoder.Varint();
+        if (value >= count) {
+          return false;
+        }
+        id = static_cast<uint32_t>(value);
+      }
+      break;
+    }
+    case kColumnMessage: {
+      const uint8_t* ends = decoder.Bytes(rows * sizeof(uint32_t));
+      const uint8_t* codec = decoder.Bytes(1);
+      if (ends == nullptr || codec == nullptr) {
+        return false;
+      }
+      group->message_ends_.resize(rows);
+      if (rows > 0) {
+        std::memcpy(group->message_ends_.data(), ends,
+                    rows * sizeof(uint32_t));
+      }
+      uint32_t previous = 0;
+      for (uint32_t end : group->message_ends_) {
+        if (end < previous) {
+          return false;
+        }
+        previous = end;
+      }
+      size_t raw_size = previous;
+      size_t stored_size = decoder.remaining();
+      const uint8_t* stored = decoder.Bytes(stored_size);
+      group->messages_.resize(raw_size);
+      if (*codec == kCodecRaw) {
+        if (stored_size != raw_size) {
+          return false;
+        }
+        if (raw_size > 0) {
+          std::memcpy(group->messages_.data(), stored, raw_size);
+        }
+      } else if (*codec == kCodecZstd) {
+        size_t decompressed = ZSTD_decompress(
+            group->messages_.data(), raw_size, stored, stored_size);
+        if (ZSTD_isError(decompressed) || decompressed != raw_size) {
+          return false;
+        }
+      } else {
+        return false;
+      }
+      break;
+    }
+    default:
+      return false;
+  }
+  return decoder.ok();
+}
+
+bool ColumnarReader::Scan(
+    const ColumnarScanFilter& filter,
+    const std::function<bool(const ColumnarRecord&)>& visit) {
+  groups_skipped_ = 0;
+  ColumnarRowGroup group;
+  std::vector<uint32_t> matches;
+
+  for (size_t i = 0; i < row_groups_.size(); ++i) {
+    const ColumnarRowGroupInfo& info = row_groups_[i];
+    if (info.max_time < filter.min_time || info.min_time > filter.max_time) {
+      groups_skipped_++;
+      continue;
+    }
+
+    // 先只读取时间和标签列，找出匹配的行
+    if (!ReadRowGroup(i, ColumnBit(kColumnTime) | ColumnBit(kColumnTag),
+                      &group)) {
+      return false;
+    }
+    uint32_t tag_id = 0;
+    if (!filter.tag.empty() && !group.FindTag(filter.tag, &tag_id)) {
+      groups_skipped_++;
+      continue;
+    }
+    matches.clear();
+    for (size_t row = 0; row < group.row_count(); ++row) {
+      int64_t time = group.time(row);
+      if (time >= filter.min_time && time <= filter.max_time &&
+          (filter.tag.empty() || group.tag_id(row) == tag_id)) {
+        matches.push_back(static_cast<uint32_t>(row));
+      }
+    }
+    if (matches.empty()) {
+      groups_skipped_++;
+      continue;
+    }
+
+    if (!ReadRowGroup(i, kAllColumns, &group)) {
+      return false;
+    }
+    for (uint32_t row : matches) {
+      if (!visit(group.Record(row))) {
+        return true;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace xlog_decode
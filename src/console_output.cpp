@@ -0,0 +1,27 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// console_output.cpp - PrintLine的实现
+
+#include "console_output.h"
+
+#include <mutex>
+
+namespace xlog_decode {
+
+namespace {
+
+// 函数内的静态变量，静态初始化期间也可以安全使用
+std::mutex& OutputMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+}  // namespace
+
+void PrintLine(std::ostream& stream, const std::string& line) {
+  std::lock_guard<std::mutex> lock(OutputMutex());
+  stream << line << std::endl;
+}
+
+}  // namespace xlog_decode
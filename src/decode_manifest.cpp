@@ -0,0 +1,214 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// decode_manifest.cpp - DecodeManifest类的实现
+
+#include "decode_manifest.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "file_utils.h"
+#include "xlog_constants.h"
+
+namespace xlog_decode {
+
+namespace {
+// 清单格式版本，记录字段变化时递增
+constexpr int kManifestVersion = 1;
+
+// 清单第一行的前缀，其后是版本号和解码选项
+constexpr char kManifestHeader[] = "xlog_decode manifest ";
+
+// 计算内容CRC时每次读取的长度
+constexpr size_t kCrcChunkSize = 1024 * 1024;
+
+// 解析一个以制表符结尾的十进制字段，成功时移动cursor到下一个字段
+bool ParseField(const char** cursor, const char* end, uint64_t* value) {
+  const char* start = *cursor;
+  uint64_t result = 0;
+  const char* ptr = start;
+  while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+    result = result * 10 + static_cast<uint64_t>(*ptr - '0');
+    ++ptr;
+  }
+  if (ptr == start || ptr >= end || *ptr != '\t') {
+    return false;
+  }
+  *value = result;
+  *cursor = ptr + 1;
+  return true;
+}
+}  // namespace
+
+std::string DecodeManifest::ManifestPathFor(const std::string& root_dir) {
+  return FileUtils::JoinPath(root_dir, kManifestFileName);
+}
+
+bool DecodeManifest::IsUpToDate(const std::string& input_file,
+                                const std::string& output_file,
+                                const DecodeManifestEntry& entry) {
+  uint64_t size = 0;
+  int64_t modified_time = 0;
+  if (!FileUtils::GetFileStatus(input_file, &size, &modified_time) ||
+      size != entry.size || modified_time != entry.modified_time) {
+    return false;
+  }
+  return FileUtils::GetFileStatus(output_file, &size, &modified_time) &&
+         size == entry.output_size;
+}
+
+ManifestChange DecodeManifest::Compare(const std::string& input_file,
+                                       const DecodeManifestEntry* previous,
+                                       DecodeManifestEntry* current) {
+  // 先取修改时间再读内容，读取期间文件被修改时下次比较会发现
+  uint64_t stat_size = 0;
+  RandomAccessFile file;
+  if (!FileUtils::GetFileStatus(input_file, &stat_size,
+                                &current->modified_time) ||
+      !file.Open(input_file)) {
+    return ManifestChange::kChanged;
+  }
+  current->size = file.Size();
+
+  // 一次读取同时得到上次记录长度内的前缀CRC和全部内容的CRC
+  uint64_t prefix_size = previous != nullptr ? previous->size : 0;
+  uLong crc = crc32(0L, Z_NULL, 0);
+  uLong prefix_crc = crc;
+  std::vector<uint8_t> chunk(kCrcChunkSize);
+  uint64_t offset = 0;
+  while (offset < current->size) {
+    uint64_t limit = offset < prefix_size
+                         ? std::min(prefix_size, current->size)
+                         : current->size;
+    size_t len = static_cast<size_t>(
+        std::min<uint64_t>(chunk.size(), limit - offset));
+    if (file.ReadAt(offset, chunk.data(), len) != len) {
+      return ManifestChange::kChanged;
+    }
+    crc = crc32(crc, chunk.data(), static_cast<uInt>(len));
+    offset += len;
+    if (offset == prefix_size) {
+      prefix_crc = crc;
+    }
+  }
+  current->content_crc = static_cast<uint32_t>(crc);
+
+  if (previous == nullptr) {
+    return ManifestChange::kChanged;
+  }
+  if (current->size == previous->size &&
+      current->content_crc == previous->content_crc) {
+    return ManifestChange::kUnchanged;
+  }
+  // 上次解码过的部分原样保留，且上次有完整的块可以接续
+  if (current->size > previous->size &&
+      static_cast<uint32_t>(prefix_crc) == previous->content_crc &&
+      previous->resume.input_offset > 0 &&
+      previous->resume.input_offset <= current->size) {
+    return ManifestChange::kAppended;
+  }
+  return ManifestChange::kChanged;
+}
+
+bool DecodeManifest::Load(const std::string& manifest_file) {
+  entries_.clear();
+
+  std::vector<uint8_t> buffer;
+  if (!FileUtils::PathExists(manifest_file) ||
+      !FileUtils::ReadFile(manifest_file, buffer)) {
+    return false;
+  }
+
+  const char* cursor = reinterpret_cast<const char*>(buffer.data());
+  const char* end = cursor + buffer.size();
+  const char* line_end = std::find(cursor, end, '\n');
+  std::string header =
+      kManifestHeader + std::to_string(kManifestVersion) + "\t" + options_;
+  if (std::string(cursor, line_end) != header) {
+    return false;
+  }
+
+  // 每行依次为：大小、修改时间、CRC32、输出大小、续解的输入偏移、
+  // 输出偏移、序列号，最后是相对路径
+  for (cursor = line_end + 1; cursor < end; cursor = line_end + 1) {
+    line_end = std::find(cursor, end, '\n');
+    uint64_t fields[7];
+    for (uint64_t& field : fields) {
+      if (!ParseField(&cursor, line_end, &field)) {
+        entries_.clear();
+        return false;
+      }
+    }
+    DecodeManifestEntry entry;
+    entry.size = fields[0];
+    entry.modified_time = static_cast<int64_t>(fields[1]);
+    entry.content_crc = static_cast<uint32_t>(fields[2]);
+    entry.output_size = fields[3];
+    entry.resume.input_offset = fields[4];
+    entry.resume.output_offset = fields[5];
+    entry.resume.last_seq = static_cast<uint16_t>(fields[6]);
+    entries_[std::string(cursor, line_end)] = entry;
+  }
+  return true;
+}
+
+bool DecodeManifest::Save(const std::string& manifest_file) const {
+  // 按路径排序，清单内容不随哈希表顺序变化
+  std::vector<const std::pair<const std::string, DecodeManifestEntry>*> sorted;
+  sorted.reserve(entries_.size());
+  for (const auto& item : entries_) {
+    sorted.push_back(&item);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const auto* a, const auto* b) { return a->first < b->first; });
+
+  std::string text =
+      kManifestHeader + std::to_string(kManifestVersion) + "\t" + options_;
+  text += '\n';
+  for (const auto* item : sorted) {
+    const DecodeManifestEntry& entry = item->second;
+    for (uint64_t field :
+         {entry.size, static_cast<uint64_t>(entry.modified_time),
+          static_cast<uint64_t>(entry.content_crc), entry.output_size,
+          entry.resume.input_offset, entry.resume.output_offset,
+          static_cast<uint64_t>(entry.resume.last_seq)}) {
+      text += std::to_string(field);
+      text += '\t';
+    }
+    text += item->first;
+    text += '\n';
+  }
+
+  std::string temp_file = manifest_file + ".tmp";
+  if (!FileUtils::WriteFile(temp_file,
+                            std::vector<uint8_t>(text.begin(), text.end()))) {
+    return false;
+  }
+#if defined(_WIN32)
+  // Windows上rename不会覆盖已有文件
+  std::remove(manifest_file.c_str());
+#endif
+  return std::rename(temp_file.c_str(), manifest_file.c_str()) == 0;
+}
+
+const DecodeManifestEntry* DecodeManifest::Find(
+    const std::string& relative_path) const {
+  auto it = entries_.find(relative_path);
+  return it != entries_.end() ? &it->second : nullptr;
+}
+
+void DecodeManifest::Set(const std::string& relative_path,
+                         const DecodeManifestEntry& entry) {
+  entries_[relative_path] = entry;
+}
+
+void DecodeManifest::Remove(const std::string& relative_path) {
+  entries_.erase(relative_path);
+}
+
+}  // namespace xlog_decode
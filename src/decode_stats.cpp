@@ -0,0 +1,228 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// decode_stats.cpp - DecodeStats的实现
+
+#include "decode_stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace xlog_decode {
+
+namespace {
+
+// 纳秒转为保留三位小数的毫秒
+std::string Millis(int64_t ns) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.3f", static_cast<double>(ns) / 1e6);
+  return text;
+}
+
+std::string Megabytes(int64_t bytes) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.2fMB",
+                static_cast<double>(bytes) / (1024 * 1024));
+  return text;
+}
+
+// 分配阶段的名称，下标为AllocStage
+const char* const kAllocStageNames[kAllocStageCount] = {
+    "other", "open", "frame", "decompress", "write"};
+
+std::string MagicName(int index) {
+  char text[8];
+  std::snprintf(text, sizeof(text), "0x%02X",
+                static_cast<unsigned>(MAGIC_NO_COMPRESS_START + index));
+  return text;
+}
+
+}  // namespace
+
+int64_t MonotonicNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::string JsonQuote(const std::string& text) {
+  std::string out = "\"";
+  for (char c : text) {
+    unsigned char byte = static_cast<unsigned char>(c);
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (byte < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", byte);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+void DecodeStats::CountBlock(uint8_t magic) {
+  int index = magic - MAGIC_NO_COMPRESS_START;
+  if (index >= 0 && index < kMagicCount) {
+    blocks[index]++;
+  }
+}
+
+uint64_t DecodeStats::block_count() const {
+  uint64_t count = 0;
+  for (uint64_t value : blocks) {
+    count += value;
+  }
+  return count;
+}
+
+void DecodeStats::SetAllocations(const AllocAccount& account) {
+  for (int i = 0; i < kAllocStageCount; ++i) {
+    AllocStage stage = static_cast<AllocStage>(i);
+    alloc_count[i] = account.count(stage);
+    alloc_bytes[i] = account.bytes(stage);
+    alloc_stage_peak[i] = account.peak(stage);
+  }
+  alloc_peak = account.peak();
+}
+
+bool DecodeStats::has_allocations() const {
+  for (uint64_t count : alloc_count) {
+    if (count > 0) {
+      return true;
+    }
+  }
+  return alloc_peak > 0;
+}
+
+void DecodeStats::Add(const DecodeStats& other) {
+  files += other.files;
+  bytes_read += other.bytes_read;
+  bytes_written += other.bytes_written;
+  for (int i = 0; i < kMagicCount; ++i) {
+    blocks[i] += other.blocks[i];
+  }
+  hour_skipped_blocks += other.hour_skipped_blocks;
+  resync_count += other.resync_count;
+  resync_bytes += other.resync_bytes;
+  seq_gaps += other.seq_gaps;
+  seq_missing += other.seq_missing;
+  decompress_errors += other.decompress_errors;
+  total_ns += other.total_ns;
+  open_ns += other.open_ns;
+  frame_ns += other.frame_ns;
+  resync_ns += other.resync_ns;
+  zlib_ns += other.zlib_ns;
+  zstd_ns += other.zstd_ns;
+  decrypt_ns += other.decrypt_ns;
+  write_ns += other.write_ns;
+  for (int i = 0; i < kAllocStageCount; ++i) {
+    alloc_count[i] += other.alloc_count[i];
+    alloc_bytes[i] += other.alloc_bytes[i];
+    alloc_stage_peak[i] = std::max(alloc_stage_peak[i],
+                                   other.alloc_stage_peak[i]);
+  }
+  alloc_peak = std::max(alloc_peak, other.alloc_peak);
+}
+
+std::string DecodeStats::ToText() const {
+  char size[64];
+  std::snprintf(size, sizeof(size), "%.2fMB -> %.2fMB",
+                static_cast<double>(bytes_read) / (1024 * 1024),
+                static_cast<double>(bytes_written) / (1024 * 1024));
+  int64_t other_ns = total_ns - open_ns - frame_ns - resync_ns - zlib_ns -
+                     zstd_ns - decrypt_ns - write_ns;
+
+  std::string text = std::string(size) + ", total " + Millis(total_ns) +
+                     "ms: open " + Millis(open_ns) + ", frame " +
+                     Millis(frame_ns) + ", resync " + Millis(resync_ns) +
+                     ", zlib " + Millis(zlib_ns) + ", zstd " +
+                     Millis(zstd_ns) + ", decrypt " + Millis(decrypt_ns) +
+                     ", write " + Millis(write_ns) + ", other " +
+                     Millis(other_ns > 0 ? other_ns : 0) + "; " +
+                     std::to_string(block_count()) + " blocks";
+  std::string by_magic;
+  for (int i = 0; i < kMagicCount; ++i) {
+    if (blocks[i] > 0) {
+      by_magic += (by_magic.empty() ? "" : " ") + MagicName(i) + ":" +
+                  std::to_string(blocks[i]);
+    }
+  }
+  if (!by_magic.empty()) {
+    text += " (" + by_magic + ")";
+  }
+  if (hour_skipped_blocks > 0) {
+    text += ", " + std::to_string(hour_skipped_blocks) +
+            " blocks outside hours";
+  }
+  text += ", " + std::to_string(resync_count) + " resyncs (" +
+          std::to_string(resync_bytes) + " bytes), " +
+          std::to_string(seq_gaps) + " seq gaps (" +
+          std::to_string(seq_missing) + " missing), " +
+          std::to_string(decompress_errors) + " decompress errors";
+  if (has_allocations()) {
+    text += "; allocations peak " + Megabytes(alloc_peak);
+    const char* separator = ": ";
+    for (int i = 0; i < kAllocStageCount; ++i) {
+      if (alloc_count[i] > 0) {
+        text += std::string(separator) + kAllocStageNames[i] + " " +
+                std::to_string(alloc_count[i]) + " / " +
+                Megabytes(static_cast<int64_t>(alloc_bytes[i])) +
+                " (peak " + Megabytes(alloc_stage_peak[i]) + ")";
+        separator = ", ";
+      }
+    }
+  }
+  if (files > 1) {
+    text = std::to_string(files) + " files, " + text;
+  }
+  return text;
+}
+
+std::string DecodeStats::ToJson(const std::string& file) const {
+  std::string json = "{";
+  if (!file.empty()) {
+    json += "\"file\":" + JsonQuote(file) + ",";
+  }
+  json += "\"files\":" + std::to_string(files) +
+          ",\"bytes_read\":" + std::to_string(bytes_read) +
+          ",\"bytes_written\":" + std::to_string(bytes_written) +
+          ",\"total_ms\":" + Millis(total_ns) +
+          ",\"open_ms\":" + Millis(open_ns) +
+          ",\"frame_ms\":" + Millis(frame_ns) +
+          ",\"resync_ms\":" + Millis(resync_ns) +
+          ",\"zlib_ms\":" + Millis(zlib_ns) +
+          ",\"zstd_ms\":" + Millis(zstd_ns) +
+          ",\"decrypt_ms\":" + Millis(decrypt_ns) +
+          ",\"write_ms\":" + Millis(write_ns) + ",\"blocks\":{";
+  bool first = true;
+  for (int i = 0; i < kMagicCount; ++i) {
+    if (blocks[i] > 0) {
+      json += (first ? "\"" : ",\"") + MagicName(i) +
+              "\":" + std::to_string(blocks[i]);
+      first = false;
+    }
+  }
+  json += "},\"hour_skipped_blocks\":" + std::to_string(hour_skipped_blocks) +
+          ",\"resync_count\":" + std::to_string(resync_count) +
+          ",\"resync_bytes\":" + std::to_string(resync_bytes) +
+          ",\"seq_gaps\":" + std::to_string(seq_gaps) +
+          ",\"seq_missing\":" + std::to_string(seq_missing) +
+          ",\"decompress_errors\":" + std::to_string(decompress_errors);
+  if (has_allocations()) {
+    json += ",\"allocations\":{\"peak_bytes\":" + std::to_string(alloc_peak);
+    for (int i = 0; i < kAllocStageCount; ++i) {
+      json += ",\"" + std::string(kAllocStageNames[i]) +
+              "\":{\"count\":" + std::to_string(alloc_count[i]) +
+              ",\"bytes\":" + std::to_string(alloc_bytes[i]) +
+              ",\"peak_bytes\":" + std::to_string(alloc_stage_peak[i]) + "}";
+    }
+    json += "}";
+  }
+  return json + "}";
+}
+
+}  // namespace xlog_decode
@@ -0,0 +1,168 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// decode_trace.cpp - TraceRecorder和TraceSpan的实现
+
+#include "decode_trace.h"
+
+#include <cstdio>
+
+#include "decode_stats.h"
+#include "output_sink.h"
+
+namespace xlog_decode {
+
+namespace {
+
+// 纳秒转为trace-event使用的微秒，保留到纳秒
+std::string Micros(int64_t ns) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.3f", static_cast<double>(ns) / 1e3);
+  return text;
+}
+
+bool WriteText(OutputSink& sink, const std::string& text) {
+  return sink.Write(reinterpret_cast<const uint8_t*>(text.data()),
+                    text.size());
+}
+
+// 一个区间的完整事件（ph为X），args只包含设置过的字段
+std::string EventJson(const TraceEvent& event, int tid, int64_t origin_ns) {
+  std::string args;
+  if (!event.file.empty()) {
+    args += "\"file\":" + JsonQuote(event.file);
+  }
+  if (event.magic >= 0) {
+    char magic[16];
+    std::snprintf(magic, sizeof(magic), "\"0x%02X\"",
+                  static_cast<unsigned>(event.magic));
+    args += std::string(args.empty() ? "" : ",") + "\"magic\":" + magic;
+  }
+  if (event.size >= 0) {
+    args += std::string(args.empty() ? "" : ",") +
+            "\"size\":" + std::to_string(event.size);
+  }
+
+  std::string json = "{\"name\":" + JsonQuote(event.name) +
+                     ",\"cat\":\"decode\",\"ph\":\"X\",\"ts\":" +
+                     Micros(event.start_ns - origin_ns) +
+                     ",\"dur\":" + Micros(event.duration_ns) +
+                     ",\"pid\":1,\"tid\":" + std::to_string(tid);
+  if (!args.empty()) {
+    json += ",\"args\":{" + args + "}";
+  }
+  return json + "}";
+}
+
+// 线程名称的元数据事件，Perfetto用它标注时间线
+std::string ThreadNameJson(int tid, const std::string& name) {
+  return "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" +
+         std::to_string(tid) + ",\"args\":{\"name\":" + JsonQuote(name) +
+         "}}";
+}
+
+}  // namespace
+
+TraceRecorder& TraceRecorder::Instance() {
+  static TraceRecorder recorder;
+  return recorder;
+}
+
+void TraceRecorder::Start() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.clear();
+    main_thread_ = std::this_thread::get_id();
+    origin_ns_ = MonotonicNanos();
+    generation_.fetch_add(1, std::memory_order_release);
+  }
+  // 调用线程先登记，使main总是第一条时间线
+  LocalBuffer();
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+void TraceRecorder::Stop() {
+  enabled_.store(false, std::memory_order_relaxed);
+}
+
+void TraceRecorder::Record(TraceEvent&& event) {
+  LocalBuffer()->events.push_back(std::move(event));
+}
+
+size_t TraceRecorder::event_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t count = 0;
+  for (const auto& buffer : buffers_) {
+    count += buffer->events.size();
+  }
+  return count;
+}
+
+bool TraceRecorder::WriteJson(const std::string& file_path) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  FileOutputSink sink(file_path);
+  bool result = WriteText(
+      sink,
+      "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+      "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+      "\"args\":{\"name\":\"xlog_decode\"}}");
+  for (const auto& buffer : buffers_) {
+    result = result &&
+             WriteText(sink, ",\n" + ThreadNameJson(buffer->tid, buffer->name));
+    for (const TraceEvent& event : buffer->events) {
+      if (!result) {
+        break;
+      }
+      result = WriteText(sink, ",\n" + EventJson(event, buffer->tid,
+                                                   origin_ns_));
+    }
+  }
+  result = result && WriteText(sink, "\n]}\n");
+  return sink.Close() && result;
+}
+
+TraceRecorder::ThreadBuffer* TraceRecorder::LocalBuffer() {
+  thread_local ThreadBuffer* buffer = nullptr;
+  thread_local uint64_t buffer_generation = 0;
+  uint64_t generation = generation_.load(std::memory_order_acquire);
+  if (buffer != nullptr && buffer_generation == generation) {
+    return buffer;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  buffers_.push_back(std::make_unique<ThreadBuffer>());
+  buffer = buffers_.back().get();
+  buffer->tid = static_cast<int>(buffers_.size());
+  buffer->name = std::this_thread::get_id() == main_thread_
+                     ? "main"
+                     : "worker " + std::to_string(buffer->tid - 1);
+  buffer_generation = generation;
+  return buffer;
+}
+
+TraceSpan::TraceSpan(const char* name)
+    : active_(TraceRecorder::Instance().enabled()) {
+  if (active_) {
+    event_.name = name;
+    event_.start_ns = MonotonicNanos();
+  }
+}
+
+TraceSpan::TraceSpan(const char* name, const std::string& file)
+    : TraceSpan(name) {
+  if (active_) {
+    event_.file = file;
+  }
+}
+
+TraceSpan::~TraceSpan() { End(); }
+
+void TraceSpan::End() {
+  if (active_) {
+    active_ = false;
+    event_.duration_ns = MonotonicNanos() - event_.start_ns;
+    TraceRecorder::Instance().Record(std::move(event_));
+  }
+}
+
+}  // namespace xlog_decode
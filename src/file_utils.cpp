@@ -4,10 +4,12 @@
 // file_utils.cpp - FileUtils类的实现
 
 #include "../include/file_utils.h"
+#include "../include/console_output.h"
 
 // 标准库头文件
 #include <sys/stat.h>
 #include <algorithm>
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
 #include <fstream>
@@ -15,16 +17,34 @@
 
 #if defined(_WIN32)
 #include <direct.h>
+#include <fcntl.h>
+#include <io.h>
 #define mkdir(path, mode) _mkdir(path)
 #define PATH_SEPARATOR "\\"
 #else
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #define PATH_SEPARATOR "/"
 #endif
 
 namespace xlog_decode {
 
+namespace {
+
+// ZIP逐条目解码的输出目录后缀，见main.cpp中的DecodeZipSplit
+const char kZipOutputDirSuffix[] = ".zip_";
+
+// 检查字符串是否以suffix结尾
+bool HasSuffix(const std::string& value, const std::string& suffix) {
+  return value.size() >= suffix.size() &&
+         value.compare(value.size() - suffix.size(), suffix.size(), suffix) ==
+             0;
+}
+
+}  // namespace
+
 bool FileUtils::PathExists(const std::string& path) {
   return FileExists(path);
 }
@@ -37,6 +57,14 @@ bool FileUtils::IsDirectory(const std::string& path) {
   return (buffer.st_mode & S_IFDIR) != 0;
 }
 
+bool FileUtils::IsRegularFile(const std::string& path) {
+  struct stat buffer;
+  if (stat(path.c_str(), &buffer) != 0) {
+    return false;
+  }
+  return (buffer.st_mode & S_IFMT) == S_IFREG;
+}
+
 bool FileUtils::HasExtension(const std::string& file_path,
                              const std::string& extension) {
   // 检查文件是否有指定的扩展名
@@ -87,19 +115,45 @@ bool FileUtils::ReadFile(const std::string& file_path,
                          std::vector<uint8_t>& buffer) {
   std::ifstream file(file_path, std::ios::binary);
   if (!file.is_open()) {
-    std::cerr << "Failed to open file: " << file_path << std::endl;
+    PrintLine(std::cerr, "Failed to open file: " + file_path);
     return false;
   }
 
-  // 获取文件大小
+  // 管道等输入无法定位，也不能预先获取大小，按块顺序读取到EOF
+  if (!IsRegularFile(file_path)) {
+    constexpr size_t kChunkSize = 64 * 1024;
+    size_t used = 0;
+    buffer.clear();
+    while (true) {
+      buffer.resize(used + kChunkSize);
+      file.read(reinterpret_cast<char*>(buffer.data() + used), kChunkSize);
+      used += static_cast<size_t>(file.gcount());
+      if (static_cast<size_t>(file.gcount()) < kChunkSize) {
+        break;
+      }
+    }
+    buffer.resize(used);
+    if (file.bad()) {
+      PrintLine(std::cerr, "Failed to read file: " + file_path);
+      return false;
+    }
+    return true;
+  }
+
+  // 获取文件大小，超过地址空间的文件无法整体读入
   file.seekg(0, std::ios::end);
-  std::streamsize file_size = file.tellg();
+  std::streamoff file_size = file.tellg();
   file.seekg(0, std::ios::beg);
+  if (file_size < 0 || static_cast<uint64_t>(file_size) > SIZE_MAX) {
+    PrintLine(std::cerr, "Failed to read file: " + file_path);
+    return false;
+  }
 
   // 调整缓冲区大小并读取文件内容
-  buffer.resize(file_size);
-  if (!file.read(reinterpret_cast<char*>(buffer.data()), file_size)) {
-    std::cerr << "Failed to read file: " << file_path << std::endl;
+  buffer.resize(static_cast<size_t>(file_size));
+  if (!file.read(reinterpret_cast<char*>(buffer.data()),
+                 static_cast<std::streamsize>(file_size))) {
+    PrintLine(std::cerr, "Failed to read file: " + file_path);
     return false;
   }
 
@@ -110,13 +164,13 @@ bool FileUtils::WriteFile(const std::string& file_path,
                           const std::vector<uint8_t>& buffer) {
   std::ofstream file(file_path, std::ios::binary);
   if (!file.is_open()) {
-    std::cerr << "Failed to create file: " << file_path << std::endl;
+    PrintLine(std::cerr, "Failed to create file: " + file_path);
     return false;
   }
 
   file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
   if (file.fail()) {
-    std::cerr << "Failed to write to file: " << file_path << std::endl;
+    PrintLine(std::cerr, "Failed to write to file: " + file_path);
     return false;
   }
 
@@ -130,7 +184,7 @@ std::vector<std::string> FileUtils::ScanDirectory(
   std::vector<std::string> result;
 
   if (!PathExists(dir_path) || !IsDirectory(dir_path)) {
-    std::cerr << "Path is not a valid directory: " << dir_path << std::endl;
+    PrintLine(std::cerr, "Path is not a valid directory: " + dir_path);
     return result;
   }
 
@@ -162,12 +216,12 @@ std::vector<std::string> FileUtils::ScanDirectory(
 std::vector<std::string> FileUtils::FindDecodedFiles(
     const std::string& dir_path,
     bool recurse) {
-  // 解码后的文件以"_.log"结尾
-  const std::string kDecodedFileExt = "_.log";
+  // 解码后的文件以"_.log"结尾，列式存储以"_.xcol"结尾
+  const std::string kDecodedFileExts[] = {"_.log", "_.xcol"};
   std::vector<std::string> result;
 
   if (!PathExists(dir_path) || !IsDirectory(dir_path)) {
-    std::cerr << "Path is not a valid directory: " << dir_path << std::endl;
+    PrintLine(std::cerr, "Path is not a valid directory: " + dir_path);
     return result;
   }
 
@@ -177,17 +231,18 @@ std::vector<std::string> FileUtils::FindDecodedFiles(
   // 处理所有文件
   for (const auto& file_path : files) {
     if (IsDirectory(file_path)) {
-      // 如果是目录且启用了递归扫描，扫描子目录
-      if (recurse) {
+      // 如果是目录且启用了递归扫描，扫描子目录；ZIP的输出目录总是扫描
+      if (recurse || HasSuffix(file_path, kZipOutputDirSuffix)) {
         std::vector<std::string> sub_dir_files =
-            FindDecodedFiles(file_path, recurse);
+            FindDecodedFiles(file_path, true);
         result.insert(result.end(), sub_dir_files.begin(), sub_dir_files.end());
       }
     } else {
-      // 检查文件名是否以"_.log"结尾
-      if (file_path.length() >= 5 &&
-          file_path.substr(file_path.length() - 5) == kDecodedFileExt) {
-        result.push_back(file_path);
+      for (const auto& ext : kDecodedFileExts) {
+        if (HasSuffix(file_path, ext)) {
+          result.push_back(file_path);
+          break;
+        }
       }
     }
   }
@@ -195,6 +250,39 @@ std::vector<std::string> FileUtils::FindDecodedFiles(
   return result;
 }
 
+std::vector<std::string> FileUtils::FindZipOutputDirectories(
+    const std::string& dir_path,
+    bool recurse) {
+  std::vector<std::string> result;
+  for (const auto& file_path : ListFilesInDirectory(dir_path)) {
+    if (!IsDirectory(file_path)) {
+      continue;
+    }
+    if (HasSuffix(file_path, kZipOutputDirSuffix)) {
+      result.push_back(file_path);
+    } else if (recurse) {
+      std::vector<std::string> sub_dirs =
+          FindZipOutputDirectories(file_path, recurse);
+      result.insert(result.end(), sub_dirs.begin(), sub_dirs.end());
+    }
+  }
+  return result;
+}
+
+bool FileUtils::RemoveEmptyDirectories(const std::string& dir_path) {
+  for (const auto& file_path : ListFilesInDirectory(dir_path)) {
+    if (IsDirectory(file_path)) {
+      RemoveEmptyDirectories(file_path);
+    }
+  }
+  // 目录不为空时rmdir失败，目录保留
+#if defined(_WIN32)
+  return _rmdir(dir_path.c_str()) == 0;
+#else
+  return rmdir(dir_path.c_str()) == 0;
+#endif
+}
+
 bool FileUtils::DeleteFile(const std::string& file_path) {
   return std::remove(file_path.c_str()) == 0;
 }
@@ -310,4 +398,219 @@ uint64_t FileUtils::GetFileSize(const std::string& file_path) {
   }
 }
 
-}  // namespace xlog_decode
\ No newline at end of file
+namespace {
+// stat结果中的修改时间（纳秒）
+int64_t StatModifiedTime(const struct stat& st) {
+#if defined(__linux__)
+  return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+         st.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+  return static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 +
+         st.st_mtimespec.tv_nsec;
+#else
+  return static_cast<int64_t>(st.st_mtime) * 1000000000;
+#endif
+}
+}  // namespace
+
+int64_t FileUtils::GetModifiedTime(const std::string& file_path) {
+  struct stat st;
+  if (stat(file_path.c_str(), &st) != 0) {
+    return 0;
+  }
+  return StatModifiedTime(st);
+}
+
+uint64_t FileUtils::GetFileId(const std::string& file_path) {
+#if defined(_WIN32)
+  return 0;
+#else
+  struct stat st;
+  if (stat(file_path.c_str(), &st) != 0) {
+    return 0;
+  }
+  return (static_cast<uint64_t>(st.st_dev) << 48) ^
+         static_cast<uint64_t>(st.st_ino);
+#endif
+}
+
+bool FileUtils::GetFileStatus(const std::string& file_path,
+                              uint64_t* size,
+                              int64_t* modified_time) {
+  struct stat st;
+  if (stat(file_path.c_str(), &st) != 0 || (st.st_mode & S_IFREG) == 0) {
+    return false;
+  }
+  *size = static_cast<uint64_t>(st.st_size);
+  *modified_time = StatModifiedTime(st);
+  return true;
+}
+
+bool FileUtils::TruncateFile(const std::string& file_path, uint64_t size) {
+#if defined(_WIN32)
+  int fd = _open(file_path.c_str(), _O_RDWR | _O_BINARY);
+  if (fd < 0) {
+    return false;
+  }
+  bool result = _chsize_s(fd, static_cast<__int64>(size)) == 0;
+  _close(fd);
+  return result;
+#else
+  return truncate(file_path.c_str(), static_cast<off_t>(size)) == 0;
+#endif
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+bool MappedFile::Open(const std::string& file_path) {
+  Close();
+
+#if defined(_WIN32)
+  // Windows平台暂不支持映射，由调用方回退到窗口读取
+  return false;
+#else
+  int fd = open(file_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  // 只映射普通文件，管道和设备文件由调用方顺序读取
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+      static_cast<uint64_t>(st.st_size) > kMaxMappedSize ||
+      static_cast<uint64_t>(st.st_size) > SIZE_MAX) {
+    close(fd);
+    return false;
+  }
+
+  size_t size = static_cast<size_t>(st.st_size);
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // 映射建立后即可关闭描述符，映射本身保持有效
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+
+  // 解码器从头到尾顺序扫描，提示内核加大预读并及时回收已读页
+  madvise(addr, size, MADV_SEQUENTIAL);
+
+  data_ = static_cast<const uint8_t*>(addr);
+  size_ = size;
+  return true;
+#endif
+}
+
+void MappedFile::Close() {
+#if !defined(_WIN32)
+  if (data_ != nullptr) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+#endif
+  data_ = nullptr;
+  size_ = 0;
+}
+
+RandomAccessFile::~RandomAccessFile() {
+  Close();
+}
+
+bool RandomAccessFile::Open(const std::string& file_path) {
+  Close();
+
+#if defined(_WIN32)
+  if (!FileUtils::IsRegularFile(file_path)) {
+    return false;
+  }
+  file_ = std::fopen(file_path.c_str(), "rb");
+  if (file_ == nullptr) {
+    return false;
+  }
+  if (_fseeki64(file_, 0, SEEK_END) != 0) {
+    Close();
+    return false;
+  }
+  __int64 file_size = _ftelli64(file_);
+  if (file_size < 0) {
+    Close();
+    return false;
+  }
+  size_ = static_cast<uint64_t>(file_size);
+  return true;
+#else
+  fd_ = open(file_path.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    return false;
+  }
+
+  // 管道等输入的st_size没有意义，也不支持pread，由调用方顺序读取
+  struct stat st;
+  if (fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 0) {
+    Close();
+    return false;
+  }
+  size_ = static_cast<uint64_t>(st.st_size);
+
+  // 解码器按窗口顺序向前读取
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+  return true;
+#endif
+}
+
+void RandomAccessFile::Close() {
+#if defined(_WIN32)
+  if (file_ != nullptr) {
+    std::fclose(file_);
+    file_ = nullptr;
+  }
+#else
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+#endif
+  size_ = 0;
+}
+
+bool RandomAccessFile::IsOpen() const {
+#if defined(_WIN32)
+  return file_ != nullptr;
+#else
+  return fd_ >= 0;
+#endif
+}
+
+size_t RandomAccessFile::ReadAt(uint64_t offset, void* dest, size_t len) {
+  if (!IsOpen() || offset >= size_) {
+    return 0;
+  }
+
+#if defined(_WIN32)
+  if (_fseeki64(file_, static_cast<__int64>(offset), SEEK_SET) != 0) {
+    return 0;
+  }
+  return std::fread(dest, 1, len, file_);
+#else
+  // pread可能只读取部分数据，循环直到读满或到达文件末尾
+  size_t total = 0;
+  uint8_t* out = static_cast<uint8_t*>(dest);
+  while (total < len) {
+    ssize_t count = pread(fd_, out + total, len - total,
+                          static_cast<off_t>(offset + total));
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (count == 0) {
+      break;
+    }
+    total += static_cast<size_t>(count);
+  }
+  return total;
+#endif
+}
+
+}  // namespace xlog_decode
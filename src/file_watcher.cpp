@@ -0,0 +1,81 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// file_watcher.cpp - FileWatcher类的实现
+
+#include "file_watcher.h"
+
+#include <chrono>
+#include <thread>
+
+#include "file_utils.h"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace xlog_decode {
+
+FileWatcher::FileWatcher(const std::string& file_path)
+    : file_name_(FileUtils::GetFileName(file_path)) {
+#if defined(__linux__)
+  std::string directory = FileUtils::GetDirectoryName(file_path);
+  if (directory.empty()) {
+    directory = file_path.compare(0, 1, "/") == 0 ? "/" : ".";
+  }
+
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0) {
+    return;
+  }
+  // 监视目录而不是文件本身，文件被删除后重新创建或被改名替换时仍能收到事件
+  uint32_t mask = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE |
+                  IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+  if (inotify_add_watch(inotify_fd_, directory.c_str(), mask) < 0) {
+    close(inotify_fd_);
+    inotify_fd_ = -1;
+  }
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+#if defined(__linux__)
+  if (inotify_fd_ >= 0) {
+    close(inotify_fd_);
+  }
+#endif
+}
+
+bool FileWatcher::Wait(int timeout_ms) {
+#if defined(__linux__)
+  if (inotify_fd_ >= 0) {
+    struct pollfd pfd = {inotify_fd_, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+      return false;
+    }
+
+    // 取出所有待处理的事件，只关心目标文件的事件
+    alignas(struct inotify_event) char buffer[4096];
+    bool matched = false;
+    ssize_t len = 0;
+    while ((len = read(inotify_fd_, buffer, sizeof(buffer))) > 0) {
+      for (char* ptr = buffer; ptr < buffer + len;) {
+        const struct inotify_event* event =
+            reinterpret_cast<const struct inotify_event*>(ptr);
+        if (event->len > 0 && file_name_ == event->name) {
+          matched = true;
+        }
+        ptr += sizeof(struct inotify_event) + event->len;
+      }
+    }
+    return matched;
+  }
+#endif
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+  return false;
+}
+
+}  // namespace xlog_decode
@@ -0,0 +1,354 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// grep_output_sink.cpp - GrepOutputSink类的实现
+
+#include "grep_output_sink.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace xlog_decode {
+
+namespace {
+// 解码器输出的诊断行前缀
+constexpr char kDiagnosticPrefix[] = "[F]xlog_decode ";
+
+// 不相邻的两组输出之间的分隔行
+constexpr char kGroupSeparator[] = "--\n";
+
+// 从正则表达式中提取每个匹配都必须包含的最长字面子串，提取不到时返回空串
+// 只分析最外层、不带可选量词的普通字符；含有|时无法确定，直接放弃
+std::string RequiredLiteral(const std::string& pattern) {
+  std::string best;
+  std::string run;
+  auto flush = [&best, &run]() {
+    if (run.size() > best.size()) {
+      best = run;
+    }
+    run.clear();
+  };
+
+  int depth = 0;
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    char c = pattern[i];
+    switch (c) {
+      case '|':
+        return std::string();
+      case '[':
+        // 跳过字符类，第一个]（或紧跟[^之后的]）属于字符类本身
+        flush();
+        ++i;
+        if (i < pattern.size() && pattern[i] == '^') {
+          ++i;
+        }
+        if (i < pattern.size() && pattern[i] == ']') {
+          ++i;
+        }
+        while (i < pattern.size() && pattern[i] != ']') {
+          i += pattern[i] == '\\' ? 2 : 1;
+        }
+        break;
+      case '(':
+        flush();
+        ++depth;
+        break;
+      case ')':
+        flush();
+        --depth;
+        break;
+      case '\\':
+        if (i + 1 < pattern.size() &&
+            !std::isalnum(static_cast<unsigned char>(pattern[i + 1])) &&
+            depth == 0) {
+          run += pattern[++i];
+        } else {
+          // \d、\w、\b、反向引用等不是固定字符
+          flush();
+          ++i;
+        }
+        break;
+      case '*':
+      case '?':
+      case '{':
+        // 前一个字符可以不出现
+        if (!run.empty()) {
+          run.pop_back();
+        }
+        flush();
+        if (c == '{') {
+          while (i < pattern.size() && pattern[i] != '}') {
+            ++i;
+          }
+        }
+        break;
+      case '+':
+        // 前一个字符至少出现一次，但之后的字符不再紧邻
+        flush();
+        break;
+      case '.':
+      case '^':
+      case '$':
+        flush();
+        break;
+      default:
+        if (depth == 0) {
+          run += c;
+        } else {
+          flush();
+        }
+        break;
+    }
+  }
+  flush();
+  return best;
+}
+
+// 返回[begin, end)中第一个换行符之后的位置，没有时返回end
+const uint8_t* NextLine(const uint8_t* begin, const uint8_t* end) {
+  const void* newline = std::memchr(begin, '\n', end - begin);
+  return newline != nullptr ? static_cast<const uint8_t*>(newline) + 1 : end;
+}
+
+// 返回position所在行的起始位置，不早于begin
+const uint8_t* LineStart(const uint8_t* begin, const uint8_t* position) {
+  while (position > begin && position[-1] != '\n') {
+    --position;
+  }
+  return position;
+}
+
+// 去掉行末的换行符
+const uint8_t* TrimNewline(const uint8_t* line, const uint8_t* line_end) {
+  return line_end > line && line_end[-1] == '\n' ? line_end - 1 : line_end;
+}
+}  // namespace
+
+GrepOutputSink::GrepOutputSink(OutputSink& downstream,
+                               const GrepOptions& options)
+    : downstream_(downstream),
+      options_(options),
+      prefilter_(options.regex ? RequiredLiteral(options.pattern)
+                               : options.pattern),
+      diagnostic_searcher_(kDiagnosticPrefix) {
+  if (options_.regex) {
+    regex_ = std::make_unique<std::regex>(
+        options_.pattern, std::regex::ECMAScript | std::regex::optimize);
+  }
+}
+
+bool GrepOutputSink::Validate(const GrepOptions& options, std::string* error) {
+  if (!options.regex) {
+    return true;
+  }
+  try {
+    std::regex regex(options.pattern, std::regex::ECMAScript);
+  } catch (const std::regex_error& e) {
+    *error = e.what();
+    return false;
+  }
+  return true;
+}
+
+bool GrepOutputSink::Write(const uint8_t* data, size_t size) {
+  if (finished_) {
+    return true;
+  }
+  const uint8_t* end = data + size;
+
+  // 先补全上一次写入末尾未结束的行
+  if (!partial_.empty()) {
+    const uint8_t* line_end = NextLine(data, end);
+    partial_.append(reinterpret_cast<const char*>(data), line_end - data);
+    if (partial_.back() != '\n') {
+      return true;
+    }
+    const uint8_t* line = reinterpret_cast<const uint8_t*>(partial_.data());
+    if (!ProcessLines(line, line + partial_.size())) {
+      return false;
+    }
+    partial_.clear();
+    data = line_end;
+  }
+
+  // 块内完整的行原地处理，只复制最后未结束的行
+  const uint8_t* complete_end = LineStart(data, end);
+  if (!ProcessLines(data, complete_end)) {
+    return false;
+  }
+  if (!finished_) {
+    partial_.assign(reinterpret_cast<const char*>(complete_end),
+                    end - complete_end);
+  }
+  return true;
+}
+
+bool GrepOutputSink::Flush() {
+  return downstream_.Flush();
+}
+
+bool GrepOutputSink::Close() {
+  bool result = true;
+  if (!partial_.empty() && !finished_) {
+    const uint8_t* line = reinterpret_cast<const uint8_t*>(partial_.data());
+    result = ProcessLines(line, line + partial_.size());
+    partial_.clear();
+  }
+  return downstream_.Close() && result;
+}
+
+bool GrepOutputSink::ProcessLines(const uint8_t* begin, const uint8_t* end) {
+  const uint8_t* position = begin;
+  // 下一个可能的诊断行位置，跨越多次查找复用
+  const uint8_t* next_diagnostic = nullptr;
+
+  while (position < end && !finished_) {
+    // 匹配行之后的下文逐行处理，其中的匹配行重新开始计算下文
+    if (after_left_ > 0) {
+      const uint8_t* line_end = NextLine(position, end);
+      bool matched = match_count_ < options_.max_count ||
+                     options_.max_count == 0;
+      if (matched && IsMatch(position, TrimNewline(position, line_end))) {
+        if (!EmitMatch(position, line_end)) {
+          return false;
+        }
+      } else {
+        if (!IsDiagnostic(position, line_end) || options_.keep_diagnostics) {
+          if (!EmitLine(position, line_end)) {
+            return false;
+          }
+        }
+        after_left_--;
+      }
+      position = line_end;
+      continue;
+    }
+    if (options_.max_count != 0 && match_count_ >= options_.max_count) {
+      finished_ = true;
+      break;
+    }
+
+    // 跳到下一个可能匹配的位置：字面子串或（需要输出时）诊断行
+    const uint8_t* candidate =
+        position + prefilter_.Find(position, end - position);
+    if (options_.keep_diagnostics) {
+      if (next_diagnostic == nullptr || next_diagnostic < position) {
+        next_diagnostic =
+            position + diagnostic_searcher_.Find(position, end - position);
+      }
+      candidate = std::min(candidate, next_diagnostic);
+    }
+    if (candidate == end) {
+      RememberSkipped(position, end);
+      break;
+    }
+
+    const uint8_t* line = LineStart(position, candidate);
+    const uint8_t* line_end = NextLine(candidate, end);
+    RememberSkipped(position, line);
+    if (IsDiagnostic(line, line_end)) {
+      // 诊断行不计入匹配，也不作为上下文
+      if (options_.keep_diagnostics && !EmitLine(line, line_end)) {
+        return false;
+      }
+    } else if (IsMatch(line, TrimNewline(line, line_end))) {
+      if (!EmitMatch(line, line_end)) {
+        return false;
+      }
+    } else {
+      RememberSkipped(line, line_end);
+    }
+    position = line_end;
+  }
+
+  if (options_.max_count != 0 && match_count_ >= options_.max_count &&
+      after_left_ == 0) {
+    finished_ = true;
+  }
+  return true;
+}
+
+bool GrepOutputSink::IsMatch(const uint8_t* line,
+                             const uint8_t* line_end) const {
+  if (IsDiagnostic(line, line_end)) {
+    return false;
+  }
+  size_t length = static_cast<size_t>(line_end - line);
+  if (prefilter_.Find(line, length) == length &&
+      !prefilter_.needle().empty()) {
+    return false;
+  }
+  if (!regex_) {
+    return true;
+  }
+  const char* text = reinterpret_cast<const char*>(line);
+  return std::regex_search(text, text + length, *regex_);
+}
+
+bool GrepOutputSink::IsDiagnostic(const uint8_t* line,
+                                  const uint8_t* line_end) {
+  size_t prefix_size = sizeof(kDiagnosticPrefix) - 1;
+  return static_cast<size_t>(line_end - line) >= prefix_size &&
+         std::memcmp(line, kDiagnosticPrefix, prefix_size) == 0;
+}
+
+bool GrepOutputSink::EmitMatch(const uint8_t* line, const uint8_t* line_end) {
+  if (options_.context_lines > 0) {
+    // 与上一组输出之间有未输出的行时加分隔行
+    if (has_output_ && skipped_since_output_ > before_lines_.size() &&
+        !downstream_.Write(reinterpret_cast<const uint8_t*>(kGroupSeparator),
+                           sizeof(kGroupSeparator) - 1)) {
+      return false;
+    }
+    for (const std::string& before : before_lines_) {
+      if (!downstream_.Write(reinterpret_cast<const uint8_t*>(before.data()),
+                             before.size())) {
+        return false;
+      }
+    }
+  }
+  match_count_++;
+  after_left_ = options_.context_lines;
+  return EmitLine(line, line_end);
+}
+
+void GrepOutputSink::RememberSkipped(const uint8_t* begin,
+                                     const uint8_t* end) {
+  if (options_.context_lines == 0 || begin >= end) {
+    return;
+  }
+
+  // 从末尾向前取最多context_lines行，诊断行不作为上下文
+  size_t limit = options_.context_lines;
+  std::deque<std::string> lines;
+  size_t skipped = 0;
+  const uint8_t* line_end = end;
+  while (line_end > begin && skipped <= limit) {
+    const uint8_t* line = LineStart(begin, line_end - 1);
+    if (!IsDiagnostic(line, line_end)) {
+      lines.emplace_front(reinterpret_cast<const char*>(line),
+                          line_end - line);
+      skipped++;
+    }
+    line_end = line;
+  }
+
+  // 超过上下文行数之后的行只影响分隔行，不再保留
+  skipped_since_output_ = std::min(skipped_since_output_ + skipped, limit + 1);
+  for (std::string& line : lines) {
+    before_lines_.push_back(std::move(line));
+  }
+  while (before_lines_.size() > limit) {
+    before_lines_.pop_front();
+  }
+}
+
+bool GrepOutputSink::EmitLine(const uint8_t* line, const uint8_t* line_end) {
+  before_lines_.clear();
+  skipped_since_output_ = 0;
+  has_output_ = true;
+  return downstream_.Write(line, line_end - line);
+}
+
+}  // namespace xlog_decode
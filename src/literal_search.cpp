@@ -0,0 +1,159 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// literal_search.cpp - LiteralSearcher类的实现
+
+#include "literal_search.h"
+
+#include <cstring>
+
+#include "magic_scanner.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define XLOG_DECODE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#define XLOG_DECODE_TARGET_AVX2
+#else
+#define XLOG_DECODE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace xlog_decode {
+
+namespace {
+
+size_t FindScalar(const uint8_t* data,
+                  size_t size,
+                  const uint8_t* needle,
+                  size_t needle_size) {
+  if (needle_size > size) {
+    return size;
+  }
+  const uint8_t* last = data + (size - needle_size);
+  for (const uint8_t* ptr = data; ptr <= last; ++ptr) {
+    ptr = static_cast<const uint8_t*>(
+        std::memchr(ptr, needle[0], static_cast<size_t>(last - ptr) + 1));
+    if (ptr == nullptr) {
+      break;
+    }
+    if (std::memcmp(ptr + 1, needle + 1, needle_size - 1) == 0) {
+      return static_cast<size_t>(ptr - data);
+    }
+  }
+  return size;
+}
+
+#if defined(XLOG_DECODE_X86)
+
+inline unsigned CountTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER)
+  unsigned long index = 0;
+  _BitScanForward(&index, mask);
+  return static_cast<unsigned>(index);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+// 逐个确认首尾字节都相同的候选位置，找到时返回true
+inline bool VerifyMask(uint32_t mask,
+                       const uint8_t* base,
+                       const uint8_t* needle,
+                       size_t needle_size,
+                       size_t* offset) {
+  while (mask != 0) {
+    unsigned bit = CountTrailingZeros(mask);
+    if (std::memcmp(base + bit + 1, needle + 1, needle_size - 2) == 0) {
+      *offset = bit;
+      return true;
+    }
+    mask &= mask - 1;
+  }
+  return false;
+}
+
+size_t FindSse2(const uint8_t* data,
+                size_t size,
+                const uint8_t* needle,
+                size_t needle_size) {
+  const __m128i first = _mm_set1_epi8(static_cast<char>(needle[0]));
+  const __m128i last =
+      _mm_set1_epi8(static_cast<char>(needle[needle_size - 1]));
+  size_t i = 0;
+  for (; i + needle_size - 1 + 16 <= size; i += 16) {
+    __m128i block_first =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    __m128i block_last = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(data + i + needle_size - 1));
+    uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last))));
+    size_t offset = 0;
+    if (VerifyMask(mask, data + i, needle, needle_size, &offset)) {
+      return i + offset;
+    }
+  }
+  return i + FindScalar(data + i, size - i, needle, needle_size);
+}
+
+XLOG_DECODE_TARGET_AVX2
+size_t FindAvx2(const uint8_t* data,
+                size_t size,
+                const uint8_t* needle,
+                size_t needle_size) {
+  const __m256i first = _mm256_set1_epi8(static_cast<char>(needle[0]));
+  const __m256i last =
+      _mm256_set1_epi8(static_cast<char>(needle[needle_size - 1]));
+  size_t i = 0;
+  for (; i + needle_size - 1 + 32 <= size; i += 32) {
+    __m256i block_first =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    __m256i block_last = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(data + i + needle_size - 1));
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first),
+                         _mm256_cmpeq_epi8(block_last, last))));
+    size_t offset = 0;
+    if (VerifyMask(mask, data + i, needle, needle_size, &offset)) {
+      return i + offset;
+    }
+  }
+  return i + FindScalar(data + i, size - i, needle, needle_size);
+}
+
+#endif  // XLOG_DECODE_X86
+
+}  // namespace
+
+LiteralSearcher::LiteralSearcher(const std::string& needle)
+    : needle_(needle) {}
+
+size_t LiteralSearcher::Find(const uint8_t* data, size_t size) const {
+  const uint8_t* needle = reinterpret_cast<const uint8_t*>(needle_.data());
+  size_t needle_size = needle_.size();
+  if (needle_size == 0) {
+    return 0;
+  }
+  if (needle_size == 1) {
+    // 单字节直接使用memchr，库实现本身已经向量化
+    const void* found = std::memchr(data, needle[0], size);
+    return found != nullptr
+               ? static_cast<size_t>(static_cast<const uint8_t*>(found) - data)
+               : size;
+  }
+
+  switch (MagicScanner::ActiveImplementation()) {
+#if defined(XLOG_DECODE_X86)
+    case MagicScanner::Implementation::kAvx2:
+      return FindAvx2(data, size, needle, needle_size);
+    case MagicScanner::Implementation::kSse2:
+      return FindSse2(data, size, needle, needle_size);
+#endif
+    default:
+      return FindScalar(data, size, needle, needle_size);
+  }
+}
+
+}  // namespace xlog_decode
@@ -0,0 +1,267 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// magic_scanner.cpp - MagicScanner类的实现
+
+#include "magic_scanner.h"
+
+#include <cstring>
+
+#include "xlog_constants.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define XLOG_DECODE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#define XLOG_DECODE_TARGET_AVX2
+#else
+#define XLOG_DECODE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace xlog_decode {
+
+namespace {
+
+// 魔数集合是连续区间[0x03, 0x0D]，减去下界后做一次无符号比较即可
+constexpr uint8_t kMagicFirst = MAGIC_NO_COMPRESS_START;
+constexpr uint8_t kMagicSpan =
+    MAGIC_ASYNC_NO_CRYPT_ZSTD_START - MAGIC_NO_COMPRESS_START;
+
+using CollectFunc = size_t (*)(const uint8_t*, size_t, size_t*, size_t,
+                               size_t*);
+
+size_t CollectScalar(const uint8_t* data,
+                     size_t size,
+                     size_t* positions,
+                     size_t max_positions,
+                     size_t* scanned) {
+  size_t count = 0;
+  size_t i = 0;
+  for (; i < size && count < max_positions; ++i) {
+    if (static_cast<uint8_t>(data[i] - kMagicFirst) <= kMagicSpan) {
+      positions[count++] = i;
+    }
+  }
+  *scanned = i;
+  return count;
+}
+
+#if defined(XLOG_DECODE_X86)
+
+inline unsigned CountTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER)
+  unsigned long index = 0;
+  _BitScanForward(&index, mask);
+  return static_cast<unsigned>(index);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+// 将一个向量的匹配位图展开为位置，达到上限时返回false
+inline bool EmitMask(uint32_t mask,
+                     size_t base,
+                     size_t* positions,
+                     size_t max_positions,
+                     size_t* count,
+                     size_t* scanned) {
+  while (mask != 0) {
+    unsigned bit = CountTrailingZeros(mask);
+    if (*count == max_positions) {
+      *scanned = base + bit;
+      return false;
+    }
+    positions[(*count)++] = base + bit;
+    mask &= mask - 1;
+  }
+  return true;
+}
+
+// 用标量实现处理不足一个向量的尾部，位置换算为相对data
+size_t CollectTail(const uint8_t* data,
+                   size_t size,
+                   size_t start,
+                   size_t* positions,
+                   size_t max_positions,
+                   size_t* scanned) {
+  size_t tail_scanned = 0;
+  size_t count = CollectScalar(data + start, size - start, positions,
+                               max_positions, &tail_scanned);
+  for (size_t j = 0; j < count; ++j) {
+    positions[j] += start;
+  }
+  *scanned = start + tail_scanned;
+  return count;
+}
+
+size_t CollectSse2(const uint8_t* data,
+                   size_t size,
+                   size_t* positions,
+                   size_t max_positions,
+                   size_t* scanned) {
+  const __m128i bias = _mm_set1_epi8(static_cast<char>(kMagicFirst));
+  const __m128i span = _mm_set1_epi8(static_cast<char>(kMagicSpan));
+  size_t count = 0;
+  size_t i = 0;
+
+  for (; i + 16 <= size; i += 16) {
+    __m128i value =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    __m128i shifted = _mm_sub_epi8(value, bias);
+    // min(x, span) == x 等价于无符号 x <= span
+    __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(shifted, span), shifted);
+    uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(in_range));
+    if (!EmitMask(mask, i, positions, max_positions, &count, scanned)) {
+      return count;
+    }
+  }
+
+  return count + CollectTail(data, size, i, positions + count,
+                             max_positions - count, scanned);
+}
+
+XLOG_DECODE_TARGET_AVX2
+size_t CollectAvx2(const uint8_t* data,
+                   size_t size,
+                   size_t* positions,
+                   size_t max_positions,
+                   size_t* scanned) {
+  const __m256i bias = _mm256_set1_epi8(static_cast<char>(kMagicFirst));
+  const __m256i span = _mm256_set1_epi8(static_cast<char>(kMagicSpan));
+  size_t count = 0;
+  size_t i = 0;
+
+  for (; i + 32 <= size; i += 32) {
+    __m256i value =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    __m256i shifted = _mm256_sub_epi8(value, bias);
+    __m256i in_range =
+        _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, span), shifted);
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(in_range));
+    if (!EmitMask(mask, i, positions, max_positions, &count, scanned)) {
+      return count;
+    }
+  }
+
+  return count + CollectTail(data, size, i, positions + count,
+                             max_positions - count, scanned);
+}
+
+bool CpuSupportsAvx2() {
+#if defined(_MSC_VER)
+  int info[4] = {0};
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  __cpuid(info, 1);
+  bool os_saves_ymm = (info[2] & (1 << 27)) != 0 &&
+                      (_xgetbv(0) & 0x6) == 0x6;
+  __cpuidex(info, 7, 0);
+  return os_saves_ymm && (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif  // XLOG_DECODE_X86
+
+MagicScanner::Implementation DetectImplementation() {
+#if defined(XLOG_DECODE_X86)
+  if (CpuSupportsAvx2()) {
+    return MagicScanner::Implementation::kAvx2;
+  }
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  return MagicScanner::Implementation::kSse2;
+#endif
+#endif
+  return MagicScanner::Implementation::kScalar;
+}
+
+CollectFunc GetCollectFunc(MagicScanner::Implementation implementation) {
+  switch (implementation) {
+#if defined(XLOG_DECODE_X86)
+    case MagicScanner::Implementation::kAvx2:
+      return CollectAvx2;
+    case MagicScanner::Implementation::kSse2:
+      return CollectSse2;
+#endif
+    default:
+      return CollectScalar;
+  }
+}
+
+MagicScanner::Implementation g_implementation = DetectImplementation();
+CollectFunc g_collect = GetCollectFunc(g_implementation);
+
+}  // namespace
+
+size_t MagicScanner::FindFirst(const uint8_t* data, size_t size) {
+  size_t position = size;
+  size_t scanned = 0;
+  g_collect(data, size, &position, 1, &scanned);
+  return position;
+}
+
+size_t MagicScanner::Collect(const uint8_t* data,
+                             size_t size,
+                             size_t* positions,
+                             size_t max_positions,
+                             size_t* scanned) {
+  return g_collect(data, size, positions, max_positions, scanned);
+}
+
+size_t MagicScanner::FilterByTrailer(const uint8_t* data,
+                                     size_t size,
+                                     size_t* positions,
+                                     size_t count) {
+  size_t kept = 0;
+  for (size_t i = 0; i < count; ++i) {
+    size_t position = positions[i];
+    if (position + 9 <= size) {
+      uint32_t length = 0;
+      std::memcpy(&length, data + position + 5, sizeof(length));
+      uint64_t trailer = static_cast<uint64_t>(position) +
+                         GetHeaderLen(data[position]) + length;
+      if (trailer < size && data[trailer] != MAGIC_END) {
+        continue;
+      }
+    }
+    positions[kept++] = position;
+  }
+  return kept;
+}
+
+MagicScanner::Implementation MagicScanner::ActiveImplementation() {
+  return g_implementation;
+}
+
+bool MagicScanner::ForceImplementation(Implementation implementation) {
+  Implementation best = DetectImplementation();
+  if (static_cast<int>(implementation) > static_cast<int>(best)) {
+    return false;
+  }
+  g_implementation = implementation;
+  g_collect = GetCollectFunc(implementation);
+  return true;
+}
+
+const char* MagicScanner::ImplementationName(Implementation implementation) {
+  switch (implementation) {
+    case Implementation::kAvx2:
+      return "avx2";
+    case Implementation::kSse2:
+      return "sse2";
+    default:
+      return "scalar";
+  }
+}
+
+}  // namespace xlog_decode
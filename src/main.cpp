@@ -3,15 +3,36 @@
 //
 // main.cpp - xlog_decode工具的主入口点
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "columnar_log.h"
+#include "console_output.h"
+#include "decode_manifest.h"
+#include "decode_stats.h"
+#include "decode_trace.h"
 #include "file_utils.h"
+#include "grep_output_sink.h"
+#include "output_sink.h"
+#include "structured_output_sink.h"
+#include "thread_pool.h"
 #include "xlog_constants.h"
+#include "xlog_crypt.h"
 #include "xlog_decoder.h"
+#include "xlog_index.h"
+#include "zip_archive.h"
 
 // 版本信息现在由构建系统通过XLOG_DECODE_VERSION宏提供
 
@@ -31,6 +52,8 @@ void PrintUsage() {
   std::cout << "Commands:\n";
   std::cout
       << "  decode   - Decode one or more XLOG files (recursive by default)\n";
+  std::cout << "  index    - Write a .xidx block index next to each XLOG "
+               "file (recursive by default)\n";
   std::cout << "  clean    - Delete all decoded files in a directory "
                "(recursive by default)\n";
   std::cout << "  help     - Show this help information\n\n";
@@ -38,6 +61,51 @@ void PrintUsage() {
   std::cout << "  --no-recursive    - Disable recursive processing\n";
   std::cout << "  --keep-errors     - Don't skip blocks with errors during "
                "decoding\n";
+  std::cout << "  --stream          - Decode block by block with bounded "
+               "memory\n";
+  std::cout << "  --resync-chain N  - Require N chained valid blocks when "
+               "resyncing after corrupt data (default 1)\n";
+  std::cout << "  --threads N       - Decompress blocks of a file on N threads "
+               "(0 = all cores, default 1)\n";
+  std::cout << "  --jobs N          - Decode N files of a directory at once, "
+               "largest first (0 = all cores, default 1)\n";
+  std::cout << "  --stdout          - Write decoded text to standard output "
+               "instead of <file>_.log\n";
+  std::cout << "  --flush-threshold N - Buffer up to N bytes of output "
+               "before writing (0 = write every block, default 65536)\n";
+  std::cout << "  --write-index     - Also write a .xidx block index while "
+               "decoding\n";
+  std::cout << "  --no-index        - Ignore existing .xidx indexes\n";
+  std::cout << "  --blocks A-B      - Decode only blocks A to B (0-based, "
+               "inclusive) using the index, not with --keep-errors\n";
+  std::cout << "  --follow          - Keep decoding blocks appended to a single "
+               "file until interrupted\n";
+  std::cout << "  --incremental     - Skip files unchanged since the last decode "
+               "of the directory and resume appended ones\n";
+  std::cout << "  --grep PATTERN    - Keep only decoded lines containing "
+               "PATTERN\n";
+  std::cout << "  --regex           - Treat the --grep pattern as an "
+               "ECMAScript regular expression\n";
+  std::cout << "  --context N       - Also print N lines before and after "
+               "each match\n";
+  std::cout << "  --max-count N     - Stop decoding a file after N matching "
+               "lines\n";
+  std::cout << "  --keep-diagnostics - Keep [F]xlog_decode diagnostic lines "
+               "when filtering\n";
+  std::cout << "  --format F        - Write records as text (default), json "
+               "lines, csv, tsv or columnar (<file>_.xcol)\n";
+  std::cout << "  --private-key F   - Decrypt encrypted blocks with the hex "
+               "private key in file F\n";
+  std::cout << "  --zip-split       - Decode each XLOG entry of a ZIP file to "
+               "<file>.zip_/<entry>_.log instead of one combined output\n";
+  std::cout << "  --stats[=json]    - Report per-stage timings and counters "
+               "for each file and the whole batch\n";
+  std::cout << "  --trace F         - Write a Chrome trace-event timeline of "
+               "the decode to F (open in Perfetto)\n";
+  std::cout << "  --from-hour H     - Decode only blocks written from hour H "
+               "(0-23, default 0)\n";
+  std::cout << "  --to-hour H       - Decode only blocks written up to hour H "
+               "(0-23, default 23, may wrap past midnight)\n";
   std::cout << "  --version         - Show version information\n\n";
   std::cout << "Examples:\n";
   std::cout
@@ -48,16 +116,329 @@ void PrintUsage() {
                "files in directory and subdirectories\n";
   std::cout << "  xlog_decode decode --no-recursive path/to/dir - Decode XLOG "
                "files only in the top directory\n";
+  std::cout << "  xlog_decode index path/to/file.xlog     - Index a file for "
+               "fast repeated decodes\n";
   std::cout << "  xlog_decode clean path/to/dir           - Delete all decoded "
                "files in directory and subdirectories\n";
 }
 
-// 解码单个文件
-bool DecodeFile(const std::string& file_path, bool skip_error_blocks) {
+// --stats的输出格式
+enum class StatsFormat {
+  kNone,  // 不统计
+  kText,  // 每个文件的结果后附一行摘要，最后给出合计
+  kJson,  // 每个文件一行JSON对象，最后一行为不带file字段的合计
+};
+
+// 解码命令的选项
+struct DecodeOptions {
+  bool skip_error_blocks = true;
+  bool streaming = false;
+  int resync_chain_length = 1;
+  size_t thread_count = 1;
+  size_t job_count = 1;
+  bool to_stdout = false;
+  size_t flush_threshold = BufferedOutputSink::kDefaultFlushThreshold;
+  bool use_index = true;
+  bool write_index = false;
+  bool has_block_range = false;
+  size_t first_block = 0;
+  size_t block_count = 0;
+  int from_hour = -1;
+  int to_hour = -1;
+  bool follow = false;
+  bool incremental = false;
+  bool grep = false;
+  GrepOptions grep_options;
+  OutputFormat format = OutputFormat::kText;
+  std::shared_ptr<XlogKeyRing> key_ring;  // 所有文件共用，公钥只派生一次
+  bool zip_split = false;
+  StatsFormat stats = StatsFormat::kNone;
+  std::string trace_file;  // 为空时不记录时间线
+};
+
+// 增量解码中需要重新检查内容的文件
+struct IncrementalFile {
+  std::string relative_path;
+  const DecodeManifestEntry* previous = nullptr;  // 上次的记录，没有时为空
+  DecodeManifestEntry current;                    // 本次解码后的记录
+  bool decoded = false;
+};
+
+// 跟踪模式收到中断信号后结束
+volatile std::sig_atomic_t g_stop_requested = 0;
+
+void HandleStopSignal(int) {
+  g_stop_requested = 1;
+}
+
+// 解析"A-B"、"A-"或"A"形式的块范围（从0开始，包含两端）
+bool ParseBlockRange(const std::string& text, DecodeOptions* options) {
+  char* end = nullptr;
+  unsigned long long first = std::strtoull(text.c_str(), &end, 10);
+  if (end == text.c_str() || text[0] == '-') {
+    return false;
+  }
+  unsigned long long last = first;
+  if (*end == '-') {
+    const char* last_text = end + 1;
+    if (*last_text == '\0') {
+      last = SIZE_MAX - 1;
+      end = const_cast<char*>(last_text);
+    } else {
+      last = std::strtoull(last_text, &end, 10);
+      if (end == last_text) {
+        return false;
+      }
+    }
+  }
+  if (*end != '\0' || last < first) {
+    return false;
+  }
+  options->has_block_range = true;
+  options->first_block = static_cast<size_t>(first);
+  options->block_count = static_cast<size_t>(last - first + 1);
+  return true;
+}
+
+// 批量解码的统计合计，由g_stats_mutex保护
+std::mutex g_stats_mutex;
+DecodeStats g_total_stats;
+
+// 把一个文件的统计累加到合计中，返回附加在结果行之后的统计行
+std::string StatsLines(const DecodeOptions& options,
+                       const std::string& file_path,
+                       const DecodeStats& stats) {
+  if (options.stats == StatsFormat::kNone) {
+    return std::string();
+  }
+  {
+    std::lock_guard<std::mutex> lock(g_stats_mutex);
+    g_total_stats.Add(stats);
+  }
+  if (options.stats == StatsFormat::kJson) {
+    return "\n" + stats.ToJson(file_path);
+  }
+  return "\n  stats: " + stats.ToText();
+}
+
+// 批量解码结束后输出统计合计
+void PrintStatsTotal(const DecodeOptions& options, std::ostream& status) {
+  if (options.stats == StatsFormat::kJson) {
+    PrintLine(status, g_total_stats.ToJson());
+  } else if (options.stats == StatsFormat::kText) {
+    PrintLine(status, "Stats total: " + g_total_stats.ToText());
+  }
+}
+
+// 按选项配置解码器
+void ConfigureDecoder(const DecodeOptions& options, XlogDecoder* decoder) {
+  decoder->set_resync_chain_length(options.resync_chain_length);
+  decoder->set_thread_count(options.thread_count);
+  decoder->set_use_index(options.use_index);
+  decoder->set_write_index(options.write_index);
+  decoder->set_key_ring(options.key_ring);
+  decoder->set_collect_stats(options.stats != StatsFormat::kNone);
+  if (options.from_hour >= 0 || options.to_hour >= 0) {
+    // 只给出一端时，另一端取当天的开始或结束
+    decoder->set_hour_range(options.from_hour >= 0 ? options.from_hour : 0,
+                            options.to_hour >= 0 ? options.to_hour : 23);
+  }
+}
+
+// 输出文件路径，列式存储使用.xcol扩展名
+std::string OutputFilename(const std::string& file_path,
+                           const DecodeOptions& options) {
+  std::string output_file = XlogDecoder::GenerateOutputFilename(file_path);
+  if (options.format == OutputFormat::kColumnar) {
+    output_file.replace(output_file.size() - 3, 3, "xcol");
+  }
+  return output_file;
+}
+
+// 写入输出之前的转换：先按行过滤，再转换为结构化格式
+struct OutputChain {
+  std::unique_ptr<ColumnarOutputSink> columnar;
+  std::unique_ptr<StructuredOutputSink> structured;
+  std::unique_ptr<GrepOutputSink> grep;
+};
+
+// 按选项在sink之前套上需要的转换，返回解码器应写入的sink
+OutputSink* BuildOutputChain(const DecodeOptions& options,
+                             OutputSink* sink,
+                             OutputChain* chain) {
+  if (options.format == OutputFormat::kColumnar) {
+    chain->columnar = std::make_unique<ColumnarOutputSink>(*sink);
+    sink = chain->columnar.get();
+  } else if (options.format != OutputFormat::kText) {
+    chain->structured =
+        std::make_unique<StructuredOutputSink>(*sink, options.format);
+    sink = chain->structured.get();
+  }
+  if (options.grep) {
+    chain->grep = std::make_unique<GrepOutputSink>(*sink, options.grep_options);
+    sink = chain->grep.get();
+  }
+  return sink;
+}
+
+// 写入文件的完整输出链，ZIP的每个条目各使用一个
+class FileOutputChain : public OutputSink {
+ public:
+  FileOutputChain(const std::string& output_file, const DecodeOptions& options)
+      : file_(output_file, options.flush_threshold),
+        target_(BuildOutputChain(options, &file_, &chain_)) {}
+
+  bool Write(const uint8_t* data, size_t size) override {
+    return target_->Write(data, size);
+  }
+  bool Flush() override { return target_->Flush(); }
+  bool Close() override { return target_->Close(); }
+  bool WantsMore() const override { return target_->WantsMore(); }
+
+ private:
+  FileOutputSink file_;
+  OutputChain chain_;
+  OutputSink* target_;
+};
+
+// 把ZIP中的每个XLOG条目分别解码到<file>.zip_/<条目路径>_.log
+bool DecodeZipSplit(const std::string& file_path,
+                    const DecodeOptions& options) {
+  XlogDecoder decoder;
+  ConfigureDecoder(options, &decoder);
+  std::string output_dir = file_path + "_";
+  auto start_time = std::chrono::high_resolution_clock::now();
+
+  std::atomic<size_t> entry_count(0);
+  bool result = decoder.DecodeZipEntries(
+      file_path,
+      [&](const std::string& entry) -> std::unique_ptr<OutputSink> {
+        // 条目路径来自压缩包，拒绝可能写到输出目录之外的路径
+        if (!ZipArchive::IsSafeEntryName(entry)) {
+          return nullptr;
+        }
+        std::string output_file =
+            OutputFilename(FileUtils::JoinPath(output_dir, entry), options);
+        // 多个条目可能同时创建同一目录
+        std::string parent = FileUtils::GetDirectoryName(output_file);
+        if (!FileUtils::CreateDirectory(parent) &&
+            !FileUtils::IsDirectory(parent)) {
+          return nullptr;
+        }
+        entry_count++;
+        return std::make_unique<FileOutputChain>(output_file, options);
+      },
+      options.skip_error_blocks);
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::high_resolution_clock::now() - start_time);
+
+  std::ostringstream line;
+  if (result) {
+    line << output_dir << " (cost: " << duration.count() << "ms, "
+         << entry_count << " entries";
+    if (decoder.hour_skipped_blocks() > 0) {
+      line << ", " << decoder.hour_skipped_blocks() << " blocks outside hours";
+    }
+    line << ")" << StatsLines(options, file_path, decoder.stats());
+    PrintLine(std::cout, line.str());
+  } else {
+    line << "Failed to decode file: " << file_path
+         << " (cost: " << duration.count() << "ms)"
+         << StatsLines(options, file_path, decoder.stats());
+    PrintLine(std::cerr, line.str());
+  }
+  return result;
+}
+
+// 跟踪单个正在增长的文件，直到收到中断信号
+int FollowFile(const std::string& file_path, const DecodeOptions& options) {
+  XlogDecoder decoder;
+  ConfigureDecoder(options, &decoder);
+
+  std::string output_file =
+      options.to_stdout ? "<stdout>" : OutputFilename(file_path, options);
+  std::unique_ptr<BufferedOutputSink> sink;
+  if (options.to_stdout) {
+    sink = std::make_unique<StdoutOutputSink>(options.flush_threshold);
+  } else {
+    sink =
+        std::make_unique<FileOutputSink>(output_file, options.flush_threshold);
+  }
+
+  std::signal(SIGINT, HandleStopSignal);
+  std::signal(SIGTERM, HandleStopSignal);
+  std::ostream& status = options.to_stdout ? std::cerr : std::cout;
+  status << "Following " << file_path << " -> " << output_file
+         << " (Ctrl+C to stop)" << std::endl;
+
+  OutputChain chain;
+  OutputSink* target = BuildOutputChain(options, sink.get(), &chain);
+  bool result = decoder.Follow(file_path, *target,
+                               [] { return g_stop_requested != 0; });
+  status << "Stopped following " << file_path << " ("
+         << sink->bytes_written() << " bytes decoded)" << std::endl;
+  return result ? 0 : 1;
+}
+
+// 影响解码输出的选项，记录在增量解码清单中
+std::string IncrementalOptionsKey(const DecodeOptions& options) {
+  return "keep-errors=" + std::to_string(options.skip_error_blocks ? 0 : 1) +
+         " resync-chain=" + std::to_string(options.resync_chain_length) +
+         " hours=" + std::to_string(options.from_hour) + "," +
+         std::to_string(options.to_hour) +
+         " decrypt=" + std::to_string(options.key_ring != nullptr ? 1 : 0);
+}
+
+// 增量解码前比较文件内容：内容没有变化且输出完好时返回false，不需要解码；
+// 只追加了数据时把输出截断到上次最后一个完整块之后，resume置为true
+bool PrepareIncremental(const std::string& file_path,
+                        const std::string& output_file,
+                        IncrementalFile* incremental,
+                        bool* resume) {
+  const DecodeManifestEntry* previous = incremental->previous;
+  ManifestChange change =
+      DecodeManifest::Compare(file_path, previous, &incremental->current);
+  uint64_t output_size = 0;
+  int64_t output_time = 0;
+  bool output_intact =
+      previous != nullptr &&
+      FileUtils::GetFileStatus(output_file, &output_size, &output_time) &&
+      output_size == previous->output_size;
+
+  // 只是修改时间变了（例如被touch或复制），沿用上次的结果
+  if (change == ManifestChange::kUnchanged && output_intact) {
+    incremental->current.output_size = previous->output_size;
+    incremental->current.resume = previous->resume;
+    incremental->decoded = true;
+    return false;
+  }
+
+  *resume = change == ManifestChange::kAppended && output_intact &&
+            FileUtils::TruncateFile(output_file,
+                                    previous->resume.output_offset);
+  return true;
+}
+
+// 解码单个文件；incremental不为空时按清单记录跳过或续解，成功后更新记录
+bool DecodeFile(const std::string& file_path,
+                const DecodeOptions& options,
+                IncrementalFile* incremental = nullptr) {
+  TraceSpan span("file", file_path);
   try {
+    if (options.zip_split && XlogDecoder::IsZipFile(file_path)) {
+      return DecodeZipSplit(file_path, options);
+    }
+
     xlog_decode::XlogDecoder decoder;
+    ConfigureDecoder(options, &decoder);
     std::string output_file =
-        xlog_decode::XlogDecoder::GenerateOutputFilename(file_path);
+        options.to_stdout ? "<stdout>" : OutputFilename(file_path, options);
+
+    bool resume = false;
+    if (incremental != nullptr &&
+        !PrepareIncremental(file_path, output_file, incremental, &resume)) {
+      return true;
+    }
 
     // 获取输入文件大小
     auto input_file_size = xlog_decode::FileUtils::GetFileSize(file_path);
@@ -66,37 +447,267 @@ bool DecodeFile(const std::string& file_path, bool skip_error_blocks) {
     // 添加时间测量
     auto start_time = std::chrono::high_resolution_clock::now();
 
-    bool result = decoder.DecodeFile(file_path, output_file, skip_error_blocks);
+    // 解码结果逐块写入输出，不在内存中累积整个文件
+    std::unique_ptr<BufferedOutputSink> sink;
+    if (options.to_stdout) {
+      sink = std::make_unique<StdoutOutputSink>(options.flush_threshold);
+    } else {
+      auto file_sink = std::make_unique<FileOutputSink>(
+          output_file, options.flush_threshold);
+      file_sink->set_append(resume);
+      sink = std::move(file_sink);
+    }
+    OutputChain chain;
+    OutputSink* target = BuildOutputChain(options, sink.get(), &chain);
+
+    bool result = false;
+    if (resume) {
+      // 只解码上次最后一个完整块之后追加的数据，接在已截断的输出后面
+      result = decoder.DecodeFrom(file_path, *target,
+                                  incremental->previous->resume,
+                                  options.skip_error_blocks);
+    } else if (options.has_block_range) {
+      // 按索引只解码指定的块
+      result = decoder.DecodeBlocks(file_path, *target, options.first_block,
+                                    options.block_count);
+    } else if (options.streaming) {
+      // 以固定大小窗口逐块读取输入
+      result = decoder.DecodeFileStreaming(file_path, *target,
+                                           options.skip_error_blocks);
+    } else {
+      result =
+          decoder.DecodeFile(file_path, *target, options.skip_error_blocks);
+    }
 
     // 计算经过时间
     auto end_time = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
         end_time - start_time);
 
+    // 小时窗口外的文件解码成功但没有输出，输出文件只在首次写出时创建，
+    // 这里写一个空文件，避免留下旧的解码结果
+    if (result && !options.to_stdout && !resume &&
+        sink->bytes_written() == 0) {
+      result = FileUtils::WriteFile(output_file, {});
+    }
+
+    if (result && incremental != nullptr) {
+      incremental->current.resume = decoder.resume_point();
+      incremental->current.output_size =
+          (resume ? incremental->previous->resume.output_offset : 0) +
+          sink->bytes_written();
+      incremental->decoded = true;
+    }
+
+    std::ostringstream line;
     if (result) {
-      // 获取输出文件大小
-      auto output_file_size = xlog_decode::FileUtils::GetFileSize(output_file);
+      // 获取输出大小
       double output_size_mb =
-          static_cast<double>(output_file_size) / (1024 * 1024);
+          static_cast<double>(sink->bytes_written()) / (1024 * 1024);
 
-      std::cout << output_file << " (cost: " << duration.count() << "ms, "
-                << "size: " << std::fixed << std::setprecision(2)
-                << input_size_mb << "MB -> " << output_size_mb << "MB)"
-                << std::endl;
+      line << output_file << " (cost: " << duration.count() << "ms, "
+           << "size: " << std::fixed << std::setprecision(2) << input_size_mb
+           << "MB -> " << output_size_mb << "MB";
+      if (resume) {
+        line << ", resumed at offset "
+             << incremental->previous->resume.input_offset;
+      }
+      if (chain.grep) {
+        line << ", " << chain.grep->match_count() << " matches";
+      }
+      if (decoder.used_index()) {
+        line << ", indexed";
+      }
+      if (decoder.hour_skipped_blocks() > 0) {
+        line << ", " << decoder.hour_skipped_blocks()
+             << " blocks outside hours";
+      }
+      // 文件开头有无法解析的数据时给出提示
+      if (decoder.leading_bytes_skipped() > 0) {
+        line << ", skipped " << decoder.leading_bytes_skipped()
+             << " leading bytes";
+      }
+      line << ")" << StatsLines(options, file_path, decoder.stats());
+      // 输出写到标准输出时，结果信息改写到标准错误
+      PrintLine(options.to_stdout ? std::cerr : std::cout, line.str());
       return true;
     } else {
-      std::cerr << "Failed to decode file: " << file_path
-                << " (cost: " << duration.count() << "ms, "
-                << "size: " << std::fixed << std::setprecision(2)
-                << input_size_mb << "MB)" << std::endl;
+      line << "Failed to decode file: " << file_path
+           << " (cost: " << duration.count() << "ms, "
+           << "size: " << std::fixed << std::setprecision(2) << input_size_mb
+           << "MB)" << StatsLines(options, file_path, decoder.stats());
+      PrintLine(std::cerr, line.str());
       return false;
     }
   } catch (const std::exception& e) {
-    std::cerr << "Error decoding file: " << e.what() << std::endl;
+    PrintLine(std::cerr, std::string("Error decoding file: ") + e.what());
     return false;
   }
 }
 
+// 批量解码多个文件，返回成功的文件数
+// incremental不为空时与files一一对应，按清单记录增量解码
+int DecodeFiles(const std::vector<std::string>& files,
+                const DecodeOptions& options,
+                std::vector<IncrementalFile>* incremental = nullptr) {
+  auto incremental_at = [incremental](size_t i) {
+    return incremental != nullptr ? &(*incremental)[i] : nullptr;
+  };
+
+  size_t job_count = ThreadPool::ResolveThreadCount(options.job_count);
+  // 多个文件写到标准输出时必须逐个解码，避免内容交错
+  if (job_count <= 1 || files.size() <= 1 || options.to_stdout) {
+    int success_count = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+      if (DecodeFile(files[i], options, incremental_at(i))) {
+        success_count++;
+      }
+    }
+    return success_count;
+  }
+
+  // 大文件先开始，避免最后只剩一个大文件在单个线程上拖尾
+  std::vector<std::pair<uint64_t, size_t>> sized_files;
+  sized_files.reserve(files.size());
+  for (size_t i = 0; i < files.size(); ++i) {
+    sized_files.emplace_back(xlog_decode::FileUtils::GetFileSize(files[i]), i);
+  }
+  std::stable_sort(
+      sized_files.begin(), sized_files.end(),
+      [](const auto& a, const auto& b) { return a.first > b.first; });
+
+  std::atomic<int> success_count(0);
+  ThreadPool pool(std::min(job_count, files.size()));
+  for (const auto& sized_file : sized_files) {
+    const std::string* file = &files[sized_file.second];
+    IncrementalFile* record = incremental_at(sized_file.second);
+    pool.Submit([file, record, &options, &success_count] {
+      if (DecodeFile(*file, options, record)) {
+        success_count++;
+      }
+    });
+  }
+  pool.Wait();
+  return success_count;
+}
+
+// 文件相对于根目录的路径
+std::string RelativePath(const std::string& root, const std::string& file) {
+  size_t start = file.compare(0, root.size(), root) == 0 ? root.size() : 0;
+  start = file.find_first_not_of("/\\", start);
+  return start == std::string::npos ? file : file.substr(start);
+}
+
+// 按根目录下的清单增量解码目录：大小和修改时间都没变的文件直接跳过，
+// 其余文件比较内容后完整解码或只解码追加的部分，最后写回清单
+int DecodeIncremental(const std::string& root,
+                      const std::vector<std::string>& files,
+                      const DecodeOptions& options,
+                      std::ostream& status) {
+  std::string manifest_file = DecodeManifest::ManifestPathFor(root);
+  DecodeManifest previous(IncrementalOptionsKey(options));
+  previous.Load(manifest_file);
+  DecodeManifest next(IncrementalOptionsKey(options));
+
+  std::vector<std::string> changed_files;
+  std::vector<IncrementalFile> changed;
+  for (const auto& file : files) {
+    std::string relative_path = RelativePath(root, file);
+    const DecodeManifestEntry* entry = previous.Find(relative_path);
+    if (entry != nullptr &&
+        DecodeManifest::IsUpToDate(
+            file, XlogDecoder::GenerateOutputFilename(file), *entry)) {
+      next.Set(relative_path, *entry);
+      continue;
+    }
+    changed_files.push_back(file);
+    changed.emplace_back();
+    changed.back().relative_path = relative_path;
+    changed.back().previous = entry;
+  }
+
+  size_t unchanged_count = files.size() - changed_files.size();
+  status << "Found " << files.size() << " XLOG files, " << unchanged_count
+         << " unchanged since the last decode" << std::endl;
+  int success_count = 0;
+  if (!changed_files.empty()) {
+    success_count = DecodeFiles(changed_files, options, &changed);
+    status << "Decoded " << success_count << " out of "
+           << changed_files.size() << " changed files" << std::endl;
+    PrintStatsTotal(options, status);
+  }
+
+  // 解码失败的文件不记录，下次重新解码；已删除的文件随之从清单中移除
+  for (const auto& record : changed) {
+    if (record.decoded) {
+      next.Set(record.relative_path, record.current);
+    }
+  }
+  if ((!changed.empty() || next.size() != previous.size()) &&
+      !next.Save(manifest_file)) {
+    std::cerr << "Failed to write manifest: " << manifest_file << std::endl;
+  }
+  return (changed_files.empty() || success_count > 0) ? 0 : 1;
+}
+
+// 按选项解码一个文件或目录，选项已通过检查
+int DecodePath(const std::string& path,
+               bool recursive,
+               const DecodeOptions& options) {
+  if (options.follow) {
+    return FollowFile(path, options);
+  }
+
+  // 解码内容写到标准输出时，状态信息改写到标准错误
+  std::ostream& status = options.to_stdout ? std::cerr : std::cout;
+
+  if (xlog_decode::FileUtils::IsDirectory(path)) {
+    // 处理目录
+    std::vector<std::string> extensions = {kXlogFileExt, kMmapFileExt};
+    // 压缩包无法按追加的数据续解，增量解码时不处理
+    if (!options.incremental) {
+      extensions.push_back(kZipFileExt);
+    }
+
+    status << "Searching for XLOG files" << (recursive ? " (recursively)" : "")
+           << "..." << std::endl;
+    std::vector<std::string> files;
+    {
+      TraceSpan span("scan", path);
+      files =
+          xlog_decode::FileUtils::ScanDirectory(path, extensions, recursive);
+    }
+
+    if (files.empty()) {
+      status << "No XLOG files found in the specified directory" << std::endl;
+      return 0;
+    }
+
+    if (options.incremental) {
+      return DecodeIncremental(path, files, options, status);
+    }
+
+    status << "Found " << files.size() << " XLOG files, starting decode..."
+           << std::endl;
+    int success_count = DecodeFiles(files, options);
+
+    status << "Decoded " << success_count << " out of " << files.size()
+           << " files" << std::endl;
+    PrintStatsTotal(options, status);
+    return (success_count > 0) ? 0 : 1;
+  } else {
+    // 处理单个文件
+    if (!xlog_decode::XlogDecoder::IsXlogFile(path) &&
+        !xlog_decode::FileUtils::HasExtension(path, kZipFileExt)) {
+      std::cerr << "Warning: File does not have a recognized XLOG extension: "
+                << path << std::endl;
+      status << "Attempting to decode anyway..." << std::endl;
+    }
+
+    return DecodeFile(path, options) ? 0 : 1;
+  }
+}
+
 // 处理解码命令
 int ProcessDecodeCommand(const std::vector<std::string>& args) {
   if (args.empty()) {
@@ -106,7 +717,7 @@ int ProcessDecodeCommand(const std::vector<std::string>& args) {
   }
 
   bool recursive = true;  // 默认启用递归
-  bool skip_error_blocks = true;
+  DecodeOptions options;
   std::string path;
 
   // 解析选项
@@ -114,7 +725,112 @@ int ProcessDecodeCommand(const std::vector<std::string>& args) {
     if (args[i] == "--no-recursive") {
       recursive = false;  // 禁用递归搜索的选项
     } else if (args[i] == "--keep-errors") {
-      skip_error_blocks = false;
+      options.skip_error_blocks = false;
+    } else if (args[i] == "--stream") {
+      options.streaming = true;
+    } else if (args[i] == "--resync-chain" && i + 1 < args.size()) {
+      options.resync_chain_length = std::atoi(args[++i].c_str());
+      if (options.resync_chain_length < 1) {
+        std::cerr << "Error: --resync-chain must be at least 1" << std::endl;
+        return 1;
+      }
+    } else if (args[i] == "--threads" && i + 1 < args.size()) {
+      int thread_count = std::atoi(args[++i].c_str());
+      if (thread_count < 0) {
+        std::cerr << "Error: --threads must not be negative" << std::endl;
+        return 1;
+      }
+      options.thread_count = static_cast<size_t>(thread_count);
+    } else if (args[i] == "--jobs" && i + 1 < args.size()) {
+      int job_count = std::atoi(args[++i].c_str());
+      if (job_count < 0) {
+        std::cerr << "Error: --jobs must not be negative" << std::endl;
+        return 1;
+      }
+      options.job_count = static_cast<size_t>(job_count);
+    } else if (args[i] == "--stdout") {
+      options.to_stdout = true;
+    } else if (args[i] == "--flush-threshold" && i + 1 < args.size()) {
+      long long flush_threshold = std::atoll(args[++i].c_str());
+      if (flush_threshold < 0) {
+        std::cerr << "Error: --flush-threshold must not be negative"
+                  << std::endl;
+        return 1;
+      }
+      options.flush_threshold = static_cast<size_t>(flush_threshold);
+    } else if (args[i] == "--write-index") {
+      options.write_index = true;
+    } else if (args[i] == "--follow") {
+      options.follow = true;
+    } else if (args[i] == "--incremental") {
+      options.incremental = true;
+    } else if (args[i] == "--grep" && i + 1 < args.size()) {
+      options.grep = true;
+      options.grep_options.pattern = args[++i];
+    } else if (args[i] == "--regex") {
+      options.grep_options.regex = true;
+    } else if (args[i] == "--context" && i + 1 < args.size()) {
+      int context_lines = std::atoi(args[++i].c_str());
+      if (context_lines < 0) {
+        std::cerr << "Error: --context must not be negative" << std::endl;
+        return 1;
+      }
+      options.grep_options.context_lines = static_cast<size_t>(context_lines);
+    } else if (args[i] == "--max-count" && i + 1 < args.size()) {
+      long long max_count = std::atoll(args[++i].c_str());
+      if (max_count < 0) {
+        std::cerr << "Error: --max-count must not be negative" << std::endl;
+        return 1;
+      }
+      options.grep_options.max_count = static_cast<uint64_t>(max_count);
+    } else if (args[i] == "--keep-diagnostics") {
+      options.grep_options.keep_diagnostics = true;
+    } else if (args[i] == "--format" && i + 1 < args.size()) {
+      if (!ParseOutputFormat(args[++i], &options.format)) {
+        std::cerr << "Error: --format expects text, json, csv, tsv or "
+                     "columnar"
+                  << std::endl;
+        return 1;
+      }
+    } else if (args[i] == "--private-key" && i + 1 < args.size()) {
+      options.key_ring = std::make_shared<XlogKeyRing>();
+      if (!options.key_ring->LoadPrivateKeyFile(args[++i])) {
+        std::cerr << "Error: --private-key expects a file with a 64-digit "
+                     "hex secp256k1 private key"
+                  << std::endl;
+        return 1;
+      }
+    } else if (args[i] == "--zip-split") {
+      options.zip_split = true;
+    } else if (args[i] == "--stats" || args[i].compare(0, 8, "--stats=") == 0) {
+      std::string format = args[i] == "--stats" ? "text" : args[i].substr(8);
+      if (format == "text") {
+        options.stats = StatsFormat::kText;
+      } else if (format == "json") {
+        options.stats = StatsFormat::kJson;
+      } else {
+        std::cerr << "Error: --stats expects text or json" << std::endl;
+        return 1;
+      }
+    } else if (args[i] == "--trace" && i + 1 < args.size()) {
+      options.trace_file = args[++i];
+    } else if (args[i] == "--no-index") {
+      options.use_index = false;
+    } else if ((args[i] == "--from-hour" || args[i] == "--to-hour") &&
+               i + 1 < args.size()) {
+      int hour = std::atoi(args[i + 1].c_str());
+      if (hour < 0 || hour > 23) {
+        std::cerr << "Error: " << args[i] << " must be between 0 and 23"
+                  << std::endl;
+        return 1;
+      }
+      (args[i] == "--from-hour" ? options.from_hour : options.to_hour) = hour;
+      ++i;
+    } else if (args[i] == "--blocks" && i + 1 < args.size()) {
+      if (!ParseBlockRange(args[++i], &options)) {
+        std::cerr << "Error: --blocks expects A-B, A- or A" << std::endl;
+        return 1;
+      }
     } else if (path.empty()) {
       path = args[i];
     }
@@ -131,43 +847,140 @@ int ProcessDecodeCommand(const std::vector<std::string>& args) {
     return 1;
   }
 
-  if (xlog_decode::FileUtils::IsDirectory(path)) {
-    // 处理目录
-    std::vector<std::string> extensions = {kXlogFileExt, kMmapFileExt};
+  std::string grep_error;
+  if (options.grep &&
+      !GrepOutputSink::Validate(options.grep_options, &grep_error)) {
+    std::cerr << "Error: invalid --grep pattern: " << grep_error << std::endl;
+    return 1;
+  }
+  if ((options.grep || options.format != OutputFormat::kText) &&
+      options.incremental) {
+    std::cerr << "Error: --grep and --format cannot be combined with "
+                 "--incremental"
+              << std::endl;
+    return 1;
+  }
 
-    std::cout << "Searching for XLOG files"
-              << (recursive ? " (recursively)" : "") << "..." << std::endl;
-    std::vector<std::string> files =
-        xlog_decode::FileUtils::ScanDirectory(path, extensions, recursive);
+  if (options.follow && xlog_decode::FileUtils::IsDirectory(path)) {
+    std::cerr << "Error: --follow requires a single file" << std::endl;
+    return 1;
+  }
 
-    if (files.empty()) {
-      std::cout << "No XLOG files found in the specified directory"
-                << std::endl;
-      return 0;
-    }
+  if (options.zip_split && options.to_stdout) {
+    std::cerr << "Error: --zip-split cannot be combined with --stdout"
+              << std::endl;
+    return 1;
+  }
 
-    std::cout << "Found " << files.size() << " XLOG files, starting decode..."
+  // 索引描述跳过错误块时的完整解码结果，--keep-errors时块编号没有意义
+  if (options.has_block_range && !options.skip_error_blocks) {
+    std::cerr << "Error: --blocks cannot be combined with --keep-errors"
               << std::endl;
-    int success_count = 0;
-    for (const auto& file : files) {
-      if (DecodeFile(file, skip_error_blocks)) {
-        success_count++;
-      }
-    }
+    return 1;
+  }
 
-    std::cout << "Decoded " << success_count << " out of " << files.size()
-              << " files" << std::endl;
-    return (success_count > 0) ? 0 : 1;
+  if (options.incremental &&
+      (!xlog_decode::FileUtils::IsDirectory(path) || options.to_stdout ||
+       options.has_block_range)) {
+    std::cerr << "Error: --incremental requires a directory and cannot be "
+                 "combined with --stdout or --blocks"
+              << std::endl;
+    return 1;
+  }
+
+  if (options.trace_file.empty()) {
+    return DecodePath(path, recursive, options);
+  }
+
+  // 时间线在所有文件解码结束、工作线程全部空闲之后写出
+  TraceRecorder::Instance().Start();
+  int result = DecodePath(path, recursive, options);
+  TraceRecorder::Instance().Stop();
+  if (!TraceRecorder::Instance().WriteJson(options.trace_file)) {
+    std::cerr << "Failed to write trace: " << options.trace_file << std::endl;
+    return 1;
+  }
+  std::ostream& status = options.to_stdout ? std::cerr : std::cout;
+  status << "Trace written to " << options.trace_file << " ("
+         << TraceRecorder::Instance().event_count() << " spans)" << std::endl;
+  return result;
+}
+
+// 为单个文件建立索引
+bool IndexFile(const std::string& file_path, int resync_chain_length) {
+  XlogDecoder decoder;
+  decoder.set_resync_chain_length(resync_chain_length);
+
+  auto start_time = std::chrono::high_resolution_clock::now();
+  bool result = decoder.BuildIndex(file_path);
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::high_resolution_clock::now() - start_time);
+
+  std::ostringstream line;
+  if (result) {
+    line << XlogIndex::IndexPathFor(file_path) << " (cost: " << duration.count()
+         << "ms, blocks: " << decoder.index()->entries().size() << ")";
+    PrintLine(std::cout, line.str());
   } else {
-    // 处理单个文件
-    if (!xlog_decode::XlogDecoder::IsXlogFile(path)) {
-      std::cerr << "Warning: File does not have a recognized XLOG extension: "
-                << path << std::endl;
-      std::cout << "Attempting to decode anyway..." << std::endl;
+    line << "Failed to index file: " << file_path;
+    PrintLine(std::cerr, line.str());
+  }
+  return result;
+}
+
+// 处理索引命令
+int ProcessIndexCommand(const std::vector<std::string>& args) {
+  bool recursive = true;  // 默认启用递归
+  int resync_chain_length = 1;
+  std::string path;
+
+  // 解析选项
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "--no-recursive") {
+      recursive = false;
+    } else if (args[i] == "--resync-chain" && i + 1 < args.size()) {
+      resync_chain_length = std::atoi(args[++i].c_str());
+      if (resync_chain_length < 1) {
+        std::cerr << "Error: --resync-chain must be at least 1" << std::endl;
+        return 1;
+      }
+    } else if (path.empty()) {
+      path = args[i];
     }
+  }
+
+  if (path.empty()) {
+    std::cerr << "Error: Missing path argument for index command\n\n";
+    PrintUsage();
+    return 1;
+  }
+
+  if (!xlog_decode::FileUtils::PathExists(path)) {
+    std::cerr << "Error: Path does not exist: " << path << std::endl;
+    return 1;
+  }
+
+  if (!xlog_decode::FileUtils::IsDirectory(path)) {
+    return IndexFile(path, resync_chain_length) ? 0 : 1;
+  }
+
+  std::vector<std::string> extensions = {kXlogFileExt, kMmapFileExt};
+  std::vector<std::string> files =
+      xlog_decode::FileUtils::ScanDirectory(path, extensions, recursive);
+  if (files.empty()) {
+    std::cout << "No XLOG files found in the specified directory" << std::endl;
+    return 0;
+  }
 
-    return DecodeFile(path, skip_error_blocks) ? 0 : 1;
+  int success_count = 0;
+  for (const auto& file : files) {
+    if (IndexFile(file, resync_chain_length)) {
+      success_count++;
+    }
   }
+  std::cout << "Indexed " << success_count << " out of " << files.size()
+            << " files" << std::endl;
+  return (success_count > 0) ? 0 : 1;
 }
 
 // 处理清理命令
@@ -211,8 +1024,11 @@ int ProcessCleanCommand(const std::vector<std::string>& args) {
             << (recursive ? " (recursively)" : "") << "..." << std::endl;
   std::vector<std::string> files =
       xlog_decode::FileUtils::FindDecodedFiles(path, recursive);
+  // --zip-split的输出目录在其中的文件删除后一并删除
+  std::vector<std::string> zip_dirs =
+      xlog_decode::FileUtils::FindZipOutputDirectories(path, recursive);
 
-  if (files.empty()) {
+  if (files.empty() && zip_dirs.empty()) {
     std::cout << "No decoded files found in the specified directory"
               << std::endl;
     return 0;
@@ -230,6 +1046,15 @@ int ProcessCleanCommand(const std::vector<std::string>& args) {
 
   std::cout << "Deleted " << deleted_count << " out of " << files.size()
             << " decoded files" << std::endl;
+
+  // 目录中还有其他文件时保留
+  for (const auto& dir : zip_dirs) {
+    if (xlog_decode::FileUtils::RemoveEmptyDirectories(dir)) {
+      std::cout << "Removed directory: " << dir << std::endl;
+    } else {
+      std::cout << "Kept non-empty directory: " << dir << std::endl;
+    }
+  }
   return 0;
 }
 
@@ -338,6 +1163,8 @@ int main(int argc, char* argv[]) {
   // 处理命令
   if (command == "decode") {
     return ProcessDecodeCommand(args);
+  } else if (command == "index") {
+    return ProcessIndexCommand(args);
   } else if (command == "clean") {
     return ProcessCleanCommand(args);
   } else if (command == "help" || command == "--help") {
@@ -0,0 +1,207 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// mars_log_line.cpp - Mars日志行解析的实现
+
+#include "mars_log_line.h"
+
+namespace xlog_decode {
+
+namespace {
+// 日志头部由方括号括起的字段个数：级别、时间、进程线程、标签、源码位置
+constexpr int kHeaderFieldCount = 5;
+
+// 去掉两端的空格
+std::string_view Trim(std::string_view text) {
+  size_t begin = text.find_first_not_of(' ');
+  if (begin == std::string_view::npos) {
+    return std::string_view();
+  }
+  size_t end = text.find_last_not_of(' ');
+  return text.substr(begin, end - begin + 1);
+}
+
+bool IsDigits(std::string_view text) {
+  if (text.empty()) {
+    return false;
+  }
+  for (char c : text) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// 从text开头读取十进制数字，至少一位、至多max_digits位
+bool ReadNumber(std::string_view* text, size_t max_digits, int64_t* value) {
+  size_t digits = 0;
+  int64_t result = 0;
+  while (digits < text->size() && digits < max_digits &&
+         (*text)[digits] >= '0' && (*text)[digits] <= '9') {
+    result = result * 10 + ((*text)[digits] - '0');
+    digits++;
+  }
+  if (digits == 0) {
+    return false;
+  }
+  text->remove_prefix(digits);
+  *value = result;
+  return true;
+}
+
+// text以c开头时去掉c并返回true
+bool Consume(std::string_view* text, char c) {
+  if (text->empty() || text->front() != c) {
+    return false;
+  }
+  text->remove_prefix(1);
+  return true;
+}
+
+// 公历日期到1970-01-01的天数
+int64_t DaysFromCivil(int64_t year, int64_t month, int64_t day) {
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t year_of_era = year - era * 400;
+  int64_t day_of_year =
+      (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int64_t day_of_era = year_of_era * 365 + year_of_era / 4 -
+                       year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+// 解析"pid, tid"或"pid, tid*"
+bool ParseThread(std::string_view field, MarsLogRecord* record) {
+  size_t comma = field.find(',');
+  if (comma == std::string_view::npos) {
+    return false;
+  }
+  record->pid = Trim(field.substr(0, comma));
+  std::string_view tid = Trim(field.substr(comma + 1));
+  record->main_thread = !tid.empty() && tid.back() == '*';
+  if (record->main_thread) {
+    tid.remove_suffix(1);
+  }
+  record->tid = tid;
+  return true;
+}
+
+// 解析"file, func, line"或"file:line, func"
+void ParseLocation(std::string_view field, MarsLogRecord* record) {
+  size_t comma = field.find(',');
+  std::string_view first = Trim(field.substr(0, comma));
+  if (comma == std::string_view::npos) {
+    record->file = first;
+    return;
+  }
+  std::string_view rest = field.substr(comma + 1);
+  size_t last_comma = rest.rfind(',');
+  if (last_comma != std::string_view::npos &&
+      IsDigits(Trim(rest.substr(last_comma + 1)))) {
+    record->file = first;
+    record->function = Trim(rest.substr(0, last_comma));
+    record->line = Trim(rest.substr(last_comma + 1));
+    return;
+  }
+  size_t colon = first.rfind(':');
+  if (colon != std::string_view::npos && IsDigits(first.substr(colon + 1))) {
+    record->file = first.substr(0, colon);
+    record->line = first.substr(colon + 1);
+  } else {
+    record->file = first;
+  }
+  record->function = Trim(rest);
+}
+}  // namespace
+
+bool ParseMarsTimestamp(std::string_view timestamp, int64_t* epoch_ms) {
+  int64_t year = 0;
+  int64_t month = 0;
+  int64_t day = 0;
+  if (!ReadNumber(&timestamp, 4, &year) || !Consume(&timestamp, '-') ||
+      !ReadNumber(&timestamp, 2, &month) || !Consume(&timestamp, '-') ||
+      !ReadNumber(&timestamp, 2, &day) || !Consume(&timestamp, ' ') ||
+      month < 1 || month > 12 || day < 1 || day > 31) {
+    return false;
+  }
+
+  // 时区：+8.0、-3.5等，以分钟计
+  bool negative = Consume(&timestamp, '-');
+  if (!negative) {
+    Consume(&timestamp, '+');
+  }
+  int64_t zone_hours = 0;
+  int64_t zone_tenths = 0;
+  if (!ReadNumber(&timestamp, 2, &zone_hours)) {
+    return false;
+  }
+  if (Consume(&timestamp, '.') && !ReadNumber(&timestamp, 1, &zone_tenths)) {
+    return false;
+  }
+  int64_t zone_minutes = zone_hours * 60 + zone_tenths * 6;
+  if (negative) {
+    zone_minutes = -zone_minutes;
+  }
+
+  int64_t hour = 0;
+  int64_t minute = 0;
+  int64_t second = 0;
+  int64_t millisecond = 0;
+  if (!Consume(&timestamp, ' ') || !ReadNumber(&timestamp, 2, &hour) ||
+      !Consume(&timestamp, ':') || !ReadNumber(&timestamp, 2, &minute) ||
+      !Consume(&timestamp, ':') || !ReadNumber(&timestamp, 2, &second)) {
+    return false;
+  }
+  if (Consume(&timestamp, '.') && !ReadNumber(&timestamp, 3, &millisecond)) {
+    return false;
+  }
+
+  int64_t minutes = (DaysFromCivil(year, month, day) * 24 + hour) * 60 +
+                    minute - zone_minutes;
+  *epoch_ms = (minutes * 60 + second) * 1000 + millisecond;
+  return true;
+}
+
+bool ParseMarsLogLine(std::string_view line, MarsLogRecord* record) {
+  *record = MarsLogRecord();
+  if (!line.empty() && line.back() == '\n') {
+    line.remove_suffix(1);
+  }
+  if (!line.empty() && line.back() == '\r') {
+    line.remove_suffix(1);
+  }
+  record->message = line;
+
+  // 依次取出头部的各个[...]字段，最后一个[之后是消息
+  std::string_view fields[kHeaderFieldCount];
+  size_t pos = 0;
+  for (std::string_view& field : fields) {
+    if (pos >= line.size() || line[pos] != '[') {
+      return false;
+    }
+    size_t close = line.find(']', pos + 1);
+    if (close == std::string_view::npos) {
+      return false;
+    }
+    field = line.substr(pos + 1, close - pos - 1);
+    pos = close + 1;
+  }
+  if (pos >= line.size() || line[pos] != '[' || fields[0].empty()) {
+    return false;
+  }
+
+  MarsLogRecord parsed;
+  if (!ParseThread(fields[2], &parsed)) {
+    return false;
+  }
+  parsed.level = fields[0];
+  parsed.timestamp = fields[1];
+  parsed.tag = fields[3];
+  ParseLocation(fields[4], &parsed);
+  parsed.message = line.substr(pos + 1);
+  *record = parsed;
+  return true;
+}
+
+}  // namespace xlog_decode
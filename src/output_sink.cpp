@@ -0,0 +1,153 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// output_sink.cpp - 输出目标的实现
+
+#include "output_sink.h"
+
+#include <iostream>
+
+#if !defined(_WIN32)
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+#include "console_output.h"
+
+namespace xlog_decode {
+
+namespace {
+#if !defined(_WIN32)
+// 写出全部iovec，处理部分写入和信号中断
+bool WriteAll(int fd, struct iovec* iov, int iov_count) {
+  while (iov_count > 0) {
+    ssize_t written = writev(fd, iov, iov_count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+
+    size_t remaining = static_cast<size_t>(written);
+    while (iov_count > 0 && remaining >= iov->iov_len) {
+      remaining -= iov->iov_len;
+      ++iov;
+      --iov_count;
+    }
+    if (iov_count > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+      iov->iov_len -= remaining;
+    }
+  }
+  return true;
+}
+#endif
+}  // namespace
+
+BufferedOutputSink::BufferedOutputSink(size_t flush_threshold)
+    : flush_threshold_(flush_threshold) {}
+
+bool BufferedOutputSink::Write(const uint8_t* data, size_t size) {
+  bytes_written_ += size;
+  if (buffer_.size() + size < flush_threshold_) {
+    buffer_.insert(buffer_.end(), data, data + size);
+    return true;
+  }
+
+  // 缓冲数据与本次数据一起写出
+  bool result = WriteOut(buffer_.data(), buffer_.size(), data, size);
+  buffer_.clear();
+  return result;
+}
+
+bool BufferedOutputSink::Flush() {
+  if (buffer_.empty()) {
+    return true;
+  }
+  bool result = WriteOut(buffer_.data(), buffer_.size(), nullptr, 0);
+  buffer_.clear();
+  return result;
+}
+
+FileOutputSink::FileOutputSink(const std::string& file_path,
+                               size_t flush_threshold)
+    : BufferedOutputSink(flush_threshold), file_path_(file_path) {}
+
+FileOutputSink::FileOutputSink(std::FILE* stream,
+                               const std::string& name,
+                               size_t flush_threshold)
+    : BufferedOutputSink(flush_threshold),
+      file_path_(name),
+      file_(stream),
+      owns_file_(false) {}
+
+FileOutputSink::~FileOutputSink() {
+  Close();
+}
+
+bool FileOutputSink::WriteOut(const uint8_t* first,
+                              size_t first_size,
+                              const uint8_t* second,
+                              size_t second_size) {
+  if (file_ == nullptr) {
+    file_ = std::fopen(file_path_.c_str(), append_ ? "ab" : "wb");
+    if (file_ == nullptr) {
+      PrintLine(std::cerr, "Failed to create file: " + file_path_);
+      return false;
+    }
+  }
+
+#if defined(_WIN32)
+  bool result =
+      std::fwrite(first, 1, first_size, file_) == first_size &&
+      (second_size == 0 ||
+       std::fwrite(second, 1, second_size, file_) == second_size);
+#else
+  if (!owns_file_) {
+    // 直接写文件描述符前先写出stdio中已有的内容，保持顺序
+    std::fflush(file_);
+  }
+  struct iovec iov[2];
+  iov[0].iov_base = const_cast<uint8_t*>(first);
+  iov[0].iov_len = first_size;
+  iov[1].iov_base = const_cast<uint8_t*>(second);
+  iov[1].iov_len = second_size;
+  bool result = WriteAll(fileno(file_), iov, second_size > 0 ? 2 : 1);
+#endif
+
+  if (!result) {
+    PrintLine(std::cerr, "Failed to write to file: " + file_path_);
+  }
+  return result;
+}
+
+bool FileOutputSink::Close() {
+  bool result = Flush();
+  if (file_ == nullptr) {
+    return result;
+  }
+  if (owns_file_) {
+    if (std::fclose(file_) != 0) {
+      result = false;
+    }
+    file_ = nullptr;
+  } else if (std::fflush(file_) != 0) {
+    result = false;
+  }
+  return result;
+}
+
+StdoutOutputSink::StdoutOutputSink(size_t flush_threshold)
+    : FileOutputSink(stdout, "<stdout>", flush_threshold) {}
+
+StdoutOutputSink::~StdoutOutputSink() = default;
+
+bool BufferOutputSink::Write(const uint8_t* data, size_t size) {
+  buffer_.insert(buffer_.end(), data, data + size);
+  return true;
+}
+
+}  // namespace xlog_decode
@@ -0,0 +1,391 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// structured_output_sink.cpp - StructuredOutputSink类的实现
+
+#include "structured_output_sink.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace xlog_decode {
+
+namespace {
+// 各格式中需要转义（或引起整个字段加引号）的字节
+struct EscapeTable {
+  bool json[256];
+  bool csv[256];
+  bool tsv[256];
+
+  constexpr EscapeTable() : json(), csv(), tsv() {
+    for (int c = 0; c < 0x20; ++c) {
+      json[c] = true;
+    }
+    json['"'] = json['\\'] = true;
+    csv[','] = csv['"'] = csv['\r'] = csv['\n'] = true;
+    tsv['\t'] = tsv['\r'] = tsv['\n'] = tsv['\\'] = true;
+  }
+};
+constexpr EscapeTable kEscape;
+
+constexpr char kHexDigits[] = "0123456789abcdef";
+
+// 与列名行一致的字段顺序
+constexpr const char* kColumns[] = {"level", "time", "pid", "tid",
+                                    "main_thread", "tag", "file", "func",
+                                    "line", "message"};
+
+// 一条记录中除字段内容外的最大字节数（键名、引号、分隔符）
+constexpr size_t kRecordOverhead = 256;
+
+// JSON中一个字节最多转义为\u00XX六个字节
+constexpr size_t kMaxEscapeRatio = 6;
+
+bool IsNumber(std::string_view text) {
+  if (text.empty() || text.size() > 18) {
+    return false;
+  }
+  for (char c : text) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// 一次检查8个字节（SWAR）：x中是否有等于c或小于n的字节
+constexpr uint64_t kOnes = 0x0101010101010101ULL;
+constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+
+inline bool HasByte(uint64_t x, uint8_t c) {
+  uint64_t v = x ^ (kOnes * c);
+  return ((v - kOnes) & ~v & kHighBits) != 0;
+}
+
+inline bool HasByteLess(uint64_t x, uint8_t n) {
+  return ((x - kOnes * n) & ~x & kHighBits) != 0;
+}
+
+inline bool JsonNeedsEscape(uint64_t x) {
+  return HasByteLess(x, 0x20) || HasByte(x, '"') || HasByte(x, '\\');
+}
+
+inline bool CsvNeedsQuote(uint64_t x) {
+  return HasByte(x, ',') || HasByte(x, '"') || HasByte(x, '\r') ||
+         HasByte(x, '\n');
+}
+
+inline bool TsvNeedsEscape(uint64_t x) {
+  return HasByte(x, '\t') || HasByte(x, '\r') || HasByte(x, '\n') ||
+         HasByte(x, '\\');
+}
+
+// 跳过开头8字节一组都不需要处理的部分，原样复制到out，返回已处理的字节数
+template <bool (*NeedsEscape)(uint64_t)>
+inline size_t CopyPlainWords(std::string_view text, char** out) {
+  size_t i = 0;
+  for (; i + 8 <= text.size(); i += 8) {
+    uint64_t word;
+    std::memcpy(&word, text.data() + i, sizeof(word));
+    if (NeedsEscape(word)) {
+      break;
+    }
+    std::memcpy(*out + i, &word, sizeof(word));
+  }
+  *out += i;
+  return i;
+}
+
+inline char* WriteLiteral(const char* literal, size_t size, char* out) {
+  std::memcpy(out, literal, size);
+  return out + size;
+}
+
+template <size_t N>
+inline char* WriteLiteral(const char (&literal)[N], char* out) {
+  return WriteLiteral(literal, N - 1, out);
+}
+
+// 先按字节复制，遇到需要转义的字节时回退并写出转义序列；
+// 调用方保证out有足够空间，转义很少出现，分支几乎总能预测正确
+char* WriteJsonString(std::string_view text, char* out) {
+  *out++ = '"';
+  while (!text.empty()) {
+    text.remove_prefix(CopyPlainWords<JsonNeedsEscape>(text, &out));
+    if (text.empty()) {
+      break;
+    }
+    char ch = text.front();
+    text.remove_prefix(1);
+    unsigned char c = static_cast<unsigned char>(ch);
+    *out++ = ch;
+    if (!kEscape.json[c]) {
+      continue;
+    }
+    out[-1] = '\\';
+    switch (c) {
+      case '"':
+      case '\\':
+        *out++ = ch;
+        break;
+      case '\t':
+        *out++ = 't';
+        break;
+      case '\r':
+        *out++ = 'r';
+        break;
+      case '\n':
+        *out++ = 'n';
+        break;
+      default:
+        out = WriteLiteral("u00", out);
+        *out++ = kHexDigits[c >> 4];
+        *out++ = kHexDigits[c & 0x0F];
+        break;
+    }
+  }
+  *out++ = '"';
+  return out;
+}
+
+// 数字字段原样输出，其他内容按字符串输出
+char* WriteJsonNumber(std::string_view text, char* out) {
+  if (!IsNumber(text)) {
+    return WriteJsonString(text, out);
+  }
+  std::memcpy(out, text.data(), text.size());
+  return out + text.size();
+}
+
+// 含有逗号、引号或换行的字段整体加引号，字段内的引号写两次
+char* WriteCsvField(std::string_view text, char* out) {
+  size_t i = 0;
+  for (; i + 8 <= text.size(); i += 8) {
+    uint64_t word;
+    std::memcpy(&word, text.data() + i, sizeof(word));
+    if (CsvNeedsQuote(word)) {
+      break;
+    }
+  }
+  while (i < text.size() &&
+         !kEscape.csv[static_cast<unsigned char>(text[i])]) {
+    ++i;
+  }
+  if (i == text.size()) {
+    // 空字段的data()可能为空指针，不能交给memcpy
+    return std::copy(text.begin(), text.end(), out);
+  }
+  *out++ = '"';
+  for (char ch : text) {
+    *out++ = ch;
+    if (ch == '"') {
+      *out++ = '"';
+    }
+  }
+  *out++ = '"';
+  return out;
+}
+
+char* WriteTsvField(std::string_view text, char* out) {
+  while (!text.empty()) {
+    text.remove_prefix(CopyPlainWords<TsvNeedsEscape>(text, &out));
+    if (text.empty()) {
+      break;
+    }
+    char ch = text.front();
+    text.remove_prefix(1);
+    unsigned char c = static_cast<unsigned char>(ch);
+    *out++ = ch;
+    if (!kEscape.tsv[c]) {
+      continue;
+    }
+    out[-1] = '\\';
+    *out++ = c == '\t' ? 't' : c == '\r' ? 'r' : c == '\n' ? 'n' : '\\';
+  }
+  return out;
+}
+
+char* WriteJsonRecord(const MarsLogRecord& record, bool parsed, char* out) {
+  *out++ = '{';
+  if (parsed) {
+    out = WriteLiteral("\"level\":", out);
+    out = WriteJsonString(record.level, out);
+    out = WriteLiteral(",\"time\":", out);
+    out = WriteJsonString(record.timestamp, out);
+    out = WriteLiteral(",\"pid\":", out);
+    out = WriteJsonNumber(record.pid, out);
+    out = WriteLiteral(",\"tid\":", out);
+    out = WriteJsonNumber(record.tid, out);
+    out = record.main_thread ? WriteLiteral(",\"main_thread\":true", out)
+                             : WriteLiteral(",\"main_thread\":false", out);
+    out = WriteLiteral(",\"tag\":", out);
+    out = WriteJsonString(record.tag, out);
+    out = WriteLiteral(",\"file\":", out);
+    out = WriteJsonString(record.file, out);
+    out = WriteLiteral(",\"func\":", out);
+    out = WriteJsonString(record.function, out);
+    if (!record.line.empty()) {
+      out = WriteLiteral(",\"line\":", out);
+      out = WriteJsonNumber(record.line, out);
+    }
+    *out++ = ',';
+  }
+  out = WriteLiteral("\"message\":", out);
+  out = WriteJsonString(record.message, out);
+  return WriteLiteral("}\n", out);
+}
+
+// CSV和TSV只有字段写法和分隔符不同
+template <char kSeparator, char* (*WriteField)(std::string_view, char*)>
+char* WriteDelimitedRecord(const MarsLogRecord& record,
+                           bool parsed,
+                           char* out) {
+  const std::string_view main_thread =
+      !parsed ? std::string_view() : record.main_thread ? "1" : "0";
+  const std::string_view fields[] = {
+      record.level, record.timestamp, record.pid,
+      record.tid,   main_thread,      record.tag,
+      record.file,  record.function,  record.line};
+  for (std::string_view field : fields) {
+    out = WriteField(field, out);
+    *out++ = kSeparator;
+  }
+  out = WriteField(record.message, out);
+  *out++ = '\n';
+  return out;
+}
+}  // namespace
+
+bool ParseOutputFormat(const std::string& name, OutputFormat* format) {
+  if (name == "text") {
+    *format = OutputFormat::kText;
+  } else if (name == "json") {
+    *format = OutputFormat::kJson;
+  } else if (name == "csv") {
+    *format = OutputFormat::kCsv;
+  } else if (name == "tsv") {
+    *format = OutputFormat::kTsv;
+  } else if (name == "columnar") {
+    *format = OutputFormat::kColumnar;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+StructuredOutputSink::StructuredOutputSink(OutputSink& downstream,
+                                           OutputFormat format)
+    : downstream_(downstream), format_(format) {}
+
+bool StructuredOutputSink::Write(const uint8_t* data, size_t size) {
+  if (format_ == OutputFormat::kText) {
+    return downstream_.Write(data, size);
+  }
+  const char* begin = reinterpret_cast<const char*>(data);
+  const char* end = begin + size;
+
+  // 先补全上一次写入末尾未结束的行
+  if (!partial_.empty()) {
+    const void* newline = std::memchr(begin, '\n', size);
+    const char* line_end =
+        newline != nullptr ? static_cast<const char*>(newline) + 1 : end;
+    partial_.append(begin, line_end - begin);
+    if (partial_.back() != '\n') {
+      return true;
+    }
+    ConvertLines(partial_.data(), partial_.data() + partial_.size());
+    partial_.clear();
+    begin = line_end;
+  }
+
+  // 块内完整的行原地解析，只复制最后未结束的行
+  const char* complete_end = end;
+  while (complete_end > begin && complete_end[-1] != '\n') {
+    --complete_end;
+  }
+  ConvertLines(begin, complete_end);
+  partial_.assign(complete_end, end - complete_end);
+  return WriteOutput();
+}
+
+bool StructuredOutputSink::Flush() {
+  return downstream_.Flush();
+}
+
+bool StructuredOutputSink::Close() {
+  ConvertLines(partial_.data(), partial_.data() + partial_.size());
+  partial_.clear();
+  bool written = WriteOutput();
+  return downstream_.Close() && written;
+}
+
+void StructuredOutputSink::ConvertLines(const char* begin, const char* end) {
+  if (begin == end) {
+    return;
+  }
+  if (!header_written_ &&
+      (format_ == OutputFormat::kCsv || format_ == OutputFormat::kTsv)) {
+    char separator = format_ == OutputFormat::kCsv ? ',' : '\t';
+    for (const char* column : kColumns) {
+      Reserve(std::strlen(column) + 1);
+      char* out = WriteLiteral(column, std::strlen(column),
+                               &output_[output_size_]);
+      *out++ = separator;
+      output_size_ = out - output_.data();
+    }
+    output_[output_size_ - 1] = '\n';
+  }
+  header_written_ = true;
+
+  const char* line = begin;
+  while (line < end) {
+    const void* newline = std::memchr(line, '\n', end - line);
+    const char* line_end =
+        newline != nullptr ? static_cast<const char*>(newline) + 1 : end;
+    size_t line_size = static_cast<size_t>(line_end - line);
+    MarsLogRecord record;
+    bool parsed =
+        ParseMarsLogLine(std::string_view(line, line_size), &record);
+    // 空行没有任何内容，不产生记录
+    if (parsed || !record.message.empty()) {
+      // 按最坏情况预留空间，格式化时不再逐字节检查容量
+      Reserve(line_size * kMaxEscapeRatio + kRecordOverhead);
+      char* out = &output_[output_size_];
+      switch (format_) {
+        case OutputFormat::kJson:
+          out = WriteJsonRecord(record, parsed, out);
+          break;
+        case OutputFormat::kCsv:
+          out = WriteDelimitedRecord<',', WriteCsvField>(record, parsed, out);
+          break;
+        case OutputFormat::kTsv:
+          out = WriteDelimitedRecord<'\t', WriteTsvField>(record, parsed, out);
+          break;
+        case OutputFormat::kText:
+        case OutputFormat::kColumnar:
+          break;
+      }
+      output_size_ = out - output_.data();
+      record_count_++;
+    }
+    line = line_end;
+  }
+}
+
+void StructuredOutputSink::Reserve(size_t size) {
+  if (output_.size() - output_size_ < size) {
+    output_.resize(std::max(output_.size() * 2, output_size_ + size));
+  }
+}
+
+bool StructuredOutputSink::WriteOutput() {
+  if (output_size_ == 0) {
+    return true;
+  }
+  bool written = downstream_.Write(
+      reinterpret_cast<const uint8_t*>(output_.data()), output_size_);
+  output_size_ = 0;
+  return written;
+}
+
+}  // namespace xlog_decode
@@ -0,0 +1,110 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// thread_pool.cpp - ThreadPool类的实现
+
+#include "thread_pool.h"
+
+#include <utility>
+
+namespace xlog_decode {
+
+ThreadPool::ThreadPool(size_t thread_count) {
+  size_t count = ResolveThreadCount(thread_count);
+  queues_.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    queues_.push_back(std::make_unique<WorkerQueue>());
+  }
+  workers_.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    workers_.emplace_back([this, i] { WorkerLoop(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  task_available_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+size_t ThreadPool::ResolveThreadCount(size_t thread_count) {
+  if (thread_count == 0) {
+    thread_count = std::thread::hardware_concurrency();
+  }
+  return thread_count == 0 ? 1 : thread_count;
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+  pending_.fetch_add(1);
+  // 先计数再入队，queued_不会小于队列中的实际任务数
+  queued_.fetch_add(1);
+  size_t queue_index = next_queue_.fetch_add(1) % queues_.size();
+  WorkerQueue& queue = *queues_[queue_index];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+  }
+
+  // 空闲线程在mutex_下先登记idle_再检查queued_，这里先增加queued_再检查
+  // idle_，两者至少有一方能看到对方，不会丢失唤醒
+  if (idle_.load() > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_available_.notify_one();
+  }
+}
+
+void ThreadPool::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  all_done_.wait(lock, [this] { return pending_.load() == 0; });
+}
+
+bool ThreadPool::TakeTask(size_t worker_index, std::function<void()>* task) {
+  for (size_t i = 0; i < queues_.size(); ++i) {
+    WorkerQueue& queue = *queues_[(worker_index + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      *task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::WorkerLoop(size_t worker_index) {
+  std::function<void()> task;
+  while (true) {
+    if (TakeTask(worker_index, &task)) {
+      queued_.fetch_sub(1);
+      task();
+      task = nullptr;
+      if (pending_.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        all_done_.notify_all();
+      }
+      continue;
+    }
+
+    if (queued_.load() > 0) {
+      // 任务已计数但提交者尚未入队，稍后重试
+      std::this_thread::yield();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.fetch_add(1);
+    task_available_.wait(
+        lock, [this] { return stopping_ || queued_.load() > 0; });
+    idle_.fetch_sub(1);
+    if (queued_.load() == 0) {
+      return;
+    }
+  }
+}
+
+}  // namespace xlog_decode
@@ -0,0 +1,512 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// xlog_block_reader.cpp - XlogBlockReader类的实现
+
+#include "xlog_block_reader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "magic_scanner.h"
+
+namespace xlog_decode {
+
+namespace {
+// 重新同步时候选块允许的最大主体长度
+// Mars的日志缓冲区只有百KB级，更长的长度字段几乎都来自随机数据，
+// 若不加限制，伪长度恰好落在真实块尾部时会连同后续真实块一起通过链式校验
+constexpr uint32_t kMaxResyncBlockLength = 4 * 1024 * 1024;
+
+// 每批收集的魔数候选数量
+constexpr size_t kCandidateBatch = 256;
+}  // namespace
+
+XlogBlockReader::XlogBlockReader() = default;
+
+XlogBlockReader::~XlogBlockReader() = default;
+
+void XlogBlockReader::Attach(const uint8_t* data, size_t size) {
+  file_.Close();
+  window_.clear();
+  window_.shrink_to_fit();
+  window_start_ = 0;
+  window_len_ = 0;
+
+  data_ = data;
+  size_ = size;
+  cursor_ = 0;
+  UseIndex(nullptr, 0, 0);
+}
+
+bool XlogBlockReader::Open(const std::string& file_path, size_t window_size) {
+  Attach(nullptr, 0);
+
+  if (!file_.Open(file_path)) {
+    return false;
+  }
+
+  size_ = file_.Size();
+  window_size_ = std::max<size_t>(window_size, 1024);
+  return true;
+}
+
+void XlogBlockReader::Seek(uint64_t offset) {
+  cursor_ = std::min(offset, size_);
+  if (index_entries_ != nullptr) {
+    // 从第一个不早于新位置的块继续
+    next_entry_ = static_cast<size_t>(
+        std::lower_bound(index_entries_, index_entries_ + index_count_,
+                         cursor_,
+                         [](const XlogIndexEntry& entry, uint64_t value) {
+                           return entry.offset < value;
+                         }) -
+        index_entries_);
+  }
+}
+
+void XlogBlockReader::UseIndex(const XlogIndexEntry* entries,
+                               size_t count,
+                               uint64_t tail_skipped) {
+  index_entries_ = entries;
+  index_count_ = entries != nullptr ? count : 0;
+  index_tail_skipped_ = tail_skipped;
+  Seek(cursor_);
+}
+
+bool XlogBlockReader::FirstIndexedOffset(uint64_t* offset) const {
+  if (index_count_ == 0) {
+    return false;
+  }
+  *offset = index_entries_[0].offset;
+  return true;
+}
+
+const uint8_t* XlogBlockReader::Fetch(uint64_t offset, size_t len) {
+  if (offset > size_ || len > size_ - offset) {
+    return nullptr;
+  }
+
+  if (data_ != nullptr) {
+    return data_ + offset;
+  }
+
+  if (offset < window_start_ || offset + len > window_start_ + window_len_) {
+    if (!FillWindow(offset, len)) {
+      return nullptr;
+    }
+  }
+  return window_.data() + (offset - window_start_);
+}
+
+const uint8_t* XlogBlockReader::FetchAvailable(uint64_t offset,
+                                               size_t* available) {
+  if (offset >= size_) {
+    *available = 0;
+    return nullptr;
+  }
+
+  if (data_ != nullptr) {
+    *available = static_cast<size_t>(
+        std::min<uint64_t>(size_ - offset, SIZE_MAX));
+    return data_ + offset;
+  }
+
+  if (offset < window_start_ || offset >= window_start_ + window_len_) {
+    if (!FillWindow(offset, 1)) {
+      *available = 0;
+      return nullptr;
+    }
+  }
+  *available = static_cast<size_t>(window_start_ + window_len_ - offset);
+  return window_.data() + (offset - window_start_);
+}
+
+bool XlogBlockReader::ReadAt(uint64_t offset, void* dest, size_t len) {
+  if (offset > size_ || len > size_ - offset) {
+    return false;
+  }
+
+  if (data_ != nullptr) {
+    std::memcpy(dest, data_ + offset, len);
+    return true;
+  }
+
+  if (offset >= window_start_ && offset + len <= window_start_ + window_len_) {
+    std::memcpy(dest, window_.data() + (offset - window_start_), len);
+    return true;
+  }
+
+  // 窗口外的少量数据直接读取，保持窗口不动，避免扫描时反复装载
+  return file_.ReadAt(offset, dest, len) == len;
+}
+
+bool XlogBlockReader::FillWindow(uint64_t start, size_t min_len) {
+  // 超大块临时扩大窗口，使整个块在内存中连续
+  size_t capacity = std::max(window_size_, min_len);
+  if (window_.size() < capacity) {
+    window_.resize(capacity);
+  }
+
+  size_t want = static_cast<size_t>(
+      std::min<uint64_t>(window_.size(), size_ - start));
+
+  // 复用与新窗口重叠的已读数据
+  size_t kept = 0;
+  uint64_t window_end = window_start_ + window_len_;
+  if (start >= window_start_ && start < window_end) {
+    kept = static_cast<size_t>(std::min<uint64_t>(window_end - start, want));
+    std::memmove(window_.data(), window_.data() + (start - window_start_),
+                 kept);
+  }
+
+  window_start_ = start;
+  window_len_ = kept;
+
+  if (kept < want) {
+    window_len_ += file_.ReadAt(start + kept, window_.data() + kept,
+                                want - kept);
+  }
+
+  return window_len_ >= min_len;
+}
+
+bool XlogBlockReader::HasPlausibleLength(uint64_t offset) {
+  uint32_t length = 0;
+  if (!ReadAt(offset + 5, &length, sizeof(length))) {
+    return false;
+  }
+  return length <= kMaxResyncBlockLength;
+}
+
+bool XlogBlockReader::IsZeroTail(uint64_t offset) {
+  static const uint8_t kZeros[4096] = {0};
+  uint8_t chunk[sizeof(kZeros)];
+  uint64_t current = offset;
+  while (current < size_) {
+    size_t len =
+        static_cast<size_t>(std::min<uint64_t>(sizeof(chunk), size_ - current));
+    const uint8_t* bytes = chunk;
+    if (data_ != nullptr) {
+      bytes = data_ + current;
+    } else if (!ReadAt(current, chunk, len)) {
+      return false;
+    }
+    if (std::memcmp(bytes, kZeros, len) != 0) {
+      return false;
+    }
+    current += len;
+  }
+  return true;
+}
+
+bool XlogBlockReader::IsPendingTail(uint64_t offset) {
+  if (offset >= size_) {
+    return true;
+  }
+
+  uint8_t header[9];
+  size_t len = static_cast<size_t>(
+      std::min<uint64_t>(sizeof(header), size_ - offset));
+  if (!ReadAt(offset, header, len)) {
+    return false;
+  }
+  if (!IsMagicStart(header[0])) {
+    return IsZeroTail(offset);
+  }
+  if (len < sizeof(header)) {
+    return true;  // 头部还没有写完
+  }
+
+  uint32_t length = 0;
+  std::memcpy(&length, header + 5, sizeof(length));
+  if (length > kMaxResyncBlockLength) {
+    return false;
+  }
+  // 与IsValidLogBuffer的长度检查保持一致
+  uint64_t header_end = offset + GetHeaderLen(header[0]);
+  return header_end + 1 + 1 > size_ ||
+         header_end + length + GetTrailerLen() > size_;
+}
+
+bool XlogBlockReader::IsResyncFinal(uint64_t skipped_start, uint64_t offset) {
+  // 长度超过kMaxResyncBlockLength的候选位置不会被接受，只有离数据末尾
+  // 足够近的位置才可能是主体尚未写完的块
+  uint64_t reach = kMaxResyncBlockLength +
+                   GetHeaderLen(MAGIC_NO_COMPRESS_NO_CRYPT_START) +
+                   GetTrailerLen();
+  uint64_t pos = std::max(skipped_start, size_ > reach ? size_ - reach : 0);
+  while (pos < offset) {
+    size_t available = 0;
+    const uint8_t* data = FetchAvailable(pos, &available);
+    if (data == nullptr) {
+      return false;
+    }
+    size_t count = static_cast<size_t>(
+        std::min<uint64_t>(available, offset - pos));
+    for (size_t i = 0; i < count; ++i) {
+      if (IsMagicStart(data[i]) && IsPendingTail(pos + i)) {
+        return false;
+      }
+    }
+    pos += count;
+  }
+
+  // 链在数据末尾或零填充处提前结束时，追加的数据可能使链校验失败
+  uint64_t current = offset;
+  for (int32_t i = 0; i < resync_chain_length_; ++i) {
+    uint8_t header[9];
+    if (current + sizeof(header) > size_ ||
+        !ReadAt(current, header, sizeof(header)) ||
+        !IsMagicStart(header[0])) {
+      return false;
+    }
+    uint32_t length = 0;
+    std::memcpy(&length, header + 5, sizeof(length));
+    current += GetHeaderLen(header[0]) + static_cast<uint64_t>(length) +
+               GetTrailerLen();
+    if (current > size_) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool XlogBlockReader::IsValidLogBuffer(uint64_t offset,
+                                       int32_t count,
+                                       std::string* error) {
+  uint64_t current_offset = offset;
+  int32_t remaining_count = count;
+
+  while (true) {
+    if (current_offset == size_) {
+      return true;
+    }
+
+    // 只读取魔数、序列号、小时和长度字段
+    uint8_t header[9];
+    size_t header_bytes = static_cast<size_t>(
+        std::min<uint64_t>(sizeof(header), size_ - current_offset));
+    ReadAt(current_offset, header, header_bytes);
+
+    uint8_t magic_start = header[0];
+    if (!IsMagicStart(magic_start)) {
+      // 链中后续位置之后全为零（mmap3的零填充尾部）视为数据结束
+      if (current_offset != offset && magic_start == MAGIC_END &&
+          IsZeroTail(current_offset)) {
+        return true;
+      }
+      if (error != nullptr) {
+        std::ostringstream oss;
+        oss << "buffer[" << current_offset
+            << "]:" << static_cast<int>(magic_start) << " != MAGIC_NUM_START";
+        *error = oss.str();
+      }
+      return false;
+    }
+
+    uint32_t header_len = GetHeaderLen(magic_start);
+
+    if (current_offset + header_len + 1 + 1 > size_) {
+      if (error != nullptr) {
+        std::ostringstream oss;
+        oss << "offset:" << (current_offset + header_len + 1 + 1)
+            << " > buffer size:" << size_;
+        *error = oss.str();
+      }
+      return false;
+    }
+
+    // 从头部提取长度字段
+    uint32_t length = 0;
+    std::memcpy(&length, header + 5, sizeof(length));
+
+    if (current_offset + header_len + length + 1 > size_) {
+      if (error != nullptr) {
+        std::ostringstream oss;
+        oss << "log length:" << length << ", end pos "
+            << (current_offset + header_len + length + 1)
+            << " > buffer size:" << size_;
+        *error = oss.str();
+      }
+      return false;
+    }
+
+    uint8_t magic_end = 0;
+    ReadAt(current_offset + header_len + length, &magic_end, 1);
+    if (magic_end != MAGIC_END) {
+      if (error != nullptr) {
+        std::ostringstream oss;
+        oss << "log length:" << length << ", buffer["
+            << (current_offset + header_len + length)
+            << "]:" << static_cast<int>(magic_end) << " != MAGIC_END";
+        *error = oss.str();
+      }
+      return false;
+    }
+
+    // 递减计数器并更新当前偏移量
+    remaining_count--;
+    if (remaining_count <= 0) {
+      return true;
+    }
+
+    current_offset = current_offset + header_len + length + 1;
+  }
+}
+
+bool XlogBlockReader::FindLogStartPosition(uint64_t offset,
+                                           int32_t count,
+                                           uint64_t* position) {
+  uint64_t current = offset;
+
+  while (current < size_) {
+    // 在窗口内顺序查找魔数；校验只用ReadAt，不会移动窗口
+    size_t available = 0;
+    const uint8_t* chunk_data = FetchAvailable(current, &available);
+    if (chunk_data == nullptr) {
+      return false;
+    }
+
+    // 向量化批量收集魔数候选，并先用窗口内的尾部字节过滤
+    size_t scanned = 0;
+    while (scanned < available) {
+      size_t candidates[kCandidateBatch];
+      size_t batch_scanned = 0;
+      size_t candidate_count = MagicScanner::Collect(
+          chunk_data + scanned, available - scanned, candidates,
+          kCandidateBatch, &batch_scanned);
+      for (size_t i = 0; i < candidate_count; ++i) {
+        candidates[i] += scanned;
+      }
+      candidate_count = MagicScanner::FilterByTrailer(
+          chunk_data, available, candidates, candidate_count);
+
+      for (size_t i = 0; i < candidate_count; ++i) {
+        uint64_t candidate = current + candidates[i];
+        if (HasPlausibleLength(candidate) &&
+            IsValidLogBuffer(candidate, count, nullptr)) {
+          *position = candidate;
+          return true;
+        }
+      }
+      scanned += batch_scanned;
+    }
+    current += available;
+  }
+
+  return false;
+}
+
+BlockReadStatus XlogBlockReader::Next(XlogBlock* block,
+                                      bool skip_error_blocks) {
+  block->resynced = false;
+  block->skipped = 0;
+  block->error.clear();
+
+  if (index_entries_ != nullptr) {
+    return NextIndexed(block, skip_error_blocks);
+  }
+
+  if (cursor_ >= size_) {
+    return BlockReadStatus::kEnd;
+  }
+
+  uint64_t offset = cursor_;
+
+  // 检查这是否是一个有效的日志缓冲区
+  if (!IsValidLogBuffer(offset, 1, &block->error)) {
+    if (!skip_error_blocks) {
+      // 不跳过错误块，直接返回错误
+      return BlockReadStatus::kError;
+    }
+
+    // 当前位置已确认无效，从下一个字节开始查找
+    uint64_t fix_pos = size_;
+    bool found =
+        FindLogStartPosition(offset + 1, resync_chain_length_, &fix_pos);
+    block->resynced = true;
+    block->skipped = fix_pos - offset;
+    if (!found) {
+      // 剩余数据中没有可恢复的块
+      cursor_ = size_;
+      return BlockReadStatus::kEnd;
+    }
+    offset = fix_pos;
+  }
+
+  // 已校验的块头部完整，直接在窗口内解析
+  const uint8_t* header = Fetch(offset, 9);
+  if (header == nullptr) {
+    cursor_ = size_;
+    return BlockReadStatus::kError;
+  }
+  block->offset = offset;
+  block->magic = header[0];
+  block->header_len = GetHeaderLen(block->magic);
+  std::memcpy(&block->length, header + 5, sizeof(block->length));
+
+  // 整个块（含尾部）必须在窗口内连续，主体以指针形式交给调用方
+  const uint8_t* block_data =
+      Fetch(offset, block->header_len + block->length + GetTrailerLen());
+  if (block_data == nullptr) {
+    cursor_ = size_;
+    return BlockReadStatus::kError;
+  }
+
+  // 提取头部字段
+  std::memcpy(&block->seq, block_data + 1, sizeof(block->seq));
+  block->begin_hour = block_data[3];
+  block->end_hour = block_data[4];
+
+  block->body = block_data + block->header_len;
+  cursor_ = offset + block->header_len + block->length + GetTrailerLen();
+  return BlockReadStatus::kBlock;
+}
+
+BlockReadStatus XlogBlockReader::NextIndexed(XlogBlock* block,
+                                             bool skip_error_blocks) {
+  // 下一个块之前（或最后一个块之后）被跳过的数据，原因只需校验起点处的一个头部
+  uint64_t target = next_entry_ < index_count_
+                        ? index_entries_[next_entry_].offset
+                        : cursor_ + index_tail_skipped_;
+  if (cursor_ < target && cursor_ < size_) {
+    if (!skip_error_blocks) {
+      return BlockReadStatus::kError;
+    }
+    block->resynced = true;
+    block->skipped = target - cursor_;
+    IsValidLogBuffer(cursor_, 1, &block->error);
+  }
+
+  if (next_entry_ >= index_count_) {
+    cursor_ = size_;
+    return BlockReadStatus::kEnd;
+  }
+
+  const XlogIndexEntry& entry = index_entries_[next_entry_];
+  block->offset = entry.offset;
+  block->magic = entry.magic;
+  block->header_len = GetHeaderLen(entry.magic);
+  block->length = entry.length;
+
+  const uint8_t* block_data =
+      Fetch(entry.offset, block->header_len + block->length + GetTrailerLen());
+  if (block_data == nullptr || block_data[0] != entry.magic) {
+    // 索引与数据不符
+    cursor_ = size_;
+    return BlockReadStatus::kError;
+  }
+
+  std::memcpy(&block->seq, block_data + 1, sizeof(block->seq));
+  block->begin_hour = block_data[3];
+  block->end_hour = block_data[4];
+
+  block->body = block_data + block->header_len;
+  cursor_ = entry.offset + block->header_len + block->length + GetTrailerLen();
+  next_entry_++;
+  return BlockReadStatus::kBlock;
+}
+
+}  // namespace xlog_decode
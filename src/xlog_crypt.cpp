@@ -0,0 +1,520 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// xlog_crypt.cpp - 加密日志块解密的实现
+//
+// Mars异步模式下，客户端用自己的临时私钥和服务端公钥做ECDH，取共享点x坐标的
+// 前16字节作为TEA密钥加密压缩后的数据，并把临时公钥写入块头部的crypt字段。
+// 解密时用服务端私钥和头部中的公钥得到同一个共享点。
+
+#include "xlog_crypt.h"
+
+#include <cstring>
+#include <vector>
+
+#include "file_utils.h"
+#include "magic_scanner.h"
+#include "xlog_constants.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define XLOG_DECODE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#define XLOG_DECODE_TARGET_AVX2
+#else
+#define XLOG_DECODE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace xlog_decode {
+
+namespace {
+
+// 256位无符号整数，8个32位分量，低位在前
+// 点乘只在遇到新公钥时计算一次，这里只求简单可移植，不追求速度
+struct U256 {
+  uint32_t n[8];
+};
+
+// 域的模数 p = 2^256 - 2^32 - 977
+constexpr U256 kFieldPrime = {{0xFFFFFC2F, 0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF,
+                               0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+                               0xFFFFFFFF}};
+
+// 2^256 mod p
+constexpr uint64_t kFieldFold = 0x1000003D1;
+
+// 曲线阶n，私钥必须在[1, n)内
+constexpr U256 kCurveOrder = {{0xD0364141, 0xBFD25E8C, 0xAF48A03B, 0xBAAEDCE6,
+                               0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF,
+                               0xFFFFFFFF}};
+
+// 曲线 y^2 = x^3 + 7
+constexpr uint32_t kCurveB = 7;
+
+U256 FromBigEndian(const uint8_t* bytes) {
+  U256 value;
+  for (int i = 0; i < 8; ++i) {
+    const uint8_t* word = bytes + (7 - i) * 4;
+    value.n[i] = (static_cast<uint32_t>(word[0]) << 24) |
+                 (static_cast<uint32_t>(word[1]) << 16) |
+                 (static_cast<uint32_t>(word[2]) << 8) | word[3];
+  }
+  return value;
+}
+
+void ToBigEndian(const U256& value, uint8_t* bytes) {
+  for (int i = 0; i < 8; ++i) {
+    uint8_t* word = bytes + (7 - i) * 4;
+    word[0] = static_cast<uint8_t>(value.n[i] >> 24);
+    word[1] = static_cast<uint8_t>(value.n[i] >> 16);
+    word[2] = static_cast<uint8_t>(value.n[i] >> 8);
+    word[3] = static_cast<uint8_t>(value.n[i]);
+  }
+}
+
+U256 Small(uint32_t value) {
+  U256 result = {};
+  result.n[0] = value;
+  return result;
+}
+
+bool IsZero(const U256& a) {
+  for (uint32_t limb : a.n) {
+    if (limb != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// a < b
+bool Less(const U256& a, const U256& b) {
+  for (int i = 7; i >= 0; --i) {
+    if (a.n[i] != b.n[i]) {
+      return a.n[i] < b.n[i];
+    }
+  }
+  return false;
+}
+
+// r = a - b mod 2^256，返回借位
+uint32_t SubRaw(const U256& a, const U256& b, U256* r) {
+  uint64_t borrow = 0;
+  for (int i = 0; i < 8; ++i) {
+    uint64_t diff = static_cast<uint64_t>(a.n[i]) - b.n[i] - borrow;
+    r->n[i] = static_cast<uint32_t>(diff);
+    borrow = (diff >> 32) & 1;
+  }
+  return static_cast<uint32_t>(borrow);
+}
+
+// r = a + b mod 2^256，返回进位
+uint32_t AddRaw(const U256& a, const U256& b, U256* r) {
+  uint64_t carry = 0;
+  for (int i = 0; i < 8; ++i) {
+    uint64_t sum = static_cast<uint64_t>(a.n[i]) + b.n[i] + carry;
+    r->n[i] = static_cast<uint32_t>(sum);
+    carry = sum >> 32;
+  }
+  return static_cast<uint32_t>(carry);
+}
+
+// 以下域运算的输入输出都在[0, p)内
+U256 FieldAdd(const U256& a, const U256& b) {
+  U256 r;
+  if (AddRaw(a, b, &r) != 0 || !Less(r, kFieldPrime)) {
+    SubRaw(r, kFieldPrime, &r);
+  }
+  return r;
+}
+
+U256 FieldSub(const U256& a, const U256& b) {
+  U256 r;
+  if (SubRaw(a, b, &r) != 0) {
+    AddRaw(r, kFieldPrime, &r);
+  }
+  return r;
+}
+
+U256 FieldMul(const U256& a, const U256& b) {
+  uint32_t t[16] = {};
+  for (int i = 0; i < 8; ++i) {
+    uint64_t carry = 0;
+    for (int j = 0; j < 8; ++j) {
+      uint64_t v = static_cast<uint64_t>(a.n[i]) * b.n[j] + t[i + j] + carry;
+      t[i + j] = static_cast<uint32_t>(v);
+      carry = v >> 32;
+    }
+    t[i + 8] = static_cast<uint32_t>(carry);
+  }
+
+  // 高256位乘以2^256 mod p = 2^32 + 977后加到低256位
+  U256 r;
+  uint64_t acc = 0;
+  for (int i = 0; i < 8; ++i) {
+    acc += static_cast<uint64_t>(t[i]) + static_cast<uint64_t>(t[i + 8]) * 977;
+    if (i > 0) {
+      acc += t[i + 7];
+    }
+    r.n[i] = static_cast<uint32_t>(acc);
+    acc >>= 32;
+  }
+  acc += t[15];
+
+  // 溢出部分（不超过2^43）再折叠一次
+  uint64_t top = acc;
+  acc = static_cast<uint64_t>(r.n[0]) + top * 977;
+  r.n[0] = static_cast<uint32_t>(acc);
+  acc >>= 32;
+  acc += static_cast<uint64_t>(r.n[1]) + top;
+  r.n[1] = static_cast<uint32_t>(acc);
+  acc >>= 32;
+  for (int i = 2; i < 8; ++i) {
+    acc += r.n[i];
+    r.n[i] = static_cast<uint32_t>(acc);
+    acc >>= 32;
+  }
+  if (acc != 0) {
+    // 结果超过2^256时r很小，加上2^256 mod p不会再溢出
+    U256 fold = {};
+    fold.n[0] = static_cast<uint32_t>(kFieldFold);
+    fold.n[1] = static_cast<uint32_t>(kFieldFold >> 32);
+    AddRaw(r, fold, &r);
+  }
+  if (!Less(r, kFieldPrime)) {
+    SubRaw(r, kFieldPrime, &r);
+  }
+  return r;
+}
+
+U256 FieldSquare(const U256& a) {
+  return FieldMul(a, a);
+}
+
+// 费马小定理：a^(p-2)
+U256 FieldInverse(const U256& a) {
+  U256 exponent;
+  SubRaw(kFieldPrime, Small(2), &exponent);
+  U256 result = Small(1);
+  for (int bit = 255; bit >= 0; --bit) {
+    result = FieldSquare(result);
+    if ((exponent.n[bit / 32] >> (bit % 32)) & 1) {
+      result = FieldMul(result, a);
+    }
+  }
+  return result;
+}
+
+// 雅可比坐标下的点，(X, Y, Z)对应仿射坐标(X/Z^2, Y/Z^3)
+struct JacobianPoint {
+  U256 x;
+  U256 y;
+  U256 z;
+  bool infinity = true;
+};
+
+JacobianPoint Double(const JacobianPoint& p) {
+  if (p.infinity || IsZero(p.y)) {
+    return JacobianPoint();
+  }
+  U256 yy = FieldSquare(p.y);
+  U256 s = FieldMul(p.x, yy);
+  s = FieldAdd(s, s);
+  s = FieldAdd(s, s);  // 4XY^2
+  U256 xx = FieldSquare(p.x);
+  U256 m = FieldAdd(FieldAdd(xx, xx), xx);  // 3X^2（曲线参数a为0）
+  U256 yyyy = FieldSquare(yy);
+  U256 yyyy8 = FieldAdd(yyyy, yyyy);
+  yyyy8 = FieldAdd(yyyy8, yyyy8);
+  yyyy8 = FieldAdd(yyyy8, yyyy8);
+
+  JacobianPoint r;
+  r.infinity = false;
+  r.x = FieldSub(FieldSquare(m), FieldAdd(s, s));
+  r.y = FieldSub(FieldMul(m, FieldSub(s, r.x)), yyyy8);
+  U256 yz = FieldMul(p.y, p.z);
+  r.z = FieldAdd(yz, yz);
+  return r;
+}
+
+// p + (qx, qy)，q为仿射坐标
+JacobianPoint AddAffine(const JacobianPoint& p,
+                        const U256& qx,
+                        const U256& qy) {
+  if (p.infinity) {
+    JacobianPoint r;
+    r.infinity = false;
+    r.x = qx;
+    r.y = qy;
+    r.z = Small(1);
+    return r;
+  }
+  U256 zz = FieldSquare(p.z);
+  U256 u2 = FieldMul(qx, zz);
+  U256 s2 = FieldMul(qy, FieldMul(zz, p.z));
+  U256 h = FieldSub(u2, p.x);
+  U256 rr = FieldSub(s2, p.y);
+  if (IsZero(h)) {
+    return IsZero(rr) ? Double(p) : JacobianPoint();
+  }
+  U256 hh = FieldSquare(h);
+  U256 hhh = FieldMul(h, hh);
+  U256 v = FieldMul(p.x, hh);
+
+  JacobianPoint r;
+  r.infinity = false;
+  r.x = FieldSub(FieldSub(FieldSquare(rr), hhh), FieldAdd(v, v));
+  r.y = FieldSub(FieldMul(rr, FieldSub(v, r.x)), FieldMul(p.y, hhh));
+  r.z = FieldMul(p.z, h);
+  return r;
+}
+
+// 仿射坐标的点是否在曲线上
+bool IsOnCurve(const U256& x, const U256& y) {
+  if (!Less(x, kFieldPrime) || !Less(y, kFieldPrime)) {
+    return false;
+  }
+  U256 lhs = FieldSquare(y);
+  U256 rhs = FieldAdd(FieldMul(FieldSquare(x), x), Small(kCurveB));
+  return std::memcmp(lhs.n, rhs.n, sizeof(lhs.n)) == 0;
+}
+
+// TEA的轮常数和轮数，与Mars的tea_encrypt一致
+constexpr uint32_t kTeaDelta = 0x9E3779B9;
+constexpr int kTeaRounds = 16;
+constexpr uint32_t kTeaInitialSum = kTeaDelta * kTeaRounds;
+
+void DecipherScalar(const TeaKey& key, uint8_t* block) {
+  uint32_t v0 = 0;
+  uint32_t v1 = 0;
+  std::memcpy(&v0, block, sizeof(v0));
+  std::memcpy(&v1, block + 4, sizeof(v1));
+  uint32_t sum = kTeaInitialSum;
+  for (int round = 0; round < kTeaRounds; ++round) {
+    v1 -= ((v0 << 4) + key[2]) ^ (v0 + sum) ^ ((v0 >> 5) + key[3]);
+    v0 -= ((v1 << 4) + key[0]) ^ (v1 + sum) ^ ((v1 >> 5) + key[1]);
+    sum -= kTeaDelta;
+  }
+  std::memcpy(block, &v0, sizeof(v0));
+  std::memcpy(block + 4, &v1, sizeof(v1));
+}
+
+// 处理前blocks个分组，返回已处理的分组数
+size_t DecryptScalar(const TeaKey& key, uint8_t* data, size_t blocks) {
+  for (size_t i = 0; i < blocks; ++i) {
+    DecipherScalar(key, data + i * 8);
+  }
+  return blocks;
+}
+
+#if defined(XLOG_DECODE_X86)
+
+// 每次4个分组：把v0、v1分别收集到一个向量中，轮函数在4个通道上同时计算
+size_t DecryptSse2(const TeaKey& key, uint8_t* data, size_t blocks) {
+  const __m128i k0 = _mm_set1_epi32(static_cast<int>(key[0]));
+  const __m128i k1 = _mm_set1_epi32(static_cast<int>(key[1]));
+  const __m128i k2 = _mm_set1_epi32(static_cast<int>(key[2]));
+  const __m128i k3 = _mm_set1_epi32(static_cast<int>(key[3]));
+  size_t i = 0;
+  for (; i + 4 <= blocks; i += 4) {
+    __m128i* ptr = reinterpret_cast<__m128i*>(data + i * 8);
+    __m128i lo = _mm_loadu_si128(ptr);      // a0 a1 b0 b1
+    __m128i hi = _mm_loadu_si128(ptr + 1);  // c0 c1 d0 d1
+    lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));  // a0 b0 a1 b1
+    hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));  // c0 d0 c1 d1
+    __m128i v0 = _mm_unpacklo_epi64(lo, hi);
+    __m128i v1 = _mm_unpackhi_epi64(lo, hi);
+    uint32_t sum = kTeaInitialSum;
+    for (int round = 0; round < kTeaRounds; ++round) {
+      const __m128i s = _mm_set1_epi32(static_cast<int>(sum));
+      v1 = _mm_sub_epi32(
+          v1, _mm_xor_si128(
+                  _mm_xor_si128(_mm_add_epi32(_mm_slli_epi32(v0, 4), k2),
+                                _mm_add_epi32(v0, s)),
+                  _mm_add_epi32(_mm_srli_epi32(v0, 5), k3)));
+      v0 = _mm_sub_epi32(
+          v0, _mm_xor_si128(
+                  _mm_xor_si128(_mm_add_epi32(_mm_slli_epi32(v1, 4), k0),
+                                _mm_add_epi32(v1, s)),
+                  _mm_add_epi32(_mm_srli_epi32(v1, 5), k1)));
+      sum -= kTeaDelta;
+    }
+    _mm_storeu_si128(ptr, _mm_unpacklo_epi32(v0, v1));
+    _mm_storeu_si128(ptr + 1, _mm_unpackhi_epi32(v0, v1));
+  }
+  return i;
+}
+
+// 每次8个分组，两个128位通道内的排列与SSE2相同
+XLOG_DECODE_TARGET_AVX2
+size_t DecryptAvx2(const TeaKey& key, uint8_t* data, size_t blocks) {
+  const __m256i k0 = _mm256_set1_epi32(static_cast<int>(key[0]));
+  const __m256i k1 = _mm256_set1_epi32(static_cast<int>(key[1]));
+  const __m256i k2 = _mm256_set1_epi32(static_cast<int>(key[2]));
+  const __m256i k3 = _mm256_set1_epi32(static_cast<int>(key[3]));
+  size_t i = 0;
+  for (; i + 8 <= blocks; i += 8) {
+    __m256i* ptr = reinterpret_cast<__m256i*>(data + i * 8);
+    __m256i lo = _mm256_loadu_si256(ptr);
+    __m256i hi = _mm256_loadu_si256(ptr + 1);
+    lo = _mm256_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+    hi = _mm256_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+    __m256i v0 = _mm256_unpacklo_epi64(lo, hi);
+    __m256i v1 = _mm256_unpackhi_epi64(lo, hi);
+    uint32_t sum = kTeaInitialSum;
+    for (int round = 0; round < kTeaRounds; ++round) {
+      const __m256i s = _mm256_set1_epi32(static_cast<int>(sum));
+      v1 = _mm256_sub_epi32(
+          v1,
+          _mm256_xor_si256(
+              _mm256_xor_si256(_mm256_add_epi32(_mm256_slli_epi32(v0, 4), k2),
+                               _mm256_add_epi32(v0, s)),
+              _mm256_add_epi32(_mm256_srli_epi32(v0, 5), k3)));
+      v0 = _mm256_sub_epi32(
+          v0,
+          _mm256_xor_si256(
+              _mm256_xor_si256(_mm256_add_epi32(_mm256_slli_epi32(v1, 4), k0),
+                               _mm256_add_epi32(v1, s)),
+              _mm256_add_epi32(_mm256_srli_epi32(v1, 5), k1)));
+      sum -= kTeaDelta;
+    }
+    _mm256_storeu_si256(ptr, _mm256_unpacklo_epi32(v0, v1));
+    _mm256_storeu_si256(ptr + 1, _mm256_unpackhi_epi32(v0, v1));
+  }
+  return i;
+}
+
+#endif  // XLOG_DECODE_X86
+
+int HexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+}  // namespace
+
+bool IsEncryptedMagic(uint8_t magic) {
+  return magic == MAGIC_COMPRESS_START2 || magic == MAGIC_ASYNC_ZSTD_START;
+}
+
+bool EcdhSharedSecret(const uint8_t* private_key,
+                      const uint8_t* public_key,
+                      uint8_t* shared_x) {
+  U256 scalar = FromBigEndian(private_key);
+  if (IsZero(scalar) || !Less(scalar, kCurveOrder)) {
+    return false;
+  }
+  U256 qx = FromBigEndian(public_key);
+  U256 qy = FromBigEndian(public_key + kXlogPublicKeySize / 2);
+  if (!IsOnCurve(qx, qy)) {
+    return false;
+  }
+
+  // 从高位开始倍点加点
+  JacobianPoint point;
+  for (int bit = 255; bit >= 0; --bit) {
+    point = Double(point);
+    if ((scalar.n[bit / 32] >> (bit % 32)) & 1) {
+      point = AddAffine(point, qx, qy);
+    }
+  }
+  if (point.infinity) {
+    return false;
+  }
+  U256 z_inverse = FieldInverse(point.z);
+  U256 x = FieldMul(point.x, FieldSquare(z_inverse));
+  ToBigEndian(x, shared_x);
+  return true;
+}
+
+void TeaDecrypt(const TeaKey& key, uint8_t* data, size_t size) {
+  size_t blocks = size / 8;
+  size_t done = 0;
+  switch (MagicScanner::ActiveImplementation()) {
+#if defined(XLOG_DECODE_X86)
+    case MagicScanner::Implementation::kAvx2:
+      done = DecryptAvx2(key, data, blocks);
+      break;
+    case MagicScanner::Implementation::kSse2:
+      done = DecryptSse2(key, data, blocks);
+      break;
+#endif
+    default:
+      break;
+  }
+  // 不足一个向量的分组
+  DecryptScalar(key, data + done * 8, blocks - done);
+}
+
+bool XlogKeyRing::SetPrivateKeyHex(const std::string& hex) {
+  uint8_t key[kXlogPrivateKeySize] = {};
+  size_t digits = 0;
+  for (char c : hex) {
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+      continue;
+    }
+    int value = HexValue(c);
+    if (value < 0 || digits >= kXlogPrivateKeySize * 2) {
+      return false;
+    }
+    key[digits / 2] = static_cast<uint8_t>(key[digits / 2] << 4 | value);
+    digits++;
+  }
+  U256 scalar = FromBigEndian(key);
+  if (digits != kXlogPrivateKeySize * 2 || IsZero(scalar) ||
+      !Less(scalar, kCurveOrder)) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::memcpy(private_key_, key, sizeof(private_key_));
+  has_private_key_ = true;
+  cache_.clear();
+  return true;
+}
+
+bool XlogKeyRing::LoadPrivateKeyFile(const std::string& file_path) {
+  std::vector<uint8_t> content;
+  if (!FileUtils::ReadFile(file_path, content)) {
+    return false;
+  }
+  return SetPrivateKeyHex(std::string(content.begin(), content.end()));
+}
+
+const TeaKey* XlogKeyRing::GetTeaKey(const uint8_t* public_key) {
+  std::string id(reinterpret_cast<const char*>(public_key),
+                 kXlogPublicKeySize);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = cache_.find(id);
+  if (found == cache_.end()) {
+    // 无法派生的公钥同样缓存，损坏的块不会反复计算
+    CacheEntry entry;
+    uint8_t shared_x[32];
+    if (has_private_key_ &&
+        EcdhSharedSecret(private_key_, public_key, shared_x)) {
+      entry.valid = true;
+      std::memcpy(entry.key.data(), shared_x, sizeof(TeaKey));
+    }
+    found = cache_.emplace(std::move(id), entry).first;
+  }
+  // unordered_map的元素地址在插入其他元素后保持不变
+  return found->second.valid ? &found->second.key : nullptr;
+}
+
+size_t XlogKeyRing::derivation_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return cache_.size();
+}
+
+}  // namespace xlog_decode
@@ -5,10 +5,13 @@
 
 #include "xlog_decoder.h"
 
+#include <algorithm>
+#include <climits>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 
@@ -17,19 +20,317 @@
 // 添加zstd.h引用
 #include <zstd.h>
 
+#include "console_output.h"
+#include "decode_trace.h"
 #include "file_utils.h"
+#include "file_watcher.h"
+#include "output_sink.h"
+#include "thread_pool.h"
+#include "xlog_block_reader.h"
 #include "xlog_constants.h"
+#include "xlog_index.h"
+#include "zip_archive.h"
 
 namespace xlog_decode {
 
+// 跟踪模式在两轮之间保存的进度
+struct FollowState {
+  bool started = false;
+  uint64_t file_id = 0;
+  uint64_t resume_offset = 0;  // 下一个块的位置
+
+  // 最后一个已输出的块，用于发现原地增长或被改写的块
+  bool has_last_block = false;
+  bool last_selected = false;
+  uint64_t last_offset = 0;
+  uint8_t last_magic = 0;
+  uint16_t last_seq = 0;
+  uint32_t last_length = 0;
+  size_t last_decoded_length = 0;
+};
+
+// 可复用的解压上下文，避免每个块重复初始化和释放zlib、zstd的状态
+struct DecompressContext {
+  DecompressContext() { std::memset(&zlib_stream, 0, sizeof(zlib_stream)); }
+
+  ~DecompressContext() {
+    if (zlib_ready) {
+      inflateEnd(&zlib_stream);
+    }
+    ZSTD_freeDCtx(zstd_context);
+  }
+
+  DecompressContext(const DecompressContext&) = delete;
+  DecompressContext& operator=(const DecompressContext&) = delete;
+
+  z_stream zlib_stream;
+  bool zlib_ready = false;
+  ZSTD_DCtx* zstd_context = nullptr;
+
+  // 加密块解密后的主体，解密不修改读取器中的数据
+  std::vector<uint8_t> decrypt_buffer;
+};
+
 namespace {
-// 预定义的解压缩缓冲区块大小
-constexpr size_t kChunkSize = 1024;
+// 解压输出空间的最小增长量
+constexpr size_t kMinOutputGrowth = 4096;
+
+// 日志文本的压缩率通常在4倍以上，按此预估解压输出空间
+constexpr size_t kExpectedRatio = 4;
+
+// 并行解码时每个线程每批分到的块数
+constexpr size_t kParallelBlocksPerThread = 16;
+
+// 并行解码每批最多包含的主体字节数，限制批内缓冲的内存占用
+constexpr size_t kParallelBatchBytes = 32 * 1024 * 1024;
+
+// 并行解码中的一个块：分帧阶段填写提示信息和主体，解压阶段填写输出
+struct BlockTask {
+  std::vector<uint8_t> prefix;  // 重新同步和序列号缺失的提示
+  bool has_body = false;
+  uint8_t magic = 0;
+  const uint8_t* body = nullptr;
+  size_t body_size = 0;
+  const TeaKey* tea_key = nullptr;
+  std::vector<uint8_t> body_copy;  // 流式读取时主体的副本
+  std::vector<uint8_t> output;
+  XlogBlock block;  // 建立索引时使用的块信息，body不保证有效
+  XlogResumePoint resume_point;  // 写出这个块之后的解码进度
+  DecodeStats stats;             // 开启统计时这个块的解密和解压耗时
+};
+
+// 统计写入下游的耗时和字节数，开启跟踪时记录每次写入的区间；
+// stats为空时只记录区间
+class MeteredOutputSink : public OutputSink {
+ public:
+  MeteredOutputSink(OutputSink& downstream, DecodeStats* stats)
+      : downstream_(downstream), stats_(stats) {}
+
+  bool Write(const uint8_t* data, size_t size) override {
+    TraceSpan span("write");
+    span.set_size(size);
+    AllocScope alloc_scope(AllocStage::kWrite);
+    int64_t start = stats_ != nullptr ? MonotonicNanos() : 0;
+    bool result = downstream_.Write(data, size);
+    if (stats_ != nullptr) {
+      stats_->write_ns += MonotonicNanos() - start;
+      stats_->bytes_written += size;
+    }
+    return result;
+  }
+
+  bool Flush() override {
+    TraceSpan span("flush");
+    AllocScope alloc_scope(AllocStage::kWrite);
+    int64_t start = stats_ != nullptr ? MonotonicNanos() : 0;
+    bool result = downstream_.Flush();
+    if (stats_ != nullptr) {
+      stats_->write_ns += MonotonicNanos() - start;
+    }
+    return result;
+  }
+
+  bool Close() override {
+    TraceSpan span("close");
+    AllocScope alloc_scope(AllocStage::kWrite);
+    int64_t start = stats_ != nullptr ? MonotonicNanos() : 0;
+    bool result = downstream_.Close();
+    if (stats_ != nullptr) {
+      stats_->write_ns += MonotonicNanos() - start;
+    }
+    return result;
+  }
+
+  bool WantsMore() const override { return downstream_.WantsMore(); }
+
+ private:
+  OutputSink& downstream_;
+  DecodeStats* stats_;
+};
+
+// 一次公开解码调用的统计范围：最外层的范围重置统计并记录总耗时，
+// 嵌套的调用（如先建立索引再解码）累加到同一份统计中；account不为空时
+// 范围内调用线程的分配计入account，结束时记录到统计中
+class StatsScope {
+ public:
+  StatsScope(bool enabled,
+             bool* active,
+             DecodeStats* stats,
+             AllocAccount* account)
+      : active_(active),
+        outermost_(!*active),
+        stats_(enabled && outermost_ ? stats : nullptr),
+        account_(stats_ != nullptr ? account : nullptr) {
+    *active_ = true;
+    if (stats_ != nullptr) {
+      *stats_ = DecodeStats();
+      stats_->files = 1;
+      start_ns_ = MonotonicNanos();
+    }
+    if (account_ != nullptr) {
+      account_->Reset();
+      alloc_scope_.emplace(account_, AllocStage::kOther);
+    }
+  }
+
+  ~StatsScope() {
+    if (stats_ != nullptr) {
+      stats_->total_ns = MonotonicNanos() - start_ns_;
+    }
+    if (account_ != nullptr) {
+      stats_->SetAllocations(*account_);
+    }
+    if (outermost_) {
+      *active_ = false;
+    }
+  }
+
+  StatsScope(const StatsScope&) = delete;
+  StatsScope& operator=(const StatsScope&) = delete;
+
+  // 最外层的范围中开启统计或跟踪时返回计量写出的sink，否则原样返回sink
+  OutputSink& Track(OutputSink& sink) {
+    if (!outermost_ ||
+        (stats_ == nullptr && !TraceRecorder::Instance().enabled())) {
+      return sink;
+    }
+    sink_.emplace(sink, stats_);
+    return *sink_;
+  }
+
+ private:
+  bool* active_;
+  bool outermost_;
+  DecodeStats* stats_;
+  AllocAccount* account_;
+  int64_t start_ns_ = 0;
+  std::optional<AllocScope> alloc_scope_;
+  std::optional<MeteredOutputSink> sink_;
+};
+
+// 并行解码时每个工作线程各自持有的解压上下文
+DecompressContext& ThreadDecompressContext() {
+  thread_local DecompressContext context;
+  return context;
+}
+
+// 初始化或重置上下文中的z_stream（原始deflate格式）
+bool ResetInflate(DecompressContext& context) {
+  z_stream& strm = context.zlib_stream;
+  int ret = context.zlib_ready ? inflateReset(&strm)
+                               : inflateInit2(&strm, -MAX_WBITS);
+  if (ret != Z_OK) {
+    return false;
+  }
+  context.zlib_ready = true;
+  return true;
+}
+
+// 把一段输入送入z_stream，解压结果直接写到输出缓冲末尾，空间不足时按已输出量
+// 加倍扩展；返回Z_OK表示输入已全部消耗（Mars按同步刷新压缩的块没有结束标记），
+// Z_STREAM_END表示压缩流结束，其余为错误，出错前已解压的内容保留在输出中
+int InflateInput(z_stream& strm,
+                 const uint8_t* input_data,
+                 size_t input_size,
+                 std::vector<uint8_t>& output_buffer) {
+  strm.avail_in = static_cast<uInt>(input_size);
+  strm.next_in =
+      const_cast<Bytef*>(input_data);  // 安全的转换，因为zlib不会修改输入
+
+  size_t start = output_buffer.size();
+  while (true) {
+    size_t used = output_buffer.size();
+    size_t room = std::max({static_cast<size_t>(strm.avail_in) * kExpectedRatio,
+                            used - start, kMinOutputGrowth});
+    room = std::min<size_t>(room, UINT_MAX);
+    output_buffer.resize(used + room);
+    strm.next_out = output_buffer.data() + used;
+    strm.avail_out = static_cast<uInt>(room);
+
+    int ret = inflate(&strm, Z_NO_FLUSH);
+    output_buffer.resize(used + room - strm.avail_out);
+
+    if (ret == Z_STREAM_END) {
+      return ret;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      return ret;
+    }
+    if (strm.avail_out != 0) {
+      return Z_OK;
+    }
+  }
+}
+
+// 从begin到end（含两端，end小于begin时跨越午夜）的小时掩码
+uint32_t HourSpanMask(unsigned begin, unsigned end) {
+  uint32_t mask = 0;
+  for (unsigned hour = begin;; hour = (hour + 1) % 24) {
+    mask |= 1u << hour;
+    if (hour == end) {
+      return mask;
+    }
+  }
+}
+
+// 累加body中所有ZSTD帧记录的内容大小，任一帧未记录大小或格式错误时返回false
+bool SumZstdContentSize(const uint8_t* data, size_t size, size_t* total) {
+  *total = 0;
+  while (size > 0) {
+    unsigned long long content_size = ZSTD_getFrameContentSize(data, size);
+    size_t frame_size = ZSTD_findFrameCompressedSize(data, size);
+    if (content_size == ZSTD_CONTENTSIZE_ERROR ||
+        content_size == ZSTD_CONTENTSIZE_UNKNOWN || ZSTD_isError(frame_size)) {
+      return false;
+    }
+    *total += static_cast<size_t>(content_size);
+    data += frame_size;
+    size -= frame_size;
+  }
+  return true;
+}
 }  // namespace
 
-XlogDecoder::XlogDecoder() : last_seq_(0) {}
+XlogDecoder::XlogDecoder()
+    : last_seq_(0),
+      stream_window_size_(XlogBlockReader::kDefaultWindowSize),
+      flush_threshold_(BufferedOutputSink::kDefaultFlushThreshold),
+      resync_chain_length_(1),
+      leading_skipped_(0),
+      decompress_context_(std::make_unique<DecompressContext>()),
+      thread_count_(1),
+      use_index_(true),
+      write_index_(false),
+      collect_index_(false),
+      used_index_(false),
+      hour_mask_(kAllHours),
+      hour_skipped_blocks_(0),
+      index_builder_(nullptr),
+      output_bytes_(0) {}
+
+XlogDecoder::~XlogDecoder() {
+  // 仍计入账户的分配各自持有引用，账户在它们都释放后才删除
+  if (alloc_account_ != nullptr) {
+    alloc_account_->Release();
+  }
+}
 
-XlogDecoder::~XlogDecoder() = default;
+void XlogDecoder::set_thread_count(size_t thread_count) {
+  size_t resolved = ThreadPool::ResolveThreadCount(thread_count);
+  if (resolved != thread_count_) {
+    thread_pool_.reset();
+  }
+  thread_count_ = resolved;
+}
+
+void XlogDecoder::set_hour_range(int from_hour, int to_hour) {
+  if (from_hour < 0 || from_hour > 23 || to_hour < 0 || to_hour > 23) {
+    hour_mask_ = kAllHours;
+    return;
+  }
+  hour_mask_ = HourSpanMask(static_cast<unsigned>(from_hour),
+                            static_cast<unsigned>(to_hour));
+}
 
 bool XlogDecoder::IsXlogFile(const std::string& file_path) {
   return FileUtils::HasExtension(file_path, kXlogFileExt) ||
@@ -46,12 +347,9 @@ bool XlogDecoder::IsMarsXlogV2(const std::string& file_path) {
     uint8_t magic;
     file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
 
-    return (magic == MAGIC_NO_COMPRESS_START ||
-            magic == MAGIC_NO_COMPRESS_START1 ||
-            magic == MAGIC_COMPRESS_START || magic == MAGIC_COMPRESS_START1 ||
-            magic == MAGIC_COMPRESS_START2 ||
-            magic == MAGIC_NO_COMPRESS_NO_CRYPT_START ||
-            magic == MAGIC_COMPRESS_NO_CRYPT_START);
+    // V2魔数为连续区间[0x03, 0x09]
+    return file.gcount() == 1 && magic >= MAGIC_NO_COMPRESS_START &&
+           magic <= MAGIC_COMPRESS_NO_CRYPT_START;
   } catch (const std::exception&) {
     return false;
   }
@@ -67,10 +365,9 @@ bool XlogDecoder::IsMarsXlogV3(const std::string& file_path) {
     uint8_t magic;
     file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
 
-    return (magic == MAGIC_SYNC_ZSTD_START ||
-            magic == MAGIC_SYNC_NO_CRYPT_ZSTD_START ||
-            magic == MAGIC_ASYNC_ZSTD_START ||
-            magic == MAGIC_ASYNC_NO_CRYPT_ZSTD_START);
+    // V3魔数为连续区间[0x0A, 0x0D]
+    return file.gcount() == 1 && magic >= MAGIC_SYNC_ZSTD_START &&
+           magic <= MAGIC_ASYNC_NO_CRYPT_ZSTD_START;
   } catch (const std::exception&) {
     return false;
   }
@@ -106,501 +403,1340 @@ std::string XlogDecoder::GenerateOutputFilename(const std::string& input_file) {
 bool XlogDecoder::DecodeFile(const std::string& input_file,
                              const std::string& output_file,
                              bool skip_error_blocks) {
+  // 解码结果逐块写入输出文件，首次写出时才创建文件
+  FileOutputSink sink(output_file, flush_threshold_);
+  return DecodeFile(input_file, sink, skip_error_blocks);
+}
+
+bool XlogDecoder::DecodeFile(const std::string& input_file,
+                             OutputSink& sink,
+                             bool skip_error_blocks) {
+  StatsScope scope(collect_stats_, &stats_scope_active_, &stats_,
+                   alloc_account());
+  OutputSink& target = scope.Track(sink);
   if (!FileUtils::PathExists(input_file)) {
-    std::cerr << "File does not exist: " << input_file << std::endl;
+    PrintLine(std::cerr, "File does not exist: " + input_file);
     return false;
   }
 
   // 重置序列计数器
   last_seq_ = 0;
 
+  // 管道只能读一遍，不能先按路径探测文件类型
+  if (!FileUtils::IsRegularFile(input_file)) {
+    return ParseSequentialInput(input_file, target, skip_error_blocks);
+  }
+
   // 确定文件类型并调用相应的解码器
   if (IsMarsXlogV2(input_file) || IsMarsXlogV3(input_file)) {
-    return ParseMarsXlogFile(input_file, output_file, skip_error_blocks);
+    return ParseMarsXlogFile(input_file, target, skip_error_blocks);
   } else if (IsZipFile(input_file)) {
-    return DecodeZipFile(input_file, output_file);
+    return DecodeZipFile(input_file, target, skip_error_blocks);
   } else {
-    return ParseMarsXlogFile(input_file, output_file, skip_error_blocks);
+    return ParseMarsXlogFile(input_file, target, skip_error_blocks);
   }
 }
 
+bool XlogDecoder::DecodeFileStreaming(const std::string& input_file,
+                                      OutputSink& sink,
+                                      bool skip_error_blocks) {
+  StatsScope scope(collect_stats_, &stats_scope_active_, &stats_,
+                   alloc_account());
+  OutputSink& target = scope.Track(sink);
+  if (!FileUtils::PathExists(input_file)) {
+    PrintLine(std::cerr, "File does not exist: " + input_file);
+    return false;
+  }
+
+  // 重置序列计数器
+  last_seq_ = 0;
+
+  // 管道等输入无法按窗口随机读取，只能整体读入
+  if (!FileUtils::IsRegularFile(input_file)) {
+    return ParseSequentialInput(input_file, target, skip_error_blocks);
+  }
+
+  if (IsZipFile(input_file) && !IsMarsXlogV2(input_file) &&
+      !IsMarsXlogV3(input_file)) {
+    return DecodeZipFile(input_file, target, skip_error_blocks);
+  }
+
+  XlogBlockReader reader;
+  {
+    TraceSpan span("open", input_file);
+    AllocScope alloc_scope(AllocStage::kOpen);
+    int64_t start_ns = collect_stats_ ? MonotonicNanos() : 0;
+    if (!reader.Open(input_file, stream_window_size_)) {
+      PrintLine(std::cerr, "Failed to read input file: " + input_file);
+      return false;
+    }
+    if (collect_stats_) {
+      stats_.open_ns += MonotonicNanos() - start_ns;
+      stats_.bytes_read += reader.Size();
+    }
+  }
+
+  if (reader.Size() == 0) {
+    PrintLine(std::cerr, "Input file is empty: " + input_file);
+    return false;
+  }
+
+  return DecodeToSink(reader, target, skip_error_blocks, input_file);
+}
+
 bool XlogDecoder::ParseMarsXlogFile(const std::string& input_file,
-                                    const std::string& output_file,
+                                    OutputSink& sink,
                                     bool skip_error_blocks) {
   try {
-    // 将整个输入文件读入缓冲区
-    std::vector<uint8_t> buffer;
-    if (!FileUtils::ReadFile(input_file, buffer)) {
-      std::cerr << "Failed to read input file: " << input_file << std::endl;
+    MappedFile mapped_file;
+    XlogBlockReader reader;
+    if (!OpenReader(input_file, mapped_file, reader)) {
       return false;
     }
+    return DecodeToSink(reader, sink, skip_error_blocks, input_file);
+  } catch (const std::exception& e) {
+    PrintLine(std::cerr, std::string("Error decoding file: ") + e.what());
+    return false;
+  }
+}
+
+bool XlogDecoder::ParseSequentialInput(const std::string& input_file,
+                                       OutputSink& sink,
+                                       bool skip_error_blocks) {
+  try {
+    std::vector<uint8_t> buffer;
+    {
+      TraceSpan span("open", input_file);
+      AllocScope alloc_scope(AllocStage::kOpen);
+      int64_t start_ns = collect_stats_ ? MonotonicNanos() : 0;
+      if (!FileUtils::ReadFile(input_file, buffer)) {
+        PrintLine(std::cerr, "Failed to read input file: " + input_file);
+        return false;
+      }
+      if (collect_stats_) {
+        stats_.open_ns += MonotonicNanos() - start_ns;
+        stats_.bytes_read += buffer.size();
+      }
+    }
 
     if (buffer.empty()) {
-      std::cerr << "Input file is empty: " << input_file << std::endl;
+      PrintLine(std::cerr, "Input file is empty: " + input_file);
       return false;
     }
 
-    // 查找有效块的可能起始位置
-    std::vector<int32_t> start_positions;
-    start_positions.push_back(0);  // 总是从开始处尝试
-
-    // 添加其他潜在的起始位置
-    for (size_t i = 1; i < buffer.size(); ++i) {
-      uint8_t magic = buffer[i];
-      if (magic == MAGIC_NO_COMPRESS_START ||
-          magic == MAGIC_NO_COMPRESS_START1 || magic == MAGIC_COMPRESS_START ||
-          magic == MAGIC_COMPRESS_START1 || magic == MAGIC_COMPRESS_START2 ||
-          magic == MAGIC_NO_COMPRESS_NO_CRYPT_START ||
-          magic == MAGIC_COMPRESS_NO_CRYPT_START ||
-          magic == MAGIC_SYNC_ZSTD_START ||
-          magic == MAGIC_SYNC_NO_CRYPT_ZSTD_START ||
-          magic == MAGIC_ASYNC_ZSTD_START ||
-          magic == MAGIC_ASYNC_NO_CRYPT_ZSTD_START) {
-        start_positions.push_back(static_cast<int32_t>(i));
-      }
-    }
-
-    // 从每个可能的起始位置尝试解码
-    std::vector<uint8_t> output_buffer;
-    bool success = false;
-
-    for (int32_t start_pos : start_positions) {
-      try {
-        int32_t current_pos = start_pos;
-        std::vector<uint8_t> temp_buffer;
-
-        while (current_pos >= 0 &&
-               static_cast<size_t>(current_pos) < buffer.size()) {
-          current_pos =
-              DecodeBlock(buffer, current_pos, temp_buffer, skip_error_blocks);
-          if (current_pos < 0) {
-            break;
-          }
-        }
+    // ZIP需要随机读取中央目录，只支持普通文件
+    if (buffer.size() >= 4 && buffer[0] == 'P' && buffer[1] == 'K' &&
+        buffer[2] == 0x03 && buffer[3] == 0x04) {
+      PrintLine(std::cerr, "ZIP input must be a regular file: " + input_file);
+      return false;
+    }
 
-        if (!temp_buffer.empty()) {
-          output_buffer = std::move(temp_buffer);
-          success = true;
-          break;
-        }
-      } catch (const std::exception&) {
-        // 尝试下一个起始位置
-        continue;
+    XlogBlockReader reader;
+    reader.Attach(buffer.data(), buffer.size());
+    return DecodeToSink(reader, sink, skip_error_blocks, input_file);
+  } catch (const std::exception& e) {
+    PrintLine(std::cerr, std::string("Error decoding file: ") + e.what());
+    return false;
+  }
+}
+
+bool XlogDecoder::OpenReader(const std::string& input_file,
+                             MappedFile& mapped_file,
+                             XlogBlockReader& reader) {
+  // 优先映射输入文件，直接在映射内存上解码；无法映射时（超过映射上限的大
+  // 文件、不支持mmap的文件系统等）按固定大小的窗口读取，内存占用与文件大小
+  // 无关。管道等非普通文件不会走到这里，见ParseSequentialInput
+  TraceSpan span("open", input_file);
+  AllocScope alloc_scope(AllocStage::kOpen);
+  int64_t start_ns = collect_stats_ ? MonotonicNanos() : 0;
+  if (mapped_file.Open(input_file)) {
+    reader.Attach(mapped_file.Data(), mapped_file.Size());
+  } else if (!reader.Open(input_file, stream_window_size_)) {
+    PrintLine(std::cerr, "Failed to read input file: " + input_file);
+    return false;
+  }
+  if (collect_stats_) {
+    stats_.open_ns += MonotonicNanos() - start_ns;
+    stats_.bytes_read += reader.Size();
+  }
+
+  if (reader.Size() == 0) {
+    PrintLine(std::cerr, "Input file is empty: " + input_file);
+    return false;
+  }
+  return true;
+}
+
+bool XlogDecoder::LoadIndex(const std::string& input_file,
+                            XlogIndex* index) const {
+  return index->Load(XlogIndex::IndexPathFor(input_file), input_file) &&
+         index->resync_chain_length() == resync_chain_length_;
+}
+
+bool XlogDecoder::CollectIndex(const std::string& input_file) {
+  // 索引描述不按小时过滤时的完整解码结果，建立期间暂时清除小时范围
+  bool use_index = use_index_;
+  uint32_t hour_mask = hour_mask_;
+  use_index_ = false;
+  hour_mask_ = kAllHours;
+  collect_index_ = true;
+
+  NullOutputSink sink;
+  bool decoded = DecodeFile(input_file, sink);
+
+  use_index_ = use_index;
+  hour_mask_ = hour_mask;
+  collect_index_ = false;
+  if (!decoded) {
+    return false;
+  }
+  if (index_ == nullptr) {
+    PrintLine(std::cerr, "Failed to build index of: " + input_file);
+    return false;
+  }
+  return true;
+}
+
+bool XlogDecoder::BuildIndex(const std::string& input_file) {
+  if (!CollectIndex(input_file)) {
+    return false;
+  }
+  if (!index_->Save(XlogIndex::IndexPathFor(input_file))) {
+    PrintLine(std::cerr, "Failed to write index of: " + input_file);
+    return false;
+  }
+  return true;
+}
+
+bool XlogDecoder::DecodeBlocks(const std::string& input_file,
+                               OutputSink& sink,
+                               size_t first_block,
+                               size_t block_count) {
+  StatsScope scope(collect_stats_, &stats_scope_active_, &stats_,
+                   alloc_account());
+  OutputSink& target = scope.Track(sink);
+  try {
+    // 没有可用的索引时完整解码一遍（不输出）来建立索引
+    auto index = std::make_unique<XlogIndex>();
+    if (!use_index_ || !LoadIndex(input_file, index.get())) {
+      if (!CollectIndex(input_file)) {
+        return false;
       }
+      index = std::move(index_);
     }
 
-    if (!success) {
-      std::cerr << "No valid log data found in file: " << input_file
-                << std::endl;
+    const std::vector<XlogIndexEntry>& entries = index->entries();
+    if (first_block >= entries.size()) {
+      PrintLine(std::cerr, "Block " + std::to_string(first_block) +
+                               " is out of range, " + input_file + " has " +
+                               std::to_string(entries.size()) + " blocks");
       return false;
     }
+    block_count = std::min(block_count, entries.size() - first_block);
 
-    if (output_buffer.empty()) {
-      std::cerr << "No valid log content decoded from: " << input_file
-                << std::endl;
+    MappedFile mapped_file;
+    XlogBlockReader reader;
+    if (!OpenReader(input_file, mapped_file, reader)) {
       return false;
     }
+    reader.UseIndex(entries.data() + first_block, block_count, 0);
+    reader.Seek(entries[first_block].offset);
+
+    // 从前一个有序列号的块接续，缺失提示与完整解码一致
+    last_seq_ = 0;
+    for (size_t i = first_block; i > 0; --i) {
+      if (entries[i - 1].seq != 0) {
+        last_seq_ = entries[i - 1].seq;
+        break;
+      }
+    }
 
-    // 将解码后的数据写入输出文件
-    if (!FileUtils::WriteFile(output_file, output_buffer)) {
-      std::cerr << "Failed to write output file: " << output_file << std::endl;
+    index_builder_ = nullptr;
+    output_bytes_ = 0;
+    hour_skipped_blocks_ = 0;
+    bool has_output = false;
+    bool result = DecodeRemaining(reader, target, true, &has_output);
+    index_ = std::move(index);
+    used_index_ = true;
+    if (!result || !target.Close()) {
+      PrintLine(std::cerr, "Failed to write decoded output of: " + input_file);
       return false;
     }
-
     return true;
   } catch (const std::exception& e) {
-    std::cerr << "Error decoding file: " << e.what() << std::endl;
+    PrintLine(std::cerr, std::string("Error decoding file: ") + e.what());
     return false;
   }
 }
 
-bool XlogDecoder::DecodeZipFile(const std::string& input_file,
-                                const std::string& output_file) {
-  // 注意：这只是一个占位符。要实际实现，你需要使用ZIP库
-  // 比如libzip、zlib或minizip来处理ZIP文件。
-  std::cerr << "ZIP decoding is not implemented in this version" << std::endl;
-  return false;
+bool XlogDecoder::DecodeFrom(const std::string& input_file,
+                             OutputSink& sink,
+                             const XlogResumePoint& from,
+                             bool skip_error_blocks) {
+  StatsScope scope(collect_stats_, &stats_scope_active_, &stats_,
+                   alloc_account());
+  OutputSink& target = scope.Track(sink);
+  try {
+    MappedFile mapped_file;
+    XlogBlockReader reader;
+    if (!OpenReader(input_file, mapped_file, reader)) {
+      return false;
+    }
+    if (from.input_offset == 0 || from.input_offset > reader.Size()) {
+      PrintLine(std::cerr, "Cannot resume decoding of: " + input_file);
+      return false;
+    }
+    if (collect_stats_) {
+      stats_.bytes_read -= from.input_offset;  // 只读取追加的部分
+    }
+
+    // 接续上次的序列号和输出偏移，缺失提示和解码进度与完整解码一致
+    reader.set_resync_chain_length(resync_chain_length_);
+    reader.Seek(from.input_offset);
+    index_.reset();
+    used_index_ = false;
+    index_builder_ = nullptr;
+    leading_skipped_ = 0;
+    hour_skipped_blocks_ = 0;
+    last_seq_ = from.last_seq;
+    output_bytes_ = from.output_offset;
+    resume_point_ = from;
+    resume_frozen_ = false;
+
+    bool has_output = false;
+    if (!DecodeRemaining(reader, target, skip_error_blocks, &has_output) ||
+        !target.Close()) {
+      PrintLine(std::cerr, "Failed to write decoded output of: " + input_file);
+      return false;
+    }
+    return true;
+  } catch (const std::exception& e) {
+    PrintLine(std::cerr, std::string("Error decoding file: ") + e.what());
+    return false;
+  }
 }
 
-std::pair<bool, std::string> XlogDecoder::IsValidLogBuffer(
-    const std::vector<uint8_t>& buffer,
-    int32_t offset,
-    int32_t count) {
-  int32_t current_offset = offset;
-  int32_t remaining_count = count;
+bool XlogDecoder::Follow(const std::string& input_file,
+                         OutputSink& sink,
+                         const std::function<bool()>& should_stop) {
+  FileWatcher watcher(input_file);
+  FollowState state;
+  last_seq_ = 0;
+
+  while (!should_stop() && sink.WantsMore()) {
+    bool progressed = false;
+    if (!FollowRound(input_file, sink, &state, &progressed)) {
+      PrintLine(std::cerr, "Failed to write decoded output of: " + input_file);
+      return false;
+    }
+    // 没有新数据时等待文件事件；mmap写入没有事件，超时后再检查一次
+    if (!progressed) {
+      watcher.Wait(FileWatcher::kPollIntervalMs);
+    }
+  }
+  return sink.Close();
+}
 
-  while (true) {
-    if (static_cast<size_t>(current_offset) == buffer.size()) {
-      return {true, ""};
-    }
-
-    uint8_t magic_start = buffer[current_offset];
-    uint32_t crypt_key_len = 0;
-
-    if (magic_start == MAGIC_NO_COMPRESS_START ||
-        magic_start == MAGIC_COMPRESS_START ||
-        magic_start == MAGIC_COMPRESS_START1) {
-      crypt_key_len = 4;
-    } else if (magic_start == MAGIC_COMPRESS_START2 ||
-               magic_start == MAGIC_NO_COMPRESS_START1 ||
-               magic_start == MAGIC_NO_COMPRESS_NO_CRYPT_START ||
-               magic_start == MAGIC_COMPRESS_NO_CRYPT_START ||
-               magic_start == MAGIC_SYNC_ZSTD_START ||
-               magic_start == MAGIC_SYNC_NO_CRYPT_ZSTD_START ||
-               magic_start == MAGIC_ASYNC_ZSTD_START ||
-               magic_start == MAGIC_ASYNC_NO_CRYPT_ZSTD_START) {
-      crypt_key_len = 64;
-    } else {
-      std::ostringstream oss;
-      oss << "buffer[" << current_offset
-          << "]:" << static_cast<int>(magic_start) << " != MAGIC_NUM_START";
-      return {false, oss.str()};
-    }
-
-    uint32_t header_len = 1 + 2 + 1 + 1 + 4 + crypt_key_len;
-
-    if (static_cast<size_t>(current_offset + header_len + 1 + 1) >
-        buffer.size()) {
-      std::ostringstream oss;
-      oss << "offset:" << (current_offset + header_len + 1 + 1)
-          << " > buffer size:" << buffer.size();
-      return {false, oss.str()};
-    }
-
-    // 从头部提取长度字段
-    uint32_t length = 0;
-    std::memcpy(&length,
-                &buffer[current_offset + header_len - 4 - crypt_key_len],
-                sizeof(length));
-
-    if (static_cast<size_t>(current_offset + header_len + length + 1) >
-        buffer.size()) {
-      std::ostringstream oss;
-      oss << "log length:" << length << ", end pos "
-          << (current_offset + header_len + length + 1)
-          << " > buffer size:" << buffer.size();
-      return {false, oss.str()};
-    }
-
-    if (buffer[current_offset + header_len + length] != MAGIC_END) {
-      std::ostringstream oss;
-      oss << "log length:" << length << ", buffer["
-          << (current_offset + header_len + length) << "]:"
-          << static_cast<int>(buffer[current_offset + header_len + length])
-          << " != MAGIC_END";
-      return {false, oss.str()};
-    }
-
-    // 递减计数器并更新当前偏移量
-    remaining_count--;
-    if (remaining_count <= 0) {
-      return {true, ""};
-    }
-
-    current_offset = current_offset + header_len + length + 1;
-  }
-}
-
-int32_t XlogDecoder::FindLogStartPosition(const std::vector<uint8_t>& buffer,
-                                          int32_t count) {
-  int32_t offset = 0;
-
-  while (static_cast<size_t>(offset) < buffer.size()) {
-    // 检查所有可能的魔数值
-    uint8_t value = buffer[offset];
-    if (value == MAGIC_NO_COMPRESS_START || value == MAGIC_NO_COMPRESS_START1 ||
-        value == MAGIC_COMPRESS_START || value == MAGIC_COMPRESS_START1 ||
-        value == MAGIC_COMPRESS_START2 ||
-        value == MAGIC_NO_COMPRESS_NO_CRYPT_START ||
-        value == MAGIC_COMPRESS_NO_CRYPT_START ||
-        value == MAGIC_SYNC_ZSTD_START ||
-        value == MAGIC_SYNC_NO_CRYPT_ZSTD_START ||
-        value == MAGIC_ASYNC_ZSTD_START ||
-        value == MAGIC_ASYNC_NO_CRYPT_ZSTD_START) {
-      // 尝试验证日志缓冲区
-      try {
-        auto result = IsValidLogBuffer(buffer, offset, count);
-        if (result.first) {
-          return offset;
+bool XlogDecoder::FollowRound(const std::string& input_file,
+                              OutputSink& sink,
+                              FollowState* state,
+                              bool* progressed) {
+  *progressed = false;
+  XlogBlockReader reader;
+  if (!reader.Open(input_file, stream_window_size_)) {
+    return true;  // 轮转期间文件可能暂时不存在
+  }
+  reader.set_resync_chain_length(resync_chain_length_);
+  uint64_t file_id = FileUtils::GetFileId(input_file);
+
+  XlogBlock block;
+  bool restart = state->started && (file_id != state->file_id ||
+                                    reader.Size() < state->resume_offset);
+  if (!restart && state->has_last_block) {
+    // 最后输出的块仍在原处时继续；长度变大说明块在原地增长（mmap3），
+    // 重新解压后只输出新增部分；其他变化说明文件被改写
+    uint8_t header[3] = {};
+    uint16_t seq = 0;
+    if (reader.ReadAt(state->last_offset, header, sizeof(header))) {
+      std::memcpy(&seq, header + 1, sizeof(seq));
+    }
+    if (header[0] == state->last_magic && seq == state->last_seq &&
+        reader.IsPendingTail(state->last_offset)) {
+      return true;  // 块还在增长，尚未写完
+    }
+    reader.Seek(state->last_offset);
+    if (header[0] != state->last_magic || seq != state->last_seq ||
+        !reader.IsValidLogBuffer(state->last_offset, 1, nullptr) ||
+        reader.Next(&block, false) != BlockReadStatus::kBlock ||
+        block.length < state->last_length) {
+      restart = true;
+    } else if (block.length > state->last_length) {
+      block_buffer_.clear();
+      if (state->last_selected) {
+        DecodeBody(block.magic, block.body, block.length, BlockKey(block),
+                   *decompress_context_, block_buffer_, active_stats());
+      }
+      if (block_buffer_.size() > state->last_decoded_length) {
+        if (!sink.Write(block_buffer_.data() + state->last_decoded_length,
+                        block_buffer_.size() - state->last_decoded_length)) {
+          return false;
         }
-      } catch (...) {
-        // 忽略异常并继续搜索
+        state->last_decoded_length = block_buffer_.size();
+        *progressed = true;
       }
+      state->last_length = block.length;
+      state->resume_offset = reader.Tell();
     }
+  }
 
-    offset++;
+  if (restart) {
+    PrintLine(std::cerr,
+              "Input was truncated or replaced, restarting: " + input_file);
+    *state = FollowState();
+    last_seq_ = 0;
   }
+  state->started = true;
+  state->file_id = file_id;
+
+  // 逐块解码到数据末尾；末尾写了一半的块和零填充的预留空间留到下一轮
+  reader.Seek(state->resume_offset);
+  while (!reader.IsPendingTail(reader.Tell())) {
+    if (reader.Next(&block, true) != BlockReadStatus::kBlock) {
+      // 剩余数据中还没有完整的块，保持位置不变，写入更多数据后重新查找
+      break;
+    }
 
-  // 如果我们已经搜索完整个缓冲区但没有找到有效的起始位置，
-  // 返回0以尝试从头开始解析
-  return 0;
+    block_buffer_.clear();
+    if (block.resynced) {
+      std::string error_msg =
+          "[F]xlog_decode error len=" + std::to_string(block.skipped) +
+          ", result:" + block.error + "\n";
+      block_buffer_.insert(block_buffer_.end(), error_msg.begin(),
+                           error_msg.end());
+    }
+
+    size_t body_start = 0;
+    state->last_selected = IsBlockSelected(block);
+    if (state->last_selected) {
+      CheckSequence(block.seq, block_buffer_);
+      body_start = block_buffer_.size();
+      DecodeBody(block.magic, block.body, block.length, BlockKey(block),
+                 *decompress_context_, block_buffer_, active_stats());
+    } else {
+      SkipBlock(block, block_buffer_);
+    }
+
+    if (!block_buffer_.empty() &&
+        !sink.Write(block_buffer_.data(), block_buffer_.size())) {
+      return false;
+    }
+
+    state->has_last_block = true;
+    state->last_offset = block.offset;
+    state->last_magic = block.magic;
+    state->last_seq = block.seq;
+    state->last_length = block.length;
+    state->last_decoded_length = block_buffer_.size() - body_start;
+    state->resume_offset = reader.Tell();
+    *progressed = true;
+    if (!sink.WantsMore()) {
+      break;
+    }
+  }
+
+  // 每轮结束时把新内容交给下游，保证输出及时可见
+  return !*progressed || sink.Flush();
 }
 
-int32_t XlogDecoder::DecodeBlock(const std::vector<uint8_t>& buffer,
-                                 int32_t offset,
-                                 std::vector<uint8_t>& output_buffer,
-                                 bool skip_error_blocks) {
-  if (static_cast<size_t>(offset) >= buffer.size()) {
-    return -1;
+bool XlogDecoder::DecodeToSink(XlogBlockReader& reader,
+                               OutputSink& sink,
+                               bool skip_error_blocks,
+                               const std::string& input_file) {
+  // 有与输入文件匹配的索引时直接按索引读取块
+  index_.reset();
+  used_index_ = false;
+  if (use_index_) {
+    auto index = std::make_unique<XlogIndex>();
+    if (LoadIndex(input_file, index.get())) {
+      index_ = std::move(index);
+      used_index_ = true;
+      reader.UseIndex(index_->entries().data(), index_->entries().size(),
+                      index_->tail_skipped());
+    }
   }
 
-  // 检查这是否是一个有效的日志缓冲区
-  auto result = IsValidLogBuffer(buffer, offset, 1);
-  if (!result.first) {
-    if (skip_error_blocks) {
-      int32_t fix_pos = FindLogStartPosition(
-          std::vector<uint8_t>(buffer.begin() + offset, buffer.end()), 1);
+  // 索引只描述跳过错误块且不按小时过滤时的完整解码结果；校验戳在解码前
+  // 取得，解码期间文件被修改时索引会在下次加载时被判为过期
+  bool build_index = !used_index_ && skip_error_blocks &&
+                     hour_mask_ == kAllHours &&
+                     (write_index_ || collect_index_);
+  if (build_index) {
+    XlogIndexStamp stamp;
+    if (XlogIndex::ComputeStamp(input_file, &stamp)) {
+      index_ = std::make_unique<XlogIndex>();
+      index_->set_stamp(stamp);
+      index_->set_resync_chain_length(resync_chain_length_);
+    } else {
+      build_index = false;
+    }
+  }
+  index_builder_ = build_index ? index_.get() : nullptr;
+
+  bool has_output = false;
+  bool decoded = DecodeStream(reader, sink, skip_error_blocks, &has_output);
+  index_builder_ = nullptr;
+  // 提前结束时索引不完整，不能保存
+  if (build_index && !sink.WantsMore()) {
+    index_.reset();
+    build_index = false;
+  }
+  if (build_index) {
+    index_->set_decoded_size(output_bytes_);
+  }
+
+  if (!decoded) {
+    PrintLine(std::cerr, "Failed to write decoded output of: " + input_file);
+    return false;
+  }
 
-      if (fix_pos == -1) {
-        return -1;
+  // 所有块都在小时窗口之外时输出为空，但解码本身是成功的
+  if (!has_output && hour_skipped_blocks_ == 0) {
+    PrintLine(std::cerr, "No valid log data found in file: " + input_file);
+    return false;
+  }
+
+  if (!sink.Close()) {
+    PrintLine(std::cerr, "Failed to write decoded output of: " + input_file);
+    return false;
+  }
+
+  // 索引写出失败不影响解码结果
+  if (build_index && write_index_ &&
+      !index_->Save(XlogIndex::IndexPathFor(input_file))) {
+    PrintLine(std::cerr, "Failed to write index of: " + input_file);
+  }
+  return true;
+}
+
+bool XlogDecoder::DecodeStream(XlogBlockReader& reader,
+                               OutputSink& sink,
+                               bool skip_error_blocks,
+                               bool* has_output) {
+  reader.set_resync_chain_length(resync_chain_length_);
+  output_bytes_ = 0;
+  hour_skipped_blocks_ = 0;
+  resume_point_ = XlogResumePoint();
+
+  uint64_t start_pos = 0;
+  bool framed = false;
+  {
+    TraceSpan span("frame");
+    AllocScope alloc_scope(AllocStage::kFrame);
+    int64_t start_ns = collect_stats_ ? MonotonicNanos() : 0;
+    framed = FrameStart(reader, &start_pos);
+    if (leading_skipped_ > 0) {
+      span.set_name("resync");
+    }
+    if (collect_stats_) {
+      // 开头的垃圾数据与块间的损坏一样计为一次重新同步
+      int64_t elapsed = MonotonicNanos() - start_ns;
+      if (leading_skipped_ > 0) {
+        stats_.resync_count++;
+        stats_.resync_bytes += leading_skipped_;
+        stats_.resync_ns += elapsed;
       } else {
+        stats_.frame_ns += elapsed;
+      }
+    }
+  }
+  if (!framed) {
+    return true;
+  }
+  resume_frozen_ = start_pos > 0 && !reader.IsIndexed() &&
+                   !reader.IsResyncFinal(0, start_pos);
+
+  // 有开头垃圾数据且允许跳过错误块时，与块间重新同步一样输出诊断信息
+  if (start_pos > 0 && skip_error_blocks) {
+    std::string error_msg = "[F]xlog_decode error len=" +
+                            std::to_string(start_pos) +
+                            ", result:" + leading_error_ + "\n";
+    if (!sink.Write(reinterpret_cast<const uint8_t*>(error_msg.data()),
+                    error_msg.size())) {
+      return false;
+    }
+    output_bytes_ += error_msg.size();
+  }
+
+  reader.Seek(start_pos);
+  return DecodeRemaining(reader, sink, skip_error_blocks, has_output);
+}
+
+bool XlogDecoder::DecodeRemaining(XlogBlockReader& reader,
+                                  OutputSink& sink,
+                                  bool skip_error_blocks,
+                                  bool* has_output) {
+  if (thread_count_ > 1) {
+    if (!thread_pool_) {
+      thread_pool_ = std::make_unique<ThreadPool>(thread_count_);
+    }
+    return DecodePassParallel(reader, sink, skip_error_blocks, has_output);
+  }
+  return DecodePass(reader, sink, skip_error_blocks, has_output);
+}
+
+bool XlogDecoder::FrameStart(XlogBlockReader& reader, uint64_t* start_pos) {
+  // 单次分帧：开头就是有效块时直接从0开始，否则只向前扫描一次，
+  // 定位第一个满足链式校验的块；之后的损坏由逐块重新同步处理
+  leading_skipped_ = 0;
+  leading_error_.clear();
+
+  // 按索引读取时起点已知，只需取得开头数据的校验失败原因
+  if (reader.IsIndexed()) {
+    if (!reader.FirstIndexedOffset(start_pos)) {
+      leading_skipped_ = reader.Size();
+      return false;
+    }
+    if (*start_pos > 0) {
+      reader.IsValidLogBuffer(0, 1, &leading_error_);
+    }
+    leading_skipped_ = *start_pos;
+    return true;
+  }
+
+  if (reader.IsValidLogBuffer(0, 1, &leading_error_)) {
+    *start_pos = 0;
+    return true;
+  }
+
+  if (!reader.FindLogStartPosition(1, resync_chain_length_, start_pos)) {
+    leading_skipped_ = reader.Size();
+    return false;
+  }
+
+  leading_skipped_ = *start_pos;
+  return true;
+}
+
+bool XlogDecoder::DecodePass(XlogBlockReader& reader,
+                             OutputSink& sink,
+                             bool skip_error_blocks,
+                             bool* has_output) {
+  XlogBlock block;
+
+  while (true) {
+    block_buffer_.clear();
+    BlockReadStatus status;
+    {
+      TraceSpan span("frame");
+      AllocScope alloc_scope(AllocStage::kFrame);
+      int64_t start_ns = collect_stats_ ? MonotonicNanos() : 0;
+      status = reader.Next(&block, skip_error_blocks);
+      if (block.resynced) {
+        span.set_name("resync");
+      }
+      if (collect_stats_) {
+        RecordFrame(block, status == BlockReadStatus::kBlock, start_ns);
+      }
+    }
+
+    if (block.resynced) {
+      std::string error_msg =
+          "[F]xlog_decode error len=" + std::to_string(block.skipped) +
+          ", result:" + block.error + "\n";
+      block_buffer_.insert(block_buffer_.end(), error_msg.begin(),
+                           error_msg.end());
+    }
+
+    if (status == BlockReadStatus::kBlock && !IsBlockSelected(block)) {
+      SkipBlock(block, block_buffer_);
+    } else if (status == BlockReadStatus::kBlock) {
+      CheckSequence(block.seq, block_buffer_);
+      size_t body_start = block_buffer_.size();
+      DecodeBody(block.magic, block.body, block.length, BlockKey(block),
+                 *decompress_context_, block_buffer_, active_stats());
+      RecordBlock(block, output_bytes_ + body_start,
+                  block_buffer_.size() - body_start);
+    } else if (block.resynced && index_builder_ != nullptr) {
+      index_builder_->set_tail_skipped(block.skipped);
+    }
+
+    // 每个块解码完成后立即交给sink
+    if (!block_buffer_.empty()) {
+      *has_output = true;
+      if (!sink.Write(block_buffer_.data(), block_buffer_.size())) {
+        return false;
+      }
+      output_bytes_ += block_buffer_.size();
+    }
+
+    if (status != BlockReadStatus::kBlock || !sink.WantsMore()) {
+      return true;
+    }
+    CheckResyncFinal(reader, block);
+    if (!resume_frozen_) {
+      resume_point_.input_offset = reader.Tell();
+      resume_point_.output_offset = output_bytes_;
+      resume_point_.last_seq = last_seq_;
+    }
+  }
+}
+
+bool XlogDecoder::DecodePassParallel(XlogBlockReader& reader,
+                                     OutputSink& sink,
+                                     bool skip_error_blocks,
+                                     bool* has_output) {
+  XlogBlock block;
+  size_t max_blocks = thread_pool_->thread_count() * kParallelBlocksPerThread;
+  std::vector<BlockTask> tasks(max_blocks);
+  bool finished = false;
+
+  while (!finished) {
+    // 分帧阶段：顺序读取一批块，序列号检查依赖块顺序，在这里完成
+    size_t task_count = 0;
+    size_t batch_bytes = 0;
+    TraceSpan frame_span("frame");
+    AllocScope frame_alloc_scope(AllocStage::kFrame);
+    while (task_count < max_blocks && batch_bytes < kParallelBatchBytes) {
+      int64_t start_ns = collect_stats_ ? MonotonicNanos() : 0;
+      BlockReadStatus status = reader.Next(&block, skip_error_blocks);
+      if (collect_stats_) {
+        RecordFrame(block, status == BlockReadStatus::kBlock, start_ns);
+      }
+      BlockTask& task = tasks[task_count++];
+      task.prefix.clear();
+      task.output.clear();
+      task.has_body = false;
+
+      if (block.resynced) {
         std::string error_msg =
-            "[F]xlog_decode error len=" + std::to_string(fix_pos) +
-            ", result:" + result.second + "\n";
-        output_buffer.insert(output_buffer.end(), error_msg.begin(),
-                             error_msg.end());
-        offset += fix_pos;
+            "[F]xlog_decode error len=" + std::to_string(block.skipped) +
+            ", result:" + block.error + "\n";
+        task.prefix.insert(task.prefix.end(), error_msg.begin(),
+                           error_msg.end());
       }
-    } else {
-      // 不跳过错误块，直接返回错误
-      return -1;
-    }
-  }
-
-  uint8_t magic_start = buffer[offset];
-  uint32_t crypt_key_len = 0;
-
-  if (magic_start == MAGIC_NO_COMPRESS_START ||
-      magic_start == MAGIC_COMPRESS_START ||
-      magic_start == MAGIC_COMPRESS_START1) {
-    crypt_key_len = 4;
-  } else if (magic_start == MAGIC_COMPRESS_START2 ||
-             magic_start == MAGIC_NO_COMPRESS_START1 ||
-             magic_start == MAGIC_NO_COMPRESS_NO_CRYPT_START ||
-             magic_start == MAGIC_COMPRESS_NO_CRYPT_START ||
-             magic_start == MAGIC_SYNC_ZSTD_START ||
-             magic_start == MAGIC_SYNC_NO_CRYPT_ZSTD_START ||
-             magic_start == MAGIC_ASYNC_ZSTD_START ||
-             magic_start == MAGIC_ASYNC_NO_CRYPT_ZSTD_START) {
-    crypt_key_len = 64;
-  } else {
-    std::string error_msg = "in DecodeBuffer buffer[" + std::to_string(offset) +
-                            "]:" + std::to_string(magic_start) +
-                            " != MAGIC_NUM_START\n";
-    output_buffer.insert(output_buffer.end(), error_msg.begin(),
-                         error_msg.end());
-    return -1;
+
+      if (status != BlockReadStatus::kBlock) {
+        if (block.resynced && index_builder_ != nullptr) {
+          index_builder_->set_tail_skipped(block.skipped);
+        }
+        finished = true;
+        break;
+      }
+
+      if (!IsBlockSelected(block)) {
+        // 窗口外的块不占用本批的任务槽
+        CheckResyncFinal(reader, block);
+        SkipBlock(block, task.prefix);
+        task_count--;
+        continue;
+      }
+
+      CheckSequence(block.seq, task.prefix);
+      if (index_builder_ != nullptr) {
+        task.block.offset = block.offset;
+        task.block.magic = block.magic;
+        task.block.seq = block.seq;
+        task.block.begin_hour = block.begin_hour;
+        task.block.end_hour = block.end_hour;
+        task.block.length = block.length;
+      }
+      task.has_body = true;
+      task.magic = block.magic;
+      task.body_size = block.length;
+      task.tea_key = BlockKey(block);
+      if (reader.IsMemoryBacked()) {
+        task.body = block.body;
+      } else {
+        // 窗口在下一次Next时可能移动，需要保留主体副本
+        task.body_copy.assign(block.body, block.body + block.length);
+        task.body = task.body_copy.data();
+      }
+      // 检查重新同步可能移动窗口，放在复制主体之后
+      CheckResyncFinal(reader, block);
+      task.resume_point.input_offset = resume_frozen_ ? 0 : reader.Tell();
+      task.resume_point.last_seq = last_seq_;
+      batch_bytes += block.length;
+    }
+    frame_span.set_size(batch_bytes);
+    frame_span.End();
+    frame_alloc_scope.Leave();
+
+    // 解压阶段：各块独立压缩，并发解压到各自的输出缓冲；工作线程上的分配
+    // 计入本线程的账户
+    AllocAccount* account = CurrentAllocAccount();
+    for (size_t i = 0; i < task_count; ++i) {
+      BlockTask* task = &tasks[i];
+      if (task->has_body) {
+        DecodeStats* stats = nullptr;
+        if (collect_stats_) {
+          task->stats = DecodeStats();
+          stats = &task->stats;
+        }
+        thread_pool_->Submit([this, task, stats, account] {
+          AllocScope alloc_scope(account, AllocStage::kOther);
+          DecodeBody(task->magic, task->body, task->body_size, task->tea_key,
+                     ThreadDecompressContext(), task->output, stats);
+        });
+      }
+    }
+    {
+      // 主线程等待最慢的块，时间线上的空档即为工作线程的负载不均
+      TraceSpan span("wait");
+      thread_pool_->Wait();
+    }
+
+    // 重组阶段：按块顺序写入sink
+    for (size_t i = 0; i < task_count; ++i) {
+      if (tasks[i].has_body) {
+        RecordBlock(tasks[i].block, output_bytes_ + tasks[i].prefix.size(),
+                    tasks[i].output.size());
+        if (collect_stats_) {
+          stats_.Add(tasks[i].stats);
+        }
+      }
+      for (const std::vector<uint8_t>* part :
+           {&tasks[i].prefix, &tasks[i].output}) {
+        if (part->empty()) {
+          continue;
+        }
+        *has_output = true;
+        if (!sink.Write(part->data(), part->size())) {
+          return false;
+        }
+        output_bytes_ += part->size();
+      }
+      if (!sink.WantsMore()) {
+        return true;  // 本批其余块的解压结果不再需要
+      }
+      // 窗口外的块不在任务中，续解时重新跳过它们，输出不变
+      if (tasks[i].has_body && tasks[i].resume_point.input_offset != 0) {
+        resume_point_ = tasks[i].resume_point;
+        resume_point_.output_offset = output_bytes_;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool XlogDecoder::DecodeZipFile(const std::string& input_file,
+                                OutputSink& sink,
+                                bool skip_error_blocks) {
+  ZipArchive archive;
+  std::vector<const ZipEntry*> entries;
+  int64_t start_ns = collect_stats_ ? MonotonicNanos() : 0;
+  if (!OpenZip(input_file, &archive, &entries)) {
+    return false;
+  }
+  if (collect_stats_) {
+    stats_.open_ns += MonotonicNanos() - start_ns;
+  }
+
+  // 每批条目数与线程数相同，缓冲的输出不超过一批条目的解码结果
+  struct EntryOutput {
+    std::vector<uint8_t> data;
+    uint64_t hour_skipped = 0;
+    bool decoded = false;
+    DecodeStats stats;
+  };
+  hour_skipped_blocks_ = 0;
+  bool all_decoded = true;
+  for (size_t first = 0; first < entries.size() && sink.WantsMore();
+       first += thread_count_) {
+    size_t count = std::min(thread_count_, entries.size() - first);
+    std::vector<EntryOutput> outputs(count);
+    RunZipTasks(count, [&](size_t i) {
+      const ZipEntry& entry = *entries[first + i];
+      BufferOutputSink buffer(outputs[i].data);
+      outputs[i].decoded = DecodeZipEntry(
+          archive, entry, input_file + ":" + entry.name, buffer,
+          skip_error_blocks, &outputs[i].hour_skipped,
+          collect_stats_ ? &outputs[i].stats : nullptr);
+    });
+
+    for (size_t i = 0; i < count && sink.WantsMore(); ++i) {
+      hour_skipped_blocks_ += outputs[i].hour_skipped;
+      // 条目先解码到内存，写出耗时在写入sink时统计
+      if (collect_stats_) {
+        stats_.Add(outputs[i].stats);
+      }
+      if (!outputs[i].decoded) {
+        all_decoded = false;
+        continue;
+      }
+      std::string header =
+          "[F]xlog_decode zip entry: " + entries[first + i]->name + "\n";
+      if (!sink.Write(reinterpret_cast<const uint8_t*>(header.data()),
+                      header.size()) ||
+          !sink.Write(outputs[i].data.data(), outputs[i].data.size())) {
+        PrintLine(std::cerr,
+                  "Failed to write decoded output of: " + input_file);
+        return false;
+      }
+    }
+  }
+
+  if (!sink.Close()) {
+    PrintLine(std::cerr, "Failed to write decoded output of: " + input_file);
+    return false;
+  }
+  return all_decoded;
+}
+
+bool XlogDecoder::DecodeZipEntries(const std::string& input_file,
+                                   const ZipSinkFactory& open_sink,
+                                   bool skip_error_blocks) {
+  StatsScope scope(collect_stats_, &stats_scope_active_, &stats_,
+                   alloc_account());
+  ZipArchive archive;
+  std::vector<const ZipEntry*> entries;
+  int64_t start_ns = collect_stats_ ? MonotonicNanos() : 0;
+  if (!OpenZip(input_file, &archive, &entries)) {
+    return false;
+  }
+  if (collect_stats_) {
+    stats_.open_ns += MonotonicNanos() - start_ns;
+  }
+
+  // 各条目的输出互不相关，全部条目一次提交，不必按批等待
+  std::vector<uint64_t> hour_skipped(entries.size(), 0);
+  std::vector<char> decoded(entries.size(), 0);
+  std::vector<DecodeStats> entry_stats(collect_stats_ ? entries.size() : 0);
+  RunZipTasks(entries.size(), [&](size_t i) {
+    const ZipEntry& entry = *entries[i];
+    std::string label = input_file + ":" + entry.name;
+    std::unique_ptr<OutputSink> sink = open_sink(entry.name);
+    if (!sink) {
+      PrintLine(std::cerr, "Failed to create output for: " + label);
+      return;
+    }
+    DecodeStats* stats = collect_stats_ ? &entry_stats[i] : nullptr;
+    std::optional<MeteredOutputSink> metered_sink;
+    if (stats != nullptr || TraceRecorder::Instance().enabled()) {
+      metered_sink.emplace(*sink, stats);
+    }
+    OutputSink& target =
+        metered_sink ? static_cast<OutputSink&>(*metered_sink) : *sink;
+    decoded[i] = DecodeZipEntry(archive, entry, label, target,
+                                skip_error_blocks, &hour_skipped[i], stats);
+  });
+
+  hour_skipped_blocks_ = 0;
+  for (uint64_t count : hour_skipped) {
+    hour_skipped_blocks_ += count;
   }
+  for (const DecodeStats& stats : entry_stats) {
+    stats_.Add(stats);
+  }
+  return std::find(decoded.begin(), decoded.end(), 0) == decoded.end();
+}
 
-  uint32_t header_len = 1 + 2 + 1 + 1 + 4 + crypt_key_len;
+bool XlogDecoder::OpenZip(const std::string& input_file,
+                          ZipArchive* archive,
+                          std::vector<const ZipEntry*>* entries) {
+  TraceSpan span("open", input_file);
+  AllocScope alloc_scope(AllocStage::kOpen);
+  std::string error;
+  if (!archive->Open(input_file, &error)) {
+    PrintLine(std::cerr,
+              "Failed to read ZIP file: " + input_file + " (" + error + ")");
+    return false;
+  }
+  for (const ZipEntry& entry : archive->entries()) {
+    if (entry.IsXlog()) {
+      entries->push_back(&entry);
+    }
+  }
+  if (entries->empty()) {
+    PrintLine(std::cerr, "No XLOG entries found in ZIP file: " + input_file);
+    return false;
+  }
+  return true;
+}
 
-  // 提取头部字段
-  uint32_t length = 0;
-  uint16_t seq = 0;
-  uint8_t begin_hour = 0;
-  uint8_t end_hour = 0;
+bool XlogDecoder::DecodeZipEntry(ZipArchive& archive,
+                                 const ZipEntry& entry,
+                                 const std::string& label,
+                                 OutputSink& sink,
+                                 bool skip_error_blocks,
+                                 uint64_t* hour_skipped,
+                                 DecodeStats* stats) const {
+  TraceSpan span("zip entry", label);
+
+  // 分帧和重新同步需要随机访问，条目整体解压到内存后按内存数据解码
+  std::vector<uint8_t> data;
+  std::string error;
+  int64_t start_ns = stats != nullptr ? MonotonicNanos() : 0;
+  TraceSpan read_span("open");
+  AllocScope read_alloc_scope(AllocStage::kOpen);
+  bool read = archive.ReadEntry(entry, &data, &error);
+  read_alloc_scope.Leave();
+  read_span.set_size(data.size());
+  read_span.End();
+  if (!read) {
+    PrintLine(std::cerr,
+              "Failed to read ZIP entry: " + label + " (" + error + ")");
+    return false;
+  }
+  if (data.empty()) {
+    PrintLine(std::cerr, "Input file is empty: " + label);
+    return false;
+  }
 
-  std::memcpy(&length, &buffer[offset + header_len - 4 - crypt_key_len],
-              sizeof(length));
-  std::memcpy(&seq, &buffer[offset + header_len - 4 - crypt_key_len - 2 - 2],
-              sizeof(seq));
-  begin_hour = buffer[offset + header_len - 4 - crypt_key_len - 1 - 1];
-  end_hour = buffer[offset + header_len - 4 - crypt_key_len - 1];
+  // 条目不在磁盘上，没有索引可用
+  XlogDecoder decoder;
+  decoder.set_resync_chain_length(resync_chain_length_);
+  decoder.set_use_index(false);
+  decoder.set_key_ring(key_ring_);
+  decoder.set_collect_stats(stats != nullptr);
+  decoder.hour_mask_ = hour_mask_;
+  if (stats != nullptr) {
+    decoder.stats_.open_ns = MonotonicNanos() - start_ns;
+    decoder.stats_.bytes_read = data.size();
+  }
+  XlogBlockReader reader;
+  reader.Attach(data.data(), data.size());
+  bool result = decoder.DecodeToSink(reader, sink, skip_error_blocks, label);
+  *hour_skipped = decoder.hour_skipped_blocks_;
+  if (stats != nullptr) {
+    stats->Add(decoder.stats_);
+  }
+  return result;
+}
 
-  // 复制主体数据
-  std::vector<uint8_t> body_buffer(
-      buffer.begin() + offset + header_len,
-      buffer.begin() + offset + header_len + length);
+void XlogDecoder::RunZipTasks(size_t count,
+                              const std::function<void(size_t)>& decode) {
+  if (thread_count_ <= 1 || count <= 1) {
+    for (size_t i = 0; i < count; ++i) {
+      decode(i);
+    }
+    return;
+  }
+  if (!thread_pool_) {
+    thread_pool_ = std::make_unique<ThreadPool>(thread_count_);
+  }
+  AllocAccount* account = CurrentAllocAccount();
+  for (size_t i = 0; i < count; ++i) {
+    thread_pool_->Submit([&decode, i, account] {
+      AllocScope alloc_scope(account, AllocStage::kOther);
+      decode(i);
+    });
+  }
+  thread_pool_->Wait();
+}
 
+bool XlogDecoder::IsBlockSelected(const XlogBlock& block) const {
+  if (hour_mask_ == kAllHours) {
+    return true;
+  }
+  // 头部小时无效时无法判断，保留该块
+  if (block.begin_hour > 23 || block.end_hour > 23) {
+    return true;
+  }
+  return (HourSpanMask(block.begin_hour, block.end_hour) & hour_mask_) != 0;
+}
+
+void XlogDecoder::SkipBlock(const XlogBlock& block,
+                            std::vector<uint8_t>& prefix) {
+  // 窗口外块的重新同步和序列号缺失提示一并丢弃，但序列号照常推进，
+  // 避免把窗口外的块误报为缺失
+  prefix.clear();
+  if (block.seq != 0) {
+    last_seq_ = block.seq;
+  }
+  hour_skipped_blocks_++;
+  if (collect_stats_) {
+    stats_.hour_skipped_blocks++;
+  }
+}
+
+void XlogDecoder::CheckResyncFinal(XlogBlockReader& reader,
+                                   const XlogBlock& block) {
+  // 重新同步的结果可能随追加的数据改变时，续解进度停在重新同步之前
+  if (block.resynced && !resume_frozen_ && !reader.IsIndexed() &&
+      !reader.IsResyncFinal(block.offset - block.skipped, block.offset)) {
+    resume_frozen_ = true;
+  }
+}
+
+void XlogDecoder::RecordBlock(const XlogBlock& block,
+                              uint64_t output_offset,
+                              size_t decoded_length) {
+  if (index_builder_ == nullptr) {
+    return;
+  }
+  XlogIndexEntry entry;
+  entry.offset = block.offset;
+  entry.output_offset = output_offset;
+  entry.decoded_length = decoded_length;
+  entry.length = block.length;
+  entry.seq = block.seq;
+  entry.magic = block.magic;
+  entry.begin_hour = block.begin_hour;
+  entry.end_hour = block.end_hour;
+  index_builder_->Add(entry);
+}
+
+void XlogDecoder::RecordFrame(const XlogBlock& block,
+                              bool is_block,
+                              int64_t start_ns) {
+  int64_t elapsed = MonotonicNanos() - start_ns;
+  if (block.resynced) {
+    stats_.resync_count++;
+    stats_.resync_bytes += block.skipped;
+    stats_.resync_ns += elapsed;
+  } else {
+    stats_.frame_ns += elapsed;
+  }
+  if (is_block) {
+    stats_.CountBlock(block.magic);
+  }
+}
+
+AllocAccount* XlogDecoder::alloc_account() {
+  if (alloc_account_ == nullptr && collect_stats_ && AllocTrackingCompiled()) {
+    alloc_account_ = AllocAccount::Create();
+  }
+  return alloc_account_;
+}
+
+void XlogDecoder::CheckSequence(uint16_t seq,
+                                std::vector<uint8_t>& output_buffer) {
   // 检查序列号的连续性
   if (seq != 0 && seq != 1 && last_seq_ != 0 && seq != (last_seq_ + 1)) {
     std::string warning =
         "[F]xlog_decode log seq:" + std::to_string(last_seq_ + 1) + "-" +
         std::to_string(seq - 1) + " is missing\n";
     output_buffer.insert(output_buffer.end(), warning.begin(), warning.end());
+    if (collect_stats_) {
+      stats_.seq_gaps++;
+      // 序列号倒退（如进程重启）时无法确定缺失的个数，只计次数
+      if (seq > last_seq_) {
+        stats_.seq_missing += seq - last_seq_ - 1;
+      }
+    }
   }
 
   if (seq != 0) {
     last_seq_ = seq;
   }
+}
+
+const TeaKey* XlogDecoder::BlockKey(const XlogBlock& block) const {
+  if (key_ring_ == nullptr || !IsEncryptedMagic(block.magic) ||
+      block.header_len < kXlogPublicKeySize) {
+    return nullptr;
+  }
+  // 公钥是头部的最后64字节，紧接在主体之前
+  return key_ring_->GetTeaKey(block.body - kXlogPublicKeySize);
+}
+
+void XlogDecoder::DecodeBlockBody(uint8_t magic,
+                                  const uint8_t* body,
+                                  size_t body_size,
+                                  std::vector<uint8_t>& output) {
+  DecodeBody(magic, body, body_size, nullptr, *decompress_context_, output,
+             nullptr);
+}
 
+void XlogDecoder::DecodeBody(uint8_t magic_start,
+                             const uint8_t* body,
+                             size_t body_size,
+                             const TeaKey* tea_key,
+                             DecompressContext& context,
+                             std::vector<uint8_t>& output_buffer,
+                             DecodeStats* stats) const {
+  TraceSpan span("decompress");
+  span.set_block(magic_start, body_size);
+  AllocScope alloc_scope(AllocStage::kDecompress);
+
+  // 统计时记录本块的解压方式，解压结束后把耗时计入对应的字段
+  int64_t start_ns = stats != nullptr ? MonotonicNanos() : 0;
+  int64_t DecodeStats::*codec_ns = nullptr;
+  bool failed = false;
+
+  // 主体直接引用读取器中的数据，解压结果直接写入输出缓冲，不做中间复制；
+  // 只有加密块需要先解密到上下文的缓冲中
   try {
+    if (tea_key != nullptr) {
+      context.decrypt_buffer.assign(body, body + body_size);
+      TeaDecrypt(*tea_key, context.decrypt_buffer.data(), body_size);
+      body = context.decrypt_buffer.data();
+      if (stats != nullptr) {
+        int64_t now = MonotonicNanos();
+        stats->decrypt_ns += now - start_ns;
+        start_ns = now;
+      }
+    }
+
     // 处理不同的压缩格式
     if (magic_start == MAGIC_NO_COMPRESS_START1 ||
-        magic_start == MAGIC_COMPRESS_START2) {
-      // 旧格式 - 无需特殊处理
-      output_buffer.insert(output_buffer.end(), body_buffer.begin(),
-                           body_buffer.end());
+        (magic_start == MAGIC_COMPRESS_START2 && tea_key == nullptr)) {
+      // 不压缩的块，以及没有密钥无法解密的MAGIC_COMPRESS_START2块，原样输出
+      output_buffer.insert(output_buffer.end(), body, body + body_size);
     } else if (magic_start == MAGIC_SYNC_ZSTD_START ||
                magic_start == MAGIC_SYNC_NO_CRYPT_ZSTD_START ||
                magic_start == MAGIC_ASYNC_ZSTD_START ||
                magic_start == MAGIC_ASYNC_NO_CRYPT_ZSTD_START) {
       // ZSTD压缩
-      if (!DecompressZstd(body_buffer.data(), body_buffer.size(),
-                          output_buffer)) {
+      codec_ns = &DecodeStats::zstd_ns;
+      if (!DecompressZstd(context, body, body_size, output_buffer)) {
+        failed = true;
         std::string error_msg = "[F]xlog_decode ZSTD decompress error\n";
         output_buffer.insert(output_buffer.end(), error_msg.begin(),
                              error_msg.end());
       }
     } else if (magic_start == MAGIC_COMPRESS_START ||
+               magic_start == MAGIC_COMPRESS_START2 ||
                magic_start == MAGIC_COMPRESS_NO_CRYPT_START) {
       // ZLIB压缩
-      if (!DecompressZlib(body_buffer.data(), body_buffer.size(),
-                          output_buffer)) {
+      codec_ns = &DecodeStats::zlib_ns;
+      if (!DecompressZlib(context, body, body_size, output_buffer)) {
+        failed = true;
         std::string error_msg = "[F]xlog_decode decompress error\n";
         output_buffer.insert(output_buffer.end(), error_msg.begin(),
                              error_msg.end());
       }
     } else if (magic_start == MAGIC_COMPRESS_START1) {
-      // 带嵌入长度的特殊格式
-      std::vector<uint8_t> decompress_data;
-      size_t pos = 0;
-
-      while (pos < body_buffer.size()) {
-        if (pos + 2 > body_buffer.size()) {
-          break;
-        }
-
-        uint16_t single_log_len = 0;
-        std::memcpy(&single_log_len, &body_buffer[pos], sizeof(single_log_len));
-        pos += 2;
-
-        if (pos + single_log_len > body_buffer.size()) {
-          break;
-        }
-
-        decompress_data.insert(decompress_data.end(), body_buffer.begin() + pos,
-                               body_buffer.begin() + pos + single_log_len);
-
-        pos += single_log_len;
-      }
-
-      if (!DecompressZlib(decompress_data.data(), decompress_data.size(),
-                          output_buffer)) {
+      // 带嵌入长度的特殊格式，各段依次送入同一个压缩流
+      codec_ns = &DecodeStats::zlib_ns;
+      if (!DecompressZlibSegments(context, body, body_size, output_buffer)) {
+        failed = true;
         std::string error_msg = "[F]xlog_decode decompress error\n";
         output_buffer.insert(output_buffer.end(), error_msg.begin(),
                              error_msg.end());
       }
     } else {
       // 无压缩，直接追加数据
-      output_buffer.insert(output_buffer.end(), body_buffer.begin(),
-                           body_buffer.end());
+      output_buffer.insert(output_buffer.end(), body, body + body_size);
     }
   } catch (const std::exception& e) {
+    failed = true;
     std::string error_msg =
         "[F]xlog_decode decompress error: " + std::string(e.what()) + "\n";
     output_buffer.insert(output_buffer.end(), error_msg.begin(),
                          error_msg.end());
   }
 
-  // 返回此块之后的位置
-  return offset + header_len + length + 1;
+  if (stats != nullptr) {
+    if (codec_ns != nullptr) {
+      stats->*codec_ns += MonotonicNanos() - start_ns;
+    }
+    if (failed) {
+      stats->decompress_errors++;
+    }
+  }
 }
 
-bool XlogDecoder::DecompressZlib(const uint8_t* input_data,
+bool XlogDecoder::DecompressZlib(DecompressContext& context,
+                                 const uint8_t* input_data,
                                  size_t input_size,
-                                 std::vector<uint8_t>& output_buffer) {
-  // 恢复zlib解压缩实现
+                                 std::vector<uint8_t>& output_buffer) const {
   if (input_size == 0) {
     return true;  // 没有需要解压的数据
   }
 
-  z_stream strm;
-  unsigned char out[kChunkSize];
-
-  // 初始化zlib进行解压缩
-  strm.zalloc = Z_NULL;
-  strm.zfree = Z_NULL;
-  strm.opaque = Z_NULL;
-  strm.avail_in = 0;
-  strm.next_in = Z_NULL;
-
-  int ret = inflateInit2(&strm, -MAX_WBITS);  // 原始deflate格式
-  if (ret != Z_OK) {
+  if (!ResetInflate(context)) {
     return false;
   }
+  int ret = InflateInput(context.zlib_stream, input_data, input_size,
+                         output_buffer);
+  return ret == Z_OK || ret == Z_STREAM_END;
+}
 
-  // 设置输入数据
-  strm.avail_in = static_cast<uInt>(input_size);
-  strm.next_in =
-      const_cast<Bytef*>(input_data);  // 安全的转换，因为zlib不会修改输入
-
-  // 解压直到完成
-  do {
-    strm.avail_out = kChunkSize;
-    strm.next_out = out;
-
-    ret = inflate(&strm, Z_NO_FLUSH);
-    if (ret != Z_OK && ret != Z_STREAM_END) {
-      inflateEnd(&strm);
+bool XlogDecoder::DecompressZlibSegments(
+    DecompressContext& context,
+    const uint8_t* body,
+    size_t body_size,
+    std::vector<uint8_t>& output_buffer) const {
+  bool started = false;
+  size_t pos = 0;
+
+  // 主体由若干[2字节长度][压缩数据]段组成，拼接后是一个完整的压缩流
+  // 逐段把输入交给inflate，不需要先拼接到临时缓冲
+  while (pos + 2 <= body_size) {
+    uint16_t single_log_len = 0;
+    std::memcpy(&single_log_len, body + pos, sizeof(single_log_len));
+    pos += 2;
+
+    if (pos + single_log_len > body_size) {
+      break;  // 不完整的段被丢弃
+    }
 
-      if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
+    if (single_log_len > 0) {
+      if (!started) {
+        if (!ResetInflate(context)) {
+          return false;
+        }
+        started = true;
+      }
+      int ret = InflateInput(context.zlib_stream, body + pos, single_log_len,
+                             output_buffer);
+      if (ret == Z_STREAM_END) {
+        return true;  // 压缩流已结束，忽略后续数据
+      }
+      if (ret != Z_OK) {
         return false;
       }
     }
 
-    unsigned int have = kChunkSize - strm.avail_out;
-    output_buffer.insert(output_buffer.end(), out, out + have);
-
-  } while (strm.avail_out == 0);
+    pos += single_log_len;
+  }
 
-  // 清理
-  inflateEnd(&strm);
-  return ret == Z_STREAM_END || ret == Z_OK;
+  return true;
 }
 
-bool XlogDecoder::DecompressZstd(const uint8_t* input_data,
+bool XlogDecoder::DecompressZstd(DecompressContext& context,
+                                 const uint8_t* input_data,
                                  size_t input_size,
-                                 std::vector<uint8_t>& output_buffer) {
+                                 std::vector<uint8_t>& output_buffer) const {
   if (input_size == 0) {
     return true;  // 没有需要解压的数据
   }
 
-  // 获取解压后的大小
-  unsigned long long const frame_content_size =
-      ZSTD_getFrameContentSize(input_data, input_size);
-  if (frame_content_size == ZSTD_CONTENTSIZE_ERROR ||
-      frame_content_size == ZSTD_CONTENTSIZE_UNKNOWN) {
-    // 无法确定大小，使用增量解压
-    size_t const out_bufsize = ZSTD_DStreamOutSize();
-    std::vector<char> out_buffer(out_bufsize);
-
-    ZSTD_DStream* const dstream = ZSTD_createDStream();
-    if (dstream == nullptr) {
+  if (context.zstd_context == nullptr) {
+    context.zstd_context = ZSTD_createDCtx();
+    if (context.zstd_context == nullptr) {
       return false;
     }
+  }
+  ZSTD_DCtx* dctx = context.zstd_context;
+  size_t base = output_buffer.size();
 
-    ZSTD_initDStream(dstream);
-
-    ZSTD_inBuffer input = {input_data, input_size, 0};
-    while (input.pos < input.size) {
-      ZSTD_outBuffer output = {out_buffer.data(), out_buffer.size(), 0};
-      size_t const ret = ZSTD_decompressStream(dstream, &output, &input);
-      if (ZSTD_isError(ret)) {
-        ZSTD_freeDStream(dstream);
-        return false;
-      }
-      output_buffer.insert(output_buffer.end(), out_buffer.begin(),
-                           out_buffer.begin() + output.pos);
-    }
-
-    ZSTD_freeDStream(dstream);
-    return true;
-  } else {
-    // 已知解压后大小，直接解压
-    std::vector<char> decompress_buffer(frame_content_size);
+  // 所有帧都记录了内容大小时一次解压到输出末尾，ZSTD_decompressDCtx依次处理多个帧
+  size_t content_size = 0;
+  if (SumZstdContentSize(input_data, input_size, &content_size)) {
+    output_buffer.resize(base + content_size);
     size_t const dsize =
-        ZSTD_decompress(decompress_buffer.data(), decompress_buffer.size(),
-                        input_data, input_size);
-
+        ZSTD_decompressDCtx(dctx, output_buffer.data() + base, content_size,
+                            input_data, input_size);
     if (ZSTD_isError(dsize)) {
+      output_buffer.resize(base);
       return false;
     }
-
-    output_buffer.insert(output_buffer.end(), decompress_buffer.begin(),
-                         decompress_buffer.begin() + dsize);
+    output_buffer.resize(base + dsize);
     return true;
   }
+
+  // 无法确定大小（Mars异步模式的帧不记录大小且可能未结束），使用增量解压
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+  ZSTD_inBuffer input = {input_data, input_size, 0};
+  while (true) {
+    size_t used = output_buffer.size();
+    size_t room = std::max({(input.size - input.pos) * kExpectedRatio,
+                            used - base, kMinOutputGrowth});
+    output_buffer.resize(used + room);
+    ZSTD_outBuffer output = {output_buffer.data() + used, room, 0};
+    size_t const ret = ZSTD_decompressStream(dctx, &output, &input);
+    output_buffer.resize(used + output.pos);
+    if (ZSTD_isError(ret)) {
+      return false;
+    }
+    // 输入耗尽且输出未写满时，解码器内没有剩余数据
+    if (input.pos == input.size && output.pos < output.size) {
+      return true;
+    }
+  }
 }
 
 }  // namespace xlog_decode
\ No newline at end of file
@@ -0,0 +1,148 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// xlog_index.cpp - XlogIndex类的实现
+
+#include "xlog_index.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "file_utils.h"
+#include "xlog_constants.h"
+
+namespace xlog_decode {
+
+namespace {
+// 索引文件格式版本，记录结构变化时递增
+constexpr uint32_t kIndexVersion = 1;
+
+// 校验戳覆盖的文件开头和末尾的数据长度
+constexpr size_t kStampSampleSize = 4096;
+
+// 索引文件头，其后紧跟entry_count个XlogIndexEntry
+#pragma pack(push, 1)
+struct IndexFileHeader {
+  char magic[4];  // "XIDX"
+  uint32_t version;
+  uint32_t entry_size;
+  int32_t resync_chain_length;
+  uint64_t file_size;
+  int64_t modified_time;
+  uint32_t head_crc;
+  uint32_t tail_crc;
+  uint64_t tail_skipped;
+  uint64_t decoded_size;
+  uint64_t entry_count;
+};
+#pragma pack(pop)
+
+constexpr char kIndexMagic[4] = {'X', 'I', 'D', 'X'};
+
+// 读取offset处最多kStampSampleSize字节并计算CRC32
+bool SampleCrc(RandomAccessFile& file, uint64_t offset, uint32_t* crc) {
+  uint8_t sample[kStampSampleSize];
+  size_t len = static_cast<size_t>(
+      std::min<uint64_t>(sizeof(sample), file.Size() - offset));
+  if (file.ReadAt(offset, sample, len) != len) {
+    return false;
+  }
+  *crc = static_cast<uint32_t>(
+      crc32(0L, sample, static_cast<uInt>(len)));
+  return true;
+}
+}  // namespace
+
+std::string XlogIndex::IndexPathFor(const std::string& input_file) {
+  return input_file + kIndexFileExt;
+}
+
+bool XlogIndex::ComputeStamp(const std::string& input_file,
+                             XlogIndexStamp* stamp) {
+  RandomAccessFile file;
+  if (!file.Open(input_file)) {
+    return false;
+  }
+
+  stamp->file_size = file.Size();
+  stamp->modified_time = FileUtils::GetModifiedTime(input_file);
+  uint64_t tail_offset =
+      file.Size() > kStampSampleSize ? file.Size() - kStampSampleSize : 0;
+  return SampleCrc(file, 0, &stamp->head_crc) &&
+         SampleCrc(file, tail_offset, &stamp->tail_crc);
+}
+
+bool XlogIndex::Load(const std::string& index_file,
+                     const std::string& input_file) {
+  entries_.clear();
+
+  std::vector<uint8_t> buffer;
+  if (!FileUtils::PathExists(index_file) ||
+      !FileUtils::ReadFile(index_file, buffer) ||
+      buffer.size() < sizeof(IndexFileHeader)) {
+    return false;
+  }
+
+  IndexFileHeader header;
+  std::memcpy(&header, buffer.data(), sizeof(header));
+  if (std::memcmp(header.magic, kIndexMagic, sizeof(kIndexMagic)) != 0 ||
+      header.version != kIndexVersion ||
+      header.entry_size != sizeof(XlogIndexEntry) ||
+      header.entry_count > (buffer.size() - sizeof(header)) /
+                               sizeof(XlogIndexEntry) ||
+      sizeof(header) + header.entry_count * sizeof(XlogIndexEntry) !=
+          buffer.size()) {
+    return false;
+  }
+
+  // 输入文件在建立索引后被修改过，索引中的偏移不再可信
+  XlogIndexStamp current;
+  if (!ComputeStamp(input_file, &current)) {
+    return false;
+  }
+  stamp_.file_size = header.file_size;
+  stamp_.modified_time = header.modified_time;
+  stamp_.head_crc = header.head_crc;
+  stamp_.tail_crc = header.tail_crc;
+  if (stamp_ != current) {
+    return false;
+  }
+
+  resync_chain_length_ = header.resync_chain_length;
+  tail_skipped_ = header.tail_skipped;
+  decoded_size_ = header.decoded_size;
+  entries_.resize(static_cast<size_t>(header.entry_count));
+  if (!entries_.empty()) {
+    std::memcpy(entries_.data(), buffer.data() + sizeof(header),
+                entries_.size() * sizeof(XlogIndexEntry));
+  }
+  return true;
+}
+
+bool XlogIndex::Save(const std::string& index_file) const {
+  IndexFileHeader header;
+  std::memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+  header.version = kIndexVersion;
+  header.entry_size = sizeof(XlogIndexEntry);
+  header.resync_chain_length = resync_chain_length_;
+  header.file_size = stamp_.file_size;
+  header.modified_time = stamp_.modified_time;
+  header.head_crc = stamp_.head_crc;
+  header.tail_crc = stamp_.tail_crc;
+  header.tail_skipped = tail_skipped_;
+  header.decoded_size = decoded_size_;
+  header.entry_count = entries_.size();
+
+  std::vector<uint8_t> buffer(sizeof(header) +
+                              entries_.size() * sizeof(XlogIndexEntry));
+  std::memcpy(buffer.data(), &header, sizeof(header));
+  if (!entries_.empty()) {
+    std::memcpy(buffer.data() + sizeof(header), entries_.data(),
+                entries_.size() * sizeof(XlogIndexEntry));
+  }
+  return FileUtils::WriteFile(index_file, buffer);
+}
+
+}  // namespace xlog_decode
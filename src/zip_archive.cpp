@@ -0,0 +1,376 @@
+// Copyright (c) 2023-2024 xlog_decode contributors
+// Licensed under the MIT License
+//
+// zip_archive.cpp - ZipArchive类的实现
+
+#include "zip_archive.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+#include "xlog_constants.h"
+
+namespace xlog_decode {
+
+namespace {
+
+// 各记录的签名
+constexpr uint32_t kLocalHeaderSignature = 0x04034b50;
+constexpr uint32_t kCentralHeaderSignature = 0x02014b50;
+constexpr uint32_t kEndOfDirectorySignature = 0x06054b50;
+constexpr uint32_t kZip64EndOfDirectorySignature = 0x06064b50;
+constexpr uint32_t kZip64LocatorSignature = 0x07064b50;
+
+// 各记录固定部分的长度
+constexpr size_t kLocalHeaderSize = 30;
+constexpr size_t kCentralHeaderSize = 46;
+constexpr size_t kEndOfDirectorySize = 22;
+constexpr size_t kZip64EndOfDirectorySize = 56;
+constexpr size_t kZip64LocatorSize = 20;
+
+// 结束记录之后的注释最长65535字节
+constexpr size_t kMaxCommentSize = 0xFFFF;
+
+// ZIP64扩展字段的标识
+constexpr uint16_t kZip64ExtraId = 0x0001;
+
+// 解压时每次读取的压缩数据量
+constexpr size_t kReadChunkSize = 256 * 1024;
+
+// 一次交给zlib的最大长度，zlib的长度字段是32位
+constexpr size_t kZlibChunkSize = size_t{1} << 30;
+
+// deflate的最大压缩比约为1032:1，声明的大小超出时条目必然无效，
+// 不按伪造的大小分配内存
+constexpr uint64_t kMaxDeflateRatio = 1032;
+
+uint16_t Read16(const uint8_t* p) {
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t Read32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint64_t Read64(const uint8_t* p) {
+  return static_cast<uint64_t>(Read32(p)) |
+         (static_cast<uint64_t>(Read32(p + 4)) << 32);
+}
+
+// 计算整个缓冲区的CRC32
+uint32_t Crc32(const uint8_t* data, size_t size) {
+  uLong crc = crc32(0L, Z_NULL, 0);
+  while (size > 0) {
+    size_t chunk = std::min(size, kZlibChunkSize);
+    crc = crc32(crc, data, static_cast<uInt>(chunk));
+    data += chunk;
+    size -= chunk;
+  }
+  return static_cast<uint32_t>(crc);
+}
+
+}  // namespace
+
+bool ZipEntry::IsDirectory() const {
+  return !name.empty() && name.back() == '/';
+}
+
+bool ZipEntry::IsXlog() const {
+  return !IsDirectory() && (FileUtils::HasExtension(name, kXlogFileExt) ||
+                            FileUtils::HasExtension(name, kMmapFileExt));
+}
+
+bool ZipArchive::Open(const std::string& file_path, std::string* error) {
+  entries_.clear();
+  if (!file_.Open(file_path)) {
+    *error = "cannot open file";
+    return false;
+  }
+
+  uint64_t offset = 0;
+  uint64_t size = 0;
+  uint64_t count = 0;
+  if (!FindCentralDirectory(&offset, &size, &count, error)) {
+    return false;
+  }
+
+  std::vector<uint8_t> directory;
+  try {
+    directory.resize(static_cast<size_t>(size));
+  } catch (const std::exception&) {
+    *error = "central directory is too large";
+    return false;
+  }
+  if (!ReadAt(offset, directory.data(), directory.size())) {
+    *error = "truncated central directory";
+    return false;
+  }
+  return ParseCentralDirectory(directory, count, error);
+}
+
+bool ZipArchive::FindCentralDirectory(uint64_t* offset,
+                                      uint64_t* size,
+                                      uint64_t* count,
+                                      std::string* error) {
+  // 结束记录位于文件末尾，之后只有变长的注释，从后向前查找签名
+  uint64_t file_size = file_.Size();
+  size_t tail_size = static_cast<size_t>(std::min<uint64_t>(
+      file_size, kEndOfDirectorySize + kMaxCommentSize));
+  uint64_t tail_start = file_size - tail_size;
+  std::vector<uint8_t> tail(tail_size);
+  if (tail_size < kEndOfDirectorySize ||
+      !ReadAt(tail_start, tail.data(), tail.size())) {
+    *error = "file is too small";
+    return false;
+  }
+
+  size_t pos = tail_size - kEndOfDirectorySize + 1;
+  const uint8_t* record = nullptr;
+  while (pos-- > 0) {
+    const uint8_t* p = &tail[pos];
+    if (Read32(p) == kEndOfDirectorySignature &&
+        pos + kEndOfDirectorySize + Read16(p + 20) <= tail_size) {
+      record = p;
+      break;
+    }
+  }
+  if (record == nullptr) {
+    *error = "end of central directory not found";
+    return false;
+  }
+
+  uint16_t disk = Read16(record + 4);
+  uint16_t directory_disk = Read16(record + 6);
+  *count = Read16(record + 10);
+  *size = Read32(record + 12);
+  *offset = Read32(record + 16);
+
+  // 有ZIP64定位记录时以ZIP64结束记录中的64位字段为准
+  uint64_t record_offset = tail_start + pos;
+  uint8_t locator[kZip64LocatorSize];
+  if (record_offset >= kZip64LocatorSize &&
+      ReadAt(record_offset - kZip64LocatorSize, locator, sizeof(locator)) &&
+      Read32(locator) == kZip64LocatorSignature) {
+    uint8_t zip64[kZip64EndOfDirectorySize];
+    if (!ReadAt(Read64(locator + 8), zip64, sizeof(zip64)) ||
+        Read32(zip64) != kZip64EndOfDirectorySignature) {
+      *error = "invalid ZIP64 end of central directory";
+      return false;
+    }
+    disk = static_cast<uint16_t>(Read32(zip64 + 16) != 0);
+    directory_disk = static_cast<uint16_t>(Read32(zip64 + 20) != 0);
+    *count = Read64(zip64 + 32);
+    *size = Read64(zip64 + 40);
+    *offset = Read64(zip64 + 48);
+  }
+
+  if (disk != 0 || directory_disk != 0) {
+    *error = "multi-volume archives are not supported";
+    return false;
+  }
+  if (*offset > file_size || *size > file_size - *offset) {
+    *error = "central directory is out of range";
+    return false;
+  }
+  return true;
+}
+
+bool ZipArchive::ParseCentralDirectory(const std::vector<uint8_t>& directory,
+                                       uint64_t count,
+                                       std::string* error) {
+  size_t pos = 0;
+  for (uint64_t i = 0; i < count; ++i) {
+    if (directory.size() - pos < kCentralHeaderSize ||
+        Read32(&directory[pos]) != kCentralHeaderSignature) {
+      *error = "invalid central directory entry";
+      return false;
+    }
+    const uint8_t* p = &directory[pos];
+    size_t name_size = Read16(p + 28);
+    size_t extra_size = Read16(p + 30);
+    size_t comment_size = Read16(p + 32);
+    size_t record_size =
+        kCentralHeaderSize + name_size + extra_size + comment_size;
+    if (directory.size() - pos < record_size) {
+      *error = "truncated central directory entry";
+      return false;
+    }
+
+    ZipEntry entry;
+    entry.flags = Read16(p + 8);
+    entry.method = Read16(p + 10);
+    entry.crc32 = Read32(p + 16);
+    entry.compressed_size = Read32(p + 20);
+    entry.uncompressed_size = Read32(p + 24);
+    entry.local_header_offset = Read32(p + 42);
+    entry.name.assign(reinterpret_cast<const char*>(p + kCentralHeaderSize),
+                      name_size);
+
+    // 32位字段为0xFFFFFFFF时，实际值按固定顺序存放在ZIP64扩展字段中
+    const uint8_t* extra = p + kCentralHeaderSize + name_size;
+    const uint8_t* extra_end = extra + extra_size;
+    while (extra_end - extra >= 4) {
+      uint16_t id = Read16(extra);
+      size_t field_size = Read16(extra + 2);
+      const uint8_t* field = extra + 4;
+      if (static_cast<size_t>(extra_end - field) < field_size) {
+        break;
+      }
+      if (id == kZip64ExtraId) {
+        const uint8_t* field_end = field + field_size;
+        for (uint64_t* value :
+             {&entry.uncompressed_size, &entry.compressed_size,
+              &entry.local_header_offset}) {
+          if (*value == 0xFFFFFFFF && field_end - field >= 8) {
+            *value = Read64(field);
+            field += 8;
+          }
+        }
+      }
+      extra += 4 + field_size;
+    }
+
+    entries_.push_back(std::move(entry));
+    pos += record_size;
+  }
+  return true;
+}
+
+bool ZipArchive::DataOffset(const ZipEntry& entry, uint64_t* offset) {
+  // 本地文件头中的文件名和扩展字段长度可能与中央目录不同，需要重新读取
+  uint8_t header[kLocalHeaderSize];
+  if (!ReadAt(entry.local_header_offset, header, sizeof(header)) ||
+      Read32(header) != kLocalHeaderSignature) {
+    return false;
+  }
+  *offset = entry.local_header_offset + kLocalHeaderSize + Read16(header + 26) +
+            Read16(header + 28);
+  return *offset <= file_.Size() &&
+         entry.compressed_size <= file_.Size() - *offset;
+}
+
+bool ZipArchive::ReadEntry(const ZipEntry& entry,
+                           std::vector<uint8_t>* data,
+                           std::string* error) {
+  data->clear();
+  if ((entry.flags & 0x0001) != 0) {
+    *error = "encrypted entries are not supported";
+    return false;
+  }
+  if (entry.method != 0 && entry.method != Z_DEFLATED) {
+    *error = "unsupported compression method " + std::to_string(entry.method);
+    return false;
+  }
+  uint64_t offset = 0;
+  if (!DataOffset(entry, &offset)) {
+    *error = "invalid local file header";
+    return false;
+  }
+  uint64_t max_size = entry.method == 0
+                          ? entry.compressed_size
+                          : entry.compressed_size * kMaxDeflateRatio + 64;
+  if (entry.uncompressed_size >= kMaxEntrySize ||
+      entry.uncompressed_size > max_size ||
+      (entry.method == 0 &&
+       entry.compressed_size != entry.uncompressed_size)) {
+    *error = "invalid entry size";
+    return false;
+  }
+
+  // 多分配1字节，解压结果超出中央目录记录的大小时能够发现
+  size_t size = static_cast<size_t>(entry.uncompressed_size);
+  try {
+    data->resize(size + 1);
+  } catch (const std::exception&) {
+    *error = "not enough memory for entry";
+    return false;
+  }
+
+  if (entry.method == 0) {
+    for (size_t done = 0; done < size;) {
+      size_t len = std::min(size - done, kReadChunkSize);
+      if (!ReadAt(offset + done, data->data() + done, len)) {
+        *error = "truncated entry data";
+        return false;
+      }
+      done += len;
+    }
+  } else {
+    z_stream stream = {};
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+      *error = "failed to initialize inflate";
+      return false;
+    }
+    std::vector<uint8_t> input(kReadChunkSize);
+    uint64_t remaining = entry.compressed_size;
+    size_t produced = 0;
+    int ret = Z_OK;
+    while (ret != Z_STREAM_END) {
+      if (stream.avail_in == 0) {
+        if (remaining == 0) {
+          break;
+        }
+        size_t len =
+            static_cast<size_t>(std::min<uint64_t>(remaining, input.size()));
+        if (!ReadAt(offset, input.data(), len)) {
+          break;
+        }
+        offset += len;
+        remaining -= len;
+        stream.next_in = input.data();
+        stream.avail_in = static_cast<uInt>(len);
+      }
+      size_t space = std::min(data->size() - produced, kZlibChunkSize);
+      stream.next_out = data->data() + produced;
+      stream.avail_out = static_cast<uInt>(space);
+      ret = inflate(&stream, Z_NO_FLUSH);
+      produced += space - stream.avail_out;
+      if ((ret != Z_OK && ret != Z_STREAM_END) || produced > size) {
+        break;
+      }
+    }
+    inflateEnd(&stream);
+    if (ret != Z_STREAM_END || produced != size) {
+      *error = "invalid deflate data";
+      return false;
+    }
+  }
+
+  data->resize(size);
+  if (Crc32(data->data(), data->size()) != entry.crc32) {
+    *error = "CRC32 mismatch";
+    return false;
+  }
+  return true;
+}
+
+bool ZipArchive::IsSafeEntryName(const std::string& name) {
+  if (name.empty() || name[0] == '/' ||
+      name.find_first_of("\\:") != std::string::npos) {
+    return false;
+  }
+  size_t start = 0;
+  while (start <= name.size()) {
+    size_t end = name.find('/', start);
+    if (end == std::string::npos) {
+      end = name.size();
+    }
+    if (name.compare(start, end - start, "..") == 0) {
+      return false;
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+bool ZipArchive::ReadAt(uint64_t offset, void* dest, size_t len) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return file_.ReadAt(offset, dest, len) == len;
+}
+
+}  // namespace xlog_decode
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -124,11 +125,194 @@ void test_file_io_functions() {
   std::cout << "File IO function tests passed!" << std::endl;
 }
 
+// Test finding decoded outputs for the clean command
+void test_find_decoded_files() {
+  const std::string root = "test_clean_dir";
+  const std::string sub_dir = FileUtils::JoinPath(root, "sub");
+  const std::string zip_dir = FileUtils::JoinPath(root, "bundle.zip_");
+  const std::string entry_dir = FileUtils::JoinPath(zip_dir, "app");
+  if (!FileUtils::CreateDirectory(sub_dir) ||
+      !FileUtils::CreateDirectory(entry_dir)) {
+    std::cerr << "Failed to create test directories" << std::endl;
+    exit(1);
+  }
+
+  const std::string decoded[] = {
+      FileUtils::JoinPath(root, "a.xlog_.log"),
+      FileUtils::JoinPath(root, "a.xlog_.xcol"),
+      FileUtils::JoinPath(entry_dir, "main.xlog_.log"),
+  };
+  const std::string nested = FileUtils::JoinPath(sub_dir, "b.xlog_.xcol");
+  const std::string kept[] = {
+      FileUtils::JoinPath(root, "a.xlog"),
+      FileUtils::JoinPath(root, "a.xlog.xidx"),
+      FileUtils::JoinPath(root, "notes.log"),
+  };
+  for (const auto& file : decoded) {
+    create_test_file(file, "decoded");
+  }
+  create_test_file(nested, "decoded");
+  for (const auto& file : kept) {
+    create_test_file(file, "input");
+  }
+
+  // Without recursion only the top level and the ZIP output directory count
+  std::vector<std::string> found = FileUtils::FindDecodedFiles(root, false);
+  std::sort(found.begin(), found.end());
+  std::vector<std::string> expected(std::begin(decoded), std::end(decoded));
+  std::sort(expected.begin(), expected.end());
+  if (found != expected) {
+    std::cerr << "FindDecodedFiles test failed, found " << found.size()
+              << " files" << std::endl;
+    exit(1);
+  }
+  found = FileUtils::FindDecodedFiles(root, true);
+  if (found.size() != expected.size() + 1 ||
+      std::find(found.begin(), found.end(), nested) == found.end()) {
+    std::cerr << "FindDecodedFiles recursive test failed" << std::endl;
+    exit(1);
+  }
+
+  // The ZIP output directory is removed once its files are gone
+  std::vector<std::string> zip_dirs =
+      FileUtils::FindZipOutputDirectories(root, false);
+  if (zip_dirs.size() != 1 || zip_dirs[0] != zip_dir) {
+    std::cerr << "FindZipOutputDirectories test failed" << std::endl;
+    exit(1);
+  }
+  create_test_file(FileUtils::JoinPath(entry_dir, "other.txt"), "user");
+  for (const auto& file : found) {
+    FileUtils::DeleteFile(file);
+  }
+  if (FileUtils::RemoveEmptyDirectories(zip_dir) ||
+      !FileUtils::IsDirectory(entry_dir)) {
+    std::cerr << "RemoveEmptyDirectories removed a non-empty directory"
+              << std::endl;
+    exit(1);
+  }
+  FileUtils::DeleteFile(FileUtils::JoinPath(entry_dir, "other.txt"));
+  if (!FileUtils::RemoveEmptyDirectories(zip_dir) ||
+      FileUtils::PathExists(zip_dir)) {
+    std::cerr << "RemoveEmptyDirectories test failed" << std::endl;
+    exit(1);
+  }
+
+  for (const auto& file : kept) {
+    FileUtils::DeleteFile(file);
+  }
+  FileUtils::RemoveEmptyDirectories(root);
+  std::cout << "Find decoded files tests passed!" << std::endl;
+}
+
+// Test memory-mapped file access
+void test_mapped_file() {
+  const std::string test_file = "test_mapped.txt";
+  const std::string test_content = "Hello, MappedFile!";
+
+  if (!create_test_file(test_file, test_content)) {
+    std::cerr << "Failed to create test file" << std::endl;
+    exit(1);
+  }
+
+  MappedFile mapped_file;
+  if (mapped_file.Open(test_file)) {
+    std::string content(reinterpret_cast<const char*>(mapped_file.Data()),
+                        mapped_file.Size());
+    if (content != test_content) {
+      std::cerr << "MappedFile test failed, expected: " << test_content
+                << ", actual: " << content << std::endl;
+      exit(1);
+    }
+    mapped_file.Close();
+    if (mapped_file.IsOpen() || mapped_file.Size() != 0) {
+      std::cerr << "MappedFile test failed, Close did not reset state"
+                << std::endl;
+      exit(1);
+    }
+  }
+
+  // Missing files must fail so callers fall back to windowed reads
+  MappedFile missing_file;
+  if (missing_file.Open("test_mapped_missing.txt")) {
+    std::cerr << "MappedFile test failed, opened a missing file" << std::endl;
+    exit(1);
+  }
+
+  FileUtils::DeleteFile(test_file);
+  std::cout << "MappedFile tests passed!" << std::endl;
+}
+
+// Test positioned reads, including offsets past 4 GiB in a sparse file
+void test_random_access_file() {
+  const std::string test_file = "test_random_access.bin";
+  const std::string test_content = "0123456789";
+  if (!create_test_file(test_file, test_content)) {
+    std::cerr << "Failed to create test file" << std::endl;
+    exit(1);
+  }
+
+  RandomAccessFile file;
+  if (!file.Open(test_file) || file.Size() != test_content.size()) {
+    std::cerr << "RandomAccessFile test failed, cannot open file" << std::endl;
+    exit(1);
+  }
+
+  char buffer[8] = {};
+  if (file.ReadAt(3, buffer, 4) != 4 || std::string(buffer, 4) != "3456") {
+    std::cerr << "RandomAccessFile test failed, wrong data at offset 3"
+              << std::endl;
+    exit(1);
+  }
+
+  // Reads are clamped at end of file
+  if (file.ReadAt(8, buffer, sizeof(buffer)) != 2 ||
+      file.ReadAt(100, buffer, sizeof(buffer)) != 0) {
+    std::cerr << "RandomAccessFile test failed, reads past EOF not clamped"
+              << std::endl;
+    exit(1);
+  }
+  file.Close();
+
+#if !defined(_WIN32)
+  // Append a marker beyond 4 GiB; the hole costs no disk space
+  const uint64_t far_offset = (uint64_t{1} << 32) + 123;
+  {
+    std::fstream stream(test_file,
+                        std::ios::in | std::ios::out | std::ios::binary);
+    stream.seekp(static_cast<std::streamoff>(far_offset));
+    stream.write("far", 3);
+    if (!stream.good()) {
+      std::cerr << "RandomAccessFile test skipped large offset" << std::endl;
+      FileUtils::DeleteFile(test_file);
+      return;
+    }
+  }
+  if (!file.Open(test_file) || file.Size() != far_offset + 3 ||
+      file.ReadAt(far_offset, buffer, 3) != 3 ||
+      std::string(buffer, 3) != "far") {
+    std::cerr << "RandomAccessFile test failed at 64-bit offset" << std::endl;
+    exit(1);
+  }
+  file.Close();
+#endif
+
+  if (file.IsOpen() || file.Open("test_random_access_missing.bin")) {
+    std::cerr << "RandomAccessFile test failed, bad open state" << std::endl;
+    exit(1);
+  }
+
+  FileUtils::DeleteFile(test_file);
+  std::cout << "RandomAccessFile tests passed!" << std::endl;
+}
+
 int main() {
   std::cout << "Starting FileUtils tests..." << std::endl;
 
   test_file_path_functions();
   test_file_io_functions();
+  test_find_decoded_files();
+  test_mapped_file();
+  test_random_access_file();
 
   std::cout << "All tests passed!" << std::endl;
   return 0;
@@ -1,11 +1,42 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <zlib.h>
+#include <zstd.h>
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
+
+#include "alloc_tracker.h"
+#include "columnar_log.h"
+#include "console_output.h"
+#include "decode_manifest.h"
+#include "decode_stats.h"
+#include "decode_trace.h"
 #include "file_utils.h"
+#include "grep_output_sink.h"
+#include "magic_scanner.h"
+#include "mars_log_line.h"
+#include "output_sink.h"
+#include "structured_output_sink.h"
+#include "thread_pool.h"
 #include "xlog_constants.h"
+#include "xlog_crypt.h"
 #include "xlog_decoder.h"
+#include "xlog_index.h"
+#include "zip_archive.h"
 
 using namespace xlog_decode;
 
@@ -20,22 +51,1950 @@ void test_file_extensions() {
 
 // Test output filename generation
 void test_output_filename_generation() {
-  assert(XlogDecoder::GenerateOutputFilename("test.xlog") == "test_.log");
-  assert(XlogDecoder::GenerateOutputFilename("test.mmap3") == "test_.log");
+  assert(XlogDecoder::GenerateOutputFilename("test.xlog") ==
+         "test.xlog_.log");
+  assert(XlogDecoder::GenerateOutputFilename("test.mmap3") ==
+         "test.mmap3_.log");
   assert(XlogDecoder::GenerateOutputFilename("test.txt") == "test.txt_.log");
   assert(XlogDecoder::GenerateOutputFilename("/path/to/test.xlog") ==
-         "/path/to/test_.log");
+         "/path/to/test.xlog_.log");
 
   std::cout << "Output filename generation tests passed" << std::endl;
 }
 
+// Append one block with the given magic and body to an xlog buffer
+void append_block(std::vector<uint8_t>& file_data,
+                  uint8_t magic,
+                  uint16_t seq,
+                  const std::vector<uint8_t>& body,
+                  uint8_t begin_hour = 10,
+                  uint8_t end_hour = 11) {
+  uint32_t header_len = GetHeaderLen(magic);
+  size_t offset = file_data.size();
+  file_data.resize(offset + header_len, 0);
+  file_data[offset] = magic;
+  std::memcpy(&file_data[offset + 1], &seq, sizeof(seq));
+  file_data[offset + 3] = begin_hour;
+  file_data[offset + 4] = end_hour;
+  uint32_t length = static_cast<uint32_t>(body.size());
+  std::memcpy(&file_data[offset + 5], &length, sizeof(length));
+  file_data.insert(file_data.end(), body.begin(), body.end());
+  file_data.push_back(MAGIC_END);
+}
+
+// Build log text for one block
+std::vector<uint8_t> make_log_text(int block_index) {
+  std::string text;
+  for (int line = 0; line < 50; ++line) {
+    text += "[I][2024-03-01 +8.0 10:11:12.345][1234, 5678*][tag][file.cc, "
+            "func, " +
+            std::to_string(line) + "][block " + std::to_string(block_index) +
+            " line " + std::to_string(line) + "\n";
+  }
+  return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+// Build a synthetic xlog with zstd and raw blocks, a corrupt region and a
+// sequence gap
+std::vector<uint8_t> make_synthetic_xlog() {
+  std::vector<uint8_t> file_data;
+  uint16_t seq = 1;
+  for (int i = 0; i < 40; ++i) {
+    std::vector<uint8_t> text = make_log_text(i);
+    if (i % 2 == 0) {
+      std::vector<uint8_t> body(ZSTD_compressBound(text.size()));
+      size_t size =
+          ZSTD_compress(body.data(), body.size(), text.data(), text.size(), 1);
+      body.resize(size);
+      append_block(file_data, MAGIC_ASYNC_NO_CRYPT_ZSTD_START, seq, body);
+    } else {
+      append_block(file_data, MAGIC_NO_COMPRESS_NO_CRYPT_START, seq, text);
+    }
+    seq += (i == 20) ? 3 : 1;
+
+    if (i == 30) {
+      // Garbage between blocks forces a resync
+      for (int j = 0; j < 3000; ++j) {
+        file_data.push_back(static_cast<uint8_t>(j * 7 + 1));
+      }
+    }
+  }
+  return file_data;
+}
+
+// Test that streaming decode matches the whole-file decoder byte for byte
+void test_streaming_decode_matches() {
+  const std::string input_file = "test_streaming.xlog";
+  const std::string output_file = "test_streaming.xlog_.log";
+  assert(FileUtils::WriteFile(input_file, make_synthetic_xlog()));
+
+  XlogDecoder decoder;
+  assert(decoder.DecodeFile(input_file, output_file));
+  std::vector<uint8_t> expected;
+  assert(FileUtils::ReadFile(output_file, expected));
+  assert(!expected.empty());
+
+  // A tiny window forces the reader to slide many times
+  std::vector<uint8_t> streamed;
+  BufferOutputSink sink(streamed);
+  decoder.set_stream_window_size(1024);
+  assert(decoder.DecodeFileStreaming(input_file, sink));
+  assert(streamed == expected);
+
+  std::string text(expected.begin(), expected.end());
+  assert(text.find("[F]xlog_decode error len=") != std::string::npos);
+  assert(text.find("[F]xlog_decode log seq:22-23 is missing") !=
+         std::string::npos);
+
+  FileUtils::DeleteFile(input_file);
+  FileUtils::DeleteFile(output_file);
+  std::cout << "Streaming decode tests passed" << std::endl;
+}
+
+// Test that parallel block decompression matches serial decode
+void test_parallel_decode_matches() {
+  const std::string input_file = "test_parallel.xlog";
+  const std::string output_file = "test_parallel.xlog_.log";
+  assert(FileUtils::WriteFile(input_file, make_synthetic_xlog()));
+
+  XlogDecoder decoder;
+  assert(decoder.DecodeFile(input_file, output_file));
+  std::vector<uint8_t> expected;
+  assert(FileUtils::ReadFile(output_file, expected));
+
+  for (size_t thread_count : {2, 4, 7}) {
+    XlogDecoder parallel_decoder;
+    parallel_decoder.set_thread_count(thread_count);
+    assert(parallel_decoder.DecodeFile(input_file, output_file));
+    std::vector<uint8_t> parallel;
+    assert(FileUtils::ReadFile(output_file, parallel));
+    assert(parallel == expected);
+
+    // Streaming mode copies bodies out of the sliding window
+    std::vector<uint8_t> streamed;
+    BufferOutputSink sink(streamed);
+    parallel_decoder.set_stream_window_size(1024);
+    assert(parallel_decoder.DecodeFileStreaming(input_file, sink));
+    assert(streamed == expected);
+  }
+
+  FileUtils::DeleteFile(input_file);
+  FileUtils::DeleteFile(output_file);
+  std::cout << "Parallel decode tests passed" << std::endl;
+}
+
+// Test writing, loading and invalidating the .xidx block index
+void test_block_index() {
+  const std::string input_file = "test_index.xlog";
+  const std::string index_file = XlogIndex::IndexPathFor(input_file);
+  std::vector<uint8_t> file_data = make_synthetic_xlog();
+  // Leading garbage is reproduced from the index as well
+  file_data.insert(file_data.begin(), 100, 0xEE);
+  assert(FileUtils::WriteFile(input_file, file_data));
+  FileUtils::DeleteFile(index_file);
+
+  std::vector<uint8_t> expected;
+  BufferOutputSink expected_sink(expected);
+  XlogDecoder writer;
+  writer.set_write_index(true);
+  assert(writer.DecodeFile(input_file, expected_sink));
+  assert(!writer.used_index());
+  assert(FileUtils::PathExists(index_file));
+
+  const XlogIndex* index = writer.index();
+  assert(index != nullptr);
+  assert(index->entries().size() == 40);
+  assert(index->decoded_size() == expected.size());
+  for (size_t i = 0; i < index->entries().size(); ++i) {
+    const XlogIndexEntry& entry = index->entries()[i];
+    std::vector<uint8_t> text = make_log_text(static_cast<int>(i));
+    assert(entry.decoded_length == text.size());
+    assert(std::equal(text.begin(), text.end(),
+                      expected.begin() + entry.output_offset));
+  }
+
+  // Every read path uses the index and reproduces the output exactly
+  for (size_t thread_count : {1, 3}) {
+    XlogDecoder decoder;
+    decoder.set_thread_count(thread_count);
+    std::vector<uint8_t> mapped;
+    BufferOutputSink mapped_sink(mapped);
+    assert(decoder.DecodeFile(input_file, mapped_sink));
+    assert(decoder.used_index());
+    assert(decoder.leading_bytes_skipped() == 100);
+    assert(mapped == expected);
+
+    std::vector<uint8_t> streamed;
+    BufferOutputSink streamed_sink(streamed);
+    decoder.set_stream_window_size(1024);
+    assert(decoder.DecodeFileStreaming(input_file, streamed_sink));
+    assert(decoder.used_index());
+    assert(streamed == expected);
+  }
+
+  // A block range is the matching slice of the full output
+  XlogDecoder range_decoder;
+  std::vector<uint8_t> range;
+  BufferOutputSink range_sink(range);
+  assert(range_decoder.DecodeBlocks(input_file, range_sink, 5, 3));
+  const XlogIndexEntry& first = index->entries()[5];
+  const XlogIndexEntry& last = index->entries()[7];
+  assert(range == std::vector<uint8_t>(
+                      expected.begin() + first.output_offset,
+                      expected.begin() + last.output_offset +
+                          last.decoded_length));
+  std::vector<uint8_t> beyond;
+  BufferOutputSink beyond_sink(beyond);
+  assert(!range_decoder.DecodeBlocks(input_file, beyond_sink, 40, 1));
+
+  // Modifying the input makes the index stale
+  file_data.push_back(0xEE);
+  assert(FileUtils::WriteFile(input_file, file_data));
+  XlogDecoder stale_decoder;
+  std::vector<uint8_t> stale;
+  BufferOutputSink stale_sink(stale);
+  assert(stale_decoder.DecodeFile(input_file, stale_sink));
+  assert(!stale_decoder.used_index());
+
+  // Building an index refreshes it
+  assert(stale_decoder.BuildIndex(input_file));
+  std::vector<uint8_t> refreshed;
+  BufferOutputSink refreshed_sink(refreshed);
+  assert(stale_decoder.DecodeFile(input_file, refreshed_sink));
+  assert(stale_decoder.used_index());
+  assert(refreshed == stale);
+
+  FileUtils::DeleteFile(input_file);
+  FileUtils::DeleteFile(index_file);
+  std::cout << "Block index tests passed" << std::endl;
+}
+
+// Test hour-window filtering, including windows that wrap past midnight
+void test_hour_range() {
+  // One block per hour, then a block spanning 23:00-01:00 and a corrupt
+  // block at 12:00 that must never be decompressed
+  std::vector<uint8_t> file_data;
+  std::vector<std::string> texts;
+  for (int hour = 0; hour < 24; ++hour) {
+    texts.push_back("hour " + std::to_string(hour) + "\n");
+    std::vector<uint8_t> text(texts.back().begin(), texts.back().end());
+    std::vector<uint8_t> body(ZSTD_compressBound(text.size()));
+    body.resize(
+        ZSTD_compress(body.data(), body.size(), text.data(), text.size(), 1));
+    append_block(file_data, MAGIC_ASYNC_NO_CRYPT_ZSTD_START,
+                 static_cast<uint16_t>(hour + 1), body,
+                 static_cast<uint8_t>(hour), static_cast<uint8_t>(hour));
+  }
+  std::string wrapping = "late night\n";
+  append_block(file_data, MAGIC_NO_COMPRESS_NO_CRYPT_START, 25,
+               std::vector<uint8_t>(wrapping.begin(), wrapping.end()), 23, 1);
+  append_block(file_data, MAGIC_ASYNC_NO_CRYPT_ZSTD_START, 27,
+               std::vector<uint8_t>(16, 0xAB), 12, 12);
+
+  const std::string input_file = "test_hours.xlog";
+  assert(FileUtils::WriteFile(input_file, file_data));
+
+  struct Case {
+    int from_hour;
+    int to_hour;
+    std::string expected;
+  };
+  const Case cases[] = {
+      {9, 10, texts[9] + texts[10]},
+      {22, 1, texts[0] + texts[1] + texts[22] + texts[23] + wrapping},
+      {0, 0, texts[0] + wrapping},
+      {2, 2, texts[2]},
+  };
+  for (size_t thread_count : {1, 3}) {
+    for (const Case& c : cases) {
+      XlogDecoder decoder;
+      decoder.set_thread_count(thread_count);
+      decoder.set_hour_range(c.from_hour, c.to_hour);
+      std::vector<uint8_t> output;
+      BufferOutputSink sink(output);
+      // A window matching only part of the file is not a failure
+      assert(decoder.DecodeFile(input_file, sink));
+      assert(std::string(output.begin(), output.end()) == c.expected);
+      assert(decoder.hour_skipped_blocks() > 0);
+    }
+  }
+
+  // A block range builds its index over all hours, then applies the window
+  {
+    XlogDecoder decoder;
+    decoder.set_hour_range(9, 10);
+    std::vector<uint8_t> output;
+    BufferOutputSink sink(output);
+    assert(decoder.DecodeBlocks(input_file, sink, 8, 4));
+    assert(std::string(output.begin(), output.end()) == texts[9] + texts[10]);
+    assert(decoder.index()->entries().size() == 26);
+  }
+
+  // A window that matches no block produces empty output
+  std::vector<uint8_t> empty_data;
+  append_block(empty_data, MAGIC_NO_COMPRESS_NO_CRYPT_START, 1,
+               std::vector<uint8_t>(texts[5].begin(), texts[5].end()), 5, 5);
+  assert(FileUtils::WriteFile(input_file, empty_data));
+  XlogDecoder decoder;
+  decoder.set_hour_range(6, 7);
+  std::vector<uint8_t> output;
+  BufferOutputSink sink(output);
+  assert(decoder.DecodeFile(input_file, sink));
+  assert(output.empty());
+
+  // Clearing the range decodes everything again
+  decoder.clear_hour_range();
+  assert(decoder.DecodeFile(input_file, sink));
+  assert(std::string(output.begin(), output.end()) == texts[5]);
+
+  FileUtils::DeleteFile(input_file);
+  std::cout << "Hour range tests passed" << std::endl;
+}
+
+// Sink shared between the follow thread and the test thread
+class LockedOutputSink : public OutputSink {
+ public:
+  bool Write(const uint8_t* data, size_t size) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    text_.append(reinterpret_cast<const char*>(data), size);
+    return true;
+  }
+
+  std::string text() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return text_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::string text_;
+};
+
+// Wait until the followed output equals expected
+bool wait_for_output(LockedOutputSink& sink, const std::string& expected) {
+  for (int i = 0; i < 500; ++i) {
+    if (sink.text() == expected) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return false;
+}
+
+// Test following a growing file through appends, a partially written block
+// and a rotation
+void test_follow() {
+  const std::string input_file = "test_follow.xlog";
+  FileUtils::DeleteFile(input_file);
+
+  std::atomic<bool> stop(false);
+  LockedOutputSink sink;
+  bool result = false;
+  std::thread follower([&]() {
+    XlogDecoder decoder;
+    result = decoder.Follow(input_file, sink, [&]() { return stop.load(); });
+  });
+
+  // The file does not exist yet
+  std::vector<uint8_t> file_data;
+  std::string expected = "first\n";
+  append_block(file_data, MAGIC_NO_COMPRESS_NO_CRYPT_START, 1,
+               std::vector<uint8_t>(expected.begin(), expected.end()));
+  assert(FileUtils::WriteFile(input_file, file_data));
+  assert(wait_for_output(sink, expected));
+
+  // Half of a block is held back until the rest arrives
+  std::string second = "second\n";
+  append_block(file_data, MAGIC_NO_COMPRESS_NO_CRYPT_START, 2,
+               std::vector<uint8_t>(second.begin(), second.end()));
+  std::vector<uint8_t> partial(file_data.begin(), file_data.end() - 5);
+  assert(FileUtils::WriteFile(input_file, partial));
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  assert(sink.text() == expected);
+  assert(FileUtils::WriteFile(input_file, file_data));
+  expected += second;
+  assert(wait_for_output(sink, expected));
+
+  // A shorter file is a new file and is decoded from the beginning
+  std::vector<uint8_t> rotated;
+  std::string third = "rotated\n";
+  append_block(rotated, MAGIC_NO_COMPRESS_NO_CRYPT_START, 1,
+               std::vector<uint8_t>(third.begin(), third.end()));
+  assert(FileUtils::WriteFile(input_file, rotated));
+  expected += third;
+  assert(wait_for_output(sink, expected));
+  assert(expected.find("[F]xlog_decode") == std::string::npos);
+
+  stop = true;
+  follower.join();
+  assert(result);
+
+  FileUtils::DeleteFile(input_file);
+  std::cout << "Follow tests passed" << std::endl;
+}
+
+// Test resuming a decode after data is appended, and the manifest checks
+// that decide when resuming is allowed
+void test_incremental_decode() {
+  const std::string input_file = "test_incremental.xlog";
+  std::vector<uint8_t> file_data = make_synthetic_xlog();
+
+  XlogDecoder decoder;
+  std::vector<uint8_t> expected;
+  BufferOutputSink expected_sink(expected);
+  assert(FileUtils::WriteFile(input_file, file_data));
+  assert(decoder.DecodeFile(input_file, expected_sink));
+  assert(decoder.resume_point().input_offset == file_data.size());
+  assert(decoder.resume_point().output_offset == expected.size());
+
+  // Cut the file inside blocks, inside the garbage region and at block
+  // boundaries; the kept output plus the resumed output equals a full decode
+  for (size_t cut = 500; cut < file_data.size(); cut += 1777) {
+    for (size_t thread_count : {1, 3}) {
+      decoder.set_thread_count(thread_count);
+      std::vector<uint8_t> prefix(file_data.begin(), file_data.begin() + cut);
+      assert(FileUtils::WriteFile(input_file, prefix));
+      std::vector<uint8_t> output;
+      BufferOutputSink prefix_sink(output);
+      decoder.DecodeFile(input_file, prefix_sink);
+      XlogResumePoint resume = decoder.resume_point();
+      if (resume.input_offset == 0) {
+        continue;
+      }
+      assert(resume.input_offset <= cut);
+      output.resize(resume.output_offset);
+
+      assert(FileUtils::WriteFile(input_file, file_data));
+      BufferOutputSink resumed_sink(output);
+      assert(decoder.DecodeFrom(input_file, resumed_sink, resume));
+      assert(output == expected);
+    }
+  }
+
+  // Appending keeps the recorded prefix, rewriting does not
+  std::vector<uint8_t> prefix(file_data.begin(), file_data.begin() + 5000);
+  assert(FileUtils::WriteFile(input_file, prefix));
+  DecodeManifestEntry previous;
+  assert(DecodeManifest::Compare(input_file, nullptr, &previous) ==
+         ManifestChange::kChanged);
+  assert(previous.size == prefix.size());
+  previous.resume.input_offset = 4000;
+  DecodeManifestEntry current;
+  assert(DecodeManifest::Compare(input_file, &previous, &current) ==
+         ManifestChange::kUnchanged);
+  assert(FileUtils::WriteFile(input_file, file_data));
+  assert(DecodeManifest::Compare(input_file, &previous, &current) ==
+         ManifestChange::kAppended);
+  file_data[10] ^= 0xFF;
+  assert(FileUtils::WriteFile(input_file, file_data));
+  assert(DecodeManifest::Compare(input_file, &previous, &current) ==
+         ManifestChange::kChanged);
+
+  // The manifest round-trips, and is ignored under different options
+  const std::string manifest_file = "test_incremental.manifest";
+  DecodeManifest manifest("options-a");
+  current.output_size = 123;
+  current.resume.last_seq = 7;
+  manifest.Set("sub/a.xlog", current);
+  assert(manifest.Save(manifest_file));
+  DecodeManifest loaded("options-a");
+  assert(loaded.Load(manifest_file));
+  const DecodeManifestEntry* entry = loaded.Find("sub/a.xlog");
+  assert(entry != nullptr);
+  assert(entry->size == current.size &&
+         entry->modified_time == current.modified_time &&
+         entry->content_crc == current.content_crc &&
+         entry->output_size == 123 && entry->resume.last_seq == 7);
+  DecodeManifest other("options-b");
+  assert(!other.Load(manifest_file));
+  assert(other.size() == 0);
+
+  FileUtils::DeleteFile(input_file);
+  FileUtils::DeleteFile(manifest_file);
+  std::cout << "Incremental decode tests passed" << std::endl;
+}
+
+// Test buffered file output at several flush thresholds
+void test_output_sinks() {
+  const std::string output_file = "test_sink_output.log";
+  std::vector<uint8_t> expected;
+  for (size_t threshold : {size_t(0), size_t(16), size_t(1000),
+                           BufferedOutputSink::kDefaultFlushThreshold}) {
+    FileUtils::DeleteFile(output_file);
+    expected.clear();
+    {
+      FileOutputSink sink(output_file, threshold);
+      // Nothing is created until data is written out
+      assert(sink.Flush());
+      assert(!FileUtils::FileExists(output_file));
+
+      for (size_t i = 0; i < 200; ++i) {
+        std::vector<uint8_t> piece(i * 37 % 500, static_cast<uint8_t>(i));
+        expected.insert(expected.end(), piece.begin(), piece.end());
+        assert(sink.Write(piece.data(), piece.size()));
+      }
+      assert(sink.bytes_written() == expected.size());
+      assert(sink.Close());
+    }
+    std::vector<uint8_t> written;
+    assert(FileUtils::ReadFile(output_file, written));
+    assert(written == expected);
+  }
+
+  // Decoding into a sink matches decoding into a file
+  const std::string input_file = "test_sink.xlog";
+  assert(FileUtils::WriteFile(input_file, make_synthetic_xlog()));
+  XlogDecoder decoder;
+  decoder.set_flush_threshold(0);
+  assert(decoder.DecodeFile(input_file, output_file));
+  std::vector<uint8_t> from_file;
+  assert(FileUtils::ReadFile(output_file, from_file));
+  std::vector<uint8_t> from_sink;
+  BufferOutputSink memory_sink(from_sink);
+  assert(decoder.DecodeFile(input_file, memory_sink));
+  assert(from_sink == from_file);
+
+  FileUtils::DeleteFile(input_file);
+  FileUtils::DeleteFile(output_file);
+  std::cout << "Output sink tests passed" << std::endl;
+}
+
+// Test that the pool runs every task and idle workers steal queued work
+void test_thread_pool() {
+  ThreadPool pool(2);
+  std::atomic<int> counter(0);
+  for (int i = 0; i < 1000; ++i) {
+    pool.Submit([&counter] { counter++; });
+  }
+  pool.Wait();
+  assert(counter == 1000);
+
+  // The first task blocks its worker; tasks queued behind it on the same
+  // worker must still finish through stealing before it is released
+  std::atomic<bool> release(false);
+  std::atomic<int> finished(0);
+  pool.Submit([&release] {
+    while (!release) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  for (int i = 0; i < 10; ++i) {
+    pool.Submit([&finished] { finished++; });
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (finished < 10 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  assert(finished == 10);
+  release = true;
+  pool.Wait();
+
+  std::cout << "Thread pool tests passed" << std::endl;
+}
+
+// Test that diagnostics from files decoded in parallel (as with --jobs) reach
+// stderr as whole lines
+void test_parallel_diagnostics() {
+  std::vector<std::string> files;
+  std::vector<std::string> expected;
+  for (int i = 0; i < 64; ++i) {
+    files.push_back("test_diagnostics_" + std::to_string(i) + ".xlog");
+    assert(FileUtils::WriteFile(files.back(), std::vector<uint8_t>(300, 'x')));
+    expected.push_back("No valid log data found in file: " + files.back());
+    expected.push_back("Failed to decode file: " + files.back());
+  }
+
+  std::ostringstream captured;
+  std::streambuf* saved = std::cerr.rdbuf(captured.rdbuf());
+  {
+    ThreadPool pool(8);
+    for (const std::string& file : files) {
+      pool.Submit([&file] {
+        XlogDecoder decoder;
+        NullOutputSink sink;
+        if (!decoder.DecodeFile(file, sink)) {
+          PrintLine(std::cerr, "Failed to decode file: " + file);
+        }
+      });
+    }
+    pool.Wait();
+  }
+  std::cerr.rdbuf(saved);
+
+  std::vector<std::string> lines;
+  std::istringstream stream(captured.str());
+  for (std::string line; std::getline(stream, line);) {
+    lines.push_back(line);
+  }
+  std::sort(lines.begin(), lines.end());
+  std::sort(expected.begin(), expected.end());
+  assert(lines == expected);
+
+  for (const std::string& file : files) {
+    FileUtils::DeleteFile(file);
+  }
+  std::cout << "Parallel diagnostics tests passed" << std::endl;
+}
+
+// Decode a buffer written to disk and return the text output
+std::string decode_to_string(const std::vector<uint8_t>& file_data,
+                             int32_t resync_chain_length) {
+  const std::string input_file = "test_resync.xlog";
+  assert(FileUtils::WriteFile(input_file, file_data));
+
+  std::vector<uint8_t> output;
+  BufferOutputSink sink(output);
+  XlogDecoder decoder;
+  decoder.set_resync_chain_length(resync_chain_length);
+  decoder.DecodeFileStreaming(input_file, sink);
+
+  FileUtils::DeleteFile(input_file);
+  return std::string(output.begin(), output.end());
+}
+
+// Test multi-frame zstd bodies, segmented zlib bodies and outputs far larger
+// than the input
+void test_decompress_paths() {
+  std::string first = "first frame\n";
+  std::string second = "second frame\n";
+  std::string repeated;
+  for (int i = 0; i < 20000; ++i) {
+    repeated += "the same log line repeated many times\n";
+  }
+
+  // Two zstd frames with recorded content sizes in one body
+  std::vector<uint8_t> multi_frame;
+  for (const std::string* text : {&first, &second}) {
+    std::vector<uint8_t> frame(ZSTD_compressBound(text->size()));
+    frame.resize(ZSTD_compress(frame.data(), frame.size(), text->data(),
+                               text->size(), 1));
+    multi_frame.insert(multi_frame.end(), frame.begin(), frame.end());
+  }
+
+  // Streaming zstd without a content size, as written by Mars async mode
+  std::vector<uint8_t> streamed(ZSTD_compressBound(repeated.size()) + 64);
+  ZSTD_CCtx* cctx = ZSTD_createCCtx();
+  ZSTD_inBuffer zstd_in = {repeated.data(), repeated.size(), 0};
+  ZSTD_outBuffer zstd_out = {streamed.data(), streamed.size(), 0};
+  ZSTD_compressStream2(cctx, &zstd_out, &zstd_in, ZSTD_e_flush);
+  streamed.resize(zstd_out.pos);
+  ZSTD_freeCCtx(cctx);
+
+  // Raw deflate ending with a sync flush instead of a final block
+  z_stream strm;
+  std::memset(&strm, 0, sizeof(strm));
+  deflateInit2(&strm, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  std::vector<uint8_t> deflated(deflateBound(&strm, repeated.size()) + 64);
+  strm.next_in = reinterpret_cast<Bytef*>(&repeated[0]);
+  strm.avail_in = static_cast<uInt>(repeated.size());
+  strm.next_out = deflated.data();
+  strm.avail_out = static_cast<uInt>(deflated.size());
+  deflate(&strm, Z_SYNC_FLUSH);
+  deflated.resize(deflated.size() - strm.avail_out);
+  deflateEnd(&strm);
+
+  // The same deflate stream cut into length-prefixed segments (magic 0x05)
+  std::vector<uint8_t> segmented;
+  for (size_t pos = 0; pos < deflated.size(); pos += 700) {
+    uint16_t len =
+        static_cast<uint16_t>(std::min<size_t>(700, deflated.size() - pos));
+    segmented.push_back(static_cast<uint8_t>(len & 0xFF));
+    segmented.push_back(static_cast<uint8_t>(len >> 8));
+    segmented.insert(segmented.end(), deflated.begin() + pos,
+                     deflated.begin() + pos + len);
+  }
+
+  std::vector<uint8_t> file_data;
+  append_block(file_data, MAGIC_SYNC_NO_CRYPT_ZSTD_START, 1, multi_frame);
+  append_block(file_data, MAGIC_ASYNC_NO_CRYPT_ZSTD_START, 2, streamed);
+  append_block(file_data, MAGIC_COMPRESS_NO_CRYPT_START, 3, deflated);
+  append_block(file_data, MAGIC_ASYNC_NO_CRYPT_ZSTD_START, 4, streamed);
+  append_block(file_data, MAGIC_COMPRESS_START1, 5, segmented);
+
+  std::string expected =
+      first + second + repeated + repeated + repeated + repeated;
+  assert(decode_to_string(file_data, 1) == expected);
+
+  std::cout << "Decompress path tests passed" << std::endl;
+}
+
+// Test resync sentinel handling and chained header validation
+void test_resync() {
+  std::string first = "first block\n";
+  std::string fake = "fake block\n";
+  std::string second = "second block\n";
+
+  std::vector<uint8_t> file_data;
+  append_block(file_data, MAGIC_NO_COMPRESS_NO_CRYPT_START, 1,
+               std::vector<uint8_t>(first.begin(), first.end()));
+  // Garbage containing a lone block whose successor is invalid
+  file_data.insert(file_data.end(), 100, 0xEE);
+  append_block(file_data, MAGIC_NO_COMPRESS_NO_CRYPT_START, 0,
+               std::vector<uint8_t>(fake.begin(), fake.end()));
+  file_data.insert(file_data.end(), 100, 0xEE);
+  append_block(file_data, MAGIC_NO_COMPRESS_NO_CRYPT_START, 2,
+               std::vector<uint8_t>(second.begin(), second.end()));
+  append_block(file_data, MAGIC_NO_COMPRESS_NO_CRYPT_START, 3,
+               std::vector<uint8_t>(first.begin(), first.end()));
+  // Unrecoverable tail
+  file_data.insert(file_data.end(), 50, 0xEE);
+
+  std::string chain1 = decode_to_string(file_data, 1);
+  assert(chain1.find(fake) != std::string::npos);
+  assert(chain1.find(second) != std::string::npos);
+  // The tail is reported once and decoding stops without a bogus block
+  assert(chain1.find("[F]xlog_decode error len=50,") != std::string::npos);
+  assert(chain1.find("in DecodeBuffer") == std::string::npos);
+
+  std::string chain2 = decode_to_string(file_data, 2);
+  assert(chain2.find(first) == 0);
+  assert(chain2.find(fake) == std::string::npos);
+  assert(chain2.find(second) != std::string::npos);
+
+  std::cout << "Resync tests passed" << std::endl;
+}
+
+// Test single-pass framing over leading garbage
+void test_framing() {
+  std::string text = "framed block\n";
+  std::vector<uint8_t> file_data(1000, 0xEE);
+  append_block(file_data, MAGIC_NO_COMPRESS_NO_CRYPT_START, 1,
+               std::vector<uint8_t>(text.begin(), text.end()));
+
+  const std::string input_file = "test_framing.xlog";
+  assert(FileUtils::WriteFile(input_file, file_data));
+
+  std::vector<uint8_t> output;
+  BufferOutputSink sink(output);
+  XlogDecoder decoder;
+  assert(decoder.DecodeFileStreaming(input_file, sink, false));
+  assert(decoder.leading_bytes_skipped() == 1000);
+  assert(std::string(output.begin(), output.end()) == text);
+
+  // A file without any valid block fails instead of decoding garbage
+  assert(FileUtils::WriteFile(input_file, std::vector<uint8_t>(500, 0xEE)));
+  std::vector<uint8_t> garbage_output;
+  BufferOutputSink garbage_sink(garbage_output);
+  assert(!decoder.DecodeFileStreaming(input_file, garbage_sink));
+  assert(decoder.leading_bytes_skipped() == 500);
+
+  FileUtils::DeleteFile(input_file);
+  std::cout << "Framing tests passed" << std::endl;
+}
+
+// Test blocks beyond the 2 GiB and 4 GiB marks of a sparse file
+void test_large_file_offsets() {
+#if !defined(_WIN32)
+  const std::string input_file = "test_large_offsets.xlog";
+  const uint64_t offsets[] = {0, (uint64_t{1} << 31) + 12345,
+                              (uint64_t{1} << 32) + 777};
+  std::string texts[3];
+  uint64_t block_ends[3] = {};
+  {
+    std::ofstream stream(input_file, std::ios::binary | std::ios::trunc);
+    for (int i = 0; i < 3; ++i) {
+      texts[i] = "block at offset " + std::to_string(offsets[i]) + "\n";
+      std::vector<uint8_t> block;
+      append_block(block, MAGIC_NO_COMPRESS_NO_CRYPT_START,
+                   static_cast<uint16_t>(i + 1),
+                   std::vector<uint8_t>(texts[i].begin(), texts[i].end()));
+      // Seeking past the end leaves a hole that reads back as zeros
+      stream.seekp(static_cast<std::streamoff>(offsets[i]));
+      stream.write(reinterpret_cast<const char*>(block.data()),
+                   static_cast<std::streamsize>(block.size()));
+      block_ends[i] = offsets[i] + block.size();
+    }
+    if (!stream.good()) {
+      std::cout << "Large file offset tests skipped" << std::endl;
+      FileUtils::DeleteFile(input_file);
+      return;
+    }
+  }
+
+  XlogDecoder decoder;
+  std::vector<uint8_t> mapped_output;
+  BufferOutputSink mapped_sink(mapped_output);
+  assert(decoder.DecodeFile(input_file, mapped_sink));
+  std::string mapped(mapped_output.begin(), mapped_output.end());
+
+  std::vector<uint8_t> streamed_output;
+  BufferOutputSink streamed_sink(streamed_output);
+  assert(decoder.DecodeFileStreaming(input_file, streamed_sink));
+  std::string streamed(streamed_output.begin(), streamed_output.end());
+
+  // Every block is found and each gap is reported with its full 64-bit length
+  assert(mapped.find(texts[0]) == 0);
+  for (int i = 1; i < 3; ++i) {
+    std::string gap = "[F]xlog_decode error len=" +
+                      std::to_string(offsets[i] - block_ends[i - 1]) + ",";
+    assert(mapped.find(gap) != std::string::npos);
+    assert(mapped.find(texts[i]) != std::string::npos);
+  }
+  assert(streamed == mapped);
+
+  FileUtils::DeleteFile(input_file);
+  std::cout << "Large file offset tests passed" << std::endl;
+#endif
+}
+
+// Test that inputs which can only be read once (pipes, FIFOs) still decode
+void test_pipe_input() {
+#if !defined(_WIN32)
+  const std::string input_file = "test_pipe_input.xlog";
+  const std::string fifo_path = "test_pipe_input.fifo";
+  std::vector<uint8_t> data = make_synthetic_xlog();
+  assert(FileUtils::WriteFile(input_file, data));
+
+  XlogDecoder decoder;
+  std::vector<uint8_t> expected;
+  BufferOutputSink expected_sink(expected);
+  assert(decoder.DecodeFile(input_file, expected_sink));
+  assert(!expected.empty());
+
+  FileUtils::DeleteFile(fifo_path);
+  assert(mkfifo(fifo_path.c_str(), 0600) == 0);
+  assert(!FileUtils::IsRegularFile(fifo_path));
+  for (bool streaming : {false, true}) {
+    // Opening a FIFO for writing blocks until the decoder opens it for reading
+    std::thread writer([&] {
+      std::ofstream stream(fifo_path, std::ios::binary);
+      stream.write(reinterpret_cast<const char*>(data.data()),
+                   static_cast<std::streamsize>(data.size()));
+    });
+    std::vector<uint8_t> output;
+    BufferOutputSink sink(output);
+    bool decoded = streaming ? decoder.DecodeFileStreaming(fifo_path, sink)
+                             : decoder.DecodeFile(fifo_path, sink);
+    writer.join();
+    assert(decoded);
+    assert(output == expected);
+  }
+
+  FileUtils::DeleteFile(fifo_path);
+  FileUtils::DeleteFile(input_file);
+  std::cout << "Pipe input tests passed" << std::endl;
+#endif
+}
+
+// Test that every supported scanner implementation matches a naive scan
+void test_magic_scanner() {
+  std::vector<uint8_t> data(1000);
+  uint32_t state = 12345;
+  for (auto& byte : data) {
+    state = state * 1103515245 + 12345;
+    byte = static_cast<uint8_t>(state >> 16);
+  }
+  // Boundary values around the magic range
+  data[0] = 0x03;
+  data[1] = 0x0D;
+  data[2] = 0x02;
+  data[3] = 0x0E;
+  data[999] = 0x0A;
+
+  const MagicScanner::Implementation implementations[] = {
+      MagicScanner::Implementation::kScalar,
+      MagicScanner::Implementation::kSse2,
+      MagicScanner::Implementation::kAvx2};
+  MagicScanner::Implementation original = MagicScanner::ActiveImplementation();
+
+  for (auto implementation : implementations) {
+    if (!MagicScanner::ForceImplementation(implementation)) {
+      continue;
+    }
+    for (size_t start = 0; start < 40; ++start) {
+      for (size_t len : {size_t(0), size_t(1), size_t(15), size_t(31),
+                         size_t(33), size_t(64), data.size() - start}) {
+        const uint8_t* base = data.data() + start;
+        std::vector<size_t> expected;
+        for (size_t i = 0; i < len; ++i) {
+          if (IsMagicStart(base[i])) {
+            expected.push_back(i);
+          }
+        }
+
+        // Small batches exercise resuming from the scanned position
+        std::vector<size_t> found;
+        size_t offset = 0;
+        while (offset < len) {
+          size_t positions[7];
+          size_t scanned = 0;
+          size_t count = MagicScanner::Collect(base + offset, len - offset,
+                                               positions, 7, &scanned);
+          assert(scanned > 0);
+          for (size_t i = 0; i < count; ++i) {
+            found.push_back(offset + positions[i]);
+          }
+          offset += scanned;
+        }
+        assert(found == expected);
+
+        size_t first = MagicScanner::FindFirst(base, len);
+        assert(first == (expected.empty() ? len : expected[0]));
+      }
+    }
+  }
+  MagicScanner::ForceImplementation(original);
+
+  // Candidates with a wrong trailer are dropped, undecidable ones are kept
+  std::string text = "ok";
+  std::vector<uint8_t> block;
+  append_block(block, MAGIC_NO_COMPRESS_NO_CRYPT_START, 1,
+               std::vector<uint8_t>(text.begin(), text.end()));
+  std::vector<uint8_t> bad = block;
+  bad.back() = 0xEE;
+  std::vector<uint8_t> buffer = block;
+  buffer.insert(buffer.end(), bad.begin(), bad.end());
+  buffer.push_back(MAGIC_NO_COMPRESS_NO_CRYPT_START);
+  size_t positions[] = {0, block.size(), buffer.size() - 1};
+  size_t kept =
+      MagicScanner::FilterByTrailer(buffer.data(), buffer.size(), positions, 3);
+  assert(kept == 2);
+  assert(positions[0] == 0);
+  assert(positions[1] == buffer.size() - 1);
+
+  std::cout << "Magic scanner tests passed" << std::endl;
+}
+
+// Feed text through a grep sink in pieces of the given size
+std::string grep_text(const std::string& text,
+                      const GrepOptions& options,
+                      size_t piece_size) {
+  std::vector<uint8_t> output;
+  BufferOutputSink memory_sink(output);
+  GrepOutputSink sink(memory_sink, options);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+  for (size_t offset = 0; offset < text.size(); offset += piece_size) {
+    assert(sink.Write(data + offset,
+                      std::min(piece_size, text.size() - offset)));
+  }
+  assert(sink.Close());
+  return std::string(output.begin(), output.end());
+}
+
+// Test line filtering, context, match limits and diagnostics
+void test_grep() {
+  const MagicScanner::Implementation implementations[] = {
+      MagicScanner::Implementation::kScalar,
+      MagicScanner::Implementation::kSse2,
+      MagicScanner::Implementation::kAvx2};
+  MagicScanner::Implementation original = MagicScanner::ActiveImplementation();
+
+  // Literal search agrees with std::string::find at every offset
+  std::string haystack(300, 'a');
+  haystack += "needle";
+  haystack += std::string(40, 'b') + "needle";
+  for (auto implementation : implementations) {
+    if (!MagicScanner::ForceImplementation(implementation)) {
+      continue;
+    }
+    for (const std::string needle : {"n", "ne", "needle", "aaan", "missing"}) {
+      LiteralSearcher searcher(needle);
+      for (size_t start = 0; start < haystack.size(); start += 7) {
+        const uint8_t* base =
+            reinterpret_cast<const uint8_t*>(haystack.data()) + start;
+        size_t size = haystack.size() - start;
+        size_t expected = haystack.find(needle, start);
+        expected = expected == std::string::npos ? size : expected - start;
+        assert(searcher.Find(base, size) == expected);
+      }
+    }
+
+    // Lines split across writes are matched once complete
+    GrepOptions literal;
+    literal.pattern = "alpha";
+    for (size_t piece_size : {size_t(1), size_t(3), size_t(7), size_t(100)}) {
+      assert(grep_text("alpha\nbeta\ngamma alpha\ndelta\nlast alpha",
+                       literal, piece_size) ==
+             "alpha\ngamma alpha\nlast alpha");
+    }
+  }
+  MagicScanner::ForceImplementation(original);
+
+  // Context lines, with a separator only between groups that are apart
+  std::string numbered;
+  for (int i = 0; i < 10; ++i) {
+    numbered += "L" + std::to_string(i) + "\n";
+  }
+  GrepOptions context;
+  context.context_lines = 1;
+  context.regex = true;
+  context.pattern = "L[28]";
+  assert(grep_text(numbered, context, 4) == "L1\nL2\nL3\n--\nL7\nL8\nL9\n");
+  context.pattern = "L[24]";
+  assert(grep_text(numbered, context, 5) == "L1\nL2\nL3\nL4\nL5\n");
+
+  // Regular expressions, with and without a usable literal prefilter
+  GrepOptions regex;
+  regex.regex = true;
+  std::string ids = "id=12 ok\nid=7 fail\nid=345 ok\n";
+  regex.pattern = "id=[0-9]{3} ok";
+  assert(grep_text(ids, regex, 6) == "id=345 ok\n");
+  regex.pattern = "fail|345";
+  assert(grep_text(ids, regex, 6) == "id=7 fail\nid=345 ok\n");
+  regex.pattern = "^id=\\d\\b";
+  assert(grep_text(ids, regex, 6) == "id=7 fail\n");
+  std::string error;
+  regex.pattern = "(unclosed";
+  assert(!GrepOutputSink::Validate(regex, &error) && !error.empty());
+
+  // The sink stops asking for data once max_count matches are out
+  GrepOptions limited;
+  limited.pattern = "L";
+  limited.max_count = 3;
+  {
+    std::vector<uint8_t> output;
+    BufferOutputSink memory_sink(output);
+    GrepOutputSink sink(memory_sink, limited);
+    assert(sink.Write(reinterpret_cast<const uint8_t*>(numbered.data()),
+                      numbered.size()));
+    assert(!sink.WantsMore());
+    assert(sink.match_count() == 3);
+    assert(sink.Close());
+    assert(std::string(output.begin(), output.end()) == "L0\nL1\nL2\n");
+  }
+
+  // Diagnostic lines never match and are only kept on request
+  std::string diagnostics =
+      "[F]xlog_decode log seq:2-3 is missing\nxlog_decode match\n";
+  GrepOptions diagnostic;
+  diagnostic.pattern = "xlog_decode";
+  assert(grep_text(diagnostics, diagnostic, 9) == "xlog_decode match\n");
+  diagnostic.pattern = "nothing";
+  diagnostic.keep_diagnostics = true;
+  assert(grep_text(diagnostics, diagnostic, 9) ==
+         "[F]xlog_decode log seq:2-3 is missing\n");
+
+  // Decoding ends early once the limit is reached
+  const std::string input_file = "test_grep.xlog";
+  assert(FileUtils::WriteFile(input_file, make_synthetic_xlog()));
+  for (size_t threads : {size_t(1), size_t(3)}) {
+    XlogDecoder decoder;
+    decoder.set_thread_count(threads);
+    GrepOptions options;
+    options.pattern = "block 5 line 1";
+    std::vector<uint8_t> all;
+    BufferOutputSink all_sink(all);
+    GrepOutputSink grep_all(all_sink, options);
+    assert(decoder.DecodeFile(input_file, grep_all));
+    assert(grep_all.match_count() == 11);
+
+    options.max_count = 2;
+    std::vector<uint8_t> first;
+    BufferOutputSink first_sink(first);
+    GrepOutputSink grep_first(first_sink, options);
+    assert(decoder.DecodeFile(input_file, grep_first));
+    assert(grep_first.match_count() == 2);
+    std::string text(first.begin(), first.end());
+    assert(text.find("block 5 line 1\n") != std::string::npos);
+    assert(text.find("block 5 line 10\n") != std::string::npos);
+    assert(std::count(text.begin(), text.end(), '\n') == 2);
+  }
+  FileUtils::DeleteFile(input_file);
+
+  std::cout << "Grep tests passed" << std::endl;
+}
+
+// Feed text through a structured sink in pieces of the given size
+std::string format_text(const std::string& text,
+                        OutputFormat format,
+                        size_t piece_size) {
+  std::vector<uint8_t> output;
+  BufferOutputSink memory_sink(output);
+  StructuredOutputSink sink(memory_sink, format);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+  for (size_t offset = 0; offset < text.size(); offset += piece_size) {
+    assert(sink.Write(data + offset,
+                      std::min(piece_size, text.size() - offset)));
+  }
+  assert(sink.Close());
+  return std::string(output.begin(), output.end());
+}
+
+// Test Mars line parsing and the json/csv/tsv output formats
+void test_structured_output() {
+  MarsLogRecord record;
+  assert(ParseMarsLogLine("[I][2024-03-01 +8.0 10:11:12.345][1234, 5678*][tag]"
+                          "[file.cc, func, 12][hello [x] world\n",
+                          &record));
+  assert(record.level == "I");
+  assert(record.timestamp == "2024-03-01 +8.0 10:11:12.345");
+  assert(record.pid == "1234" && record.tid == "5678" && record.main_thread);
+  assert(record.tag == "tag");
+  assert(record.file == "file.cc" && record.function == "func" &&
+         record.line == "12");
+  assert(record.message == "hello [x] world");
+
+  // The location as written by the Mars formatter
+  assert(ParseMarsLogLine("[W][t][1, 2][net][client.cc:88, Send][msg\r\n",
+                          &record));
+  assert(record.file == "client.cc" && record.line == "88" &&
+         record.function == "Send" && !record.main_thread);
+  assert(record.message == "msg");
+
+  // Anything else is kept whole as the message
+  assert(!ParseMarsLogLine("  continued message\n", &record));
+  assert(record.message == "  continued message" && record.level.empty());
+  assert(!ParseMarsLogLine("[F]xlog_decode log seq:2-3 is missing\n",
+                           &record));
+
+  std::string text =
+      "[E][2024-03-01 +8.0 10:11:12.345][1, 2*][db][a.cc, Run, 7][say "
+      "\"hi\",\tC:\\dir\x01\n"
+      "plain, line\n";
+  for (size_t piece_size : {size_t(1), size_t(5), size_t(1000)}) {
+    assert(format_text(text, OutputFormat::kJson, piece_size) ==
+           "{\"level\":\"E\",\"time\":\"2024-03-01 +8.0 10:11:12.345\","
+           "\"pid\":1,\"tid\":2,\"main_thread\":true,\"tag\":\"db\","
+           "\"file\":\"a.cc\",\"func\":\"Run\",\"line\":7,"
+           "\"message\":\"say \\\"hi\\\",\\tC:\\\\dir\\u0001\"}\n"
+           "{\"message\":\"plain, line\"}\n");
+    assert(format_text(text, OutputFormat::kCsv, piece_size) ==
+           "level,time,pid,tid,main_thread,tag,file,func,line,message\n"
+           "E,2024-03-01 +8.0 10:11:12.345,1,2,1,db,a.cc,Run,7,"
+           "\"say \"\"hi\"\",\tC:\\dir\x01\"\n"
+           ",,,,,,,,,\"plain, line\"\n");
+    assert(format_text(text, OutputFormat::kTsv, piece_size) ==
+           "level\ttime\tpid\ttid\tmain_thread\ttag\tfile\tfunc\tline\t"
+           "message\n"
+           "E\t2024-03-01 +8.0 10:11:12.345\t1\t2\t1\tdb\ta.cc\tRun\t7\t"
+           "say \"hi\",\\tC:\\\\dir\x01\n"
+           "\t\t\t\t\t\t\t\t\tplain, line\n");
+  }
+  assert(format_text(text, OutputFormat::kText, 3) == text);
+
+  // Long plain runs take the word-at-a-time path and still escape correctly
+  std::string long_message(100, 'a');
+  long_message[50] = '"';
+  assert(format_text(long_message, OutputFormat::kJson, 7) ==
+         "{\"message\":\"" + long_message.substr(0, 50) + "\\\"" +
+             long_message.substr(51) + "\"}\n");
+
+  // A decoded file yields one record per line
+  const std::string input_file = "test_format.xlog";
+  assert(FileUtils::WriteFile(input_file, make_synthetic_xlog()));
+  XlogDecoder decoder;
+  std::vector<uint8_t> plain;
+  BufferOutputSink plain_sink(plain);
+  assert(decoder.DecodeFile(input_file, plain_sink));
+  std::vector<uint8_t> json;
+  BufferOutputSink json_sink(json);
+  StructuredOutputSink structured(json_sink, OutputFormat::kJson);
+  assert(decoder.DecodeFile(input_file, structured));
+  assert(structured.record_count() ==
+         static_cast<uint64_t>(std::count(plain.begin(), plain.end(), '\n')));
+  assert(std::count(json.begin(), json.end(), '\n') ==
+         std::count(plain.begin(), plain.end(), '\n'));
+  FileUtils::DeleteFile(input_file);
+
+  std::cout << "Structured output tests passed" << std::endl;
+}
+
+// Test the columnar writer, reader and row group skipping
+void test_columnar() {
+  int64_t time = 0;
+  assert(ParseMarsTimestamp("2024-03-01 +8.0 10:11:12.345", &time));
+  assert(time == 1709259072345);
+  assert(ParseMarsTimestamp("1970-01-01 -3.5 00:00:00", &time));
+  assert(time == 12600000);
+  assert(!ParseMarsTimestamp("2024-13-01 +8.0 10:11:12", &time));
+  assert(!ParseMarsTimestamp("t", &time));
+
+  // Six records per second, the tag alternates between two values and the
+  // last record of each second has a continuation line
+  std::string text;
+  for (int second = 0; second < 10; ++second) {
+    for (int i = 0; i < 6; ++i) {
+      text += "[I][2024-03-01 +0.0 00:00:0" + std::to_string(second) + "." +
+              std::to_string(100 + i) + "][7, 8" + (i == 0 ? "*" : "") +
+              "][" + (second < 5 ? "net" : "db") + "][a.cc, Run, " +
+              std::to_string(i) + "][message " + std::to_string(second) +
+              "-" + std::to_string(i) + "\n";
+    }
+    text += "  continued " + std::to_string(second) + "\n\n";
+  }
+  const int64_t base = 1709251200000;
+
+  const std::string output_file = "test_columnar.xcol";
+  {
+    FileOutputSink file_sink(output_file);
+    ColumnarOutputSink sink(file_sink, 14);
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+    for (size_t offset = 0; offset < text.size(); offset += 9) {
+      assert(sink.Write(data + offset,
+                        std::min<size_t>(9, text.size() - offset)));
+    }
+    assert(sink.Close());
+    assert(sink.record_count() == 70);
+    assert(sink.row_group_count() == 5);
+  }
+
+  ColumnarReader reader;
+  assert(reader.Open(output_file));
+  assert(reader.row_groups().size() == 5);
+  assert(reader.row_count() == 70);
+  assert(reader.row_groups()[0].min_time == base + 100);
+  assert(reader.row_groups()[4].max_time == base + 9105);
+
+  // Columns load incrementally
+  ColumnarRowGroup group;
+  assert(reader.ReadRowGroup(0, ColumnBit(kColumnTime), &group));
+  assert(group.row_count() == 14 && group.columns() == ColumnBit(kColumnTime));
+  ColumnarRecord record = group.Record(0);
+  assert(record.time == base + 100 && record.message.empty());
+  assert(reader.ReadRowGroup(0, kAllColumns, &group));
+  assert(group.columns() == kAllColumns);
+  record = group.Record(0);
+  assert(record.parsed && record.level == 'I' && record.main_thread);
+  assert(record.pid == 7 && record.tid == 8 && record.tag == "net");
+  assert(record.file == "a.cc" && record.function == "Run" &&
+         record.line == 0);
+  assert(record.message == "message 0-0");
+  record = group.Record(6);
+  assert(!record.parsed && record.level == 0 && record.tag.empty());
+  assert(record.time == base + 105 && record.message == "  continued 0");
+
+  // A time range only reads the groups it overlaps
+  ColumnarScanFilter filter;
+  filter.min_time = base + 8000;
+  std::vector<std::string> messages;
+  auto collect = [&messages](const ColumnarRecord& record) {
+    messages.push_back(std::string(record.message));
+    return true;
+  };
+  assert(reader.Scan(filter, collect));
+  assert(messages.size() == 14);
+  assert(messages.front() == "message 8-0" &&
+         messages.back() == "  continued 9");
+  assert(reader.groups_skipped() == 4);
+
+  // Groups without the tag are skipped by the dictionary
+  messages.clear();
+  filter = ColumnarScanFilter();
+  filter.tag = "net";
+  assert(reader.Scan(filter, collect));
+  assert(messages.size() == 30);
+  assert(reader.groups_skipped() == 2);
+
+  // The visitor can stop the scan
+  messages.clear();
+  assert(reader.Scan(ColumnarScanFilter(), [&messages](const ColumnarRecord&) {
+    messages.push_back(std::string());
+    return messages.size() < 3;
+  }));
+  assert(messages.size() == 3);
+
+  // A truncated file is rejected
+  std::vector<uint8_t> content;
+  assert(FileUtils::ReadFile(output_file, content));
+  content.pop_back();
+  assert(FileUtils::WriteFile(output_file, content));
+  assert(!reader.Open(output_file));
+  FileUtils::DeleteFile(output_file);
+
+  std::cout << "Columnar tests passed" << std::endl;
+}
+
+std::vector<uint8_t> hex_bytes(const std::string& hex) {
+  std::vector<uint8_t> bytes;
+  for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+    bytes.push_back(
+        static_cast<uint8_t>(std::stoul(hex.substr(i, 2), nullptr, 16)));
+  }
+  return bytes;
+}
+
+// TEA encryption as done by the Mars client
+void tea_encrypt(const TeaKey& key, std::vector<uint8_t>& data) {
+  for (size_t pos = 0; pos + 8 <= data.size(); pos += 8) {
+    uint32_t v0 = 0;
+    uint32_t v1 = 0;
+    std::memcpy(&v0, &data[pos], 4);
+    std::memcpy(&v1, &data[pos + 4], 4);
+    uint32_t sum = 0;
+    for (int round = 0; round < 16; ++round) {
+      sum += 0x9E3779B9;
+      v0 += ((v1 << 4) + key[0]) ^ (v1 + sum) ^ ((v1 >> 5) + key[1]);
+      v1 += ((v0 << 4) + key[2]) ^ (v0 + sum) ^ ((v0 >> 5) + key[3]);
+    }
+    std::memcpy(&data[pos], &v0, 4);
+    std::memcpy(&data[pos + 4], &v1, 4);
+  }
+}
+
+// Test ECDH key derivation, TEA decryption and decoding encrypted blocks
+void test_decryption() {
+  // The example key pair shipped with the Mars decode script
+  const std::string server_private =
+      "145aa7717bf9745b91e9569b80bbf1eedaa6cc6cd0e26317d810e35710f44cf8";
+  const std::string generator =
+      "79be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798"
+      "483ada7726a3c4655da4fbfc0e1108a8fd17b448a68554199c47d08ffb10d4b8";
+  const std::string client_public =
+      "bf3bb76511949219861f1fb3661d362587cf082395a984a8f441450e433bba8b"
+      "30effd3c9d084b9faa035c19a1fb5a03f801b1335cfb922be99c6cbbc06df9b0";
+  uint8_t shared[32];
+  assert(EcdhSharedSecret(hex_bytes(server_private).data(),
+                          hex_bytes(generator).data(), shared));
+  assert(std::vector<uint8_t>(shared, shared + 32) ==
+         hex_bytes("572d1e2710ae5fbca54c76a382fdd44050b3a675cb2bf39feebe85ef"
+                   "63d947af"));
+  std::vector<uint8_t> two(32, 0);
+  two[31] = 2;
+  assert(EcdhSharedSecret(two.data(), hex_bytes(generator).data(), shared));
+  assert(std::vector<uint8_t>(shared, shared + 32) ==
+         hex_bytes("c6047f9441ed7d6d3045406e95c07cd85c778e4b8cef3ca7abac09b9"
+                   "5c709ee5"));
+  assert(EcdhSharedSecret(hex_bytes(server_private).data(),
+                          hex_bytes(client_public).data(), shared));
+  assert(std::vector<uint8_t>(shared, shared + 32) ==
+         hex_bytes("09897a5e86e5eea377eddf1dc8d8dc7d255cfa0ab5ac69e491f6fc55"
+                   "ce3fa40f"));
+  std::vector<uint8_t> off_curve = hex_bytes(client_public);
+  off_curve[63] ^= 1;
+  assert(!EcdhSharedSecret(hex_bytes(server_private).data(), off_curve.data(),
+                           shared));
+  std::vector<uint8_t> zero(32, 0);
+  assert(!EcdhSharedSecret(zero.data(), hex_bytes(generator).data(), shared));
+
+  TeaKey key;
+  std::memcpy(key.data(), hex_bytes("09897a5e86e5eea377eddf1dc8d8dc7d").data(),
+              sizeof(key));
+
+  // Every implementation decrypts every length, the tail stays as is
+  std::vector<uint8_t> plain(203);
+  for (size_t i = 0; i < plain.size(); ++i) {
+    plain[i] = static_cast<uint8_t>(i * 31 + 7);
+  }
+  const MagicScanner::Implementation implementations[] = {
+      MagicScanner::Implementation::kScalar,
+      MagicScanner::Implementation::kSse2,
+      MagicScanner::Implementation::kAvx2};
+  MagicScanner::Implementation original = MagicScanner::ActiveImplementation();
+  for (auto implementation : implementations) {
+    if (!MagicScanner::ForceImplementation(implementation)) {
+      continue;
+    }
+    for (size_t size : {size_t(0), size_t(7), size_t(8), size_t(36),
+                        size_t(64), size_t(101), plain.size()}) {
+      std::vector<uint8_t> data(plain.begin(), plain.begin() + size);
+      tea_encrypt(key, data);
+      if (size >= 8) {
+        assert(data != std::vector<uint8_t>(plain.begin(),
+                                            plain.begin() + size));
+      }
+      TeaDecrypt(key, data.data(), data.size());
+      assert(data == std::vector<uint8_t>(plain.begin(), plain.begin() + size));
+    }
+  }
+  MagicScanner::ForceImplementation(original);
+
+  // Encrypted zstd and zlib blocks as written by Mars async mode
+  std::vector<uint8_t> public_key = hex_bytes(client_public);
+  std::vector<uint8_t> file_data;
+  std::string expected;
+  for (int i = 0; i < 24; ++i) {
+    std::vector<uint8_t> text = make_log_text(i);
+    expected.append(text.begin(), text.end());
+    std::vector<uint8_t> body;
+    uint8_t magic = MAGIC_ASYNC_ZSTD_START;
+    if (i % 2 == 0) {
+      body.resize(ZSTD_compressBound(text.size()));
+      body.resize(ZSTD_compress(body.data(), body.size(), text.data(),
+                                text.size(), 1));
+    } else {
+      magic = MAGIC_COMPRESS_START2;
+      z_stream strm;
+      std::memset(&strm, 0, sizeof(strm));
+      deflateInit2(&strm, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY);
+      body.resize(deflateBound(&strm, text.size()) + 64);
+      strm.next_in = text.data();
+      strm.avail_in = static_cast<uInt>(text.size());
+      strm.next_out = body.data();
+      strm.avail_out = static_cast<uInt>(body.size());
+      deflate(&strm, Z_SYNC_FLUSH);
+      body.resize(body.size() - strm.avail_out);
+      deflateEnd(&strm);
+    }
+    tea_encrypt(key, body);
+    size_t header_end = file_data.size() + GetHeaderLen(magic);
+    append_block(file_data, magic, static_cast<uint16_t>(i + 1), body);
+    std::memcpy(&file_data[header_end - kXlogPublicKeySize], public_key.data(),
+                public_key.size());
+  }
+  const std::string input_file = "test_crypt.xlog";
+  assert(FileUtils::WriteFile(input_file, file_data));
+
+  XlogKeyRing bad_key;
+  assert(!bad_key.SetPrivateKeyHex("12345"));
+  assert(!bad_key.SetPrivateKeyHex(std::string(64, 'f')));
+  auto key_ring = std::make_shared<XlogKeyRing>();
+  assert(key_ring->SetPrivateKeyHex(server_private.substr(0, 32) + "\n" +
+                                    server_private.substr(32) + "\n"));
+
+  // Without a key the output is unchanged from before, with it the text
+  // comes back for serial, streaming and parallel decoding
+  std::vector<uint8_t> output;
+  BufferOutputSink no_key_sink(output);
+  XlogDecoder no_key_decoder;
+  no_key_decoder.DecodeFile(input_file, no_key_sink);
+  assert(std::string(output.begin(), output.end()) != expected);
+
+  for (size_t threads : {size_t(1), size_t(4)}) {
+    for (bool streaming : {false, true}) {
+      output.clear();
+      BufferOutputSink sink(output);
+      XlogDecoder decoder;
+      decoder.set_key_ring(key_ring);
+      decoder.set_thread_count(threads);
+      assert(streaming ? decoder.DecodeFileStreaming(input_file, sink)
+                       : decoder.DecodeFile(input_file, sink));
+      assert(std::string(output.begin(), output.end()) == expected);
+    }
+  }
+  // The point multiply ran once for the whole session
+  assert(key_ring->derivation_count() == 1);
+  FileUtils::DeleteFile(input_file);
+
+  std::cout << "Decryption tests passed" << std::endl;
+}
+
+// Append a little-endian integer of the given width
+void put_le(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+  }
+}
+
+// Build a ZIP archive in memory. Entries are deflated unless stored is set;
+// zip64 moves sizes and offsets into ZIP64 extra fields and end records
+std::vector<uint8_t> make_zip(
+    const std::vector<std::pair<std::string, std::vector<uint8_t>>>& files,
+    bool stored,
+    bool zip64) {
+  std::vector<uint8_t> zip;
+  std::vector<uint8_t> directory;
+  for (const auto& file : files) {
+    const std::vector<uint8_t>& data = file.second;
+    uint32_t crc = static_cast<uint32_t>(
+        crc32(0L, data.data(), static_cast<uInt>(data.size())));
+    std::vector<uint8_t> packed = data;
+    if (!stored) {
+      z_stream strm;
+      std::memset(&strm, 0, sizeof(strm));
+      deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY);
+      packed.resize(deflateBound(&strm, data.size()));
+      strm.next_in = const_cast<uint8_t*>(data.data());
+      strm.avail_in = static_cast<uInt>(data.size());
+      strm.next_out = packed.data();
+      strm.avail_out = static_cast<uInt>(packed.size());
+      deflate(&strm, Z_FINISH);
+      packed.resize(packed.size() - strm.avail_out);
+      deflateEnd(&strm);
+    }
+    uint16_t method = stored ? 0 : 8;
+    uint64_t offset = zip.size();
+
+    put_le(zip, 0x04034b50, 4);
+    put_le(zip, 20, 2);
+    put_le(zip, 0, 2);
+    put_le(zip, method, 2);
+    put_le(zip, 0, 4);
+    put_le(zip, crc, 4);
+    put_le(zip, packed.size(), 4);
+    put_le(zip, data.size(), 4);
+    put_le(zip, file.first.size(), 2);
+    put_le(zip, 0, 2);
+    zip.insert(zip.end(), file.first.begin(), file.first.end());
+    zip.insert(zip.end(), packed.begin(), packed.end());
+
+    put_le(directory, 0x02014b50, 4);
+    put_le(directory, zip64 ? 45 : 20, 2);
+    put_le(directory, zip64 ? 45 : 20, 2);
+    put_le(directory, 0, 2);
+    put_le(directory, method, 2);
+    put_le(directory, 0, 4);
+    put_le(directory, crc, 4);
+    put_le(directory, zip64 ? 0xFFFFFFFF : packed.size(), 4);
+    put_le(directory, zip64 ? 0xFFFFFFFF : data.size(), 4);
+    put_le(directory, file.first.size(), 2);
+    put_le(directory, zip64 ? 28 : 0, 2);
+    put_le(directory, 0, 6);
+    put_le(directory, 0, 4);
+    put_le(directory, zip64 ? 0xFFFFFFFF : offset, 4);
+    directory.insert(directory.end(), file.first.begin(), file.first.end());
+    if (zip64) {
+      put_le(directory, 0x0001, 2);
+      put_le(directory, 24, 2);
+      put_le(directory, data.size(), 8);
+      put_le(directory, packed.size(), 8);
+      put_le(directory, offset, 8);
+    }
+  }
+
+  uint64_t directory_offset = zip.size();
+  zip.insert(zip.end(), directory.begin(), directory.end());
+  if (zip64) {
+    uint64_t record_offset = zip.size();
+    put_le(zip, 0x06064b50, 4);
+    put_le(zip, 44, 8);
+    put_le(zip, 45, 2);
+    put_le(zip, 45, 2);
+    put_le(zip, 0, 8);
+    put_le(zip, files.size(), 8);
+    put_le(zip, files.size(), 8);
+    put_le(zip, directory.size(), 8);
+    put_le(zip, directory_offset, 8);
+    put_le(zip, 0x07064b50, 4);
+    put_le(zip, 0, 4);
+    put_le(zip, record_offset, 8);
+    put_le(zip, 1, 4);
+  }
+  put_le(zip, 0x06054b50, 4);
+  put_le(zip, 0, 4);
+  put_le(zip, zip64 ? 0xFFFF : files.size(), 2);
+  put_le(zip, zip64 ? 0xFFFF : files.size(), 2);
+  put_le(zip, zip64 ? 0xFFFFFFFF : directory.size(), 4);
+  put_le(zip, zip64 ? 0xFFFFFFFF : directory_offset, 4);
+  const std::string comment = "device log bundle";
+  put_le(zip, comment.size(), 2);
+  zip.insert(zip.end(), comment.begin(), comment.end());
+  return zip;
+}
+
+// Test decoding the XLOG entries of a ZIP archive in memory
+void test_zip() {
+  std::vector<uint8_t> second;
+  for (int i = 0; i < 10; ++i) {
+    std::vector<uint8_t> text = make_log_text(100 + i);
+    append_block(second, MAGIC_NO_COMPRESS_NO_CRYPT_START,
+                 static_cast<uint16_t>(i + 1), text);
+  }
+  const std::vector<std::pair<std::string, std::vector<uint8_t>>> files = {
+      {"app/main.xlog", make_synthetic_xlog()},
+      {"readme.txt", {'h', 'i', '\n'}},
+      {"app/", {}},
+      {"app/cache/second.mmap3", second}};
+
+  // Each entry decodes exactly like the same file on disk
+  std::map<std::string, std::string> expected;
+  for (const auto& file : files) {
+    ZipEntry entry;
+    entry.name = file.first;
+    if (!entry.IsXlog()) {
+      continue;
+    }
+    const std::string plain_file = "test_zip_plain.xlog";
+    assert(FileUtils::WriteFile(plain_file, file.second));
+    std::vector<uint8_t> output;
+    BufferOutputSink sink(output);
+    XlogDecoder decoder;
+    assert(decoder.DecodeFile(plain_file, sink));
+    expected[file.first].assign(output.begin(), output.end());
+    FileUtils::DeleteFile(plain_file);
+  }
+  assert(expected.size() == 2);
+  std::string combined;
+  for (const char* name : {"app/main.xlog", "app/cache/second.mmap3"}) {
+    combined += "[F]xlog_decode zip entry: " + std::string(name) + "\n" +
+                expected[name];
+  }
+
+  const std::string zip_file = "test_bundle.zip";
+  for (bool stored : {false, true}) {
+    for (bool zip64 : {false, true}) {
+      assert(FileUtils::WriteFile(zip_file, make_zip(files, stored, zip64)));
+      assert(XlogDecoder::IsZipFile(zip_file));
+
+      ZipArchive archive;
+      std::string error;
+      assert(archive.Open(zip_file, &error));
+      assert(archive.entries().size() == files.size());
+      for (size_t i = 0; i < files.size(); ++i) {
+        std::vector<uint8_t> data;
+        assert(archive.entries()[i].name == files[i].first);
+        assert(archive.ReadEntry(archive.entries()[i], &data, &error));
+        assert(data == files[i].second);
+      }
+
+      // Combined output in directory order at any thread count
+      for (size_t threads : {size_t(1), size_t(4)}) {
+        for (bool streaming : {false, true}) {
+          std::vector<uint8_t> output;
+          BufferOutputSink sink(output);
+          XlogDecoder decoder;
+          decoder.set_thread_count(threads);
+          assert(streaming ? decoder.DecodeFileStreaming(zip_file, sink)
+                           : decoder.DecodeFile(zip_file, sink));
+          assert(std::string(output.begin(), output.end()) == combined);
+        }
+      }
+
+      // One output per entry, decoded in parallel
+      std::map<std::string, std::vector<uint8_t>> outputs;
+      for (const auto& entry : expected) {
+        outputs[entry.first];
+      }
+      XlogDecoder decoder;
+      decoder.set_thread_count(4);
+      assert(decoder.DecodeZipEntries(
+          zip_file, [&outputs](const std::string& entry) {
+            return std::make_unique<BufferOutputSink>(outputs.at(entry));
+          }));
+      for (const auto& entry : expected) {
+        const std::vector<uint8_t>& output = outputs[entry.first];
+        assert(std::string(output.begin(), output.end()) == entry.second);
+      }
+    }
+  }
+
+  // A damaged entry fails its CRC check, the others still decode
+  std::vector<uint8_t> zip = make_zip(files, true, false);
+  zip[30 + files[0].first.size() + 100] ^= 0xFF;
+  assert(FileUtils::WriteFile(zip_file, zip));
+  ZipArchive archive;
+  std::string error;
+  assert(archive.Open(zip_file, &error));
+  std::vector<uint8_t> data;
+  assert(!archive.ReadEntry(archive.entries()[0], &data, &error));
+  assert(error == "CRC32 mismatch");
+  std::vector<uint8_t> output;
+  BufferOutputSink sink(output);
+  XlogDecoder decoder;
+  assert(!decoder.DecodeFile(zip_file, sink));
+  assert(std::string(output.begin(), output.end()) ==
+         "[F]xlog_decode zip entry: app/cache/second.mmap3\n" +
+             expected["app/cache/second.mmap3"]);
+
+  // Truncated archives are rejected instead of misread
+  zip.resize(zip.size() - 30);
+  assert(FileUtils::WriteFile(zip_file, zip));
+  assert(!archive.Open(zip_file, &error));
+  FileUtils::DeleteFile(zip_file);
+
+  assert(ZipArchive::IsSafeEntryName("app/cache/second.mmap3"));
+  assert(ZipArchive::IsSafeEntryName("a..b/c.xlog"));
+  assert(!ZipArchive::IsSafeEntryName(""));
+  assert(!ZipArchive::IsSafeEntryName("/etc/passwd.xlog"));
+  assert(!ZipArchive::IsSafeEntryName("../up.xlog"));
+  assert(!ZipArchive::IsSafeEntryName("app/../../up.xlog"));
+  assert(!ZipArchive::IsSafeEntryName("app\\up.xlog"));
+  assert(!ZipArchive::IsSafeEntryName("C:/up.xlog"));
+
+  std::cout << "ZIP tests passed" << std::endl;
+}
+
 // Main function
+// Test per-stage timings and counters collected by the decoder
+void test_decode_stats() {
+  const std::string input_file = "test_stats.xlog";
+  std::vector<uint8_t> file_data = make_synthetic_xlog();
+  assert(FileUtils::WriteFile(input_file, file_data));
+
+  std::vector<uint8_t> expected;
+  BufferOutputSink expected_sink(expected);
+  XlogDecoder plain_decoder;
+  assert(plain_decoder.DecodeFile(input_file, expected_sink));
+  assert(plain_decoder.stats().files == 0);
+  assert(plain_decoder.stats().total_ns == 0);
+
+  auto check = [&](const DecodeStats& stats) {
+    assert(stats.files == 1);
+    assert(stats.bytes_read == file_data.size());
+    assert(stats.bytes_written == expected.size());
+    assert(stats.block_count() == 40);
+    assert(stats.blocks[MAGIC_ASYNC_NO_CRYPT_ZSTD_START -
+                        MAGIC_NO_COMPRESS_START] == 20);
+    assert(stats.blocks[MAGIC_NO_COMPRESS_NO_CRYPT_START -
+                        MAGIC_NO_COMPRESS_START] == 20);
+    assert(stats.resync_count == 1);
+    assert(stats.resync_bytes == 3000);
+    assert(stats.seq_gaps == 1);
+    assert(stats.seq_missing == 2);
+    assert(stats.decompress_errors == 0);
+    assert(stats.zstd_ns > 0);
+    assert(stats.zlib_ns == 0);
+    assert(stats.decrypt_ns == 0);
+    assert(stats.total_ns >= stats.open_ns + stats.frame_ns);
+  };
+
+  // Serial, parallel and streaming decodes count the same work, and each
+  // decode replaces the previous statistics
+  for (size_t thread_count : {1, 4}) {
+    XlogDecoder decoder;
+    decoder.set_collect_stats(true);
+    decoder.set_thread_count(thread_count);
+    for (int round = 0; round < 2; ++round) {
+      std::vector<uint8_t> output;
+      BufferOutputSink sink(output);
+      assert(decoder.DecodeFile(input_file, sink));
+      assert(output == expected);
+      check(decoder.stats());
+    }
+    std::vector<uint8_t> streamed;
+    BufferOutputSink stream_sink(streamed);
+    decoder.set_stream_window_size(1024);
+    assert(decoder.DecodeFileStreaming(input_file, stream_sink));
+    assert(streamed == expected);
+    check(decoder.stats());
+  }
+
+  // Leading garbage counts as a resync; decompress failures are counted
+  std::vector<uint8_t> broken(100, 0xEE);
+  std::vector<uint8_t> bad_body(64, 0x5A);
+  append_block(broken, MAGIC_ASYNC_NO_CRYPT_ZSTD_START, 1, bad_body);
+  append_block(broken, MAGIC_NO_COMPRESS_NO_CRYPT_START, 2,
+               make_log_text(0));
+  assert(FileUtils::WriteFile(input_file, broken));
+  XlogDecoder decoder;
+  decoder.set_collect_stats(true);
+  std::vector<uint8_t> output;
+  BufferOutputSink sink(output);
+  assert(decoder.DecodeFile(input_file, sink));
+  assert(decoder.stats().resync_count == 1);
+  assert(decoder.stats().resync_bytes == 100);
+  assert(decoder.stats().decompress_errors == 1);
+  assert(decoder.stats().block_count() == 2);
+
+  // ZIP entries are merged into the statistics of the archive
+  const std::string zip_file = "test_stats.zip";
+  assert(FileUtils::WriteFile(
+      zip_file, make_zip({{"a.xlog", file_data}, {"b.xlog", file_data}},
+                         false, false)));
+  decoder.set_thread_count(2);
+  std::vector<uint8_t> zip_output;
+  BufferOutputSink zip_sink(zip_output);
+  assert(decoder.DecodeFile(zip_file, zip_sink));
+  assert(decoder.stats().files == 1);
+  assert(decoder.stats().block_count() == 80);
+  assert(decoder.stats().bytes_read == 2 * file_data.size());
+  assert(decoder.stats().bytes_written == zip_output.size());
+  assert(decoder.stats().resync_count == 2);
+
+  // Batch totals and report formats
+  DecodeStats total;
+  total.Add(decoder.stats());
+  total.Add(decoder.stats());
+  assert(total.files == 2);
+  assert(total.block_count() == 160);
+  std::string json = total.ToJson("dir/\"quoted\".xlog");
+  assert(json.find("{\"file\":\"dir/\\\"quoted\\\".xlog\",\"files\":2,") ==
+         0);
+  assert(json.find("\"blocks\":{\"0x08\":80,\"0x0D\":80}") !=
+         std::string::npos);
+  assert(total.ToJson().find("{\"files\":2,") == 0);
+  assert(total.ToText().find("2 files, ") == 0);
+  assert(total.ToText().find("160 blocks (0x08:80 0x0D:80)") !=
+         std::string::npos);
+
+  FileUtils::DeleteFile(input_file);
+  FileUtils::DeleteFile(zip_file);
+  std::cout << "Decode stats tests passed" << std::endl;
+}
+
+// Count non-overlapping occurrences of needle in text
+size_t count_occurrences(const std::string& text, const std::string& needle) {
+  size_t count = 0;
+  for (size_t pos = text.find(needle); pos != std::string::npos;
+       pos = text.find(needle, pos + needle.size())) {
+    count++;
+  }
+  return count;
+}
+
+// Test the Chrome trace-event timeline of serial and parallel decodes
+void test_decode_trace() {
+  const std::string input_file = "test_trace.xlog";
+  const std::string trace_file = "test_trace.json";
+  std::vector<uint8_t> file_data = make_synthetic_xlog();
+  assert(FileUtils::WriteFile(input_file, file_data));
+
+  std::vector<uint8_t> expected;
+  BufferOutputSink expected_sink(expected);
+  XlogDecoder plain_decoder;
+  assert(plain_decoder.DecodeFile(input_file, expected_sink));
+  assert(TraceRecorder::Instance().event_count() == 0);
+
+  // Tracing does not change the output; every block gets a decompress span
+  TraceRecorder& recorder = TraceRecorder::Instance();
+  recorder.Start();
+  for (size_t thread_count : {1, 4}) {
+    XlogDecoder decoder;
+    decoder.set_thread_count(thread_count);
+    std::vector<uint8_t> output;
+    BufferOutputSink sink(output);
+    assert(decoder.DecodeFile(input_file, sink));
+    assert(output == expected);
+  }
+  recorder.Stop();
+  size_t event_count = recorder.event_count();
+  assert(event_count > 80);
+
+  // Decodes after Stop are not recorded
+  std::vector<uint8_t> output;
+  BufferOutputSink sink(output);
+  assert(plain_decoder.DecodeFile(input_file, sink));
+  assert(recorder.event_count() == event_count);
+
+  assert(recorder.WriteJson(trace_file));
+  std::vector<uint8_t> trace_data;
+  assert(FileUtils::ReadFile(trace_file, trace_data));
+  std::string trace(trace_data.begin(), trace_data.end());
+  assert(trace.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[") == 0);
+  assert(trace.size() > 4 && trace.compare(trace.size() - 4, 4, "\n]}\n") == 0);
+  assert(count_occurrences(trace, "\"ph\":\"X\"") == event_count);
+  assert(count_occurrences(trace, "\"name\":\"decompress\"") == 80);
+  assert(count_occurrences(trace, "\"magic\":\"0x0D\"") == 40);
+  assert(trace.find("\"name\":\"open\",") != std::string::npos);
+  assert(trace.find("\"name\":\"resync\",") != std::string::npos);
+  assert(trace.find("\"name\":\"write\",") != std::string::npos);
+  assert(trace.find("\"name\":\"wait\",") != std::string::npos);
+  assert(trace.find("\"args\":{\"name\":\"main\"}") != std::string::npos);
+  assert(trace.find("\"args\":{\"name\":\"worker 1\"}") !=
+         std::string::npos);
+
+  // Start discards the previous spans
+  recorder.Start();
+  recorder.Stop();
+  assert(recorder.event_count() == 0);
+  assert(!recorder.WriteJson("no_such_dir/test_trace.json"));
+
+  FileUtils::DeleteFile(input_file);
+  FileUtils::DeleteFile(trace_file);
+  std::cout << "Decode trace tests passed" << std::endl;
+}
+
+// Test allocation accounting by decode stage
+void test_alloc_tracking() {
+  // Frees are charged to the stage that allocated; Reset restarts peaks
+  // from the bytes still live
+  AllocAccount* account = AllocAccount::Create();
+  account->OnAllocate(AllocStage::kDecompress, 1000);
+  account->OnAllocate(AllocStage::kWrite, 500);
+  account->OnFree(AllocStage::kDecompress, 1000);
+  account->OnAllocate(AllocStage::kDecompress, 200);
+  assert(account->count(AllocStage::kDecompress) == 2);
+  assert(account->bytes(AllocStage::kDecompress) == 1200);
+  assert(account->peak(AllocStage::kDecompress) == 1000);
+  assert(account->peak() == 1500);
+  account->Reset();
+  assert(account->count(AllocStage::kDecompress) == 0);
+  assert(account->peak(AllocStage::kDecompress) == 200);
+  assert(account->peak() == 700);
+
+  DecodeStats stats;
+  assert(!stats.has_allocations());
+  assert(stats.ToJson().find("allocations") == std::string::npos);
+  account->OnAllocate(AllocStage::kWrite, 300);
+  stats.SetAllocations(*account);
+  assert(stats.has_allocations());
+  assert(stats.ToJson().find(
+             "\"allocations\":{\"peak_bytes\":1000,\"other\":{\"count\":0,") !=
+         std::string::npos);
+  assert(stats.ToText().find("; allocations peak 0.00MB: write 1 / 0.00MB") !=
+         std::string::npos);
+  DecodeStats total;
+  total.Add(stats);
+  total.Add(stats);
+  assert(total.alloc_count[static_cast<int>(AllocStage::kWrite)] == 2);
+  assert(total.alloc_peak == 1000);
+
+  // Scopes nest and restore the previous account and stage
+  assert(CurrentAllocAccount() == nullptr);
+  {
+    AllocScope scope(account, AllocStage::kFrame);
+    assert(CurrentAllocAccount() == account);
+    {
+      AllocScope inner(nullptr, AllocStage::kOther);
+      assert(CurrentAllocAccount() == nullptr);
+    }
+    assert(CurrentAllocAccount() == account);
+  }
+  assert(CurrentAllocAccount() == nullptr);
+  account->Release();
+
+  if (AllocTrackingCompiled()) {
+    AllocAccount* heap = AllocAccount::Create();
+    std::vector<uint8_t> block;
+    {
+      AllocScope scope(heap, AllocStage::kFrame);
+      block.resize(4096);
+    }
+    assert(heap->count(AllocStage::kFrame) == 1);
+    assert(heap->bytes(AllocStage::kFrame) == block.size());
+    std::vector<uint8_t>().swap(block);
+    heap->Reset();
+    assert(heap->peak(AllocStage::kFrame) == 0);
+
+    // A live allocation keeps the account alive after its owner releases it
+    {
+      AllocScope scope(heap, AllocStage::kFrame);
+      block.resize(4096);
+    }
+    heap->Release();
+    assert(heap->bytes(AllocStage::kFrame) == block.size());
+    std::vector<uint8_t>().swap(block);
+  }
+
+  // Decodes report allocations only when tracking is compiled in; worker
+  // threads charge the decoder that submitted the blocks
+  const std::string input_file = "test_alloc.xlog";
+  assert(FileUtils::WriteFile(input_file, make_synthetic_xlog()));
+  for (size_t thread_count : {1, 4}) {
+    XlogDecoder decoder;
+    decoder.set_collect_stats(true);
+    decoder.set_thread_count(thread_count);
+    std::vector<uint8_t> output;
+    BufferOutputSink sink(output);
+    assert(decoder.DecodeFile(input_file, sink));
+    const DecodeStats& decoded = decoder.stats();
+    if (AllocTrackingCompiled()) {
+      assert(decoded.alloc_count[static_cast<int>(AllocStage::kDecompress)] >
+             0);
+      assert(decoded.alloc_count[static_cast<int>(AllocStage::kWrite)] > 0);
+      assert(decoded.alloc_peak >=
+             decoded.alloc_stage_peak[static_cast<int>(AllocStage::kWrite)]);
+      assert(decoded.alloc_stage_peak[static_cast<int>(AllocStage::kWrite)] >=
+             static_cast<int64_t>(output.size()));
+    } else {
+      assert(!decoded.has_allocations());
+    }
+  }
+
+  FileUtils::DeleteFile(input_file);
+  std::cout << "Allocation tracking tests passed" << std::endl;
+}
+
 int main() {
   std::cout << "Starting xlog_decoder tests..." << std::endl;
 
-  // Run only static method tests
   test_file_extensions();
   test_output_filename_generation();
+  test_streaming_decode_matches();
+  test_parallel_decode_matches();
+  test_block_index();
+  test_hour_range();
+  test_follow();
+  test_incremental_decode();
+  test_thread_pool();
+  test_parallel_diagnostics();
+  test_output_sinks();
+  test_decompress_paths();
+  test_resync();
+  test_framing();
+  test_large_file_offsets();
+  test_pipe_input();
+  test_magic_scanner();
+  test_grep();
+  test_structured_output();
+  test_columnar();
+  test_decryption();
+  test_zip();
+  test_decode_stats();
+  test_decode_trace();
+  test_alloc_tracking();
 
   std::cout << "All tests passed!" << std::endl;
   return 0;
@@ -34,6 +34,8 @@ if is_plat("windows") then
         add_ldflags("/INCREMENTAL")
     end
 elseif is_plat("linux") then
+    add_syslinks("pthread") -- 并行解码使用std::thread
+    add_defines("_FILE_OFFSET_BITS=64") -- 32位平台上pread/fstat也使用64位偏移
     if is_mode("debug") then
         add_cxflags("-g3", "-O0") -- 生成完整调试信息，禁用优化
         add_ldflags("-rdynamic") -- 导出所有符号，方便调试
@@ -64,18 +66,34 @@ option("keep-errors")
     set_description("不跳过错误数据块")
 option_end()
 
+option("alloc-tracking")
+    set_default(false)
+    set_showmenu(true)
+    set_description("替换全局operator new/delete，--stats时统计各阶段的内存分配")
+    add_defines("XLOG_DECODE_ALLOC_TRACKING")
+option_end()
+
 -- 添加包含目录
 add_includedirs("include")
 
 -- 文件工具库
 target("file_utils")
     set_kind("static")
-    add_files("src/file_utils.cpp")
+    add_files("src/file_utils.cpp", "src/console_output.cpp")
 
 -- XLog解码器库
 target("xlog_decoder")
     set_kind("static")
-    add_files("src/xlog_decoder.cpp")
+    add_files("src/xlog_decoder.cpp", "src/xlog_block_reader.cpp",
+              "src/output_sink.cpp", "src/magic_scanner.cpp",
+              "src/thread_pool.cpp", "src/xlog_index.cpp",
+              "src/file_watcher.cpp", "src/decode_manifest.cpp",
+              "src/literal_search.cpp", "src/grep_output_sink.cpp",
+              "src/mars_log_line.cpp", "src/structured_output_sink.cpp",
+              "src/columnar_log.cpp", "src/xlog_crypt.cpp",
+              "src/zip_archive.cpp", "src/decode_stats.cpp",
+              "src/decode_trace.cpp", "src/alloc_tracker.cpp")
+    add_options("alloc-tracking")
     add_deps("file_utils")
     add_packages("zlib", "zstd")
 
@@ -109,4 +127,47 @@ target("test_xlog_decoder")
     set_kind("binary")
     add_files("test/test_xlog_decoder.cpp")
     add_deps("file_utils", "xlog_decoder")
-    add_packages("zlib", "zstd")
\ No newline at end of file
+    add_packages("zlib", "zstd")
+
+-- 性能测试
+target("bench_resync")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/bench_resync.cpp")
+    add_deps("file_utils", "xlog_decoder")
+    add_packages("zlib", "zstd")
+
+target("bench_decompress")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/bench_decompress.cpp")
+    add_deps("file_utils", "xlog_decoder")
+    add_packages("zlib", "zstd")
+
+target("bench_format")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/bench_format.cpp")
+    add_deps("file_utils", "xlog_decoder")
+    add_packages("zlib", "zstd")
+
+target("bench_decrypt")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/bench_decrypt.cpp")
+    add_deps("file_utils", "xlog_decoder")
+    add_packages("zlib", "zstd")
+
+target("bench_xlog_decoder")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/bench_xlog_decoder.cpp")
+    add_deps("file_utils", "xlog_decoder")
+    add_packages("zlib", "zstd")
+
+target("bench_fleet")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/bench_fleet.cpp")
+    add_deps("file_utils", "xlog_decoder")
+    add_packages("zlib", "zstd")